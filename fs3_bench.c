@@ -0,0 +1,448 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_bench.c
+//  Description    : This is the micro-benchmark program for the FS3 driver,
+//                   it runs targeted benchmarks against a running controller.
+//                   The benchmarks live in the bench file of the module they
+//                   measure, this file parses the options, holds the helpers
+//                   they share and runs the one asked for.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_network.h>
+#include <fs3_erasure.h>
+#include <fs3_ring.h>
+#include <fs3_lease.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_BENCH_ARGUMENTS "hvn:w:t:i:p:s:r:q:e:H:L"
+#define USAGE \
+	"USAGE: fs3_bench [-h] [-v] [-n <files>] [-w <wraps>] [-t <trials>] [-i <ip>] [-p <port>] [-s <ip:port>]... [-r <replicas>] [-q <quorum>] [-e <data:parity>] [-H <points>] [-L] <benchmark>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - verbose output\n" \
+	"    -n - number of files to use (default 1000)\n" \
+	"    -w - times the churn benchmark allocates the whole disk (default 4)\n" \
+	"    -t - number of crashes the crash benchmark injects (default 20)\n" \
+	"    -i - IP address of server to connect to.\n" \
+	"    -p - port number of server to connect to.\n" \
+	"    -s - another server to stripe the disk over, may be given up to 7 times\n" \
+	"    -r - number of servers holding a copy of each stripe (default 1)\n" \
+	"    -q - copies that must acknowledge a write (default all of them)\n" \
+	"    -e - erasure code the disk, each stripe of <data> sectors getting <parity>\n" \
+	"         parity sectors, over exactly <data> + <parity> servers\n" \
+	"    -H - place whole files on the servers by consistent hashing, each server\n" \
+	"         getting <points> points on the ring\n" \
+	"    -L - the server is a lease broker, cache only under its leases\n" \
+	"\n" \
+	"    <benchmark> - one of:\n" \
+	"        open  - latency of creating and then re-opening <files> files\n" \
+	"        churn - create, verify and delete up to <files> live files until\n" \
+	"                the disk has been allocated <wraps> times over\n" \
+	"        interleave - write <files> files a sector at a time in turn, then\n" \
+	"                read each back in order and count the seeks per MB\n" \
+	"        crash - run random operations on <files> files, crash the client\n" \
+	"                at a random write, recover and check, <trials> times\n" \
+	"        small - write <files> mostly tiny files, then report the space\n" \
+	"                they take and the sector reads needed to read each back\n" \
+	"        sched - random appends and reads over <files> files, once with\n" \
+	"                writes dispatched in FIFO order and once with C-LOOK\n" \
+	"        stripe - write <files> files sequentially in 64KB chunks, then read\n" \
+	"                them back, reporting the throughput of each\n" \
+	"        mirror - write <files> files, then read them back several times,\n" \
+	"                reporting the reads each server served on every pass\n" \
+	"        erasure - encode and decode throughput of each erasure code kernel,\n" \
+	"                then with -e the read latency of <files> files with\n" \
+	"                every server up and with the last one down\n" \
+	"        ring - load imbalance and data moved by each membership change\n" \
+	"                when <files> files are placed by consistent hashing, then\n" \
+	"                with -H the sectors the rebalancer moves when the last\n" \
+	"                server leaves the ring and comes back\n" \
+	"        lease - two clients sharing the server read and write the same\n" \
+	"                sectors, 16 * <files> operations each, reporting the\n" \
+	"                throughput, hit ratio and reads that returned stale data\n" \
+	"                (run against fs3_broker, stale reads fail it with -L)\n" \
+	"        codec - check every sector of every command against the command\n" \
+	"                block codec, then its encode and decode throughput\n" \
+	"        sums - throughput of each CRC32C kernel, then the read throughput\n" \
+	"                of <files> files with and without the sector checksums\n" \
+	"                checked, and that a sector changed behind the driver's\n" \
+	"                back fails its read\n" \
+	"\n" \
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 benchmarks
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	int ch, verbose = 0, nfiles = 1000, wraps = 4, trials = 20, ret;
+	char address[64];
+	unsigned short port;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_BENCH_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 'n': // Set the number of files
+			if ( (sscanf(optarg, "%d", &nfiles) != 1) || (nfiles <= 0) ) {
+				fprintf( stderr, "Bad file count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'w': // Set the number of times the disk is allocated over
+			if ( (sscanf(optarg, "%d", &wraps) != 1) || (wraps <= 0) ) {
+				fprintf( stderr, "Bad wrap count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 't': // Set the number of crashes
+			if ( (sscanf(optarg, "%d", &trials) != 1) || (trials <= 0) ) {
+				fprintf( stderr, "Bad trial count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'i': // Get the IP address
+			if (inet_addr(optarg) == INADDR_NONE) {
+				fprintf( stderr, "Bad IP address [%s]\n", optarg );
+				return( -1 );
+			}
+			fs3_network_address = (unsigned char *)strdup(optarg);
+			break;
+
+		case 'p': // Set the network port number
+			if ( sscanf(optarg, "%hu", &fs3_network_port) != 1 ) {
+				fprintf( stderr, "Bad port number [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 's': // Add a server to stripe over
+			if ( (sscanf(optarg, "%63[^:]:%hu", address, &port) != 2) || (inet_addr(address) == INADDR_NONE) ||
+					(fs3_network_add_controller(address, port) == -1) ) {
+				fprintf( stderr, "Bad stripe server [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'r': // Set the number of replicas
+			if ( (sscanf(optarg, "%d", &fs3_network_replicas) != 1) || (fs3_network_replicas <= 0) ) {
+				fprintf( stderr, "Bad replica count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'q': // Set the write quorum
+			if ( (sscanf(optarg, "%d", &fs3_network_quorum) != 1) || (fs3_network_quorum < 0) ) {
+				fprintf( stderr, "Bad quorum [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'e': // Erasure code the disk
+			if ( (sscanf(optarg, "%d:%d", &fs3_erasure_data, &fs3_erasure_parity) != 2) ||
+					(fs3_erasure_data <= 0) || (fs3_erasure_parity <= 0) ) {
+				fprintf( stderr, "Bad erasure code [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'H': // Place files on the servers by consistent hashing
+			if ( (sscanf(optarg, "%d", &fs3_ring_vnodes) != 1) || (fs3_ring_vnodes <= 0) ||
+					(fs3_ring_vnodes > FS3_RING_MAX_VNODES) ) {
+				fprintf( stderr, "Bad placement ring [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'L': // Share the server with other clients under leases
+			fs3_lease_enabled = true;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log
+	initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	FS3DriverLLevel = registerLogLevel("FS3_DRIVER", 0);
+	FS3SimulatorLLevel = registerLogLevel("FS3_SIMULATOR", 0);
+	if ( verbose ) {
+		enableLogLevels(FS3DriverLLevel | FS3SimulatorLLevel);
+	}
+
+	// The benchmark name should be the next option
+	if ( optind >= argc ) {
+		fprintf( stderr, "Missing benchmark name, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Run the benchmark
+	if (strcmp(argv[optind], "open") == 0) {
+		ret = bench_open(nfiles);
+	} else if (strcmp(argv[optind], "churn") == 0) {
+		ret = bench_churn(nfiles, wraps);
+	} else if (strcmp(argv[optind], "interleave") == 0) {
+		ret = bench_interleave(nfiles);
+	} else if (strcmp(argv[optind], "crash") == 0) {
+		ret = bench_crash(nfiles, trials);
+	} else if (strcmp(argv[optind], "small") == 0) {
+		ret = bench_small(nfiles);
+	} else if (strcmp(argv[optind], "sched") == 0) {
+		ret = bench_sched(nfiles);
+	} else if (strcmp(argv[optind], "stripe") == 0) {
+		ret = bench_stripe(nfiles);
+	} else if (strcmp(argv[optind], "mirror") == 0) {
+		ret = bench_mirror(nfiles);
+	} else if (strcmp(argv[optind], "erasure") == 0) {
+		ret = bench_erasure(nfiles);
+	} else if (strcmp(argv[optind], "ring") == 0) {
+		ret = bench_ring(nfiles);
+	} else if (strcmp(argv[optind], "lease") == 0) {
+		ret = bench_lease(nfiles);
+	} else if (strcmp(argv[optind], "codec") == 0) {
+		ret = bench_codec();
+	} else if (strcmp(argv[optind], "sums") == 0) {
+		ret = bench_sums(nfiles);
+	} else {
+		fprintf( stderr, "Unknown benchmark [%s], use -h to see usage, aborting.\n", argv[optind] );
+		return( -1 );
+	}
+
+	if ( ret != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark [%s] failed.", argv[optind] );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_now
+// Description  : Get the current monotonic time
+//
+// Inputs       : none
+// Outputs      : the time in seconds
+
+double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_start
+// Description  : Start a timed span of a benchmark, the driver's seek and
+//                sector counters are taken here so only the span's own
+//                round trips are reported
+//
+// Inputs       : span - the span to start
+// Outputs      : none
+
+void bench_start(BenchSpan *span) {
+	span->seeks = trackSeeks();
+	span->reads = diskReads();
+	span->writes = diskWrites();
+	span->elapsed = bench_now();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_stop
+// Description  : End a timed span of a benchmark
+//
+// Inputs       : span - the span started by bench_start
+// Outputs      : none
+
+void bench_stop(BenchSpan *span) {
+	span->elapsed = bench_now() - span->elapsed;
+	span->seeks = trackSeeks() - span->seeks;
+	span->reads = diskReads() - span->reads;
+	span->writes = diskWrites() - span->writes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_pattern
+// Description  : The byte the benchmarks write at an offset of a file, each
+//                generation of a file (it is deleted and created again) gets
+//                different contents
+//
+// Inputs       : file - number of the file
+//                gen - generation of the file
+//                off - offset in the file
+// Outputs      : the byte
+
+uint8_t bench_pattern(int file, int gen, uint32_t off) {
+	return( (uint8_t)((file * 7) + (gen * 13) + off) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_mount
+// Description  : Mount the disk for a benchmark, logging why the benchmark
+//                stopped if it cannot be
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_mount(void) {
+	if ( fs3_mount_disk() == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark mount failed." );
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_setup
+// Description  : Mount the disk and write the files a benchmark reads, each
+//                of the same number of chunks (as many as fit in half of the
+//                free space, up to maxChunks) and filled by bench_pattern.
+//                The files are closed so everything has reached the disk
+//                when the write span ends
+//
+// Inputs       : files - the files to set up
+//                name - what the files are named after
+//                nfiles - number of files
+//                maxChunks - most chunks in each file
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_setup(BenchFiles *files, const char *name, int nfiles, uint32_t maxChunks) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH];
+	uint64_t totalSectors, freeSectors;
+	uint32_t c, j;
+	int16_t fh;
+	int i;
+
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	diskSpace(&totalSectors, &freeSectors);
+	files->name = name;
+	files->nfiles = nfiles;
+	files->chunks = (freeSectors * FS3_SECTOR_SIZE) / (2 * (uint64_t)nfiles * FS3_BENCH_CHUNK);
+	files->chunks = (files->chunks > maxChunks) ? maxChunks : files->chunks;
+	if ( files->chunks == 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark has too many files for the disk." );
+		return( -1 );
+	}
+	files->mb = ((double)nfiles * files->chunks * FS3_BENCH_CHUNK) / (1024.0 * 1024.0);
+	files->buf = malloc(FS3_BENCH_CHUNK);
+
+	bench_start(&files->written);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "%s-file-%d.txt", name, i);
+		if ( (fh = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (c=0; c<files->chunks; c++) {
+			for (j=0; j<FS3_BENCH_CHUNK; j++) {
+				files->buf[j] = bench_pattern(i, 0, (c * FS3_BENCH_CHUNK) + j);
+			}
+			if ( fs3_write(fh, files->buf, FS3_BENCH_CHUNK) != FS3_BENCH_CHUNK ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark write to [%s] failed.", fname );
+				return( -1 );
+			}
+		}
+		fs3_close(fh);
+	}
+	bench_stop(&files->written);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_read_files
+// Description  : Read every file bench_setup wrote from start to end a chunk
+//                at a time, checking the first and last byte of each chunk
+//
+// Inputs       : files - the files to read
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_read_files(BenchFiles *files) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH];
+	uint32_t c;
+	int16_t fh;
+	int i;
+
+	for (i=0; i<files->nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "%s-file-%d.txt", files->name, i);
+		if ( (fh = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (c=0; c<files->chunks; c++) {
+			if ( (fs3_read(fh, files->buf, FS3_BENCH_CHUNK) != FS3_BENCH_CHUNK) ||
+					((uint8_t)files->buf[0] != bench_pattern(i, 0, c * FS3_BENCH_CHUNK)) ||
+					((uint8_t)files->buf[FS3_BENCH_CHUNK - 1] != bench_pattern(i, 0, ((c + 1) * FS3_BENCH_CHUNK) - 1)) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed at chunk %u.", fname, c );
+				return( -1 );
+			}
+		}
+		fs3_close(fh);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_teardown
+// Description  : Free the buffer of the files bench_setup wrote and unmount
+//
+// Inputs       : files - the files of the benchmark
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_teardown(BenchFiles *files) {
+	free(files->buf);
+	files->buf = NULL;
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
+
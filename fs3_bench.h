@@ -0,0 +1,128 @@
+#ifndef FS3_BENCH_INCLUDED
+#define FS3_BENCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_bench.h
+//  Description    : This is the interface shared by the FS3 micro-benchmarks,
+//                   the helpers every benchmark sets up with and the
+//                   benchmarks each module's bench file provides.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+
+// Defines
+#define FS3_BENCH_CHUNK (64 * 1024) // Size of each read and write of the benchmark files
+
+// Type definitions
+typedef struct {
+	double elapsed;  // Seconds the span took
+	uint64_t seeks;  // Track seeks the driver made in it
+	uint64_t reads;  // Sectors it read from the controllers
+	uint64_t writes; // Sectors it wrote to the controllers
+} BenchSpan;
+
+typedef struct {
+	const char *name;  // The files are named <name>-file-<n>.txt
+	int nfiles;        // Number of files
+	uint32_t chunks;   // FS3_BENCH_CHUNK chunks in each file
+	double mb;         // MB in all of the files together
+	char *buf;         // A chunk sized buffer for the benchmark to use
+	BenchSpan written; // Time and traffic of writing the files
+} BenchFiles;
+
+//
+// Benchmark Helpers (fs3_bench.c)
+
+double bench_now(void);
+	// Monotonic time in seconds
+
+void bench_start(BenchSpan *span);
+	// Start timing a span of a benchmark and counting its controller traffic
+
+void bench_stop(BenchSpan *span);
+	// Leave the time and traffic since bench_start in the span
+
+uint8_t bench_pattern(int file, int gen, uint32_t off);
+	// Byte the benchmarks write at an offset of a generation of a file
+
+int bench_mount(void);
+	// Mount the disk, logging the failure if it cannot be
+
+int bench_setup(BenchFiles *files, const char *name, int nfiles, uint32_t maxChunks);
+	// Mount and write nfiles files of up to maxChunks chunks, at most half the disk in all
+
+int bench_read_files(BenchFiles *files);
+	// Read every file back a chunk at a time, checking both ends of each chunk
+
+int bench_teardown(BenchFiles *files);
+	// Free the files' buffer and unmount
+
+//
+// Driver Benchmarks (fs3_driver_bench.c)
+
+int bench_open(int nfiles);
+	// Open latency benchmark
+
+int bench_churn(int nfiles, int wraps);
+	// Allocate/free churn benchmark
+
+int bench_interleave(int nfiles);
+	// Seeks per MB after interleaved writes
+
+int bench_crash(int nfiles, int trials);
+	// Crash injection and recovery check
+
+int bench_small(int nfiles);
+	// Space and reads per open of many small files
+
+//
+// Scheduler Benchmarks (fs3_sched_bench.c)
+
+int bench_sched(int nfiles);
+	// FIFO against C-LOOK write scheduling
+
+//
+// Network Benchmarks (fs3_network_bench.c)
+
+int bench_stripe(int nfiles);
+	// Sequential throughput over the striped controllers
+
+int bench_mirror(int nfiles);
+	// Reads served by each mirrored controller
+
+//
+// Erasure Code Benchmarks (fs3_erasure_bench.c)
+
+int bench_erasure(int nfiles);
+	// Erasure code throughput and degraded read latency
+
+//
+// Ring Benchmarks (fs3_ring_bench.c)
+
+int bench_ring(int nfiles);
+	// Balance and data moved by consistent hashing placement
+
+//
+// Lease Benchmarks (fs3_lease_bench.c)
+
+int bench_lease(int nfiles);
+	// Consistency and throughput of two clients sharing sectors
+
+//
+// Command Block Benchmarks (fs3_cmdblock_bench.c)
+
+int bench_codec(void);
+	// Correctness and throughput of the command block codec
+
+//
+// Checksum Benchmarks (fs3_crc_bench.c)
+
+int bench_sums(int nfiles);
+	// Cost of checking the sector checksums on reads
+
+#endif
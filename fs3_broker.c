@@ -0,0 +1,777 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_broker.c
+//  Description    : This is the lease broker that lets several FS3 drivers
+//                   share one controller. It holds the only connection to the
+//                   controller and runs the commands of every driver on it in
+//                   turn, keeping track of where each driver thinks the head
+//                   is. Drivers mounted with leases ask it for a read or write
+//                   lease on a track before caching or writing the track. Read
+//                   leases are shared, a write lease excludes every other
+//                   lease, and a request that conflicts with leases held by
+//                   others waits while they are recalled. A recalled lease is
+//                   given back the next time its holder talks to the broker,
+//                   or lapses at the end of its term if the holder goes quiet.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <signal.h>
+#include <endian.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_network.h>
+#include <fs3_lease.h>
+#include <fs3_cmdblock.h>
+
+// Defines
+#define FS3_BROKER_ARGUMENTS "ht:v"
+#define FS3_BROKER_MAX_CLIENTS 64 // Drivers that can be connected at once
+#define FS3_BROKER_MAX_NOTIFY ((FS3_SECTOR_SIZE / 2) - 1) // Given back tracks that fit in one lease reply
+#define FS3_BROKER_DEFAULT_TERM 250 // Milliseconds a lease lasts unless told otherwise
+#define USAGE \
+	"USAGE: fs3_broker [-h] [-v] [-t <term>] <listen port> <server ip:port>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -v - log every lease granted and recalled\n" \
+	"    -t - milliseconds a lease lasts (default 250)\n" \
+	"\n" \
+	"    <listen port> - port the drivers connect to\n" \
+	"    <server ip:port> - controller the drivers share\n" \
+	"\n" \
+
+// Type definitions
+typedef struct {
+	int fd;             // Socket of the driver, -1 when the slot is free
+	int head;           // Track the driver last seeked to, -1 for none
+	bool parked;        // A lease request is waiting for conflicting leases to go
+	uint16_t parkedTrk; // Track and mode of the waiting request
+	uint8_t parkedMode;
+	uint64_t seq;       // Order the waiting request arrived in
+	uint16_t notify[FS3_BROKER_MAX_NOTIFY]; // Tracks given back, reported in the next lease reply
+	int notifyLen;
+} BrokerClient;
+
+typedef struct {
+	int client;     // Holder of the lease
+	uint16_t trk;   // Track the lease covers
+	uint8_t mode;   // FS3_LEASE_READ or FS3_LEASE_WRITE
+	double expires; // When the lease lapses
+	bool recalled;  // The holder has been asked to give it back
+} BrokerLease;
+
+//
+// Global Data
+
+BrokerClient clients[FS3_BROKER_MAX_CLIENTS];
+BrokerLease *leases = NULL;
+int leasesLen = 0;
+int leasesCap = 0;
+int server = -1;
+int serverHead = -1;
+uint16_t term = FS3_BROKER_DEFAULT_TERM;
+uint64_t arrivals = 0;
+int verbose = 0;
+volatile sig_atomic_t stopping = 0;
+
+//Metrics
+uint64_t granted = 0;
+uint64_t recalls = 0;
+uint64_t waits = 0;
+uint64_t refused = 0;
+
+//
+// Functional Prototypes
+
+int broker_connect(const char *address, unsigned short port); // Connect to the controller
+double broker_now(void); // Monotonic time in seconds
+int broker_read(int fd, void *buf, size_t len); // Read all of a message
+int broker_call(FS3CmdBlk cmd, void *buf, FS3CmdBlk *ret); // Run a command on the controller
+int broker_reply(int c, FS3CmdBlk ret, void *buf, size_t len); // Send a reply to a driver
+int broker_serve(int c); // Run the next command of a driver
+int broker_lease(int c, uint8_t mode, uint16_t trk); // Handle a lease request
+bool broker_grant(int c, uint8_t mode, uint16_t trk, uint64_t seq); // Grant a lease if nothing conflicts
+int broker_reply_lease(int c, uint8_t mode, uint16_t trk); // Send a lease reply
+int broker_recall(int l); // Ask for a lease back
+int broker_give_back(int c); // Take back the recalled leases of a driver
+int broker_remove(int l); // Forget a lease
+int broker_expire(double now); // Forget the leases that have lapsed
+int broker_retry(void); // Grant the waiting requests that no longer conflict
+int broker_drop(int c); // Disconnect a driver
+int broker_timeout(void); // Milliseconds until the next lease lapses
+void broker_stop(int sig); // Signal handler
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 lease broker, it mounts the
+//                controller and serves every driver connected to it until
+//                it is told to stop, then unmounts the controller
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	struct pollfd pfds[FS3_BROKER_MAX_CLIENTS + 1];
+	int slots[FS3_BROKER_MAX_CLIENTS + 1];
+	struct sockaddr_in addr;
+	struct sigaction sa;
+	char address[64];
+	unsigned short listenPort, serverPort;
+	FS3CmdBlk ret;
+	int ch, lfd, fd, c, n, one = 1;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_BROKER_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'v': // Verbose Flag
+			verbose = 1;
+			break;
+
+		case 't': // Set the lease term
+			if ( (sscanf(optarg, "%hu", &term) != 1) || (term <= FS3_LEASE_MARGIN_MS) ) {
+				fprintf( stderr, "Bad lease term [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+	if ( (optind + 2 != argc) || (sscanf(argv[optind], "%hu", &listenPort) != 1) ||
+			(sscanf(argv[optind + 1], "%63[^:]:%hu", address, &serverPort) != 2) ) {
+		fprintf( stderr, "Missing or bad command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Mount the controller, every driver shares this one mount
+	if ( ((server = broker_connect(address, serverPort)) == -1) ||
+			(broker_call(fs3_cmd_encode(FS3_OP_MOUNT, 0, 0, 0), NULL, &ret) != 0) ||
+			(fs3_cmd_ret(ret) != 0) ) {
+		fprintf( stderr, "Cannot mount %s:%u\n", address, serverPort );
+		return( -1 );
+	}
+
+	// Listen for the drivers
+	lfd = socket(PF_INET, SOCK_STREAM, 0);
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(listenPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ( (lfd == -1) || (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+			(listen(lfd, FS3_MAX_BACKLOG) == -1) ) {
+		fprintf( stderr, "Cannot listen on port %u\n", listenPort );
+		return( -1 );
+	}
+	for (c=0; c<FS3_BROKER_MAX_CLIENTS; c++) {
+		clients[c].fd = -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = broker_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Serve the drivers, a driver waiting for a lease sends nothing until it gets it
+	while ( stopping == 0 ) {
+		pfds[0].fd = lfd;
+		pfds[0].events = POLLIN;
+		n = 1;
+		for (c=0; c<FS3_BROKER_MAX_CLIENTS; c++) {
+			if ( clients[c].fd != -1 ) {
+				pfds[n].fd = clients[c].fd;
+				pfds[n].events = POLLIN;
+				slots[n++] = c;
+			}
+		}
+		if ( (poll(pfds, n, broker_timeout()) == -1) && (errno != EINTR) ) {
+			break;
+		}
+		broker_expire(broker_now());
+		for (int i=1; (i<n) && (stopping == 0); i++) {
+			if ( (pfds[i].revents != 0) && (broker_serve(slots[i]) != 0) ) {
+				broker_drop(slots[i]);
+			}
+		}
+		if ( (stopping == 0) && (pfds[0].revents != 0) && ((fd = accept(lfd, NULL, NULL)) != -1) ) {
+			for (c=0; (c<FS3_BROKER_MAX_CLIENTS) && (clients[c].fd != -1); c++);
+			if ( c == FS3_BROKER_MAX_CLIENTS ) {
+				close(fd);
+			} else {
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+				memset(&clients[c], 0, sizeof(BrokerClient));
+				clients[c].fd = fd;
+				clients[c].head = -1;
+			}
+		}
+		broker_retry();
+	}
+
+	// The controller only stores the disk when it is unmounted
+	for (c=0; c<FS3_BROKER_MAX_CLIENTS; c++) {
+		if ( clients[c].fd != -1 ) {
+			broker_drop(c);
+		}
+	}
+	close(lfd);
+	broker_call(fs3_cmd_encode(FS3_OP_UMOUNT, 0, 0, 0), NULL, &ret);
+	close(server);
+	fprintf( stderr, "FS3 broker: %lu leases granted, %lu recalled, %lu requests waited, %lu writes refused\n",
+		(unsigned long)granted, (unsigned long)recalls, (unsigned long)waits, (unsigned long)refused );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_stop
+// Description  : Signal handler telling the broker to unmount and exit
+//
+// Inputs       : sig - the signal
+// Outputs      : none
+
+void broker_stop(int sig) {
+	stopping = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_connect
+// Description  : Connect to the controller
+//
+// Inputs       : address - IP address of the controller
+//                port - port of the controller
+// Outputs      : the socket if successful, -1 if failure
+
+int broker_connect(const char *address, unsigned short port) {
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if ( (inet_aton(address, &addr.sin_addr) == 0) || ((fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) ) {
+		return( -1 );
+	}
+	if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+		close(fd);
+		return( -1 );
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return( fd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_now
+// Description  : Get the current monotonic time
+//
+// Inputs       : none
+// Outputs      : the time in seconds
+
+double broker_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_read
+// Description  : Read a whole message from a socket, however it is split
+//
+// Inputs       : fd - the socket
+//                buf - where to put the message
+//                len - length of the message
+// Outputs      : 0 if successful, -1 if failure (or the socket closed)
+
+int broker_read(int fd, void *buf, size_t len) {
+	size_t got = 0;
+	ssize_t n;
+
+	while ( got < len ) {
+		if ( (n = read(fd, (char *)buf + got, len - got)) <= 0 ) {
+			if ( (n == -1) && (errno == EINTR) ) {
+				continue;
+			}
+			return( -1 );
+		}
+		got += n;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_call
+// Description  : Run a command on the controller, a write sends the sector
+//                after the command and a read that worked gets one back
+//
+// Inputs       : cmd - the command block
+//                buf - the sector to send or receive, NULL if none
+//                ret - the command block the controller returned
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_call(FS3CmdBlk cmd, void *buf, FS3CmdBlk *ret) {
+	char msg[sizeof(FS3CmdBlk) + FS3_SECTOR_SIZE];
+	uint8_t op = fs3_cmd_op(cmd);
+	uint64_t wire = htobe64(cmd);
+	size_t len = sizeof(wire) + ((op == FS3_OP_WRSECT) ? FS3_SECTOR_SIZE : 0);
+
+	// A write goes with its sector in one message
+	memcpy(msg, &wire, sizeof(wire));
+	if ( op == FS3_OP_WRSECT ) {
+		memcpy(msg + sizeof(wire), buf, FS3_SECTOR_SIZE);
+	}
+	if ( (write(server, msg, len) != (ssize_t)len) || (broker_read(server, &wire, sizeof(wire)) != 0) ) {
+		return( -1 );
+	}
+	*ret = be64toh(wire);
+	if ( (op == FS3_OP_RDSECT) && (fs3_cmd_ret(*ret) == 0) && (broker_read(server, buf, FS3_SECTOR_SIZE) != 0) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_reply
+// Description  : Send a reply to a driver, with the recall bit set if it
+//                holds leases it has been asked to give back
+//
+// Inputs       : c - the driver
+//                ret - the command block to return
+//                buf - data to send after it, NULL if none
+//                len - length of the data
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_reply(int c, FS3CmdBlk ret, void *buf, size_t len) {
+	char msg[sizeof(FS3CmdBlk) + FS3_SECTOR_SIZE];
+	uint64_t wire;
+
+	for (int l=0; l<leasesLen; l++) {
+		if ( (leases[l].client == c) && (leases[l].recalled == true) ) {
+			ret |= (FS3CmdBlk)1 << FS3_LEASE_RECALL_BIT;
+			break;
+		}
+	}
+
+	// The reply goes in one write, the driver reads the sector straight after the command block
+	wire = htobe64(ret);
+	len = (buf == NULL) ? 0 : len;
+	memcpy(msg, &wire, sizeof(wire));
+	if ( len > 0 ) {
+		memcpy(msg + sizeof(wire), buf, len);
+	}
+	if ( write(clients[c].fd, msg, sizeof(wire) + len) != (ssize_t)(sizeof(wire) + len) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_serve
+// Description  : Read the next command of a driver and run it. Mounts and
+//                unmounts are answered by the broker, the controller stays
+//                mounted for the others. Reads and writes first move the
+//                controller's head to where the driver last seeked, and a
+//                write to a track another driver holds a lease on is refused
+//
+// Inputs       : c - the driver
+// Outputs      : 0 if successful, -1 if the driver should be dropped
+
+int broker_serve(int c) {
+	char buf[FS3_SECTOR_SIZE];
+	uint64_t wire;
+	FS3CmdBlk cmd, ret;
+
+	if ( broker_read(clients[c].fd, &wire, sizeof(wire)) != 0 ) {
+		return( -1 );
+	}
+	cmd = be64toh(wire);
+	uint8_t op = fs3_cmd_op(cmd);
+	uint16_t sec = fs3_cmd_sec(cmd);
+	uint32_t trk = fs3_cmd_trk(cmd);
+
+	switch (op) {
+	case FS3_OP_MOUNT:
+		clients[c].head = -1;
+		return( broker_reply(c, fs3_cmd_encode(op, 0, 0, 0), NULL, 0) );
+
+	case FS3_OP_UMOUNT:
+		for (int l=leasesLen-1; l>=0; l--) {
+			if ( leases[l].client == c ) {
+				broker_remove(l);
+			}
+		}
+		clients[c].notifyLen = 0;
+		return( broker_reply(c, fs3_cmd_encode(op, 0, 0, 0), NULL, 0) );
+
+	case FS3_OP_TSEEK:
+		if ( broker_call(cmd, NULL, &ret) != 0 ) {
+			return( -1 );
+		}
+		serverHead = (fs3_cmd_ret(ret) == 0) ? (int)trk : -1;
+		clients[c].head = serverHead;
+		return( broker_reply(c, ret, NULL, 0) );
+
+	case FS3_OP_RDSECT:
+	case FS3_OP_WRSECT:
+		if ( (op == FS3_OP_WRSECT) && (broker_read(clients[c].fd, buf, FS3_SECTOR_SIZE) != 0) ) {
+			return( -1 );
+		}
+		if ( op == FS3_OP_WRSECT ) {
+			double now = broker_now();
+			for (int l=0; l<leasesLen; l++) {
+				if ( (leases[l].trk == clients[c].head) && (leases[l].client != c) && (leases[l].expires > now) ) {
+					refused++;
+					return( broker_reply(c, fs3_cmd_encode(op, sec, 0, 1), NULL, 0) );
+				}
+			}
+		}
+		if ( (clients[c].head != -1) && (clients[c].head != serverHead) ) {
+			FS3CmdBlk seek = fs3_cmd_encode(FS3_OP_TSEEK, 0, clients[c].head, 0);
+			if ( broker_call(seek, NULL, &ret) != 0 ) {
+				return( -1 );
+			}
+			serverHead = (fs3_cmd_ret(ret) == 0) ? clients[c].head : -1;
+		}
+		if ( broker_call(cmd, buf, &ret) != 0 ) {
+			return( -1 );
+		}
+		if ( (op == FS3_OP_RDSECT) && (fs3_cmd_ret(ret) == 0) ) {
+			return( broker_reply(c, ret, buf, FS3_SECTOR_SIZE) );
+		}
+		return( broker_reply(c, ret, NULL, 0) );
+
+	case FS3_OP_LEASE:
+		if ( (sec > FS3_LEASE_WRITE) || (trk >= FS3_LEASE_MAX_TRACKS) ) {
+			return( broker_reply(c, fs3_cmd_encode(op, 0, trk, 1), NULL, 0) );
+		}
+		return( broker_lease(c, (uint8_t)sec, (uint16_t)trk) );
+
+	default:
+		return( broker_reply(c, fs3_cmd_encode(op, 0, 0, 1), NULL, 0) );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_lease
+// Description  : Handle a lease request, the leases of the driver that were
+//                recalled are taken back first. A request for FS3_LEASE_NONE
+//                is answered at once, anything else waits if it conflicts
+//
+// Inputs       : c - the driver
+//                mode - lease wanted
+//                trk - the track
+// Outputs      : 0 if successful, -1 if the driver should be dropped
+
+int broker_lease(int c, uint8_t mode, uint16_t trk) {
+	uint64_t seq = ++arrivals;
+
+	broker_give_back(c);
+	if ( (mode == FS3_LEASE_NONE) || (broker_grant(c, mode, trk, seq) == true) ) {
+		return( broker_reply_lease(c, mode, trk) );
+	}
+
+	// Wait for the conflicting leases to be given back or lapse
+	clients[c].parked = true;
+	clients[c].parkedTrk = trk;
+	clients[c].parkedMode = mode;
+	clients[c].seq = seq;
+	waits++;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_grant
+// Description  : Grants a lease unless another driver holds a conflicting one
+//                or asked for a conflicting one earlier, in which case those
+//                leases are recalled. A driver asking again for a track it
+//                holds a lease on renews it, or upgrades it to a write lease
+//
+// Inputs       : c - the driver
+//                mode - lease wanted
+//                trk - the track
+//                seq - order the request arrived in
+// Outputs      : true if granted, false if the request has to wait
+
+bool broker_grant(int c, uint8_t mode, uint16_t trk, uint64_t seq) {
+	bool conflict = false;
+	int own = -1;
+
+	// Recalling the lease of a waiting holder removes it, so the leases are walked from the end
+	for (int l=leasesLen-1; l>=0; l--) {
+		if ( (leases[l].trk == trk) && (leases[l].client != c) &&
+				((mode == FS3_LEASE_WRITE) || (leases[l].mode == FS3_LEASE_WRITE)) ) {
+			conflict = true;
+			if ( leases[l].recalled == false ) {
+				broker_recall(l);
+			}
+		}
+	}
+	for (int p=0; p<FS3_BROKER_MAX_CLIENTS; p++) {
+		if ( (p != c) && (clients[p].fd != -1) && (clients[p].parked == true) && (clients[p].seq < seq) &&
+				(clients[p].parkedTrk == trk) && ((mode == FS3_LEASE_WRITE) || (clients[p].parkedMode == FS3_LEASE_WRITE)) ) {
+			conflict = true;
+		}
+	}
+	if ( conflict == true ) {
+		return( false );
+	}
+
+	for (int l=0; l<leasesLen; l++) {
+		if ( (leases[l].client == c) && (leases[l].trk == trk) ) {
+			own = l;
+		}
+	}
+	if ( own == -1 ) {
+		if ( leasesLen == leasesCap ) {
+			int cap = (leasesCap == 0) ? 64 : leasesCap * 2;
+			BrokerLease *grown = realloc(leases, sizeof(BrokerLease) * cap);
+			if ( grown == NULL ) {
+				return( false );
+			}
+			leases = grown;
+			leasesCap = cap;
+		}
+		own = leasesLen++;
+		leases[own].client = c;
+		leases[own].trk = trk;
+		leases[own].mode = mode;
+	} else if ( mode > leases[own].mode ) {
+		leases[own].mode = mode;
+	}
+	leases[own].expires = broker_now() + (term / 1000.0);
+	leases[own].recalled = false;
+	granted++;
+	if ( verbose ) {
+		fprintf( stderr, "FS3 broker: driver %d holds a %s lease on track %u\n", c,
+			(leases[own].mode == FS3_LEASE_WRITE) ? "write" : "read", trk );
+	}
+	return( true );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_reply_lease
+// Description  : Send the reply to a lease request, the term granted goes in
+//                the sector field and the sector sent after it lists the
+//                tracks the driver has given back
+//
+// Inputs       : c - the driver
+//                mode - lease granted
+//                trk - the track
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_reply_lease(int c, uint8_t mode, uint16_t trk) {
+	uint16_t buf[FS3_SECTOR_SIZE / 2];
+
+	memset(buf, 0, sizeof(buf));
+	buf[0] = htons((uint16_t)clients[c].notifyLen);
+	for (int i=0; i<clients[c].notifyLen; i++) {
+		buf[i + 1] = htons(clients[c].notify[i]);
+	}
+	clients[c].notifyLen = 0;
+	FS3CmdBlk ret = fs3_cmd_encode(FS3_OP_LEASE, (mode == FS3_LEASE_NONE) ? 0 : term, trk, 0);
+	return( broker_reply(c, ret, buf, sizeof(buf)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_recall
+// Description  : Asks for a lease back. A holder waiting for a lease of its
+//                own cannot use its cache until that reply arrives, and the
+//                reply tells it what it gave back, so its lease is taken
+//                back at once
+//
+// Inputs       : l - the lease
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_recall(int l) {
+	BrokerClient *holder = &clients[leases[l].client];
+
+	if ( leases[l].recalled == false ) {
+		recalls++;
+		if ( verbose ) {
+			fprintf( stderr, "FS3 broker: recalling driver %d's lease on track %u\n", leases[l].client, leases[l].trk );
+		}
+	}
+	leases[l].recalled = true;
+	if ( (holder->parked == true) && (holder->notifyLen < FS3_BROKER_MAX_NOTIFY) ) {
+		holder->notify[holder->notifyLen++] = leases[l].trk;
+		broker_remove(l);
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_give_back
+// Description  : Takes back the recalled leases of a driver that has sent a
+//                lease request, they are listed in the reply to it
+//
+// Inputs       : c - the driver
+// Outputs      : the number of leases taken back
+
+int broker_give_back(int c) {
+	int n = 0;
+
+	for (int l=leasesLen-1; l>=0; l--) {
+		if ( (leases[l].client == c) && (leases[l].recalled == true) && (clients[c].notifyLen < FS3_BROKER_MAX_NOTIFY) ) {
+			clients[c].notify[clients[c].notifyLen++] = leases[l].trk;
+			broker_remove(l);
+			n++;
+		}
+	}
+	return( n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_remove
+// Description  : Forget a lease, the last lease takes its place
+//
+// Inputs       : l - the lease
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_remove(int l) {
+	leases[l] = leases[--leasesLen];
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_expire
+// Description  : Forget the leases that have lapsed, their holders stopped
+//                using them a margin before this
+//
+// Inputs       : now - the current time
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_expire(double now) {
+	for (int l=leasesLen-1; l>=0; l--) {
+		if ( leases[l].expires <= now ) {
+			broker_remove(l);
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_retry
+// Description  : Grant the waiting requests that no longer conflict, oldest
+//                first so a writer is not starved by a stream of readers
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_retry(void) {
+	int order[FS3_BROKER_MAX_CLIENTS], n = 0, i, j, c;
+
+	for (c=0; c<FS3_BROKER_MAX_CLIENTS; c++) {
+		if ( (clients[c].fd != -1) && (clients[c].parked == true) ) {
+			for (i=n++; (i>0) && (clients[order[i - 1]].seq > clients[c].seq); i--) {
+				order[i] = order[i - 1];
+			}
+			order[i] = c;
+		}
+	}
+
+	// A grant never makes room for another, so one pass is enough
+	for (j=0; j<n; j++) {
+		c = order[j];
+		if ( broker_grant(c, clients[c].parkedMode, clients[c].parkedTrk, clients[c].seq) == true ) {
+			clients[c].parked = false;
+			if ( broker_reply_lease(c, clients[c].parkedMode, clients[c].parkedTrk) != 0 ) {
+				broker_drop(c);
+			}
+		}
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_drop
+// Description  : Disconnect a driver, its leases and any request it was
+//                waiting on go with it
+//
+// Inputs       : c - the driver
+// Outputs      : 0 if successful, -1 if failure
+
+int broker_drop(int c) {
+	for (int l=leasesLen-1; l>=0; l--) {
+		if ( leases[l].client == c ) {
+			broker_remove(l);
+		}
+	}
+	close(clients[c].fd);
+	clients[c].fd = -1;
+	clients[c].parked = false;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : broker_timeout
+// Description  : Gets how long the broker can wait for the drivers, only a
+//                waiting request needs it to wake up when a lease lapses
+//
+// Inputs       : none
+// Outputs      : milliseconds to wait, -1 for no limit
+
+int broker_timeout(void) {
+	double next = -1, now = broker_now();
+	bool waiting = false;
+
+	for (int c=0; c<FS3_BROKER_MAX_CLIENTS; c++) {
+		waiting = waiting || ((clients[c].fd != -1) && (clients[c].parked == true));
+	}
+	if ( waiting == false ) {
+		return( -1 );
+	}
+	for (int l=0; l<leasesLen; l++) {
+		if ( (next < 0) || (leases[l].expires < next) ) {
+			next = leases[l].expires;
+		}
+	}
+	if ( next < 0 ) {
+		return( 0 );
+	}
+	return( (next <= now) ? 0 : (int)((next - now) * 1000) + 1 );
+}
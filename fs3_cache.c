@@ -16,6 +16,8 @@
 #include <malloc.h>
 #include <string.h>
 #include <fs3_common.h>
+#include <fs3_log.h>
+#include <fs3_span.h>
 
 //
 // Support Macros/Data
@@ -111,6 +113,7 @@ int fs3_close_cache(void)  {
 // Outputs      : 0 if inserted, -1 if not inserted
 
 int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+    FS3_SPAN("cache", "fs3_put_cache");
     //Checking if cache line is already in the cache, if it is then update the buffer
     for (int i=0; i<cacheSize; i++){
         if ((cache[i].cacheTrk == trk) && (cache[i].cacheSec == sct)){
@@ -167,6 +170,7 @@ int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
 // Outputs      : returns NULL if not found or failed, pointer to buffer if found
 
 void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
+    FS3_SPAN("cache", "fs3_get_cache");
     attempts++;
     for (int i=0; i<cacheSize; i++){
         if ((cache[i].cacheTrk == trk) && (cache[i].cacheSec == sct)){
@@ -182,6 +186,52 @@ void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
     return(NULL);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_invalidate_cache
+// Description  : Drop an element from the cache, used when a sector stops
+//                belonging to a file
+//
+// Inputs       : trk - the track number of the sector to drop
+//                sct - the sector number of the sector to drop
+// Outputs      : 0 if dropped, -1 if it was not in the cache
+
+int fs3_invalidate_cache(FS3TrackIndex trk, FS3SectorIndex sct) {
+    for (int i=0; i<cacheSize; i++){
+        if ((cache[i].cacheTrk == trk) && (cache[i].cacheSec == sct)){
+            if (cache[i].buf != NULL){
+                free(cache[i].buf);
+                cache[i].buf = NULL;
+                cache[i].callsSinceAccessed = 0;
+                return (0);
+            }
+        }
+    }
+    return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_invalidate_cache_track
+// Description  : Drop every element of a track from the cache, used when the
+//                lease that let the track be cached is lost
+//
+// Inputs       : trk - the track number of the sectors to drop
+// Outputs      : the number of elements dropped
+
+int fs3_invalidate_cache_track(FS3TrackIndex trk) {
+    int dropped = 0;
+    for (int i=0; i<cacheSize; i++){
+        if ((cache[i].cacheTrk == trk) && (cache[i].buf != NULL)){
+            free(cache[i].buf);
+            cache[i].buf = NULL;
+            cache[i].callsSinceAccessed = 0;
+            dropped++;
+        }
+    }
+    return (dropped);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_log_cache_metrics
@@ -192,12 +242,12 @@ void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct)  {
 
 int fs3_log_cache_metrics(void) {
     //Writing the metrics of the cache to the terminal
-    logMessage(FS3SimulatorLLevel, "** FS3 Cache Metrics **");
-    logMessage(FS3SimulatorLLevel, " Cache Attempts = [     %d]", attempts);
-    logMessage(FS3SimulatorLLevel, " Hits =           [     %d]", hits);
-    logMessage(FS3SimulatorLLevel, " Misses =         [     %d]", misses);
+    FS3_LOG_INFO(FS3SimulatorLLevel, "** FS3 Cache Metrics **");
+    FS3_LOG_INFO(FS3SimulatorLLevel, " Cache Attempts = [     %d]", attempts);
+    FS3_LOG_INFO(FS3SimulatorLLevel, " Hits =           [     %d]", hits);
+    FS3_LOG_INFO(FS3SimulatorLLevel, " Misses =         [     %d]", misses);
     float hitRatio = 100 * (((float)hits) / ((float)attempts));
-    logMessage(FS3SimulatorLLevel, " Hit Ratio =      [   %%%.2f]", hitRatio);
+    FS3_LOG_INFO(FS3SimulatorLLevel, " Hit Ratio =      [   %%%.2f]", hitRatio);
     return(0);
 }
 
@@ -35,6 +35,12 @@ int fs3_put_cache(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
 void * fs3_get_cache(FS3TrackIndex trk, FS3SectorIndex sct);
     // Get an element from the cache (returns NULL if not found)
 
+int fs3_invalidate_cache(FS3TrackIndex trk, FS3SectorIndex sct);
+    // Drop an element from the cache if it is there
+
+int fs3_invalidate_cache_track(FS3TrackIndex trk);
+    // Drop every element of a track from the cache
+
 int fs3_log_cache_metrics(void);
     // Log the metrics for the cache 
 
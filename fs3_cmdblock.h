@@ -0,0 +1,92 @@
+#ifndef FS3_CMDBLOCK_INCLUDED
+#define FS3_CMDBLOCK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cmdblock.h
+//  Description    : This is the codec for the FS3 command block, used by the
+//                   driver and by the programs that talk to a controller for
+//                   it. The block is laid out as
+//
+//                     bits 63-60 op, 59-44 sec, 43-12 trk, 11 ret, 10-0 unused
+//
+//                   and every field is read or written with a fixed shift and
+//                   mask, so the functions are a few instructions each and
+//                   are defined here to be inlined.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_CMD_OP_SHIFT 60
+#define FS3_CMD_SEC_SHIFT 44
+#define FS3_CMD_TRK_SHIFT 12
+#define FS3_CMD_RET_SHIFT 11
+#define FS3_CMD_OP_MASK 0xfULL
+#define FS3_CMD_SEC_MASK 0xffffULL
+#define FS3_CMD_TRK_MASK 0xffffffffULL
+#define FS3_CMD_RET_MASK 0x1ULL
+
+// Type definitions
+typedef struct {
+	uint8_t  op;  // Operator code
+	uint16_t sec; // Sector number
+	uint32_t trk; // Track number
+	uint8_t  ret; // Return value, 0 if the command worked
+} FS3CmdFields;
+
+//
+// Codec Functions
+
+static inline FS3CmdBlk fs3_cmd_encode(uint8_t op, uint16_t sec, uint32_t trk, uint8_t ret) {
+	return ((((FS3CmdBlk)op & FS3_CMD_OP_MASK) << FS3_CMD_OP_SHIFT) | ((FS3CmdBlk)sec << FS3_CMD_SEC_SHIFT) |
+		((FS3CmdBlk)trk << FS3_CMD_TRK_SHIFT) | (((FS3CmdBlk)ret & FS3_CMD_RET_MASK) << FS3_CMD_RET_SHIFT));
+}
+	// Build a command block
+
+static inline uint8_t fs3_cmd_op(FS3CmdBlk cmd) {
+	return ((uint8_t)((cmd >> FS3_CMD_OP_SHIFT) & FS3_CMD_OP_MASK));
+}
+	// Get the operator code of a command block
+
+static inline uint16_t fs3_cmd_sec(FS3CmdBlk cmd) {
+	return ((uint16_t)((cmd >> FS3_CMD_SEC_SHIFT) & FS3_CMD_SEC_MASK));
+}
+	// Get the sector number of a command block
+
+static inline uint32_t fs3_cmd_trk(FS3CmdBlk cmd) {
+	return ((uint32_t)((cmd >> FS3_CMD_TRK_SHIFT) & FS3_CMD_TRK_MASK));
+}
+	// Get the track number of a command block
+
+static inline uint8_t fs3_cmd_ret(FS3CmdBlk cmd) {
+	return ((uint8_t)((cmd >> FS3_CMD_RET_SHIFT) & FS3_CMD_RET_MASK));
+}
+	// Get the return value of a command block, 0 if the command worked
+
+static inline FS3CmdFields fs3_cmd_decode(FS3CmdBlk cmd) {
+	FS3CmdFields fields = { fs3_cmd_op(cmd), fs3_cmd_sec(cmd), fs3_cmd_trk(cmd), fs3_cmd_ret(cmd) };
+	return (fields);
+}
+	// Get every field of a command block
+
+static inline void fs3_cmd_encode_batch(const FS3CmdFields *fields, FS3CmdBlk *cmds, int n) {
+	for (int i=0; i<n; i++) {
+		cmds[i] = fs3_cmd_encode(fields[i].op, fields[i].sec, fields[i].trk, fields[i].ret);
+	}
+}
+	// Build n command blocks
+
+static inline void fs3_cmd_decode_batch(const FS3CmdBlk *cmds, FS3CmdFields *fields, int n) {
+	for (int i=0; i<n; i++) {
+		fields[i] = fs3_cmd_decode(cmds[i]);
+	}
+}
+	// Get every field of n command blocks
+
+#endif
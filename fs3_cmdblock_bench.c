@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_cmdblock_bench.c
+//  Description    : This is the benchmark of the FS3 command block codec, its
+//                   correctness over every field and its throughput.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Project Includes
+#include <fs3_cmdblock.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_CODEC_BLOCKS 4096 // Command blocks the codec benchmark encodes and decodes at a time
+#define FS3_CODEC_ITERATIONS 4096 // Times the codec benchmark encodes and decodes them
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_codec
+// Description  : Check the command block codec, every sector of every op
+//                and return value at the edge tracks and a spread of others
+//                must decode to what was encoded and leave the unused bits
+//                clear, then measure the encode and decode throughput one
+//                block at a time and in batches. Needs no controller
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_codec(void) {
+
+	// Local variables
+	uint32_t tracks[] = { 0, 1, 0x7fffffff, 0x80000000, 0xfffffffe, 0xffffffff, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	FS3CmdFields *fields, *back, got;
+	FS3CmdBlk *cmds, cmd, sum;
+	uint32_t op, ret, sec, t, seed;
+	double start, gb, encodeTime, decodeTime, encodeBatchTime, decodeBatchTime;
+	int i, iter;
+
+	// The tracks after the edges are random, each checked with every op, sector and return value
+	seed = 311;
+	for (t=6; t<sizeof(tracks)/sizeof(tracks[0]); t++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		tracks[t] = seed;
+	}
+	for (t=0; t<sizeof(tracks)/sizeof(tracks[0]); t++) {
+		for (op=0; op<=FS3_CMD_OP_MASK; op++) {
+			for (ret=0; ret<=FS3_CMD_RET_MASK; ret++) {
+				for (sec=0; sec<=FS3_CMD_SEC_MASK; sec++) {
+					cmd = fs3_cmd_encode(op, sec, tracks[t], ret);
+					got = fs3_cmd_decode(cmd);
+					if ( (got.op != op) || (got.sec != sec) || (got.trk != tracks[t]) || (got.ret != ret) ||
+							(fs3_cmd_op(cmd) != op) || (fs3_cmd_sec(cmd) != sec) || (fs3_cmd_trk(cmd) != tracks[t]) ||
+							(fs3_cmd_ret(cmd) != ret) || ((cmd & ((1ULL << FS3_CMD_RET_SHIFT) - 1)) != 0) ) {
+						logMessage( LOG_ERROR_LEVEL, "FS3 benchmark codec is wrong for op %u, sector %u, track %u, ret %u (0x%016llx).",
+							op, sec, tracks[t], ret, (unsigned long long)cmd );
+						return( -1 );
+					}
+				}
+			}
+		}
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 codec benchmark, %lu command blocks round tripped",
+		(unsigned long)(sizeof(tracks)/sizeof(tracks[0]) * (FS3_CMD_OP_MASK + 1) * (FS3_CMD_RET_MASK + 1) * (FS3_CMD_SEC_MASK + 1)) );
+
+	// Then the throughput, summing what is decoded so none of it can be left out
+	fields = malloc(sizeof(FS3CmdFields) * FS3_CODEC_BLOCKS);
+	back = malloc(sizeof(FS3CmdFields) * FS3_CODEC_BLOCKS);
+	cmds = malloc(sizeof(FS3CmdBlk) * FS3_CODEC_BLOCKS);
+	for (i=0; i<FS3_CODEC_BLOCKS; i++) {
+		fields[i].op = rand() % (FS3_CMD_OP_MASK + 1);
+		fields[i].sec = rand();
+		fields[i].trk = rand();
+		fields[i].ret = rand() % (FS3_CMD_RET_MASK + 1);
+	}
+	gb = ((double)FS3_CODEC_BLOCKS * FS3_CODEC_ITERATIONS) / 1e9;
+	sum = 0;
+
+	start = bench_now();
+	for (iter=0; iter<FS3_CODEC_ITERATIONS; iter++) {
+		for (i=0; i<FS3_CODEC_BLOCKS; i++) {
+			cmds[i] = fs3_cmd_encode(fields[i].op, fields[i].sec, fields[i].trk + iter, fields[i].ret);
+		}
+		sum += cmds[iter % FS3_CODEC_BLOCKS];
+	}
+	encodeTime = bench_now() - start;
+
+	start = bench_now();
+	for (iter=0; iter<FS3_CODEC_ITERATIONS; iter++) {
+		for (i=0; i<FS3_CODEC_BLOCKS; i++) {
+			sum += fs3_cmd_op(cmds[i]) + fs3_cmd_sec(cmds[i]) + fs3_cmd_trk(cmds[i]) + fs3_cmd_ret(cmds[i]);
+		}
+	}
+	decodeTime = bench_now() - start;
+
+	start = bench_now();
+	for (iter=0; iter<FS3_CODEC_ITERATIONS; iter++) {
+		fs3_cmd_encode_batch(fields, cmds, FS3_CODEC_BLOCKS);
+		sum += cmds[iter % FS3_CODEC_BLOCKS];
+	}
+	encodeBatchTime = bench_now() - start;
+
+	start = bench_now();
+	for (iter=0; iter<FS3_CODEC_ITERATIONS; iter++) {
+		fs3_cmd_decode_batch(cmds, back, FS3_CODEC_BLOCKS);
+		sum += back[iter % FS3_CODEC_BLOCKS].trk;
+	}
+	decodeBatchTime = bench_now() - start;
+
+	for (i=0; i<FS3_CODEC_BLOCKS; i++) {
+		if ( (back[i].op != fields[i].op) || (back[i].sec != fields[i].sec) || (back[i].trk != fields[i].trk) ||
+				(back[i].ret != fields[i].ret) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark codec batch is wrong at block %d.", i );
+			return( -1 );
+		}
+	}
+	logMessage( LOG_OUTPUT_LEVEL, " %-11s = [ encode %7.3f G blocks/s, decode %7.3f G blocks/s ]", "single", gb / encodeTime, gb / decodeTime );
+	logMessage( LOG_OUTPUT_LEVEL, " %-11s = [ encode %7.3f G blocks/s, decode %7.3f G blocks/s ] (sum %llx)", "batch",
+		gb / encodeBatchTime, gb / decodeBatchTime, (unsigned long long)sum );
+	free(fields);
+	free(back);
+	free(cmds);
+	return( 0 );
+}
@@ -0,0 +1,213 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_crc.c
+//  Description    : This is the implementation of the CRC32C checksums of the
+//                   FS3 filesystem. With SSE4.2 the CPU's CRC32 instruction
+//                   (which computes exactly this polynomial) takes eight bytes
+//                   at a time, without it the table kernel does the same with
+//                   eight lookups per eight bytes, the tables holding the
+//                   remainder of each byte at each of the eight positions
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <stdbool.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FS3_CRC_X86
+#endif
+
+// Project Includes
+#include <fs3_crc.h>
+
+//
+// Support Macros/Data
+
+#define CRC32C_POLYNOMIAL 0x82f63b78 // Castagnoli polynomial, bit reversed
+
+typedef uint32_t (*FS3CrcUpdate)(uint32_t crc, const uint8_t *buf, size_t len);
+
+//crcTable[j][b] is the remainder of byte b followed by j zero bytes
+uint32_t crcTable[8][256];
+bool crcReady = false;
+FS3CrcKernel crcKernel = FS3_CRC_TABLE;
+FS3CrcUpdate crcUpdate = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crcTables
+// Description  : Fills in the tables of the table kernel
+//
+// Inputs       : none
+// Outputs      : none
+
+void crcTables(void) {
+	for (int b=0; b<256; b++) {
+		uint32_t crc = b;
+		for (int bit=0; bit<8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLYNOMIAL : 0);
+		}
+		crcTable[0][b] = crc;
+	}
+	for (int b=0; b<256; b++) {
+		for (int j=1; j<8; j++) {
+			crcTable[j][b] = (crcTable[j - 1][b] >> 8) ^ crcTable[0][crcTable[j - 1][b] & 0xff];
+		}
+	}
+	crcReady = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crcUpdateTable
+// Description  : Adds bytes to a checksum eight at a time through the tables,
+//                then the last few one at a time
+//
+// Inputs       : crc - the checksum so far, inverted
+//                buf - the bytes
+//                len - number of bytes
+// Outputs      : the new checksum, inverted
+
+uint32_t crcUpdateTable(uint32_t crc, const uint8_t *buf, size_t len) {
+	while (len >= 8) {
+		uint32_t lo, hi;
+		memcpy(&lo, buf, sizeof(lo));
+		memcpy(&hi, buf + 4, sizeof(hi));
+		lo ^= crc;
+		crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^ crcTable[5][(lo >> 16) & 0xff] ^
+			crcTable[4][lo >> 24] ^ crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^
+			crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+		buf += 8;
+		len -= 8;
+	}
+	while (len-- > 0) {
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *buf++) & 0xff];
+	}
+	return (crc);
+}
+
+#ifdef FS3_CRC_X86
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : crcUpdateSse42
+// Description  : Adds bytes to a checksum eight at a time with the CRC32
+//                instruction, then the last few one at a time
+//
+// Inputs       : crc - the checksum so far, inverted
+//                buf - the bytes
+//                len - number of bytes
+// Outputs      : the new checksum, inverted
+
+__attribute__((target("sse4.2")))
+uint32_t crcUpdateSse42(uint32_t crc, const uint8_t *buf, size_t len) {
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+	while (len >= 8) {
+		uint64_t word;
+		memcpy(&word, buf, sizeof(word));
+		crc64 = _mm_crc32_u64(crc64, word);
+		buf += 8;
+		len -= 8;
+	}
+	crc = (uint32_t)crc64;
+#endif
+	while (len >= 4) {
+		uint32_t word;
+		memcpy(&word, buf, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+		buf += 4;
+		len -= 4;
+	}
+	while (len-- > 0) {
+		crc = _mm_crc32_u8(crc, *buf++);
+	}
+	return (crc);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_crc_kernel
+// Description  : Chooses the kernel checksums are computed with, so the
+//                kernels can be compared
+//
+// Inputs       : kernel - the kernel
+// Outputs      : 0 if successful, -1 if the CPU does not support it
+
+int fs3_crc_kernel(FS3CrcKernel kernel) {
+	switch (kernel) {
+	case FS3_CRC_TABLE:
+		if (crcReady == false) {
+			crcTables();
+		}
+		crcUpdate = crcUpdateTable;
+		break;
+#ifdef FS3_CRC_X86
+	case FS3_CRC_SSE42:
+		if (!__builtin_cpu_supports("sse4.2")) {
+			return (-1);
+		}
+		crcUpdate = crcUpdateSse42;
+		break;
+#endif
+	default:
+		return (-1);
+	}
+	crcKernel = kernel;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_crc_best_kernel
+// Description  : Gets the fastest kernel the CPU supports
+//
+// Inputs       : none
+// Outputs      : the kernel
+
+FS3CrcKernel fs3_crc_best_kernel(void) {
+#ifdef FS3_CRC_X86
+	if (__builtin_cpu_supports("sse4.2")) {
+		return (FS3_CRC_SSE42);
+	}
+#endif
+	return (FS3_CRC_TABLE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_crc_kernel_name
+// Description  : Gets the name of a kernel
+//
+// Inputs       : kernel - the kernel
+// Outputs      : the name
+
+const char *fs3_crc_kernel_name(FS3CrcKernel kernel) {
+	switch (kernel) {
+	case FS3_CRC_SSE42:
+		return ("sse4.2");
+	default:
+		return ("table");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_crc32c
+// Description  : Adds bytes to a CRC32C checksum, choosing the fastest kernel
+//                the first time it is called
+//
+// Inputs       : crc - the checksum so far, 0 to start one
+//                buf - the bytes
+//                len - number of bytes
+// Outputs      : the new checksum
+
+uint32_t fs3_crc32c(uint32_t crc, const void *buf, size_t len) {
+	if (crcUpdate == NULL) {
+		fs3_crc_kernel(fs3_crc_best_kernel());
+	}
+	return (~crcUpdate(~crc, buf, len));
+}
@@ -0,0 +1,39 @@
+#ifndef FS3_CRC_INCLUDED
+#define FS3_CRC_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_crc.h
+//  Description    : This is the interface for the CRC32C (Castagnoli)
+//                   checksums the FS3 filesystem keeps of its sectors.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <stddef.h>
+
+// Type definitions
+typedef enum {
+	FS3_CRC_TABLE = 0, // Eight bytes at a time through eight 256 entry tables (slicing-by-8)
+	FS3_CRC_SSE42 = 1, // Eight bytes at a time with the SSE4.2 CRC32 instruction
+} FS3CrcKernel;
+
+//
+// Checksum Functions
+
+int fs3_crc_kernel(FS3CrcKernel kernel);
+	// Choose the kernel checksums are computed with, -1 if the CPU does not support it
+
+FS3CrcKernel fs3_crc_best_kernel(void);
+	// The fastest kernel the CPU supports
+
+const char *fs3_crc_kernel_name(FS3CrcKernel kernel);
+	// Name of a kernel, for logging
+
+uint32_t fs3_crc32c(uint32_t crc, const void *buf, size_t len);
+	// Add len bytes to a checksum, start with 0 (the CRC32C of nothing)
+
+#endif
@@ -0,0 +1,134 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_crc_bench.c
+//  Description    : This is the benchmark of the FS3 sector checksums, the
+//                   speed of the CRC32C kernels and what checking costs reads.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_crc.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_SUMS_SECTORS 1024 // Sectors the checksum benchmark sums at a time
+#define FS3_SUMS_ITERATIONS 64 // Times the checksum benchmark sums them with each kernel
+#define FS3_SUMS_PASSES 4 // Times the checksum benchmark reads its files back, with and without checking them
+#define FS3_SUMS_CHUNKS 4 // Most chunks in each file of the checksum benchmark
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_sums
+// Description  : Measure the sector checksums, first the throughput of every
+//                CRC32C kernel the CPU has, then the read throughput of
+//                nfiles files with the checksums checked and not, passes of
+//                each taking turns, and last make sure a sector changed
+//                without the driver knowing fails its read
+//
+// Inputs       : nfiles - number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_sums(int nfiles) {
+
+	// Local variables
+	char *buf, good[FS3_SECTOR_SIZE], bad[FS3_SECTOR_SIZE];
+	uint64_t checks, failures;
+	uint32_t j, sum, first = 0;
+	double start, elapsed, gb, mb, perSector = 0, readTime[2] = { 0, 0 };
+	int kernel, iter, pass, on, ok;
+	BenchFiles files;
+	BenchSpan span;
+
+	// The kernels, over a buffer of sectors
+	buf = malloc((size_t)FS3_SUMS_SECTORS * FS3_SECTOR_SIZE);
+	for (j=0; j<(uint32_t)FS3_SUMS_SECTORS * FS3_SECTOR_SIZE; j++) {
+		buf[j] = rand();
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 checksum benchmark, CRC32C of %d byte sectors", FS3_SECTOR_SIZE );
+	gb = ((double)FS3_SUMS_SECTORS * FS3_SUMS_ITERATIONS * FS3_SECTOR_SIZE) / 1e9;
+	for (kernel=FS3_CRC_TABLE; kernel<=FS3_CRC_SSE42; kernel++) {
+		if ( fs3_crc_kernel(kernel) != 0 ) {
+			continue;
+		}
+		sum = 0;
+		start = bench_now();
+		for (iter=0; iter<FS3_SUMS_ITERATIONS; iter++) {
+			for (j=0; j<FS3_SUMS_SECTORS; j++) {
+				sum ^= fs3_crc32c(0, buf + ((size_t)j * FS3_SECTOR_SIZE), FS3_SECTOR_SIZE);
+			}
+		}
+		elapsed = bench_now() - start;
+		if ( (kernel != FS3_CRC_TABLE) && (sum != first) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark %s checksums are wrong.", fs3_crc_kernel_name(kernel) );
+			return( -1 );
+		}
+		first = (kernel == FS3_CRC_TABLE) ? sum : first;
+		perSector = elapsed / ((double)FS3_SUMS_SECTORS * FS3_SUMS_ITERATIONS);
+		logMessage( LOG_OUTPUT_LEVEL, " %-11s = [ %6.2f GB/s, %6.1f ns per sector ]", fs3_crc_kernel_name(kernel),
+			gb / elapsed, perSector * 1e9 );
+	}
+	fs3_crc_kernel(fs3_crc_best_kernel());
+	free(buf);
+
+	// Then the disk, the files are written with the checksums on so they all have one
+	fs3_sector_sums = true;
+	if ( bench_setup(&files, "sums", nfiles, FS3_SUMS_CHUNKS) != 0 ) {
+		return( -1 );
+	}
+
+	// Passes with the checksums checked and not take turns, so both see the same conditions. The round trips
+	//  vary more from pass to pass than the checksums cost, so the time the best kernel takes over the sectors
+	//  checked is reported as a share of the reads too
+	checks = sectorSumChecks();
+	for (pass=0; pass<2*FS3_SUMS_PASSES; pass++) {
+		on = (pass % 2 == 0);
+		fs3_sector_sums = on;
+		bench_start(&span);
+		if ( bench_read_files(&files) != 0 ) {
+			return( -1 );
+		}
+		bench_stop(&span);
+		readTime[on] += span.elapsed;
+	}
+	fs3_sector_sums = true;
+	checks = sectorSumChecks() - checks;
+	mb = files.mb * FS3_SUMS_PASSES;
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 checksum benchmark, %d files of %u KB read %d times each way", nfiles,
+		files.chunks * (FS3_BENCH_CHUNK / 1024), FS3_SUMS_PASSES );
+	logMessage( LOG_OUTPUT_LEVEL, " unchecked  = [ %10.2f MB/s ]", mb / readTime[0] );
+	logMessage( LOG_OUTPUT_LEVEL, " checked    = [ %10.2f MB/s, %lu sectors checked ]", mb / readTime[1], (unsigned long)checks );
+	logMessage( LOG_OUTPUT_LEVEL, " overhead   = [ %10.2f %% measured, %.2f %% summing ]", ((readTime[1] / readTime[0]) - 1.0) * 100.0,
+		(checks * perSector * 100.0) / readTime[1] );
+
+	// Last the superblock is changed behind the driver's back (the write keeps the old checksum with the
+	//  checksums off), the read of it has to fail and then it is put back
+	ok = (checkpoint(false) == 0) && (readSectorFromDisk(0, 0, good) == 0);
+	memcpy(bad, good, FS3_SECTOR_SIZE);
+	bad[FS3_SECTOR_SIZE / 2] ^= 0x01;
+	fs3_sector_sums = false;
+	ok = ok && (writeSector(0, 0, bad) == 0);
+	fs3_sector_sums = true;
+	failures = sectorSumFailures();
+	ok = ok && (readSectorFromDisk(0, 0, files.buf) == -1) && (sectorSumFailures() == failures + 1);
+	ok = ok && (writeSector(0, 0, good) == 0) && (readSectorFromDisk(0, 0, files.buf) == 0);
+	logMessage( LOG_OUTPUT_LEVEL, " corruption = [ %s ]", ok ? "caught" : "MISSED" );
+	if ( !ok ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark changed sector was not caught." );
+		return( -1 );
+	}
+	return( bench_teardown(&files) );
+}
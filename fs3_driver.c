@@ -13,199 +13,3284 @@
 
 // Includes
 #include <string.h>
+#include <stdlib.h>
 #include <cmpsc311_log.h>
 #include <stdbool.h>
-#include <math.h>
 
 // Project Includes
 #include <fs3_driver.h>
 #include <fs3_controller.h>
 #include <fs3_cache.h>
 #include <fs3_network.h>
+#include <fs3_common.h>
+#include <fs3_log.h>
+#include <fs3_cmdblock.h>
+#include <fs3_span.h>
+#include <fs3_journal.h>
+#include <fs3_sched.h>
+#include <fs3_erasure.h>
+#include <fs3_ring.h>
+#include <fs3_lease.h>
+#include <fs3_trace.h>
+#include <fs3_crc.h>
 
 // Defines
-#define SECTOR_INDEX_NUMBER(x) ((int)(x/FS3_SECTOR_SIZE))
+#define SECTOR_INDEX_NUMBER(x) ((int)((x)/FS3_SECTOR_SIZE))
+#define BITMAP_WORDS(x) (((x) + 63) / 64)
+#define FS3_NO_TRACK_SELECTED UINT32_MAX // Head is not resting on any track
+#define FS3_MAX_SECTORS_PER_TRACK 65536 // Sector field in the command block is 16 bits
+#define FS3_MAX_TRACK_COUNT 65536 // Tracks are kept in an FS3TrackIndex (16 bits) by the cache
+#define FS3_MAX_HANDLE INT16_MAX // Largest file handle fs3_open can return
+#define FS3_PREALLOC_SECTORS 32 // Sectors reserved for a file at a time while it is being written
+#define FS3_JOURNAL_GROUP 64 // Metadata changes gathered before they are committed as one record
+#define EC_SHARD_CONTROLLER(stripe, shard) (((shard) + (stripe)) % (fs3_erasure_data + fs3_erasure_parity))
+#define FS3_REBALANCE_BUDGET 256 // Sectors the rebalancer moves (finishing the file it is on) each time a file is closed
+#define FS3_REBALANCE_CHUNK 64 // Sectors copied at a time while a file is moved to another column
 
 //
 // Static Global Variables
 
-//Variables for a singular file, will be the basis for the structure that will handle multiple files
 int mounted = 0;
-int unusedBits = 0;
-int nextHandle = 10;
-int nextSecAvailable = 0;
-int nextTrkAvailable = 0;
-uint16_t sec;
-uint_fast32_t trk;
-int recursion = 0;
-int tempPos;
-int tempLen;
-int totalBytes;
+
+//Disk geometry, negotiated with the controller the first time the disk is mounted. When the volume is striped
+//  over several controllers each track is made of the same track on all of them, sector s of a track being
+//  sector s / fs3Controllers on controller s % fs3Controllers, so a file's run of sectors is spread round-robin
+uint32_t fs3Tracks = 0;
+uint32_t fs3TrackSize = 0;
+int fs3Controllers = 1;
+
+//When files are placed by consistent hashing (fs3_ring_vnodes > 0) the columns are not striped. Each one has
+//  fs3ColumnTracks tracks of its own, track t of the disk being track t % fs3ColumnTracks of column
+//  t / fs3ColumnTracks, and a file's sectors are kept on the column the ring gives its name. Columns set in
+//  placeRetired are off the ring. After the ring changes the rebalancer works through the file table from
+//  rebalanceCursor moving files that are on the wrong column, a few each time a file is closed
+uint32_t fs3ColumnTracks = 0;
+uint32_t placeRetired = 0;
+int rebalanceCursor = 0;
+bool rebalancePending = false; // Files may be on the wrong column
+bool rebalanceFound = false;   // The current pass over the file table has moved a file
+uint64_t rebalanceSectors = 0;
+uint64_t rebalanceFiles = 0;
+
+//An erasure coded disk is striped over fs3Controllers = fs3_erasure_data columns the same way, but sector s of a
+//  track belongs to stripe s / fs3Controllers, which is sector s / fs3Controllers on every controller. Shard i of
+//  the stripe (data shards first, then parity) is on controller (i + stripe) % (data + parity), so the parity
+//  moves around the controllers from one stripe to the next
+typedef struct {
+	uint32_t trk;
+	uint16_t stripe;
+	char *data[FS3_EC_MAX_DATA];  // Contents of each data shard while the stripe is written
+	bool write[FS3_EC_MAX_DATA];  // Data shards in the batch being written
+	int present[FS3_EC_MAX_DATA]; // Shards read to rebuild a sector on a failed controller
+	char *scratch;                // Room for every shard of the stripe
+} FS3Stripe;
 
 struct fileData{
-	int fileHandle;
+	int16_t fileHandle; //0 when the file is not open
 	char *fileName;
-	bool fileOpen;
 	int fileLen;
 	int filePos;
-	int fileStorage[FS3_MAX_TRACKS][FS3_TRACK_SIZE];
+	FS3SectorAddress *fileSectors; //Where each of the file's sectors is on the disk, in file order
 	int secNums;
+	int secCap;
+	int nextInBucket;
+	uint32_t resvTrk; //Sectors resvNext up to resvEnd on resvTrk are reserved for the file's next writes
+	uint32_t resvNext;
+	uint32_t resvEnd;
+	int jSecs; //Sectors and length the journal (or the last checkpoint) already has for the file
+	int jLen;
+	bool jDirty; //On dirtyFiles, the file has changed since the journal last saw it
+	char *inlineData; //Bytes past the file's last sector, kept with its metadata while there are at most
+	int inlineLen;    //  FS3_INLINE_MAX of them and every sector before them is full
+	bool inlineDirty; //The inline bytes have changed since the journal last saw them
+	char *wcBuf;  //Write-combining buffer, while wcDirty it holds sector wcSec of the file with writes
+	int wcSec;    //  that have not been sent to the disk yet
+	bool wcDirty;
 };
 
-struct fileData files[1000];
-int filesLen = 1000;
+//File table, grows as files are created, the index into it never changes while a file exists. Slots of
+//  deleted files have a NULL fileName and are kept on freeFileSlots so new files can reuse them
+struct fileData *files = NULL;
+int filesLen = 0;
+int filesCap = 0;
+int *freeFileSlots = NULL;
+int freeFileSlotsLen = 0;
+
+//Open file handles, handleTable[fd] is the index of the file in the file table (-1 when free), closed
+//  handles are kept on freeHandles so they can be reused
+int *handleTable = NULL;
+int handleTableLen = 0;
+int16_t nextHandle = 1;
+int16_t *freeHandles = NULL;
+int freeHandlesLen = 0;
+
+//Filename hash table, each bucket holds the index of the first file in its chain (-1 when empty) and the
+//  rest of the chain is linked through nextInBucket
+int *fileBuckets = NULL;
+int fileBucketsLen = 0;
+
+//Tracks which sectors have actually been written to the controller, allocated sectors that were never
+//  written hold nothing but zeros so they can be served locally without a round trip. Each track gets its
+//  bitmap the first time one of its sectors is written
+uint64_t **writtenMap = NULL;
+uint_fast32_t controllerTrk[FS3_MAX_CONTROLLERS]; // Track each controller's head is on
+uint32_t schedHead = FS3_SCHED_NO_HEAD; // Virtual track of the last sector sought, where the scheduler's sweep starts
+uint64_t seekCount = 0;
+uint64_t readCount = 0;
+uint64_t writeCount = 0;
+
+//CRC32C of what was last written to each sector, checked against every sector read back from the controller so
+//  a sector that comes back corrupted, or is really some other sector, fails the read instead of reaching the
+//  caller or the cache. A track gets its sums the first time one of its sectors is written and sumKnown has a
+//  bit set for each sector whose sum is kept, sectors written before the mount only have them when the last
+//  unmount saved them
+bool fs3_sector_sums = true;
+uint32_t **sumMap = NULL;
+uint64_t **sumKnown = NULL;
+uint64_t sumChecks = 0;
+uint64_t sumFailures = 0;
+
+//Free space bitmap, one bit per sector that is set while the sector belongs to a file. Each track gets its
+//  words the first time one of its sectors is allocated and trackUsed counts the allocated sectors on each
+//  track so full tracks are skipped without looking at their words. Files are given runs of sectors on
+//  the track they are already on, and new files are spread over the tracks starting at allocTrk
+uint64_t **allocMap = NULL;
+uint32_t *trackUsed = NULL;
+uint32_t allocTrk = 0;
+
+//Where the metadata stream the superblock points at is on the disk, its runs followed by the sectors of the
+//  extent list chained from the superblock. Those sectors stay allocated until the next checkpoint has
+//  written a new stream and pointed the superblock at it
+FS3MetaExtent *metaExtents = NULL;
+uint32_t metaExtentsLen = 0;
+
+//Files whose changes have not been added to the journal yet, and how many changes have been made since the
+//  last commit. Changes are committed as a group once there are FS3_JOURNAL_GROUP of them or a file is closed
+int *dirtyFiles = NULL;
+int dirtyFilesLen = 0;
+int dirtyFilesCap = 0;
+int metaChanges = 0;
+
+//Set when a checkpoint has failed, the next commit tries it again before anything else
+bool checkpointDue = false;
+
+//Crash injection, once it counts down to zero the driver acts as if the client had died and nothing more
+//  reaches the disk (-1 when off)
+int64_t crashCountdown = -1;
 
 //
 // Implementation
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : findFile
-// Description  : Finds the file that have been created based on fileName
+// Function     : findFile
+// Description  : Finds the file that have been created based on fileName
+//
+// Inputs       : fileName - fileName of file to look for
+//
+// Outputs      : index of the file in the file table if found, -1 if not found
+
+int findFile(char *fileName){
+	if (fileBucketsLen == 0){
+		return (-1);
+	}
+	int i = fileBuckets[hashFileName(fileName) & (fileBucketsLen - 1)];
+	while (i != -1){
+		if (strcmp(files[i].fileName, fileName) == 0){
+			return (i);
+		}
+		i = files[i].nextInBucket;
+	}
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hashFileName
+// Description  : Hashes a fileName for the filename table (32 bit FNV-1a)
+//
+// Inputs       : fileName - fileName to hash
+//
+// Outputs      : the hash of the fileName
+
+uint32_t hashFileName(const char *fileName){
+	uint32_t hash = 2166136261u;
+	while (*fileName != '\0'){
+		hash ^= (unsigned char)*fileName;
+		hash *= 16777619u;
+		fileName++;
+	}
+	return hash;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insertFile
+// Description  : Adds a file to the filename hash table so findFile can find it,
+//                the table is doubled whenever it holds more files than buckets
+//
+// Inputs       : idx - index of the file in the file table, its fileName must
+//                      already be set
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int insertFile(int idx){
+	if ((idx < 0) || (idx >= filesLen) || (files[idx].fileName == NULL)){
+		return (-1);
+	}
+	//Grow the buckets and rechain every file that is already in the table
+	if (filesLen > fileBucketsLen){
+		int newLen = (fileBucketsLen == 0) ? 1024 : fileBucketsLen * 2;
+		int *newBuckets = malloc(sizeof(int) * newLen);
+		if (newBuckets == NULL){
+			return (-1);
+		}
+		memset(newBuckets, 0xff, sizeof(int) * newLen);
+		free(fileBuckets);
+		fileBuckets = newBuckets;
+		fileBucketsLen = newLen;
+		for (int i=0; i<filesLen; i++){
+			if ((i != idx) && (files[i].fileName != NULL)){
+				int bucket = hashFileName(files[i].fileName) & (fileBucketsLen - 1);
+				files[i].nextInBucket = fileBuckets[bucket];
+				fileBuckets[bucket] = i;
+			}
+		}
+	}
+	int bucket = hashFileName(files[idx].fileName) & (fileBucketsLen - 1);
+	files[idx].nextInBucket = fileBuckets[bucket];
+	fileBuckets[bucket] = idx;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : removeFile
+// Description  : Takes a file out of the filename hash table
+//
+// Inputs       : idx - index of the file in the file table
+//
+// Outputs      : 0 if successful, -1 if the file was not in the table
+
+int removeFile(int idx){
+	int *link = &fileBuckets[hashFileName(files[idx].fileName) & (fileBucketsLen - 1)];
+	while (*link != -1){
+		if (*link == idx){
+			*link = files[idx].nextInBucket;
+			return (0);
+		}
+		link = &files[*link].nextInBucket;
+	}
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : createFile
+// Description  : Adds a new, empty file to the file table, reusing the slot of
+//                a deleted file if there is one and growing the table if not
+//
+// Inputs       : fileName - name of the new file, it is copied into the table
+//
+// Outputs      : index of the new file if successful, -1 if failure
+
+int createFile(char *fileName){
+	//Reuse the slot of a deleted file
+	if (freeFileSlotsLen > 0){
+		int idx = freeFileSlots[freeFileSlotsLen - 1];
+		files[idx].fileName = strdup(fileName);
+		if (files[idx].fileName == NULL){
+			return (-1);
+		}
+		freeFileSlotsLen--;
+		insertFile(idx);
+		return (idx);
+	}
+	if (filesLen == filesCap){
+		int newCap = (filesCap == 0) ? 64 : filesCap * 2;
+		struct fileData *newFiles = realloc(files, sizeof(struct fileData) * newCap);
+		if (newFiles == NULL){
+			return (-1);
+		}
+		files = newFiles;
+		int *newSlots = realloc(freeFileSlots, sizeof(int) * newCap);
+		if (newSlots == NULL){
+			return (-1);
+		}
+		freeFileSlots = newSlots;
+		filesCap = newCap;
+	}
+	int idx = filesLen;
+	memset(&files[idx], 0, sizeof(struct fileData));
+	//The name is copied so the table does not depend on the caller's buffer staying around
+	files[idx].fileName = strdup(fileName);
+	if (files[idx].fileName == NULL){
+		return (-1);
+	}
+	filesLen++;
+	if (insertFile(idx) != 0){
+		filesLen--;
+		free(files[idx].fileName);
+		return (-1);
+	}
+	return (idx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : allocateHandle
+// Description  : Gives an open file a file handle, reusing closed handles first
+//
+// Inputs       : idx - index of the file in the file table
+//
+// Outputs      : the file handle if successful, -1 if failure
+
+int allocateHandle(int idx){
+	int16_t fd;
+	if (freeHandlesLen > 0){
+		freeHandlesLen--;
+		fd = freeHandles[freeHandlesLen];
+	}
+	else{
+		if (nextHandle == FS3_MAX_HANDLE){
+			return (-1);
+		}
+		//Handle table is full so it needs to be doubled, along with the stack of closed handles
+		if (nextHandle >= handleTableLen){
+			int newLen = (handleTableLen == 0) ? 64 : handleTableLen * 2;
+			int *newTable = realloc(handleTable, sizeof(int) * newLen);
+			if (newTable == NULL){
+				return (-1);
+			}
+			handleTable = newTable;
+			int16_t *newFree = realloc(freeHandles, sizeof(int16_t) * newLen);
+			if (newFree == NULL){
+				return (-1);
+			}
+			freeHandles = newFree;
+			handleTableLen = newLen;
+		}
+		fd = nextHandle;
+		nextHandle++;
+	}
+	handleTable[fd] = idx;
+	files[idx].fileHandle = fd;
+	return (fd);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fileIndex
+// Description  : Validates a file handle and finds the file it refers to
+//
+// Inputs       : fd - file handle to look up
+//
+// Outputs      : index of the file in the file table, -1 if the handle is bad
+//                or the file is not open
+
+int fileIndex(int16_t fd){
+	if ((fd <= 0) || (fd >= nextHandle)){
+		return (-1);
+	}
+	int idx = handleTable[fd];
+	if ((idx == -1) || (files[idx].fileHandle != fd)){
+		return (-1);
+	}
+	return (idx);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findFreeRun
+// Description  : Looks for a run of free sectors on a track, starting the search
+//                at a given sector. The bitmap is searched a word at a time, the
+//                start of a run is the lowest clear bit and its end the lowest
+//                set bit after it
+//
+// Inputs       : localTrk - track to search
+//                from - first sector to look at
+//                want - the run stops growing once it is this long
+//                need - shortest run that will be accepted
+//                start - filled in with the first sector of the run
+//
+// Outputs      : length of the run found, 0 if there is none
+
+uint32_t findFreeRun(uint32_t localTrk, uint32_t from, uint32_t want, uint32_t need, uint32_t *start){
+	uint64_t *map = allocMap[localTrk];
+	uint32_t localSec = from;
+	while ((localSec < fs3TrackSize) && (want > 0)){
+		//Start of the next run, the first free sector at or after localSec
+		if (map != NULL){
+			uint64_t freeBits = ~map[localSec / 64] & (UINT64_MAX << (localSec % 64));
+			if (freeBits == 0){
+				localSec = ((localSec / 64) + 1) * 64;
+				continue;
+			}
+			localSec = ((localSec / 64) * 64) + __builtin_ctzll(freeBits);
+			if (localSec >= fs3TrackSize){
+				break;
+			}
+		}
+
+		//End of the run, the first taken sector after its start, or want sectors on
+		uint32_t runStart = localSec;
+		uint32_t limit = (want < (fs3TrackSize - runStart)) ? (runStart + want) : fs3TrackSize;
+		while (localSec < limit){
+			uint64_t takenBits = (map == NULL) ? 0 : (map[localSec / 64] >> (localSec % 64));
+			if (takenBits != 0){
+				localSec += __builtin_ctzll(takenBits);
+				break;
+			}
+			localSec = ((localSec / 64) + 1) * 64;
+		}
+		if (localSec > limit){
+			localSec = limit;
+		}
+		if ((localSec - runStart) >= need){
+			*start = runStart;
+			return (localSec - runStart);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fileHome
+// Description  : Finds the column a file belongs on, the one the ring gives
+//                the hash of its name
+//
+// Inputs       : idx - index of the file in the file table
+//
+// Outputs      : the column, -1 if files are striped rather than placed
+
+int fileHome(int idx){
+	if (fs3ColumnTracks == 0){
+		return (-1);
+	}
+	return (fs3_ring_lookup(hashFileName(files[idx].fileName)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trackOnRing
+// Description  : Checks whether new sectors can be given out on a track, which
+//                they cannot on the tracks of a column taken off the ring
+//
+// Inputs       : localTrk - the track
+//
+// Outputs      : true if they can, false if not
+
+bool trackOnRing(uint32_t localTrk){
+	return ((fs3ColumnTracks == 0) || (fs3_ring_member(localTrk / fs3ColumnTracks) == true));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : reserveWindow
+// Description  : Reserves the next run of sectors for a file that is being
+//                written. The run is taken right after the file's last sector
+//                if possible, otherwise somewhere else on the same track, so a
+//                file only moves to another track when its track is full. New
+//                files, and files whose track is full, go to the next track
+//                from allocTrk that has a whole window free, or any free sector
+//                at all once the disk is nearly full. A placed file only looks
+//                beyond the tracks of its home column once they are full
+//
+// Inputs       : idx - index of the file in the file table
+//
+// Outputs      : 0 if successful, -1 if failure (the disk is full)
+
+int reserveWindow(int idx){
+	uint32_t localTrk = 0, start = 0, len = 0;
+	int home = fileHome(idx);
+	if (files[idx].secNums > 0){
+		FS3SectorAddress *last = &files[idx].fileSectors[files[idx].secNums - 1];
+		localTrk = last->trk;
+		if ((trackUsed[localTrk] < fs3TrackSize) && ((home == -1) || ((localTrk / fs3ColumnTracks) == (uint32_t)home))){
+			len = findFreeRun(localTrk, last->sec + 1, FS3_PREALLOC_SECTORS, 1, &start);
+			if (len == 0){
+				len = findFreeRun(localTrk, 0, FS3_PREALLOC_SECTORS, 1, &start);
+			}
+		}
+	}
+	for (int pass=(home == -1) ? 1 : 0; (len == 0) && (pass<2); pass++){
+		uint32_t first = (pass == 0) ? home * fs3ColumnTracks : 0;
+		uint32_t span = (pass == 0) ? fs3ColumnTracks : fs3Tracks;
+		for (uint32_t need = FS3_PREALLOC_SECTORS; (len == 0) && (need > 0); need = (need == 1) ? 0 : 1){
+			for (uint32_t i=0; (len == 0) && (i<span); i++){
+				localTrk = first + ((allocTrk + i) % span);
+				if (((fs3TrackSize - trackUsed[localTrk]) >= need) && (trackOnRing(localTrk) == true)){
+					len = findFreeRun(localTrk, 0, FS3_PREALLOC_SECTORS, need, &start);
+				}
+			}
+			if (len != 0){
+				allocTrk = (localTrk + 1) % fs3Tracks;
+			}
+		}
+	}
+	if (len == 0){
+		return (-1);
+	}
+
+	//The run belongs to the file from now on even before it is written
+	if (markRunAllocated(localTrk, start, len) != 0){
+		return (-1);
+	}
+	files[idx].resvTrk = localTrk;
+	files[idx].resvNext = start;
+	files[idx].resvEnd = start + len;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : markRunAllocated
+// Description  : Marks a run of free sectors on a track as allocated
+//
+// Inputs       : localTrk - track the run is on
+//                start - first sector of the run
+//                len - number of sectors in the run
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int markRunAllocated(uint32_t localTrk, uint32_t start, uint32_t len){
+	if (allocMap[localTrk] == NULL){
+		allocMap[localTrk] = calloc(BITMAP_WORDS(fs3TrackSize), sizeof(uint64_t));
+		if (allocMap[localTrk] == NULL){
+			return (-1);
+		}
+	}
+	for (uint32_t localSec=start; localSec<start + len; localSec++){
+		allocMap[localTrk][localSec / 64] |= ((uint64_t)1 << (localSec % 64));
+	}
+	trackUsed[localTrk] += len;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseWindow
+// Description  : Gives the part of a file's reserved run that was never used
+//                back to the disk
+//
+// Inputs       : idx - index of the file in the file table
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int releaseWindow(int idx){
+	FS3SectorAddress addr;
+	addr.trk = files[idx].resvTrk;
+	while (files[idx].resvNext < files[idx].resvEnd){
+		addr.sec = files[idx].resvNext;
+		files[idx].resvNext++;
+		if (freeSector(&addr) != 0){
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeSector
+// Description  : Gives a sector back to the free space bitmap. It is also
+//                marked unwritten so if it is handed out again it reads as zeros
+//                rather than whatever the last file left in it
+//
+// Inputs       : addr - location of the sector to free
+//
+// Outputs      : 0 if successful, -1 if the sector was not allocated
+
+int freeSector(FS3SectorAddress *addr){
+	uint64_t bit = ((uint64_t)1 << (addr->sec % 64));
+	if ((allocMap[addr->trk] == NULL) || ((allocMap[addr->trk][addr->sec / 64] & bit) == 0)){
+		return (-1);
+	}
+	allocMap[addr->trk][addr->sec / 64] &= ~bit;
+	trackUsed[addr->trk]--;
+	if (writtenMap[addr->trk] != NULL){
+		writtenMap[addr->trk][addr->sec / 64] &= ~bit;
+	}
+	fs3_invalidate_cache(addr->trk, addr->sec);
+	return (fs3_sched_cancel(addr->trk, addr->sec));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : diskSpace
+// Description  : Counts the sectors on the disk and how many of them are free
+//
+// Inputs       : totalSectors - filled in with the number of sectors on the disk
+//                freeSectors - filled in with the number of free sectors
+//
+// Outputs      : 0 if successful, -1 if the disk has not been mounted
+
+int diskSpace(uint64_t *totalSectors, uint64_t *freeSectors){
+	if (allocMap == NULL){
+		return (-1);
+	}
+	uint64_t used = 0;
+	for (uint32_t i=0; i<fs3Tracks; i++){
+		if (allocMap[i] != NULL){
+			for (int w=0; w<BITMAP_WORDS(fs3TrackSize); w++){
+				used += __builtin_popcountll(allocMap[i][w]);
+			}
+		}
+	}
+	*totalSectors = (uint64_t)fs3Tracks * fs3TrackSize;
+	*freeSectors = *totalSectors - used;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addFileSector
+// Description  : Gives a file the next sector of its reserved run, appending
+//                it to the end of the file's sector list
+//
+// Inputs       : idx - index of the file in the file table
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int addFileSector(int idx){
+	if (files[idx].secNums == files[idx].secCap){
+		int newCap = (files[idx].secCap == 0) ? 4 : files[idx].secCap * 2;
+		FS3SectorAddress *newSectors = realloc(files[idx].fileSectors, sizeof(FS3SectorAddress) * newCap);
+		if (newSectors == NULL){
+			return (-1);
+		}
+		files[idx].fileSectors = newSectors;
+		files[idx].secCap = newCap;
+	}
+	if ((files[idx].resvNext == files[idx].resvEnd) && (reserveWindow(idx) != 0)){
+		return (-1);
+	}
+	files[idx].fileSectors[files[idx].secNums].trk = files[idx].resvTrk;
+	files[idx].fileSectors[files[idx].secNums].sec = files[idx].resvNext;
+	files[idx].resvNext++;
+	files[idx].secNums++;
+	metaChanges++;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseFileSectors
+// Description  : Gives the sectors at the end of a file back to the disk until
+//                the file only holds the number of sectors asked for
+//
+// Inputs       : idx - index of the file in the file table
+//                keep - number of sectors the file keeps
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int releaseFileSectors(int idx, int keep){
+	while (files[idx].secNums > keep){
+		files[idx].secNums--;
+		if (freeSector(&files[idx].fileSectors[files[idx].secNums]) != 0){
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushWriteBuffer
+// Description  : Writes the sector collected in a file's write-combining
+//                buffer out to the disk
+//
+// Inputs       : idx - index of the file in the file table
+// Outputs      : 0 if successful, -1 if failure
+
+int flushWriteBuffer(int idx){
+	if (files[idx].wcDirty == false){
+		return (0);
+	}
+	FS3SectorAddress *addr = &files[idx].fileSectors[files[idx].wcSec];
+	if (queueSector(addr->trk, addr->sec, files[idx].wcBuf) != 0){
+		return (-1);
+	}
+	files[idx].wcDirty = false;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushWriteBuffers
+// Description  : Writes out the write-combining buffer of every open file and
+//                dispatches the scheduler's queue, so the data is on the disk
+//                before metadata that refers to it is committed
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int flushWriteBuffers(void){
+	for (int16_t fd=1; fd<nextHandle; fd++){
+		int idx = fileIndex(fd);
+		if ((idx != -1) && (flushWriteBuffer(idx) != 0)){
+			return (-1);
+		}
+	}
+	return (fs3_sched_dispatch(schedHead));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setInline
+// Description  : Replaces the bytes a file keeps inline, past its last sector
+//
+// Inputs       : idx - index of the file in the file table
+//                data - the new inline bytes
+//                len - number of bytes, at most FS3_INLINE_MAX
+// Outputs      : 0 if successful, -1 if failure
+
+int setInline(int idx, const char *data, uint16_t len){
+	if (len > FS3_INLINE_MAX){
+		return (-1);
+	}
+	if (files[idx].inlineData == NULL){
+		files[idx].inlineData = malloc(FS3_INLINE_MAX);
+		if (files[idx].inlineData == NULL){
+			return (-1);
+		}
+	}
+	memcpy(files[idx].inlineData, data, len);
+	files[idx].inlineLen = len;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sectorIsWritten
+// Description  : Checks whether a sector has ever been written to the disk
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector to check
+//
+// Outputs      : true if the sector has been written, false if not
+
+bool sectorIsWritten(uint_fast32_t localTrk, uint16_t localSec){
+	//Another client sharing the controller may have written it
+	if (fs3_lease_enabled == true){
+		return (true);
+	}
+	if (writtenMap[localTrk] == NULL){
+		return false;
+	}
+	return ((writtenMap[localTrk][localSec / 64] >> (localSec % 64)) & 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : markSectorWritten
+// Description  : Records that a sector has been written to the disk
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector that was written
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int markSectorWritten(uint_fast32_t localTrk, uint16_t localSec){
+	if (writtenMap[localTrk] == NULL){
+		writtenMap[localTrk] = calloc(BITMAP_WORDS(fs3TrackSize), sizeof(uint64_t));
+		if (writtenMap[localTrk] == NULL){
+			return (-1);
+		}
+	}
+	writtenMap[localTrk][localSec / 64] |= ((uint64_t)1 << (localSec % 64));
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : recordSectorSum
+// Description  : Keeps the checksum of what was just written to a sector
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector that was written
+//				  sectorBuf - the FS3_SECTOR_SIZE bytes written
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int recordSectorSum(uint_fast32_t localTrk, uint16_t localSec, const char *sectorBuf){
+	if (fs3_sector_sums == false){
+		return (0);
+	}
+	if (sumMap[localTrk] == NULL){
+		sumMap[localTrk] = malloc(sizeof(uint32_t) * fs3TrackSize);
+		sumKnown[localTrk] = calloc(BITMAP_WORDS(fs3TrackSize), sizeof(uint64_t));
+		if ((sumMap[localTrk] == NULL) || (sumKnown[localTrk] == NULL)){
+			free(sumMap[localTrk]);
+			free(sumKnown[localTrk]);
+			sumMap[localTrk] = NULL;
+			sumKnown[localTrk] = NULL;
+			return (-1);
+		}
+	}
+	sumMap[localTrk][localSec] = fs3_crc32c(0, sectorBuf, FS3_SECTOR_SIZE);
+	sumKnown[localTrk][localSec / 64] |= ((uint64_t)1 << (localSec % 64));
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropSectorSum
+// Description  : Forgets the checksum of a sector, used when a write of it
+//                failed and what the disk holds is no longer known
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - the sector
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int dropSectorSum(uint_fast32_t localTrk, uint16_t localSec){
+	if ((sumKnown != NULL) && (localTrk < fs3Tracks) && (sumKnown[localTrk] != NULL)){
+		sumKnown[localTrk][localSec / 64] &= ~((uint64_t)1 << (localSec % 64));
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : forgetTrackSums
+// Description  : Forgets the checksums of a whole track, used when a lease on
+//                it is given up as another client may write to it next
+//
+// Inputs       : localTrk - the track
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int forgetTrackSums(uint_fast32_t localTrk){
+	if ((sumKnown != NULL) && (localTrk < fs3Tracks)){
+		free(sumMap[localTrk]);
+		free(sumKnown[localTrk]);
+		sumMap[localTrk] = NULL;
+		sumKnown[localTrk] = NULL;
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : forgetSums
+// Description  : Forgets the checksum of every sector
+//
+// Inputs       : none
+//
+// Outputs      : 0 if successful, -1 if failure
+
+int forgetSums(void){
+	for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+		forgetTrackSums(localTrk);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkSectorSum
+// Description  : Checks a sector read from the controller against the
+//                checksum of what was last written to it, sectors without a
+//                checksum are let through
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector that was read
+//				  sectorBuf - the FS3_SECTOR_SIZE bytes read
+//
+// Outputs      : 0 if the sector matches or has no checksum, -1 if it does
+//                not match
+
+int checkSectorSum(uint_fast32_t localTrk, uint16_t localSec, const char *sectorBuf){
+	//The superblock is read, and the geometry probed, before the maps are set up
+	if ((fs3_sector_sums == false) || (sumKnown == NULL) || (localTrk >= fs3Tracks) || (sumKnown[localTrk] == NULL) ||
+			(((sumKnown[localTrk][localSec / 64] >> (localSec % 64)) & 1) == 0)){
+		return (0);
+	}
+	sumChecks++;
+	uint32_t sum = fs3_crc32c(0, sectorBuf, FS3_SECTOR_SIZE);
+	if (sum != sumMap[localTrk][localSec]){
+		sumFailures++;
+		FS3_LOG_ERROR("FS3 driver: sector %u of track %lu failed its checksum (%08x, written as %08x).",
+			localSec, (unsigned long)localTrk, sum, sumMap[localTrk][localSec]);
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resetHeads
+// Description  : Forgets where the controllers' heads are, the next operation
+//                on each controller seeks first
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int resetHeads(void){
+	for (int ctrl=0; ctrl<FS3_MAX_CONTROLLERS; ctrl++){
+		controllerTrk[ctrl] = FS3_NO_TRACK_SELECTED;
+	}
+	schedHead = FS3_SCHED_NO_HEAD;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : seekTrack
+// Description  : Moves a controller's disk head to a track, skipping the
+//                syscall if the head is already resting on that track
+//
+// Inputs       : ctrl - controller to seek on
+//                localTrk - track to seek to
+// Outputs      : 0 if successful, -1 if failure
+
+int seekTrack(int ctrl, uint_fast32_t localTrk){
+	if (controllerTrk[ctrl] == localTrk){
+		return (0);
+	}
+	seekCount++;
+	FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_TSEEK, 0, localTrk, 0);
+	FS3CmdBlk *rtnBlock = &cmdBlock;
+	if ((network_fs3_syscall_on(ctrl, cmdBlock, rtnBlock, NULL) != 0) ||
+			(fs3_cmd_ret(*rtnBlock) != 0)){
+		controllerTrk[ctrl] = FS3_NO_TRACK_SELECTED;
+		return (-1);
+	}
+	controllerTrk[ctrl] = localTrk;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trackSeeks
+// Description  : Gets the number of TSEEK commands that have been sent to the
+//                controller, seeks skipped because the head was already on the
+//                track are not counted
+//
+// Inputs       : none
+// Outputs      : the number of seeks
+
+uint64_t trackSeeks(void){
+	return (seekCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : diskReads
+// Description  : Gets the number of RDSECT commands that have been sent to the
+//                controller, reads served by the cache or zero filled locally
+//                are not counted
+//
+// Inputs       : none
+// Outputs      : the number of sector reads
+
+uint64_t diskReads(void){
+	return (readCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : diskWrites
+// Description  : Gets the number of WRSECT commands that have been sent to the
+//                controller
+//
+// Inputs       : none
+// Outputs      : the number of sector writes
+
+uint64_t diskWrites(void){
+	return (writeCount);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sectorSumChecks
+// Description  : Gets the number of sectors read from the controller that
+//                were checked against a checksum
+//
+// Inputs       : none
+// Outputs      : the number of sectors checked
+
+uint64_t sectorSumChecks(void){
+	return (sumChecks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sectorSumFailures
+// Description  : Gets the number of sectors read from the controller that did
+//                not match their checksum
+//
+// Inputs       : none
+// Outputs      : the number of sectors that failed
+
+uint64_t sectorSumFailures(void){
+	return (sumFailures);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mapSector
+// Description  : Finds where a sector of the disk is on the controllers, a
+//                striped track is spread over every column while a placed
+//                track is all on one
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - the sector
+//				  sectorBuf - buffer of FS3_SECTOR_SIZE bytes to send or receive
+// Outputs      : the controller, track and sector to use
+
+FS3Shard mapSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf){
+	FS3Shard shard;
+	if (fs3ColumnTracks > 0){
+		shard.ctrl = localTrk / fs3ColumnTracks;
+		shard.trk = localTrk % fs3ColumnTracks;
+		shard.sec = localSec;
+	}
+	else{
+		shard.ctrl = localSec % fs3Controllers;
+		shard.trk = localTrk;
+		shard.sec = localSec / fs3Controllers;
+	}
+	shard.buf = sectorBuf;
+	return (shard);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSector
+// Description  : Reads a sector from the disk, sectors that have never been
+//                written are zero filled locally instead of going to the disk
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector to read
+//				  sectorBuf - buffer of FS3_SECTOR_SIZE bytes to read into
+// Outputs      : 0 if successful, -1 if failure
+
+int readSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf){
+	//Nothing has been written here yet so the contents are all zeros
+	if (sectorIsWritten(localTrk, localSec) == false){
+		memset(sectorBuf, 0, FS3_SECTOR_SIZE);
+		return (0);
+	}
+	return (readSectorFromDisk(localTrk, localSec, sectorBuf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSectorFromDisk
+// Description  : Reads a sector from the controller, used directly for sectors
+//                written before this mount such as the superblock. The sector
+//                is checked against its checksum if it has one
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector to read
+//				  sectorBuf - buffer of FS3_SECTOR_SIZE bytes to read into
+// Outputs      : 0 if successful, -1 if failure
+
+int readSectorFromDisk(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf){
+	if (crashCountdown == 0){
+		return (-1);
+	}
+	if (fs3_erasure_parity > 0){
+		FS3SectorAddress addr = { .trk = localTrk, .sec = localSec };
+		if (ecTransfer(FS3_OP_RDSECT, &addr, &sectorBuf, 1) != 0){
+			return (-1);
+		}
+		schedHead = localTrk;
+		return (checkSectorSum(localTrk, localSec, sectorBuf));
+	}
+	readCount++;
+	FS3Shard shard = mapSector(localTrk, localSec, sectorBuf);
+	if (seekTrack(shard.ctrl, shard.trk) != 0){
+		return (-1);
+	}
+	schedHead = localTrk;
+	FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_RDSECT, shard.sec, 0, 0);
+	FS3CmdBlk *rtnBlock = &cmdBlock;
+	if ((network_fs3_syscall_on(shard.ctrl, cmdBlock, rtnBlock, sectorBuf) != 0) ||
+			(fs3_cmd_ret(*rtnBlock) != 0)){
+		return (-1);
+	}
+	return (checkSectorSum(localTrk, localSec, sectorBuf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSector
+// Description  : Writes a sector to the disk, marks it as written and keeps
+//                its checksum
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector to write
+//				  sectorBuf - buffer of FS3_SECTOR_SIZE bytes to write from
+// Outputs      : 0 if successful, -1 if failure
+
+int writeSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf){
+	if (crashCountdown == 0){
+		return (-1);
+	}
+	if (crashCountdown > 0){
+		crashCountdown--;
+	}
+	if (fs3_erasure_parity > 0){
+		FS3SectorAddress addr = { .trk = localTrk, .sec = localSec };
+		schedHead = localTrk;
+		return (ecTransfer(FS3_OP_WRSECT, &addr, &sectorBuf, 1));
+	}
+	if (fs3_lease_acquire(localTrk, FS3_LEASE_WRITE) != 0){
+		return (-1);
+	}
+	writeCount++;
+	FS3Shard shard = mapSector(localTrk, localSec, sectorBuf);
+	if (seekTrack(shard.ctrl, shard.trk) != 0){
+		return (-1);
+	}
+	schedHead = localTrk;
+	FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_WRSECT, shard.sec, 0, 0);
+	FS3CmdBlk *rtnBlock = &cmdBlock;
+	if ((network_fs3_syscall_on(shard.ctrl, cmdBlock, rtnBlock, sectorBuf) != 0) ||
+			(fs3_cmd_ret(*rtnBlock) != 0)){
+		dropSectorSum(localTrk, localSec);
+		return (-1);
+	}
+	if (markSectorWritten(localTrk, localSec) != 0){
+		return (-1);
+	}
+	return (recordSectorSum(localTrk, localSec, sectorBuf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendShards
+// Description  : Reads or writes a batch of sectors given by the controller
+//                they are on, with every controller working at the same time.
+//                Each controller gets its sectors in the order of the batch,
+//                seeking only when its head has to move. On an erasure coded
+//                disk a controller that cannot be reached is dropped, what it
+//                held can be rebuilt from the others
+//
+// Inputs       : op - FS3_OP_RDSECT or FS3_OP_WRSECT
+//                shards - the sectors
+//                n - number of sectors
+// Outputs      : 0 if successful, 1 if a controller was dropped, -1 if
+//                failure
+
+int sendShards(uint8_t op, FS3Shard *shards, int n){
+	if (n == 0){
+		return (0);
+	}
+	//A seek is added in front of a sector whenever its controller's head is somewhere else
+	FS3NetRequest *reqs = malloc(sizeof(FS3NetRequest) * n * 2);
+	if (reqs == NULL){
+		return (-1);
+	}
+	uint_fast32_t heads[FS3_MAX_CONTROLLERS];
+	memcpy(heads, controllerTrk, sizeof(heads));
+	int len = 0;
+	for (int i=0; i<n; i++){
+		int ctrl = shards[i].ctrl;
+		if (heads[ctrl] != shards[i].trk){
+			reqs[len].ctrl = ctrl;
+			reqs[len].cmd = fs3_cmd_encode(FS3_OP_TSEEK, 0, shards[i].trk, 0);
+			reqs[len].buf = NULL;
+			heads[ctrl] = shards[i].trk;
+			seekCount++;
+			len++;
+		}
+		reqs[len].ctrl = ctrl;
+		reqs[len].cmd = fs3_cmd_encode(op, shards[i].sec, 0, 0);
+		reqs[len].buf = shards[i].buf;
+		len++;
+	}
+	if (op == FS3_OP_WRSECT){
+		writeCount += n;
+	}
+	else{
+		readCount += n;
+	}
+
+	int result = network_fs3_syscall_batch(reqs, len);
+	bool lost = false, refused = false;
+	for (int i=0; i<len; i++){
+		if ((reqs[i].result == -1) && (fs3_erasure_parity > 0)){
+			if (fs3_network_up(reqs[i].ctrl) == true){
+				dropReplica(reqs[i].ctrl, "I/O failed");
+			}
+			lost = true;
+		}
+		else if ((reqs[i].result == 0) && (fs3_cmd_ret(reqs[i].ret) != 0)){
+			refused = true;
+		}
+	}
+	free(reqs);
+	if ((result != 0) || (refused == true)){
+		//Some seeks may not have happened, so nothing is known about the heads
+		resetHeads();
+		return (((lost == true) && (refused == false)) ? 1 : -1);
+	}
+	memcpy(controllerTrk, heads, sizeof(heads));
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findStripe
+// Description  : Finds a stripe in a list of stripes being read or written
+//
+// Inputs       : stripes - the list
+//                len - number of stripes in the list
+//                trk - track of the stripe
+//                stripe - the stripe within the track
+// Outputs      : index of the stripe, -1 if it is not in the list
+
+int findStripe(FS3Stripe *stripes, int len, uint32_t trk, uint16_t stripe){
+	for (int s=len-1; s>=0; s--){
+		if ((stripes[s].trk == trk) && (stripes[s].stripe == stripe)){
+			return (s);
+		}
+	}
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ecRead
+// Description  : Reads a batch of sectors of an erasure coded disk. Sectors on
+//                a controller that is up are read directly, the others are
+//                rebuilt from the first fs3_erasure_data shards of their stripe
+//                on controllers that are up, all in one batch
+//
+// Inputs       : addrs - the sectors
+//                bufs - FS3_SECTOR_SIZE byte buffer for each sector
+//                n - number of sectors
+// Outputs      : 0 if successful, 1 if a controller was dropped, -1 if
+//                failure
+
+int ecRead(FS3SectorAddress *addrs, char **bufs, int n){
+	int k = fs3_erasure_data, width = fs3_erasure_data + fs3_erasure_parity;
+	FS3Shard *shards = malloc(sizeof(FS3Shard) * n * k);
+	FS3Stripe *stripes = calloc(n, sizeof(FS3Stripe));
+	int *rebuildFrom = malloc(sizeof(int) * n);
+	int len = 0, stripesLen = 0, result = 0;
+	if ((shards == NULL) || (stripes == NULL) || (rebuildFrom == NULL)){
+		result = -1;
+	}
+
+	for (int i=0; (i<n) && (result == 0); i++){
+		uint16_t stripe = addrs[i].sec / k;
+		int ctrl = EC_SHARD_CONTROLLER(stripe, addrs[i].sec % k);
+		rebuildFrom[i] = -1;
+		if (fs3_network_up(ctrl) == true){
+			shards[len++] = (FS3Shard){ .ctrl = ctrl, .trk = addrs[i].trk, .sec = stripe, .buf = bufs[i] };
+			continue;
+		}
+		int s = findStripe(stripes, stripesLen, addrs[i].trk, stripe);
+		if (s == -1){
+			s = stripesLen++;
+			stripes[s].trk = addrs[i].trk;
+			stripes[s].stripe = stripe;
+			stripes[s].scratch = malloc((size_t)k * FS3_SECTOR_SIZE);
+			int found = 0;
+			for (int shard=0; (shard<width) && (found<k) && (stripes[s].scratch != NULL); shard++){
+				int shardCtrl = EC_SHARD_CONTROLLER(stripe, shard);
+				if (fs3_network_up(shardCtrl) == true){
+					stripes[s].present[found] = shard;
+					shards[len++] = (FS3Shard){ .ctrl = shardCtrl, .trk = addrs[i].trk, .sec = stripe,
+						.buf = stripes[s].scratch + ((size_t)found * FS3_SECTOR_SIZE) };
+					found++;
+				}
+			}
+			if (found < k){
+				FS3_LOG_ERROR("FS3 driver: too many controllers down to rebuild stripe %u of track %u.",
+					stripe, addrs[i].trk);
+				result = -1;
+			}
+		}
+		rebuildFrom[i] = s;
+	}
+	if (result == 0){
+		result = sendShards(FS3_OP_RDSECT, shards, len);
+	}
+
+	for (int i=0; (i<n) && (result == 0); i++){
+		if (rebuildFrom[i] == -1){
+			continue;
+		}
+		FS3Stripe *st = &stripes[rebuildFrom[i]];
+		uint8_t *have[FS3_EC_MAX_DATA];
+		for (int t=0; t<k; t++){
+			have[t] = (uint8_t *)st->scratch + ((size_t)t * FS3_SECTOR_SIZE);
+		}
+		if (fs3_erasure_decode(st->present, have, addrs[i].sec % k, (uint8_t *)bufs[i], FS3_SECTOR_SIZE) != 0){
+			result = -1;
+		}
+	}
+	for (int s=0; s<stripesLen; s++){
+		free(stripes[s].scratch);
+	}
+	free(shards);
+	free(stripes);
+	free(rebuildFrom);
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ecWrite
+// Description  : Writes a batch of sectors of an erasure coded disk along with
+//                new parity for every stripe they are in. The data shards of
+//                those stripes that are not being written are read from the
+//                disk first, even ones that were never written or have been
+//                freed (a freed sector may still be in a file as far as the
+//                metadata on the disk knows), so the parity always matches
+//                what the disk holds. Shards on controllers that are down are
+//                left out, they can be rebuilt from the parity
+//
+// Inputs       : addrs - the sectors
+//                bufs - FS3_SECTOR_SIZE byte buffer for each sector
+//                n - number of sectors
+// Outputs      : 0 if successful, 1 if a controller was dropped, -1 if
+//                failure
+
+int ecWrite(FS3SectorAddress *addrs, char **bufs, int n){
+	int k = fs3_erasure_data, m = fs3_erasure_parity, width = fs3_erasure_data + fs3_erasure_parity;
+	FS3Stripe *stripes = calloc(n, sizeof(FS3Stripe));
+	FS3SectorAddress *readAddrs = malloc(sizeof(FS3SectorAddress) * n * k);
+	char **readBufs = malloc(sizeof(char *) * n * k);
+	FS3Shard *shards = malloc(sizeof(FS3Shard) * n * width);
+	int stripesLen = 0, readLen = 0, len = 0, result = 0;
+	if ((stripes == NULL) || (readAddrs == NULL) || (readBufs == NULL) || (shards == NULL)){
+		result = -1;
+	}
+
+	//Sectors are gathered by stripe, a later write of a sector in the batch replaces an earlier one
+	for (int i=0; (i<n) && (result == 0); i++){
+		uint16_t stripe = addrs[i].sec / k;
+		int s = findStripe(stripes, stripesLen, addrs[i].trk, stripe);
+		if (s == -1){
+			s = stripesLen++;
+			stripes[s].trk = addrs[i].trk;
+			stripes[s].stripe = stripe;
+			stripes[s].scratch = malloc((size_t)width * FS3_SECTOR_SIZE);
+			if (stripes[s].scratch == NULL){
+				result = -1;
+			}
+		}
+		stripes[s].data[addrs[i].sec % k] = bufs[i];
+		stripes[s].write[addrs[i].sec % k] = true;
+	}
+	for (int s=0; (s<stripesLen) && (result == 0); s++){
+		for (int idx=0; idx<k; idx++){
+			if (stripes[s].data[idx] != NULL){
+				continue;
+			}
+			stripes[s].data[idx] = stripes[s].scratch + ((size_t)idx * FS3_SECTOR_SIZE);
+			readAddrs[readLen].trk = stripes[s].trk;
+			readAddrs[readLen].sec = (stripes[s].stripe * k) + idx;
+			readBufs[readLen] = stripes[s].data[idx];
+			readLen++;
+		}
+	}
+	if ((result == 0) && (readLen > 0)){
+		result = ecRead(readAddrs, readBufs, readLen);
+	}
+	//The parity is made from these too, so they are checked like any other sector read
+	for (int i=0; (i<readLen) && (result == 0); i++){
+		result = checkSectorSum(readAddrs[i].trk, readAddrs[i].sec, readBufs[i]);
+	}
+
+	for (int s=0; (s<stripesLen) && (result == 0); s++){
+		uint8_t *parity[FS3_EC_MAX_PARITY];
+		for (int j=0; j<m; j++){
+			parity[j] = (uint8_t *)stripes[s].scratch + ((size_t)(k + j) * FS3_SECTOR_SIZE);
+		}
+		fs3_erasure_encode((uint8_t **)stripes[s].data, parity, FS3_SECTOR_SIZE);
+		for (int shard=0; shard<width; shard++){
+			int ctrl = EC_SHARD_CONTROLLER(stripes[s].stripe, shard);
+			if (((shard < k) && (stripes[s].write[shard] == false)) || (fs3_network_up(ctrl) == false)){
+				continue;
+			}
+			shards[len++] = (FS3Shard){ .ctrl = ctrl, .trk = stripes[s].trk, .sec = stripes[s].stripe,
+				.buf = (shard < k) ? stripes[s].data[shard] : (char *)parity[shard - k] };
+		}
+	}
+	if (result == 0){
+		result = sendShards(FS3_OP_WRSECT, shards, len);
+	}
+
+	for (int s=0; s<stripesLen; s++){
+		for (int idx=0; idx<k; idx++){
+			if (stripes[s].write[idx] == false){
+				continue;
+			}
+			if (result == 0){
+				markSectorWritten(stripes[s].trk, (stripes[s].stripe * k) + idx);
+				recordSectorSum(stripes[s].trk, (stripes[s].stripe * k) + idx, stripes[s].data[idx]);
+			}
+			else{
+				dropSectorSum(stripes[s].trk, (stripes[s].stripe * k) + idx);
+			}
+		}
+		free(stripes[s].scratch);
+	}
+	free(stripes);
+	free(readAddrs);
+	free(readBufs);
+	free(shards);
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ecTransfer
+// Description  : Reads or writes a batch of sectors of an erasure coded disk.
+//                A controller lost part way through is dropped and the batch
+//                is tried again without it, until more controllers are down
+//                than each stripe has parity shards
+//
+// Inputs       : op - FS3_OP_RDSECT or FS3_OP_WRSECT
+//                addrs - the sectors
+//                bufs - FS3_SECTOR_SIZE byte buffer for each sector
+//                n - number of sectors
+// Outputs      : 0 if successful, -1 if failure
+
+int ecTransfer(uint8_t op, FS3SectorAddress *addrs, char **bufs, int n){
+	if (n == 0){
+		return (0);
+	}
+	for (int tries=0; tries<=fs3_erasure_parity; tries++){
+		int result = (op == FS3_OP_WRSECT) ? ecWrite(addrs, bufs, n) : ecRead(addrs, bufs, n);
+		if (result != 1){
+			return (result);
+		}
+	}
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : transferSectors
+// Description  : Reads or writes a batch of sectors with every controller
+//                working at the same time. With one controller, or while a
+//                crash is being injected, the sectors go one at a time. The
+//                sectors read are checked against their checksums and those
+//                written get new ones
+//
+// Inputs       : op - FS3_OP_RDSECT or FS3_OP_WRSECT
+//                addrs - the sectors
+//                bufs - FS3_SECTOR_SIZE byte buffer for each sector
+//                n - number of sectors
+// Outputs      : 0 if successful, -1 if failure
+
+int transferSectors(uint8_t op, FS3SectorAddress *addrs, char **bufs, int n){
+	if ((crashCountdown != -1) || ((fs3_erasure_parity == 0) && ((fs3Controllers == 1) || (n == 1)))){
+		for (int i=0; i<n; i++){
+			int result = (op == FS3_OP_WRSECT) ? writeSector(addrs[i].trk, addrs[i].sec, bufs[i]) :
+				readSectorFromDisk(addrs[i].trk, addrs[i].sec, bufs[i]);
+			if (result != 0){
+				return (-1);
+			}
+		}
+		return (0);
+	}
+	//The batch ends with the heads on or near the last sector's track
+	schedHead = addrs[n - 1].trk;
+	if (fs3_erasure_parity > 0){
+		if (ecTransfer(op, addrs, bufs, n) != 0){
+			return (-1);
+		}
+		for (int i=0; (i<n) && (op == FS3_OP_RDSECT); i++){
+			if (checkSectorSum(addrs[i].trk, addrs[i].sec, bufs[i]) != 0){
+				return (-1);
+			}
+		}
+		return (0);
+	}
+
+	FS3Shard *shards = malloc(sizeof(FS3Shard) * n);
+	if (shards == NULL){
+		return (-1);
+	}
+	for (int i=0; i<n; i++){
+		shards[i] = mapSector(addrs[i].trk, addrs[i].sec, bufs[i]);
+	}
+	int result = sendShards(op, shards, n);
+	free(shards);
+	for (int i=0; i<n; i++){
+		if (op == FS3_OP_RDSECT){
+			if ((result == 0) && (checkSectorSum(addrs[i].trk, addrs[i].sec, bufs[i]) != 0)){
+				return (-1);
+			}
+		}
+		else if (result == 0){
+			markSectorWritten(addrs[i].trk, addrs[i].sec);
+			recordSectorSum(addrs[i].trk, addrs[i].sec, bufs[i]);
+		}
+		else{
+			dropSectorSum(addrs[i].trk, addrs[i].sec);
+		}
+	}
+	return ((result == 0) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueSector
+// Description  : Hands a data sector write to the scheduler and caches the new
+//                contents, the queue is dispatched once it is full
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector to write
+//				  sectorBuf - buffer of FS3_SECTOR_SIZE bytes to write from
+// Outputs      : 0 if successful, -1 if failure
+
+int queueSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf){
+	//Other clients sharing the controller have to see the write once it is made, so it is not queued
+	if (fs3_lease_enabled == true){
+		if (writeSector(localTrk, localSec, sectorBuf) != 0){
+			return (-1);
+		}
+		fs3_put_cache(localTrk, localSec, sectorBuf);
+		return (0);
+	}
+	int full = fs3_sched_write(localTrk, localSec, sectorBuf);
+	if (full == -1){
+		return (-1);
+	}
+	fs3_put_cache(localTrk, localSec, sectorBuf);
+	if ((full == 1) && (fs3_sched_dispatch(schedHead) != 0)){
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSector
+// Description  : Gets the contents of a sector, from the cache if it is there
+//                and from the disk (filling the cache) if it is not
+//
+// Inputs       : localTrk - track the sector is on
+//				  localSec - sector to get
+//				  sectorBuf - buffer of FS3_SECTOR_SIZE bytes to read into
+// Outputs      : 0 if successful, -1 if failure
+
+int getSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf){
+	if (fs3_lease_acquire(localTrk, FS3_LEASE_READ) != 0){
+		return (-1);
+	}
+	void *cacheBuf = fs3_get_cache(localTrk, localSec);
+	if (cacheBuf != NULL){
+		memcpy(sectorBuf, cacheBuf, FS3_SECTOR_SIZE);
+		return (0);
+	}
+	//A write still waiting in the scheduler's queue is newer than the disk
+	if (fs3_sched_lookup(localTrk, localSec, sectorBuf) == 1){
+		return (0);
+	}
+	if (readSector(localTrk, localSec, sectorBuf) != 0){
+		return (-1);
+	}
+	fs3_put_cache(localTrk, localSec, sectorBuf);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSectors
+// Description  : Gets the contents of a run of sectors like getSector, except
+//                that the ones that have to come from the disk are read as one
+//                batch so the controllers they are striped over work in
+//                parallel
+//
+// Inputs       : addrs - the sectors to get
+//                sectorBufs - buffer of n * FS3_SECTOR_SIZE bytes to read into
+//                n - number of sectors
+// Outputs      : 0 if successful, -1 if failure
+
+int getSectors(FS3SectorAddress *addrs, char *sectorBufs, int n){
+	FS3SectorAddress *diskAddrs = malloc(sizeof(FS3SectorAddress) * n);
+	char **diskBufs = malloc(sizeof(char *) * n);
+	if ((diskAddrs == NULL) || (diskBufs == NULL)){
+		free(diskAddrs);
+		free(diskBufs);
+		return (-1);
+	}
+	int diskLen = 0;
+	for (int i=0; i<n; i++){
+		char *sectorBuf = sectorBufs + ((size_t)i * FS3_SECTOR_SIZE);
+		if (fs3_lease_acquire(addrs[i].trk, FS3_LEASE_READ) != 0){
+			free(diskAddrs);
+			free(diskBufs);
+			return (-1);
+		}
+		void *cacheBuf = fs3_get_cache(addrs[i].trk, addrs[i].sec);
+		if (cacheBuf != NULL){
+			memcpy(sectorBuf, cacheBuf, FS3_SECTOR_SIZE);
+		}
+		else if (fs3_sched_lookup(addrs[i].trk, addrs[i].sec, sectorBuf) == 1){
+			continue;
+		}
+		else if (sectorIsWritten(addrs[i].trk, addrs[i].sec) == false){
+			memset(sectorBuf, 0, FS3_SECTOR_SIZE);
+		}
+		else{
+			diskAddrs[diskLen] = addrs[i];
+			diskBufs[diskLen] = sectorBuf;
+			diskLen++;
+		}
+	}
+	int result = transferSectors(FS3_OP_RDSECT, diskAddrs, diskBufs, diskLen);
+	for (int i=0; (i<diskLen) && (result == 0); i++){
+		fs3_put_cache(diskAddrs[i].trk, diskAddrs[i].sec, diskBufs[i]);
+	}
+	free(diskAddrs);
+	free(diskBufs);
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : probeController
+// Description  : Chooses the controller the geometry is negotiated with, the
+//                first one still up when the disk is erasure coded
+//
+// Inputs       : none
+// Outputs      : the controller
+
+int probeController(void){
+	for (int ctrl=0; (fs3_erasure_parity > 0) && (ctrl<fs3_network_controllers); ctrl++){
+		if (fs3_network_up(ctrl) == true){
+			return (ctrl);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : probeTrack
+// Description  : Checks whether the controller has a track by seeking to it
+//
+// Inputs       : localTrk - track to check
+// Outputs      : true if the track exists, false if not
+
+bool probeTrack(uint_fast32_t localTrk){
+	return (seekTrack(probeController(), localTrk) == 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : probeSector
+// Description  : Checks whether the controller has a sector on the current
+//                track by reading it
+//
+// Inputs       : localSec - sector to check
+// Outputs      : true if the sector exists, false if not
+
+bool probeSector(uint32_t localSec){
+	char sectorBuf[FS3_SECTOR_SIZE];
+	if (localSec >= FS3_MAX_SECTORS_PER_TRACK){
+		return false;
+	}
+	FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_RDSECT, localSec, 0, 0);
+	FS3CmdBlk *rtnBlock = &cmdBlock;
+	if ((network_fs3_syscall_on(probeController(), cmdBlock, rtnBlock, sectorBuf) != 0) ||
+			(fs3_cmd_ret(*rtnBlock) != 0)){
+		return false;
+	}
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : negotiateGeometry
+// Description  : Finds how many tracks the controller has and how many sectors
+//                are on each track. Starting from the default geometry the upper
+//                bound is doubled until the controller refuses it, then a binary
+//                search finds the last good value
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int negotiateGeometry(void){
+	uint64_t good, bad, mid;
+
+	//Tracks are found by seeking
+	if (probeTrack(0) == false){
+		return (-1);
+	}
+	good = 0;
+	bad = FS3_MAX_TRACKS;
+	while ((bad < FS3_MAX_TRACK_COUNT) && (probeTrack(bad) == true)){
+		good = bad;
+		bad *= 2;
+	}
+	while ((bad - good) > 1){
+		mid = good + ((bad - good) / 2);
+		if (probeTrack(mid) == true){
+			good = mid;
+		}
+		else{
+			bad = mid;
+		}
+	}
+	fs3Tracks = good + 1;
+
+	//Sectors are found by reading on track 0
+	if ((probeTrack(0) == false) || (probeSector(0) == false)){
+		return (-1);
+	}
+	good = 0;
+	bad = FS3_TRACK_SIZE;
+	while ((bad < FS3_MAX_SECTORS_PER_TRACK) && (probeSector(bad) == true)){
+		good = bad;
+		bad *= 2;
+	}
+	while ((bad - good) > 1){
+		mid = good + ((bad - good) / 2);
+		if (probeSector(mid) == true){
+			good = mid;
+		}
+		else{
+			bad = mid;
+		}
+	}
+	fs3TrackSize = good + 1;
+
+	//Every controller is taken to have the same geometry as the first. Placed columns are laid end to end, each
+	//  using at most its share of the tracks the cache can address so the volume can still grow to
+	//  FS3_MAX_CONTROLLERS of them
+	if (fs3_ring_vnodes > 0){
+		fs3ColumnTracks = fs3Tracks;
+		if (fs3ColumnTracks > (FS3_MAX_TRACK_COUNT / FS3_MAX_CONTROLLERS)){
+			fs3ColumnTracks = FS3_MAX_TRACK_COUNT / FS3_MAX_CONTROLLERS;
+		}
+		fs3Tracks = fs3ColumnTracks * fs3Controllers;
+		FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver negotiated geometry of %u tracks of %u sectors on each of %d controllers.",
+			fs3ColumnTracks, fs3TrackSize, fs3Controllers);
+		return (0);
+	}
+
+	//A striped track holds the sectors of all of them as long as the sector numbers still fit in a command
+	//  block, and a whole number of stripes
+	fs3TrackSize *= fs3Controllers;
+	if (fs3TrackSize > FS3_MAX_SECTORS_PER_TRACK){
+		fs3TrackSize = FS3_MAX_SECTORS_PER_TRACK;
+	}
+	fs3TrackSize -= fs3TrackSize % fs3Controllers;
+
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver negotiated geometry of %u tracks of %u sectors over %d controllers.",
+		fs3Tracks, fs3TrackSize, fs3Controllers);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupSectorMaps
+// Description  : Allocates the per track sector maps once the geometry of the
+//                disk is known, the maps for each track are filled in lazily
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int setupSectorMaps(void){
+	writtenMap = calloc(fs3Tracks, sizeof(uint64_t *));
+	allocMap = calloc(fs3Tracks, sizeof(uint64_t *));
+	trackUsed = calloc(fs3Tracks, sizeof(uint32_t));
+	sumMap = calloc(fs3Tracks, sizeof(uint32_t *));
+	sumKnown = calloc(fs3Tracks, sizeof(uint64_t *));
+	if ((writtenMap == NULL) || (allocMap == NULL) || (trackUsed == NULL) || (sumMap == NULL) || (sumKnown == NULL)){
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : growTracks
+// Description  : Extends the per track sector maps when controllers are added
+//                to a placed disk, the tracks of the new columns start empty
+//
+// Inputs       : tracks - the new number of tracks
+// Outputs      : 0 if successful, -1 if failure
+
+int growTracks(uint32_t tracks){
+	uint64_t **newWritten = realloc(writtenMap, sizeof(uint64_t *) * tracks);
+	if (newWritten == NULL){
+		return (-1);
+	}
+	writtenMap = newWritten;
+	uint64_t **newAlloc = realloc(allocMap, sizeof(uint64_t *) * tracks);
+	if (newAlloc == NULL){
+		return (-1);
+	}
+	allocMap = newAlloc;
+	uint32_t *newUsed = realloc(trackUsed, sizeof(uint32_t) * tracks);
+	if (newUsed == NULL){
+		return (-1);
+	}
+	trackUsed = newUsed;
+	uint32_t **newSums = realloc(sumMap, sizeof(uint32_t *) * tracks);
+	if (newSums == NULL){
+		return (-1);
+	}
+	sumMap = newSums;
+	uint64_t **newKnown = realloc(sumKnown, sizeof(uint64_t *) * tracks);
+	if (newKnown == NULL){
+		return (-1);
+	}
+	sumKnown = newKnown;
+	for (uint32_t localTrk=fs3Tracks; localTrk<tracks; localTrk++){
+		writtenMap[localTrk] = NULL;
+		allocMap[localTrk] = NULL;
+		trackUsed[localTrk] = 0;
+		sumMap[localTrk] = NULL;
+		sumKnown[localTrk] = NULL;
+	}
+	fs3Tracks = tracks;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupRing
+// Description  : Puts every column of a placed disk that has not been retired
+//                on the placement ring. Files written before the ring last
+//                changed may belong somewhere else now, so the rebalancer is
+//                set to look for them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int setupRing(void){
+	if (fs3ColumnTracks == 0){
+		return (0);
+	}
+	if (fs3_ring_init(fs3_ring_vnodes) != 0){
+		return (-1);
+	}
+	for (int col=0; col<fs3Controllers; col++){
+		if (((placeRetired & (1u << col)) == 0) && (fs3_ring_add(col) != 0)){
+			return (-1);
+		}
+	}
+	if (fs3_ring_nodes() == 0){
+		FS3_LOG_ERROR("FS3 driver has every controller off the placement ring.");
+		return (-1);
+	}
+	rebalanceCursor = 0;
+	rebalanceFound = false;
+	rebalancePending = true;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journalSectors
+// Description  : Gets the number of sectors the journal takes up on track 0,
+//                the journal is smaller on disks with very short tracks
+//
+// Inputs       : none
+// Outputs      : the number of sectors
+
+uint32_t journalSectors(void){
+	return ((fs3TrackSize > FS3_JOURNAL_SECTORS) ? FS3_JOURNAL_SECTORS : fs3TrackSize - 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatDisk
+// Description  : Starts an empty filesystem on a disk without a superblock,
+//                sector 0 of track 0 is kept back for the superblock and the
+//                sectors after it for the journal
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int formatDisk(void){
+	uint32_t journalLen = journalSectors();
+	metaExtentsLen = 0;
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver found no superblock, starting an empty filesystem.");
+	fs3_journal_init(0, 1, journalLen, 0);
+	return (markRunAllocated(0, 0, 1 + journalLen));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : countExtents
+// Description  : Counts the runs of contiguous sectors on one track that make
+//                up a file, each run is one extent in the file's inode
+//
+// Inputs       : idx - index of the file in the file table
+// Outputs      : the number of extents
+
+int countExtents(int idx){
+	int extents = 0;
+	for (int i=0; i<files[idx].secNums; i++){
+		if ((i == 0) || (files[idx].fileSectors[i].trk != files[idx].fileSectors[i - 1].trk) ||
+				(files[idx].fileSectors[i].sec != files[idx].fileSectors[i - 1].sec + 1)){
+			extents++;
+		}
+	}
+	return (extents);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeExtents
+// Description  : Gives every sector in a list of runs back to the disk
+//
+// Inputs       : extents - the runs to free
+//                count - number of runs in the list
+// Outputs      : 0 if successful, -1 if failure
+
+int freeExtents(FS3MetaExtent *extents, uint32_t count){
+	FS3SectorAddress addr;
+	for (uint32_t i=0; i<count; i++){
+		addr.trk = extents[i].trk;
+		for (uint32_t localSec=extents[i].sec; localSec<extents[i].sec + extents[i].len; localSec++){
+			addr.sec = localSec;
+			if (freeSector(&addr) != 0){
+				return (-1);
+			}
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : addMetaExtent
+// Description  : Allocates a run of free sectors for the metadata and adds it
+//                to the end of a list of runs, growing the list as needed
+//
+// Inputs       : extents - the list, reallocated as it grows
+//                len - number of runs in the list, updated
+//                cap - number of runs there is room for, updated
+//                localTrk - track the run is on
+//                start - first sector of the run
+//                runLen - number of sectors in the run
+// Outputs      : 0 if successful, -1 if failure
+
+int addMetaExtent(FS3MetaExtent **extents, uint32_t *len, uint32_t *cap, uint32_t localTrk, uint32_t start, uint32_t runLen){
+	if (*len == *cap){
+		uint32_t newCap = (*cap == 0) ? FS3_META_MAX_EXTENTS : *cap * 2;
+		FS3MetaExtent *newExtents = realloc(*extents, sizeof(FS3MetaExtent) * newCap);
+		if (newExtents == NULL){
+			return (-1);
+		}
+		*extents = newExtents;
+		*cap = newCap;
+	}
+	if (markRunAllocated(localTrk, start, runLen) != 0){
+		return (-1);
+	}
+	(*extents)[*len].trk = localTrk;
+	(*extents)[*len].sec = start;
+	(*extents)[*len].len = runLen;
+	(*len)++;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : streamSectorFree
+// Description  : Clears a sector's bit in the free space bitmap at the start
+//                of a metadata stream being put together
+//
+// Inputs       : stream - the stream
+//                localTrk - track the sector is on
+//                localSec - the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int streamSectorFree(char *stream, uint32_t localTrk, uint32_t localSec){
+	uint64_t word;
+	char *wordPos = stream + ((((uint64_t)localTrk * BITMAP_WORDS(fs3TrackSize)) + (localSec / 64)) * sizeof(uint64_t));
+	memcpy(&word, wordPos, sizeof(uint64_t));
+	word &= ~((uint64_t)1 << (localSec % 64));
+	memcpy(wordPos, &word, sizeof(uint64_t));
+	return (0);
+}
+
+////
+//
+// Function     : saveMetadata
+// Description  : Writes the metadata stream (the free space bitmap followed by
+//                an inode for every file) to newly allocated runs of sectors,
+//                then points the superblock at it. The first runs are listed in
+//                the superblock and the rest in a chain of extent list sectors,
+//                so the stream can be spread over as many runs as the free space
+//                is split into. The old stream is only given back once the new
+//                superblock is written, so the superblock on the disk always
+//                describes a complete stream and a failed checkpoint can simply
+//                be tried again. Everything the journal holds is in the new
+//                stream so the superblock records the last journal record as
+//                included. When unmounting, the checksums of the files' sectors
+//                follow the stream, a bitmap of the sectors that have one and
+//                then the checksums in the bitmap's order
+//
+// Inputs       : sums - save the sector checksums
+// Outputs      : 0 if successful, -1 if failure
+
+int saveMetadata(bool sums){
+	int words = BITMAP_WORDS(fs3TrackSize);
+	uint64_t bitmapBytes = (uint64_t)fs3Tracks * words * sizeof(uint64_t);
+	uint64_t streamBytes = bitmapBytes, sumBytes = 0;
+	uint64_t *saved = NULL;
+	FS3MetaExtent *extents = NULL;
+	uint32_t extentsLen = 0, extentsCap = 0;
+	FS3Superblock super;
+	memset(&super, 0, sizeof(FS3Superblock));
+
+	//Another client may write to the disk once its leases are given up, so its checksums are not kept
+	if ((sums == true) && (fs3_sector_sums == true) && (fs3_lease_enabled == false)){
+		saved = calloc((uint64_t)fs3Tracks * words, sizeof(uint64_t));
+		if (saved == NULL){
+			return (-1);
+		}
+		for (int i=0; i<filesLen; i++){
+			for (int j=0; j<files[i].secNums; j++){
+				uint32_t localTrk = files[i].fileSectors[j].trk, localSec = files[i].fileSectors[j].sec;
+				if ((sumKnown[localTrk] != NULL) && ((sumKnown[localTrk][localSec / 64] >> (localSec % 64)) & 1) &&
+						(claimSector(saved, localTrk, localSec) == 0)){
+					super.sumCount++;
+				}
+			}
+		}
+		sumBytes = bitmapBytes + ((uint64_t)super.sumCount * sizeof(uint32_t));
+	}
+
+	//Each inode is the name length, name, file length, extent count, the extents and then the inline bytes
+	//  with their length in front
+	for (int i=0; i<filesLen; i++){
+		if (files[i].fileName != NULL){
+			streamBytes += sizeof(uint16_t) + strlen(files[i].fileName) + (2 * sizeof(uint32_t)) +
+				(countExtents(i) * ((2 * sizeof(uint16_t)) + sizeof(uint32_t))) + sizeof(uint16_t) + files[i].inlineLen;
+			super.fileCount++;
+		}
+	}
+
+	//Place the new stream, runs are taken from the start of the disk so it can be read back in order. The
+	//  runs past the ones the superblock has room for are listed in extent list sectors, placed after them
+	uint64_t remaining = (streamBytes + sumBytes + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+	uint32_t listSectors = 0;
+	for (uint32_t localTrk=0; ((remaining > 0) || (listSectors > 0)) && (localTrk<fs3Tracks); localTrk++){
+		uint32_t start, len;
+		while ((remaining > 0) && (trackUsed[localTrk] < fs3TrackSize) &&
+				((len = findFreeRun(localTrk, 0, (remaining < fs3TrackSize) ? remaining : fs3TrackSize, 1, &start)) != 0)){
+			if (addMetaExtent(&extents, &extentsLen, &extentsCap, localTrk, start, len) != 0){
+				break;
+			}
+			remaining -= len;
+			if ((remaining == 0) && (extentsLen > FS3_META_MAX_EXTENTS)){
+				super.extentCount = extentsLen;
+				listSectors = (extentsLen - FS3_META_MAX_EXTENTS + FS3_META_LIST_EXTENTS - 1) / FS3_META_LIST_EXTENTS;
+			}
+		}
+		while ((remaining == 0) && (listSectors > 0) && (trackUsed[localTrk] < fs3TrackSize) &&
+				(findFreeRun(localTrk, 0, 1, 1, &start) != 0)){
+			if (addMetaExtent(&extents, &extentsLen, &extentsCap, localTrk, start, 1) != 0){
+				break;
+			}
+			listSectors--;
+		}
+	}
+	if ((remaining > 0) || (listSectors > 0)){
+		FS3_LOG_ERROR("FS3 driver could not find room for %lu bytes of metadata.", (unsigned long)(streamBytes + sumBytes));
+		freeExtents(extents, extentsLen);
+		free(extents);
+		free(saved);
+		return (-1);
+	}
+	if (super.extentCount == 0){
+		super.extentCount = extentsLen;
+	}
+
+	char *stream = calloc(((streamBytes + sumBytes + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE), FS3_SECTOR_SIZE);
+	if (stream == NULL){
+		freeExtents(extents, extentsLen);
+		free(extents);
+		free(saved);
+		return (-1);
+	}
+	char *pos = stream;
+	for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+		if (allocMap[localTrk] != NULL){
+			memcpy(pos, allocMap[localTrk], words * sizeof(uint64_t));
+		}
+		pos += words * sizeof(uint64_t);
+	}
+	//Runs reserved for open files are not theirs until written, after a crash they should be free. The old
+	//  stream is still on the disk but no longer needed once the new superblock is written, so the bitmap
+	//  that goes in the new stream already counts its sectors as free too
+	for (int i=0; i<filesLen; i++){
+		for (uint32_t localSec=files[i].resvNext; localSec<files[i].resvEnd; localSec++){
+			streamSectorFree(stream, files[i].resvTrk, localSec);
+		}
+	}
+	for (uint32_t i=0; i<metaExtentsLen; i++){
+		for (uint32_t localSec=metaExtents[i].sec; localSec<metaExtents[i].sec + metaExtents[i].len; localSec++){
+			streamSectorFree(stream, metaExtents[i].trk, localSec);
+		}
+	}
+	for (int i=0; i<filesLen; i++){
+		if (files[i].fileName == NULL){
+			continue;
+		}
+		uint16_t nameLen = strlen(files[i].fileName);
+		uint32_t fileLen = files[i].fileLen;
+		uint32_t extentCount = countExtents(i);
+		memcpy(pos, &nameLen, sizeof(uint16_t));
+		pos += sizeof(uint16_t);
+		memcpy(pos, files[i].fileName, nameLen);
+		pos += nameLen;
+		memcpy(pos, &fileLen, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
+		memcpy(pos, &extentCount, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
+		for (int j=0; j<files[i].secNums; ){
+			uint16_t extentTrk = files[i].fileSectors[j].trk;
+			uint16_t extentSec = files[i].fileSectors[j].sec;
+			uint32_t extentLen = 1;
+			while (((j + extentLen) < files[i].secNums) && (files[i].fileSectors[j + extentLen].trk == extentTrk) &&
+					(files[i].fileSectors[j + extentLen].sec == extentSec + extentLen)){
+				extentLen++;
+			}
+			memcpy(pos, &extentTrk, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+			memcpy(pos, &extentSec, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+			memcpy(pos, &extentLen, sizeof(uint32_t));
+			pos += sizeof(uint32_t);
+			j += extentLen;
+		}
+		uint16_t inlineLen = files[i].inlineLen;
+		memcpy(pos, &inlineLen, sizeof(uint16_t));
+		pos += sizeof(uint16_t);
+		if (inlineLen > 0){
+			memcpy(pos, files[i].inlineData, inlineLen);
+			pos += inlineLen;
+		}
+	}
+	if (saved != NULL){
+		memcpy(pos, saved, bitmapBytes);
+		pos += bitmapBytes;
+		for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+			for (int w=0; w<words; w++){
+				for (uint64_t bits=saved[(localTrk * words) + w]; bits!=0; bits&=bits-1){
+					memcpy(pos, &sumMap[localTrk][(w * 64) + __builtin_ctzll(bits)], sizeof(uint32_t));
+					pos += sizeof(uint32_t);
+				}
+			}
+		}
+		free(saved);
+	}
+
+	//Write the stream run by run, each run is on one track so it only needs one seek
+	pos = stream;
+	for (uint32_t i=0; i<super.extentCount; i++){
+		for (uint32_t localSec=extents[i].sec; localSec<extents[i].sec + extents[i].len; localSec++){
+			if (writeSector(extents[i].trk, localSec, pos) != 0){
+				free(stream);
+				freeExtents(extents, extentsLen);
+				free(extents);
+				return (-1);
+			}
+			pos += FS3_SECTOR_SIZE;
+		}
+	}
+	free(stream);
+
+	//Then the extent list, each of its sectors pointing at the next
+	for (uint32_t listed=FS3_META_MAX_EXTENTS, l=super.extentCount; listed<super.extentCount; l++){
+		char listBuf[FS3_SECTOR_SIZE];
+		FS3MetaExtentList list;
+		memset(&list, 0, sizeof(FS3MetaExtentList));
+		list.count = super.extentCount - listed;
+		list.count = (list.count > FS3_META_LIST_EXTENTS) ? FS3_META_LIST_EXTENTS : list.count;
+		memcpy(list.extents, &extents[listed], sizeof(FS3MetaExtent) * list.count);
+		listed += list.count;
+		if (listed < super.extentCount){
+			list.nextTrk = extents[l + 1].trk;
+			list.nextSec = extents[l + 1].sec;
+		}
+		memset(listBuf, 0, FS3_SECTOR_SIZE);
+		memcpy(listBuf, &list, sizeof(FS3MetaExtentList));
+		if (writeSector(extents[l].trk, extents[l].sec, listBuf) != 0){
+			freeExtents(extents, extentsLen);
+			free(extents);
+			return (-1);
+		}
+	}
+
+	//Only now does the disk refer to the new stream
+	char superBuf[FS3_SECTOR_SIZE];
+	memcpy(super.magic, FS3_META_MAGIC, sizeof(super.magic));
+	super.version = FS3_META_VERSION;
+	super.tracks = fs3Tracks;
+	super.trackSize = fs3TrackSize;
+	super.controllers = fs3Controllers;
+	super.parity = fs3_erasure_parity;
+	super.columnTracks = fs3ColumnTracks;
+	super.retired = placeRetired;
+	super.streamBytes = streamBytes;
+	super.journalStart = 1;
+	super.journalLen = journalSectors();
+	super.checkpointSeq = fs3_journal_seq();
+	memcpy(super.extents, extents, sizeof(FS3MetaExtent) *
+		((super.extentCount < FS3_META_MAX_EXTENTS) ? super.extentCount : FS3_META_MAX_EXTENTS));
+	if (super.extentCount > FS3_META_MAX_EXTENTS){
+		super.listTrk = extents[super.extentCount].trk;
+		super.listSec = extents[super.extentCount].sec;
+	}
+	memset(superBuf, 0, FS3_SECTOR_SIZE);
+	memcpy(superBuf, &super, sizeof(FS3Superblock));
+	if (writeSector(0, 0, superBuf) != 0){
+		freeExtents(extents, extentsLen);
+		free(extents);
+		return (-1);
+	}
+	if (freeExtents(metaExtents, metaExtentsLen) != 0){
+		free(extents);
+		return (-1);
+	}
+	free(metaExtents);
+	metaExtents = extents;
+	metaExtentsLen = extentsLen;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadExtents
+// Description  : Gets the runs of the metadata stream a superblock points at,
+//                the first from the superblock and the rest from the chain of
+//                extent list sectors. The list sectors follow the stream's runs
+//                as runs of one sector, so they are freed with the stream
+//
+// Inputs       : super - the superblock read from the disk
+//                extents - filled in with the runs (freed by the caller)
+//                len - filled in with the number of runs, list sectors included
+// Outputs      : 0 if successful, -1 if failure
+
+int loadExtents(FS3Superblock *super, FS3MetaExtent **extents, uint32_t *len){
+	uint32_t count = super->extentCount;
+	uint32_t listed = (count < FS3_META_MAX_EXTENTS) ? count : FS3_META_MAX_EXTENTS;
+	uint32_t listSectors = (count > FS3_META_MAX_EXTENTS) ?
+		(count - FS3_META_MAX_EXTENTS + FS3_META_LIST_EXTENTS - 1) / FS3_META_LIST_EXTENTS : 0;
+	if ((count == 0) || (count > fs3Tracks * fs3TrackSize)){
+		return (-1);
+	}
+	FS3MetaExtent *runs = malloc(sizeof(FS3MetaExtent) * (count + listSectors));
+	if (runs == NULL){
+		return (-1);
+	}
+	memcpy(runs, super->extents, sizeof(FS3MetaExtent) * listed);
+	uint32_t listTrk = super->listTrk, listSec = super->listSec;
+	for (uint32_t l=0; l<listSectors; l++){
+		char listBuf[FS3_SECTOR_SIZE];
+		FS3MetaExtentList list;
+		if ((listTrk >= fs3Tracks) || (listSec >= fs3TrackSize) || (readSectorFromDisk(listTrk, listSec, listBuf) != 0)){
+			free(runs);
+			return (-1);
+		}
+		memcpy(&list, listBuf, sizeof(FS3MetaExtentList));
+		if ((list.count == 0) || (list.count > FS3_META_LIST_EXTENTS) || (list.count > count - listed)){
+			free(runs);
+			return (-1);
+		}
+		memcpy(&runs[listed], list.extents, sizeof(FS3MetaExtent) * list.count);
+		listed += list.count;
+		runs[count + l].trk = listTrk;
+		runs[count + l].sec = listSec;
+		runs[count + l].len = 1;
+		listTrk = list.nextTrk;
+		listSec = list.nextSec;
+	}
+	for (uint32_t i=0; i<count; i++){
+		if ((listed != count) || (runs[i].trk >= fs3Tracks) || (runs[i].len > fs3TrackSize) ||
+				(runs[i].sec + runs[i].len > fs3TrackSize)){
+			free(runs);
+			return (-1);
+		}
+	}
+	*extents = runs;
+	*len = count + listSectors;
+	return (0);
+}
+
+////
+//
+// Function     : loadMetadata
+// Description  : Reads the metadata stream a superblock points at and rebuilds
+//                the free space bitmap and file table from it, along with the
+//                sector checksums saved after it. Every sector the bitmap says
+//                is allocated was written before the unmount that saved it, so
+//                they are all marked as written too
+//
+// Inputs       : super - the superblock read from the disk
+// Outputs      : 0 if successful, -1 if failure
+
+int loadMetadata(FS3Superblock *super){
+	int words = BITMAP_WORDS(fs3TrackSize);
+	uint64_t bitmapBytes = (uint64_t)fs3Tracks * words * sizeof(uint64_t);
+	uint64_t sumBytes = (super->sumCount > 0) ? bitmapBytes + ((uint64_t)super->sumCount * sizeof(uint32_t)) : 0;
+	uint64_t streamSectors = 0;
+	FS3MetaExtent *extents;
+	uint32_t extentsLen;
+	if ((super->streamBytes < bitmapBytes) || (loadExtents(super, &extents, &extentsLen) != 0)){
+		return (-1);
+	}
+	for (uint32_t i=0; i<super->extentCount; i++){
+		streamSectors += extents[i].len;
+	}
+	if ((streamSectors * FS3_SECTOR_SIZE) < super->streamBytes + sumBytes){
+		free(extents);
+		return (-1);
+	}
+
+	//Read the stream run by run
+	char *stream = malloc(streamSectors * FS3_SECTOR_SIZE);
+	if (stream == NULL){
+		free(extents);
+		return (-1);
+	}
+	char *pos = stream;
+	for (uint32_t i=0; i<super->extentCount; i++){
+		for (uint32_t localSec=extents[i].sec; localSec<extents[i].sec + extents[i].len; localSec++){
+			if (readSectorFromDisk(extents[i].trk, localSec, pos) != 0){
+				free(stream);
+				free(extents);
+				return (-1);
+			}
+			pos += FS3_SECTOR_SIZE;
+		}
+	}
+
+	//Free space bitmap, tracks with nothing allocated are left without maps
+	pos = stream;
+	for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+		uint32_t used = 0;
+		for (int w=0; w<words; w++){
+			uint64_t word;
+			memcpy(&word, pos + (w * sizeof(uint64_t)), sizeof(uint64_t));
+			used += __builtin_popcountll(word);
+		}
+		if (used != 0){
+			allocMap[localTrk] = malloc(words * sizeof(uint64_t));
+			writtenMap[localTrk] = malloc(words * sizeof(uint64_t));
+			if ((allocMap[localTrk] == NULL) || (writtenMap[localTrk] == NULL)){
+				free(stream);
+				free(extents);
+				return (-1);
+			}
+			memcpy(allocMap[localTrk], pos, words * sizeof(uint64_t));
+			memcpy(writtenMap[localTrk], pos, words * sizeof(uint64_t));
+			trackUsed[localTrk] = used;
+		}
+		pos += words * sizeof(uint64_t);
+	}
+
+	//Inodes
+	char *end = stream + super->streamBytes;
+	char fileName[FS3_MAX_PATH_LENGTH + 1];
+	bool damaged = false;
+	for (uint32_t f=0; (f<super->fileCount) && (damaged == false); f++){
+		uint16_t nameLen;
+		uint32_t fileLen, extentCount;
+		if ((end - pos) < (long)sizeof(uint16_t)){
+			damaged = true;
+			break;
+		}
+		memcpy(&nameLen, pos, sizeof(uint16_t));
+		pos += sizeof(uint16_t);
+		if ((nameLen > FS3_MAX_PATH_LENGTH) || ((end - pos) < (long)(nameLen + (2 * sizeof(uint32_t))))){
+			damaged = true;
+			break;
+		}
+		memcpy(fileName, pos, nameLen);
+		fileName[nameLen] = '\0';
+		pos += nameLen;
+		memcpy(&fileLen, pos, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
+		memcpy(&extentCount, pos, sizeof(uint32_t));
+		pos += sizeof(uint32_t);
+		int idx = createFile(fileName);
+		if (idx == -1){
+			damaged = true;
+			break;
+		}
+		files[idx].fileLen = fileLen;
+		for (uint32_t e=0; (e<extentCount) && (damaged == false); e++){
+			uint16_t extentTrk, extentSec;
+			uint32_t extentLen;
+			if ((end - pos) < (long)((2 * sizeof(uint16_t)) + sizeof(uint32_t))){
+				damaged = true;
+				break;
+			}
+			memcpy(&extentTrk, pos, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+			memcpy(&extentSec, pos, sizeof(uint16_t));
+			pos += sizeof(uint16_t);
+			memcpy(&extentLen, pos, sizeof(uint32_t));
+			pos += sizeof(uint32_t);
+			if ((extentTrk >= fs3Tracks) || ((extentSec + extentLen) > fs3TrackSize)){
+				damaged = true;
+				break;
+			}
+			if ((files[idx].secNums + extentLen) > files[idx].secCap){
+				int newCap = files[idx].secNums + extentLen;
+				FS3SectorAddress *newSectors = realloc(files[idx].fileSectors, sizeof(FS3SectorAddress) * newCap);
+				if (newSectors == NULL){
+					free(stream);
+					free(extents);
+					return (-1);
+				}
+				files[idx].fileSectors = newSectors;
+				files[idx].secCap = newCap;
+			}
+			for (uint32_t localSec=0; localSec<extentLen; localSec++){
+				files[idx].fileSectors[files[idx].secNums].trk = extentTrk;
+				files[idx].fileSectors[files[idx].secNums].sec = extentSec + localSec;
+				files[idx].secNums++;
+			}
+		}
+		if (damaged == true){
+			break;
+		}
+		uint16_t inlineLen;
+		if ((end - pos) < (long)sizeof(uint16_t)){
+			damaged = true;
+			break;
+		}
+		memcpy(&inlineLen, pos, sizeof(uint16_t));
+		pos += sizeof(uint16_t);
+		if ((inlineLen > 0) && (((end - pos) < (long)inlineLen) || (setInline(idx, pos, inlineLen) != 0))){
+			damaged = true;
+			break;
+		}
+		pos += inlineLen;
+	}
+	if ((damaged == false) && (pos == end) && (super->sumCount > 0) && (loadSums(end, super->sumCount) != 0)){
+		damaged = true;
+	}
+	free(stream);
+	if ((damaged == true) || (pos != end)){
+		FS3_LOG_ERROR("FS3 driver found a damaged inode table.");
+		free(extents);
+		return (-1);
+	}
+
+	free(metaExtents);
+	metaExtents = extents;
+	metaExtentsLen = extentsLen;
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver loaded %u files from a %lu byte metadata stream.", super->fileCount, (unsigned long)super->streamBytes);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadSums
+// Description  : Takes the sector checksums saved after the metadata stream,
+//                the bitmap of the sectors that have one and then the
+//                checksums in the bitmap's order
+//
+// Inputs       : pos - where the checksums start in the stream
+//                count - number of checksums
+// Outputs      : 0 if successful, -1 if failure
+
+int loadSums(char *pos, uint32_t count){
+	int words = BITMAP_WORDS(fs3TrackSize);
+	uint64_t found = 0;
+	char *sums = pos + ((uint64_t)fs3Tracks * words * sizeof(uint64_t));
+	for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+		for (int w=0; w<words; w++){
+			uint64_t bits;
+			memcpy(&bits, pos + ((((uint64_t)localTrk * words) + w) * sizeof(uint64_t)), sizeof(uint64_t));
+			for (; bits!=0; bits&=bits-1){
+				uint32_t localSec = (w * 64) + __builtin_ctzll(bits);
+				if ((localSec >= fs3TrackSize) || (++found > count)){
+					return (-1);
+				}
+				if (sumMap[localTrk] == NULL){
+					sumMap[localTrk] = malloc(sizeof(uint32_t) * fs3TrackSize);
+					sumKnown[localTrk] = calloc(words, sizeof(uint64_t));
+					if ((sumMap[localTrk] == NULL) || (sumKnown[localTrk] == NULL)){
+						return (-1);
+					}
+				}
+				memcpy(&sumMap[localTrk][localSec], sums, sizeof(uint32_t));
+				sumKnown[localTrk][w] |= ((uint64_t)1 << (localSec % 64));
+				sums += sizeof(uint32_t);
+			}
+		}
+	}
+	return ((found == count) ? 0 : -1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadFilesystem
+// Description  : Loads the filesystem from the superblock, then replays the
+//                journal over it to redo the changes made since the last
+//                checkpoint. The geometry is kept in the superblock so it only
+//                has to be negotiated for a disk that has never been formatted
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int loadFilesystem(void){
+	char superBuf[FS3_SECTOR_SIZE];
+	FS3Superblock super;
+	if (readSectorFromDisk(0, 0, superBuf) != 0){
+		return (-1);
+	}
+	memcpy(&super, superBuf, sizeof(FS3Superblock));
+	if (memcmp(super.magic, FS3_META_MAGIC, sizeof(super.magic)) != 0){
+		if ((negotiateGeometry() != 0) || (setupSectorMaps() != 0) || (formatDisk() != 0)){
+			return (-1);
+		}
+		return (setupRing());
+	}
+	if (super.version != FS3_META_VERSION){
+		FS3_LOG_ERROR("FS3 driver cannot mount metadata version %u.", super.version);
+		return (-1);
+	}
+	//A placed disk can be mounted with more controllers than it was written with, the new ones start empty
+	if ((super.parity != (uint32_t)fs3_erasure_parity) || ((super.columnTracks > 0) != (fs3_ring_vnodes > 0)) ||
+			((super.columnTracks == 0) && (super.controllers != (uint32_t)fs3Controllers)) ||
+			(super.controllers > (uint32_t)fs3Controllers)){
+		FS3_LOG_ERROR("FS3 driver: disk is %s over %u controllers with %u parity, not %d with %d.",
+			(super.columnTracks > 0) ? "placed" : "striped", super.controllers, super.parity, fs3Controllers, fs3_erasure_parity);
+		return (-1);
+	}
+	fs3Tracks = super.tracks;
+	fs3TrackSize = super.trackSize;
+	fs3ColumnTracks = super.columnTracks;
+	placeRetired = super.retired;
+	if ((setupSectorMaps() != 0) || (loadMetadata(&super) != 0)){
+		return (-1);
+	}
+
+	fs3_journal_init(0, super.journalStart, super.journalLen, super.checkpointSeq);
+	int records = fs3_journal_replay(applyJournalRecord);
+	if (records < 0){
+		FS3_LOG_ERROR("FS3 driver failed to replay the journal.");
+		return (-1);
+	}
+	//Everything that was replayed is already in the journal
+	for (int i=0; i<filesLen; i++){
+		files[i].jSecs = files[i].secNums;
+		files[i].jLen = files[i].fileLen;
+	}
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver replayed %d journal records.", records);
+
+	//The checksums saved by the last unmount are only right until a sector is written again, and a crash
+	//  before the next unmount would leave them wrong, so the superblock stops pointing at them. Replayed
+	//  records would mean the disk was not unmounted cleanly after all
+	if (super.sumCount > 0){
+		if (records > 0){
+			forgetSums();
+		}
+		FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver loaded %u sector checksums.", (records > 0) ? 0 : super.sumCount);
+		super.sumCount = 0;
+		memset(superBuf, 0, FS3_SECTOR_SIZE);
+		memcpy(superBuf, &super, sizeof(FS3Superblock));
+		if (writeSector(0, 0, superBuf) != 0){
+			return (-1);
+		}
+	}
+	if ((fs3ColumnTracks > 0) && (fs3Tracks < fs3ColumnTracks * fs3Controllers)){
+		FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver adding %d controllers to the placement ring.",
+			fs3Controllers - (int)(fs3Tracks / fs3ColumnTracks));
+		if (growTracks(fs3ColumnTracks * fs3Controllers) != 0){
+			return (-1);
+		}
+	}
+	return (setupRing());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : markDirty
+// Description  : Notes that a file has new sectors or a new length that the
+//                journal has not seen yet
+//
+// Inputs       : idx - index of the file in the file table
+// Outputs      : 0 if successful, -1 if failure
+
+int markDirty(int idx){
+	if (files[idx].jDirty == true){
+		return (0);
+	}
+	if (dirtyFilesLen == dirtyFilesCap){
+		int newCap = (dirtyFilesCap == 0) ? 64 : dirtyFilesCap * 2;
+		int *newDirty = realloc(dirtyFiles, sizeof(int) * newCap);
+		if (newDirty == NULL){
+			return (-1);
+		}
+		dirtyFiles = newDirty;
+		dirtyFilesCap = newCap;
+	}
+	dirtyFiles[dirtyFilesLen] = idx;
+	dirtyFilesLen++;
+	files[idx].jDirty = true;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushDirty
+// Description  : Adds journal entries for what has changed in every dirty file,
+//                the sectors it gained as runs on one track, its inline bytes
+//                and its new length
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int flushDirty(void){
+	char payload[(2 * sizeof(uint16_t)) + sizeof(uint32_t)];
+	for (int d=0; d<dirtyFilesLen; d++){
+		int idx = dirtyFiles[d];
+		if ((files[idx].fileName == NULL) || (files[idx].jDirty == false)){
+			continue;
+		}
+		for (int j=files[idx].jSecs; j<files[idx].secNums; ){
+			uint16_t extentTrk = files[idx].fileSectors[j].trk;
+			uint16_t extentSec = files[idx].fileSectors[j].sec;
+			uint32_t extentLen = 1;
+			while (((j + extentLen) < files[idx].secNums) && (files[idx].fileSectors[j + extentLen].trk == extentTrk) &&
+					(files[idx].fileSectors[j + extentLen].sec == extentSec + extentLen)){
+				extentLen++;
+			}
+			memcpy(payload, &extentTrk, sizeof(uint16_t));
+			memcpy(payload + sizeof(uint16_t), &extentSec, sizeof(uint16_t));
+			memcpy(payload + (2 * sizeof(uint16_t)), &extentLen, sizeof(uint32_t));
+			if (fs3_journal_append(FS3_JREC_EXTEND, files[idx].fileName, payload, sizeof(payload)) != 0){
+				return (-1);
+			}
+			j += extentLen;
+		}
+		if ((files[idx].inlineDirty == true) &&
+				(fs3_journal_append(FS3_JREC_INLINE, files[idx].fileName, files[idx].inlineData, files[idx].inlineLen) != 0)){
+			return (-1);
+		}
+		if (files[idx].fileLen != files[idx].jLen){
+			uint32_t fileLen = files[idx].fileLen;
+			if (fs3_journal_append(FS3_JREC_SETLEN, files[idx].fileName, &fileLen, sizeof(uint32_t)) != 0){
+				return (-1);
+			}
+		}
+		files[idx].jSecs = files[idx].secNums;
+		files[idx].jLen = files[idx].fileLen;
+		files[idx].jDirty = false;
+		files[idx].inlineDirty = false;
+	}
+	dirtyFilesLen = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : commitMetadata
+// Description  : Group commit, everything that changed since the last commit
+//                is written to the journal as one record. When the record does
+//                not fit in the journal, or the journal is three quarters full
+//                after it, the metadata is checkpointed instead so the journal
+//                can start over. A checkpoint that fails once the record is on
+//                the disk does not fail the commit, it is tried again by the
+//                next one
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int commitMetadata(void){
+	metaChanges = 0;
+	if ((flushWriteBuffers() != 0) || (flushDirty() != 0)){
+		return (-1);
+	}
+	//A checkpoint takes everything pending with it, if it fails again the changes still go to the journal
+	if ((checkpointDue == true) && (checkpoint(false) == 0)){
+		return (0);
+	}
+	if (fs3_journal_pending() == 0){
+		return (0);
+	}
+	if (fs3_journal_fits() == 0){
+		return (checkpoint(false));
+	}
+	if (fs3_journal_commit() != 0){
+		return (-1);
+	}
+	if ((checkpointDue == false) && (fs3_journal_used() > ((journalSectors() * 3) / 4)) && (checkpoint(false) != 0)){
+		FS3_LOG_ERROR("FS3 driver failed to checkpoint the metadata, it is tried again at the next commit.");
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkpoint
+// Description  : Writes all of the metadata to the disk, after which nothing
+//                in the journal is needed and it starts over
+//
+// Inputs       : clean - the disk is being unmounted, so nothing more will be
+//                written and the sector checksums can be saved too
+// Outputs      : 0 if successful, -1 if failure
+
+int checkpoint(bool clean){
+	if ((flushWriteBuffers() != 0) || (saveMetadata(clean) != 0)){
+		checkpointDue = true;
+		return (-1);
+	}
+	checkpointDue = false;
+	for (int i=0; i<filesLen; i++){
+		files[i].jSecs = files[i].secNums;
+		files[i].jLen = files[i].fileLen;
+		files[i].jDirty = false;
+		files[i].inlineDirty = false;
+	}
+	dirtyFilesLen = 0;
+	metaChanges = 0;
+	return (fs3_journal_reset());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : deleteFile
+// Description  : Gives all of a closed file's sectors back to the disk and
+//                takes it out of the file table, its slot is kept for the next
+//                file that is created
+//
+// Inputs       : idx - index of the file in the file table
+// Outputs      : 0 if successful, -1 if failure
+
+int deleteFile(int idx){
+	if (releaseFileSectors(idx, 0) != 0){
+		return (-1);
+	}
+	removeFile(idx);
+	free(files[idx].fileName);
+	free(files[idx].fileSectors);
+	free(files[idx].inlineData);
+	free(files[idx].wcBuf);
+	memset(&files[idx], 0, sizeof(struct fileData));
+	freeFileSlots[freeFileSlotsLen] = idx;
+	freeFileSlotsLen++;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : truncateFile
+// Description  : Shortens a file, giving the sectors past its new end back to
+//                the disk. A new end inside the inline bytes only shortens
+//                them, one inside the sectors drops them
+//
+// Inputs       : idx - index of the file in the file table
+//                len - new length of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int truncateFile(int idx, uint32_t len){
+	uint32_t base = files[idx].secNums * FS3_SECTOR_SIZE;
+	if ((files[idx].inlineLen > 0) && (len >= base)){
+		files[idx].inlineLen = len - base;
+	}
+	else{
+		files[idx].inlineLen = 0;
+		int keep = (len + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+		if (releaseFileSectors(idx, keep) != 0){
+			return (-1);
+		}
+		if (files[idx].jSecs > keep){
+			files[idx].jSecs = keep;
+		}
+	}
+	files[idx].fileLen = len;
+	if (files[idx].filePos > len){
+		files[idx].filePos = len;
+	}
+	files[idx].jLen = len;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : misplacedSectors
+// Description  : Counts the sectors of a file that are not on a column
+//
+// Inputs       : idx - index of the file in the file table
+//                home - the column
+// Outputs      : the number of sectors
+
+int misplacedSectors(int idx, int home){
+	int misplaced = 0;
+	for (int i=0; i<files[idx].secNums; i++){
+		if ((files[idx].fileSectors[i].trk / fs3ColumnTracks) != (uint32_t)home){
+			misplaced++;
+		}
+	}
+	return (misplaced);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : migrateFile
+// Description  : Moves the sectors of a closed file that are not on its home
+//                column to new sectors there. The new sectors are written
+//                before the journal hears of them, and the change is committed
+//                at once as a truncate to nothing followed by the file's whole
+//                sector list, so a replay finds the file either where it was or
+//                where it went
+//
+// Inputs       : idx - index of the file in the file table
+//                home - the column the file belongs on
+// Outputs      : number of sectors moved, 0 if there was no room on the home
+//                column, -1 if failure
+
+int migrateFile(int idx, int home){
+	struct fileData *file = &files[idx];
+	FS3SectorAddress *newSectors = malloc(sizeof(FS3SectorAddress) * file->secCap);
+	FS3SectorAddress *oldAddrs = malloc(sizeof(FS3SectorAddress) * file->secNums);
+	FS3SectorAddress *newAddrs = malloc(sizeof(FS3SectorAddress) * file->secNums);
+	char *copyBuf = malloc((size_t)FS3_REBALANCE_CHUNK * FS3_SECTOR_SIZE);
+	char *copyBufs[FS3_REBALANCE_CHUNK];
+	int moved = 0, result = 0;
+	if ((newSectors == NULL) || (oldAddrs == NULL) || (newAddrs == NULL) || (copyBuf == NULL)){
+		result = -1;
+	}
+	else{
+		//Sectors already on the home column stay where they are, the others are given the next free
+		//  sectors there in file order so they end up in runs
+		memcpy(newSectors, file->fileSectors, sizeof(FS3SectorAddress) * file->secNums);
+		uint32_t localTrk = home * fs3ColumnTracks, lastTrk = localTrk + fs3ColumnTracks, from = 0, start = 0;
+		for (int i=0; (i<file->secNums) && (result == 0); i++){
+			if ((file->fileSectors[i].trk / fs3ColumnTracks) == (uint32_t)home){
+				continue;
+			}
+			while ((localTrk < lastTrk) && ((trackUsed[localTrk] == fs3TrackSize) ||
+					((findFreeRun(localTrk, from, 1, 1, &start) == 0) && (findFreeRun(localTrk, 0, 1, 1, &start) == 0)))){
+				localTrk++;
+				from = 0;
+			}
+			if (localTrk == lastTrk){
+				result = 1;
+			}
+			else if (markRunAllocated(localTrk, start, 1) != 0){
+				result = -1;
+			}
+			else{
+				newSectors[i].trk = localTrk;
+				newSectors[i].sec = start;
+				from = start + 1;
+				oldAddrs[moved] = file->fileSectors[i];
+				newAddrs[moved] = newSectors[i];
+				moved++;
+			}
+		}
+
+		//Copied a chunk at a time, the old contents come through the cache and the write queue
+		for (int c=0; (c<moved) && (result == 0); c+=FS3_REBALANCE_CHUNK){
+			int len = ((moved - c) < FS3_REBALANCE_CHUNK) ? (moved - c) : FS3_REBALANCE_CHUNK;
+			for (int j=0; j<len; j++){
+				copyBufs[j] = copyBuf + ((size_t)j * FS3_SECTOR_SIZE);
+			}
+			if ((getSectors(&oldAddrs[c], copyBuf, len) != 0) || (transferSectors(FS3_OP_WRSECT, &newAddrs[c], copyBufs, len) != 0)){
+				result = -1;
+			}
+		}
+	}
+
+	if (result != 0){
+		//The file stays where it was and the sectors it was given go back
+		for (int j=0; j<moved; j++){
+			freeSector(&newAddrs[j]);
+		}
+	}
+	else{
+		uint32_t len = 0;
+		if ((flushDirty() != 0) || (fs3_journal_append(FS3_JREC_TRUNCATE, file->fileName, &len, sizeof(uint32_t)) != 0)){
+			result = -1;
+		}
+		for (int j=0; (j<moved) && (result == 0); j++){
+			if (freeSector(&oldAddrs[j]) != 0){
+				result = -1;
+			}
+		}
+		if (result == 0){
+			free(file->fileSectors);
+			file->fileSectors = newSectors;
+			newSectors = NULL;
+			file->jSecs = 0;
+			file->jLen = 0;
+			file->inlineDirty = (file->inlineLen > 0);
+			if ((markDirty(idx) != 0) || (commitMetadata() != 0)){
+				result = -1;
+			}
+		}
+	}
+	free(newSectors);
+	free(oldAddrs);
+	free(newAddrs);
+	free(copyBuf);
+	if (result != 0){
+		return ((result == 1) ? 0 : -1);
+	}
+	rebalanceSectors += moved;
+	rebalanceFiles++;
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rebalance
+// Description  : Carries on the rebalancer's pass over the file table, moving
+//                closed files that are not on their home column until about
+//                "budget" sectors have been moved. A pass that moves nothing
+//                means every file is home (or there is no room for it there)
+//                and the rebalancer stops until the ring changes again. Open
+//                files are moved once a later pass finds them closed
+//
+// Inputs       : budget - sectors to move before stopping
+// Outputs      : number of sectors moved, -1 if failure
+
+int rebalance(uint32_t budget){
+	uint32_t moved = 0;
+	for (int scanned=0; (rebalancePending == true) && (moved < budget) && (scanned <= filesLen); scanned++){
+		if (rebalanceCursor >= filesLen){
+			rebalanceCursor = 0;
+			rebalancePending = rebalanceFound;
+			rebalanceFound = false;
+			continue;
+		}
+		int idx = rebalanceCursor;
+		rebalanceCursor++;
+		if ((files[idx].fileName == NULL) || (files[idx].secNums == 0) ||
+				(misplacedSectors(idx, fileHome(idx)) == 0)){
+			continue;
+		}
+		if (files[idx].fileHandle != 0){
+			rebalanceFound = true;
+			continue;
+		}
+		int result = migrateFile(idx, fileHome(idx));
+		if (result < 0){
+			return (-1);
+		}
+		if (result > 0){
+			rebalanceFound = true;
+			moved += result;
+		}
+	}
+	return (moved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setControllerMember
+// Description  : Puts a column of a placed disk on the placement ring or takes
+//                it off. Only the files whose names the change moves to another
+//                column have to go, the rebalancer moves them as files are
+//                closed. The change is checkpointed so it lasts
+//
+// Inputs       : ctrl - the column
+//                member - true to put it on the ring, false to take it off
+// Outputs      : 0 if successful, -1 if failure
+
+int setControllerMember(int ctrl, bool member){
+	if ((mounted == 0) || (fs3ColumnTracks == 0) || (ctrl < 0) || (ctrl >= fs3Controllers)){
+		return (-1);
+	}
+	if (fs3_ring_member(ctrl) == member){
+		return (0);
+	}
+	if (member == true){
+		if (fs3_ring_add(ctrl) != 0){
+			return (-1);
+		}
+		placeRetired &= ~(1u << ctrl);
+	}
+	else{
+		//Some column has to be left for the files
+		if ((fs3_ring_nodes() == 1) || (fs3_ring_remove(ctrl) != 0)){
+			return (-1);
+		}
+		placeRetired |= (1u << ctrl);
+	}
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver %s controller %d %s the placement ring.",
+		(member == true) ? "put" : "took", ctrl, (member == true) ? "on" : "off");
+	rebalanceCursor = 0;
+	rebalanceFound = false;
+	rebalancePending = true;
+	return (checkpoint(false));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : columnUsage
+// Description  : Counts the allocated sectors on each column of a placed disk
 //
-// Inputs       : fd - fileHandle of file to look for
-//				  fileName - fileName of file to look for
-//				  len - length of array of files
-//
-// Outputs      : fileHandle if file is found, -1 if failure
+// Inputs       : sectors - filled in with the count for each column
+// Outputs      : number of columns, -1 if files are not placed
 
-int findFile(int fd, char *fileName){
-	//Invalid fileHandle inputted
-	if (fd > filesLen){
+int columnUsage(uint64_t *sectors){
+	if ((fs3ColumnTracks == 0) || (trackUsed == NULL)){
 		return (-1);
 	}
-	//The file might already be open, but open was called again so need to find a file with the same fileName
-	if (fd == 0){
-		int i;
-		for (i=10; i<filesLen; i++){
-			if (files[i].fileName == fileName){
-				files[i].fileOpen = true;
-				fs3_seek(files[i].fileHandle, 0);
-				return (files[i].fileHandle);
-			}
-		}
+	for (int col=0; col<fs3Controllers; col++){
+		sectors[col] = 0;
 	}
-	return (-1);
+	for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+		sectors[localTrk / fs3ColumnTracks] += trackUsed[localTrk];
+	}
+	return (fs3Controllers);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : updateSPace
-// Description  : Updates the global variables for available space
-//
-// Inputs       : None
+// Function     : applyJournalRecord
+// Description  : Redoes one journal entry while the journal is replayed. The
+//                sectors a file gained were written before the entry was
+//                committed so they are marked as written
 //
-// Outputs      : 0 if update was a success, -1 if failure
+// Inputs       : type - what kind of change the entry records
+//                name - name of the file that changed
+//                payload - the details of the change
+//                payloadLen - number of bytes in the payload
+// Outputs      : 0 if successful, -1 if failure
 
-int updateSpace(){
-	if ((nextSecAvailable == 0) && (nextTrkAvailable == 0)){
-		nextSecAvailable++;
-		return (0);
+int applyJournalRecord(uint8_t type, char *name, char *payload, uint16_t payloadLen){
+	int idx = findFile(name);
+	if (type == FS3_JREC_CREATE){
+		return ((idx != -1) || (createFile(name) != -1)) ? 0 : -1;
+	}
+	if (idx == -1){
+		return (-1);
 	}
-	if ((nextSecAvailable + 1) > (FS3_TRACK_SIZE - 1)){
-		nextTrkAvailable++;
-		nextSecAvailable = 0;
+	if ((type == FS3_JREC_EXTEND) && (payloadLen == (2 * sizeof(uint16_t)) + sizeof(uint32_t))){
+		uint16_t extentTrk, extentSec;
+		uint32_t extentLen;
+		memcpy(&extentTrk, payload, sizeof(uint16_t));
+		memcpy(&extentSec, payload + sizeof(uint16_t), sizeof(uint16_t));
+		memcpy(&extentLen, payload + (2 * sizeof(uint16_t)), sizeof(uint32_t));
+		if ((extentTrk >= fs3Tracks) || ((extentSec + extentLen) > fs3TrackSize) ||
+				(markRunAllocated(extentTrk, extentSec, extentLen) != 0)){
+			return (-1);
+		}
+		if ((files[idx].secNums + extentLen) > files[idx].secCap){
+			int newCap = files[idx].secNums + extentLen;
+			FS3SectorAddress *newSectors = realloc(files[idx].fileSectors, sizeof(FS3SectorAddress) * newCap);
+			if (newSectors == NULL){
+				return (-1);
+			}
+			files[idx].fileSectors = newSectors;
+			files[idx].secCap = newCap;
+		}
+		for (uint32_t localSec=extentSec; localSec<extentSec + extentLen; localSec++){
+			files[idx].fileSectors[files[idx].secNums].trk = extentTrk;
+			files[idx].fileSectors[files[idx].secNums].sec = localSec;
+			files[idx].secNums++;
+			markSectorWritten(extentTrk, localSec);
+		}
 		return (0);
 	}
-	else{
-		nextSecAvailable++;
+	if (((type == FS3_JREC_SETLEN) || (type == FS3_JREC_TRUNCATE)) && (payloadLen == sizeof(uint32_t))){
+		uint32_t len;
+		memcpy(&len, payload, sizeof(uint32_t));
+		if (type == FS3_JREC_TRUNCATE){
+			return (truncateFile(idx, len));
+		}
+		files[idx].fileLen = len;
 		return (0);
 	}
+	if (type == FS3_JREC_INLINE){
+		return (setInline(idx, payload, payloadLen));
+	}
+	if (type == FS3_JREC_DELETE){
+		return (deleteFile(idx));
+	}
 	return (-1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : fileLocation
-// Description  : Finds where a file has data on the disk
+// Function     : injectCrash
+// Description  : Crash injection for testing recovery, after the given number
+//                of sector writes every read and write fails as if the client
+//                had died at that point
 //
-// Inputs       : fd - fileHandle of file to look for
-//				  localSec - sector to start at
-//				  localTrk - track to start at
-//
-// Outputs      : 0 if successful search, -1 if failure
+// Inputs       : writes - sector writes allowed before the crash, -1 to turn it off
+// Outputs      : 0 if successful, -1 if failure
 
-int fileLocation(int fd, uint16_t localSec, uint_fast32_t localTrk){
-	int i; //equals sector
-	int j; //equals track
-	//Loop for track
-	for (j=localTrk; j<FS3_MAX_TRACKS; j++){
-		//Loop for sector in track
-		for (i=localSec; i<FS3_TRACK_SIZE; i++){
-			if (files[fd].fileStorage[j][i] == 1){
-				sec = i;
-				trk = j;
-				return (0);
-			}
-		}
-		localSec = 0;
-	}
-	return (-1);
+int injectCrash(int64_t writes){
+	crashCountdown = writes;
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : construct_fs3_cmdblock
-// Description  : constructs the command block that will be used
+// Function     : dropDriverState
+// Description  : Frees the file table, handles and sector maps, leaving the
+//                driver as it was before the first mount
 //
-// Inputs       : op - operator code
-//				  sec - sector number
-//				  trk - track number
-//				  ret - return value (typically zero)
-// Outputs      : the constructed command block
-
-FS3CmdBlk construct_fs3_cmdblock(uint8_t op, uint16_t sec, uint_fast32_t trk, uint8_t ret){
-	//create variables for command blocks that will be used
-	uint64_t cmdBlock = 0;
-	uint64_t temp = 0;
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
 
-	//repeated process -> make temp have the different components in the correct spot and or "|" it with cmdBlock
-	//  each part will be surrounded by 0's which when or'd with cmdBlock will give the correct cmdBlock back
-	cmdBlock = op;
-	cmdBlock = cmdBlock << 60;
-	temp = sec;
-	temp = temp << 44;
-	cmdBlock = cmdBlock | temp;
-	temp = trk;
-	temp = temp << 12;
-	cmdBlock = cmdBlock | temp;
-	temp = ret;
-	temp = temp << 11;
-	cmdBlock = cmdBlock | temp;
-	cmdBlock = cmdBlock | unusedBits;
-	return cmdBlock;
+int dropDriverState(void){
+	for (int i=0; i<filesLen; i++){
+		free(files[i].fileName);
+		free(files[i].fileSectors);
+		free(files[i].inlineData);
+		free(files[i].wcBuf);
+	}
+	free(files);
+	free(freeFileSlots);
+	free(handleTable);
+	free(freeHandles);
+	free(fileBuckets);
+	free(dirtyFiles);
+	files = NULL;
+	freeFileSlots = NULL;
+	handleTable = NULL;
+	freeHandles = NULL;
+	fileBuckets = NULL;
+	dirtyFiles = NULL;
+	filesLen = filesCap = freeFileSlotsLen = 0;
+	handleTableLen = freeHandlesLen = fileBucketsLen = 0;
+	dirtyFilesLen = dirtyFilesCap = metaChanges = 0;
+	checkpointDue = false;
+	nextHandle = 1;
+	for (uint32_t i=0; i<fs3Tracks; i++){
+		if (writtenMap != NULL){
+			free(writtenMap[i]);
+		}
+		if (allocMap != NULL){
+			free(allocMap[i]);
+		}
+	}
+	forgetSums();
+	free(writtenMap);
+	free(allocMap);
+	free(trackUsed);
+	free(sumMap);
+	free(sumKnown);
+	writtenMap = NULL;
+	allocMap = NULL;
+	trackUsed = NULL;
+	sumMap = NULL;
+	sumKnown = NULL;
+	allocTrk = 0;
+	free(metaExtents);
+	metaExtents = NULL;
+	metaExtentsLen = 0;
+	fs3ColumnTracks = 0;
+	placeRetired = 0;
+	rebalancePending = false;
+	resetHeads();
+	return (0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : deconstruct_fs3_cmdblock
-// Description  : 
+// Function     : remountAfterCrash
+// Description  : Recovers from an injected crash, everything the driver holds
+//                in memory is thrown away (including the cache and the write
+//                queue, which hold writes that never reached the disk) and the
+//                filesystem is loaded back from the superblock and journal over
+//                the same connection to the controller
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
-int deconstruct_fs3_cmdblock(FS3CmdBlk *cmdBlock, uint8_t op, uint16_t sec, uint32_t trk, uint8_t ret){
-	//Generate a destroyBlock that contains 0's in every place that we don't want the value of
-	// then shift to get proper value
-	//Getting ret value
-	FS3CmdBlk destroyBlock = construct_fs3_cmdblock(0, 0, 0, 1);
-	ret = (*cmdBlock & destroyBlock) >> 11;
+int remountAfterCrash(void){
+	crashCountdown = -1;
+	fs3_close_cache();
+	fs3_sched_close();
+	dropDriverState();
+	return (loadFilesystem());
+}
 
-	//Getting trk value
-	destroyBlock = construct_fs3_cmdblock(0, 0, (uint32_t)pow(2.0, 32.0), 0);
-	trk = (*cmdBlock & destroyBlock) >> 12;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : claimSector
+// Description  : Sets a sector's bit in a bitmap covering the whole disk
+//
+// Inputs       : bitmap - the bitmap, BITMAP_WORDS(fs3TrackSize) words per track
+//                localTrk - track the sector is on
+//                localSec - the sector
+// Outputs      : 1 if the sector was already set, 0 if not
 
-	//Getting sec value
-	destroyBlock = construct_fs3_cmdblock(0, (uint16_t)pow(2.0,16.0), 0, 0);
-	sec = (*cmdBlock & destroyBlock) >> 44;
+int claimSector(uint64_t *bitmap, uint32_t localTrk, uint32_t localSec){
+	uint64_t *word = &bitmap[(localTrk * BITMAP_WORDS(fs3TrackSize)) + (localSec / 64)];
+	uint64_t bit = ((uint64_t)1 << (localSec % 64));
+	int claimed = ((*word & bit) != 0) ? 1 : 0;
+	*word |= bit;
+	return (claimed);
+}
 
-	//Getting op value
-	destroyBlock = construct_fs3_cmdblock((uint8_t)pow(2.0, 4.0), 0, 0, 0);
-	op = (*cmdBlock & destroyBlock) >> 60;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : checkAllocation
+// Description  : Rebuilds the free space bitmap from the superblock, journal,
+//                metadata stream, files and reserved runs and compares it with
+//                the one the driver keeps. A sector claimed twice also counts
+//
+// Inputs       : none
+// Outputs      : number of sectors in disagreement, -1 if failure
 
-	return ret;
+int checkAllocation(void){
+	int words = BITMAP_WORDS(fs3TrackSize);
+	int problems = 0;
+	uint64_t *expected = calloc((uint64_t)fs3Tracks * words, sizeof(uint64_t));
+	if (expected == NULL){
+		return (-1);
+	}
+	for (uint32_t localSec=0; localSec<1 + journalSectors(); localSec++){
+		problems += claimSector(expected, 0, localSec);
+	}
+	for (uint32_t i=0; i<metaExtentsLen; i++){
+		for (uint32_t localSec=metaExtents[i].sec; localSec<metaExtents[i].sec + metaExtents[i].len; localSec++){
+			problems += claimSector(expected, metaExtents[i].trk, localSec);
+		}
+	}
+	for (int i=0; i<filesLen; i++){
+		for (int j=0; j<files[i].secNums; j++){
+			problems += claimSector(expected, files[i].fileSectors[j].trk, files[i].fileSectors[j].sec);
+		}
+		for (uint32_t localSec=files[i].resvNext; localSec<files[i].resvEnd; localSec++){
+			problems += claimSector(expected, files[i].resvTrk, localSec);
+		}
+	}
+	for (uint32_t localTrk=0; localTrk<fs3Tracks; localTrk++){
+		for (int w=0; w<words; w++){
+			uint64_t actual = (allocMap[localTrk] != NULL) ? allocMap[localTrk][w] : 0;
+			problems += __builtin_popcountll(actual ^ expected[(localTrk * words) + w]);
+		}
+	}
+	free(expected);
+	return (problems);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : abandonMount
+// Description  : Backs out of a mount that failed after the controller took
+//                the MOUNT, unmounting it again and closing the trace and span
+//                files the mount opened
+//
+// Inputs       : none
+// Outputs      : none
+
+void abandonMount(void){
+	FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_UMOUNT, 0, 0, 0);
+	FS3CmdBlk rtnBlock;
+	network_fs3_syscall(cmdBlock, &rtnBlock, NULL);
+	fs3_trace_close();
+	fs3_span_close();
+}
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -218,16 +3303,63 @@ int deconstruct_fs3_cmdblock(FS3CmdBlk *cmdBlock, uint8_t op, uint16_t sec, uint
 int32_t fs3_mount_disk(void) {
 	//mount the disk
 	if (mounted == 0){
-		FS3CmdBlk cmdBlock = construct_fs3_cmdblock(FS3_OP_MOUNT, 0, 0, 0);
+		//An erasure coded disk needs a controller for every shard of a stripe, and keeps going with up to
+		//  fs3_erasure_parity of them down
+		if (fs3_erasure_parity > 0){
+			if ((fs3_network_replicas != 1) || (fs3_network_controllers != fs3_erasure_data + fs3_erasure_parity) ||
+					(fs3_erasure_init(fs3_erasure_data, fs3_erasure_parity) != 0)){
+				FS3_LOG_ERROR("FS3 driver cannot erasure code %d data and %d parity shards over %d controllers.",
+					fs3_erasure_data, fs3_erasure_parity, fs3_network_controllers);
+				return (-1);
+			}
+			fs3_network_spares = fs3_erasure_parity;
+		}
+		//Files are either placed on controllers whole or spread over them by erasure coded stripes
+		if ((fs3_ring_vnodes > 0) && ((fs3_erasure_parity > 0) || (fs3_ring_vnodes > FS3_RING_MAX_VNODES))){
+			FS3_LOG_ERROR("FS3 driver cannot place files with %d points per controller.", fs3_ring_vnodes);
+			return (-1);
+		}
+		//Leases come from a broker in front of a single controller
+		if ((fs3_lease_enabled == true) && ((fs3_network_controllers != 1) || (fs3_lease_reset() != 0))){
+			FS3_LOG_ERROR("FS3 driver cannot hold leases over %d controllers.", fs3_network_controllers);
+			return (-1);
+		}
+		if ((fs3_trace_open() != 0) || (fs3_span_open() != 0)){
+			return (-1);
+		}
+		FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_MOUNT, 0, 0, 0);
 		FS3CmdBlk *rtnBlock = &cmdBlock;
-		network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-		
+		if (network_fs3_syscall(cmdBlock, rtnBlock, NULL) != 0){
+			fs3_trace_close();
+			fs3_span_close();
+			return (-1);
+		}
+
 		//value returend here will be the ret value that fs3_syscall gave back
-		int32_t retValue = deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_MOUNT, 0, 0, 0);
-		if (retValue == 0){
-			mounted = 1;
+		int32_t retValue = fs3_cmd_ret(*rtnBlock);
+		if (retValue != 0){
+			abandonMount();
+			return (-1);
 		}
-		return retValue;
+		//Heads start in the neutral position after a mount
+		resetHeads();
+		fs3Controllers = (fs3_erasure_parity > 0) ? fs3_erasure_data : fs3_network_columns();
+
+		//The first mount loads the filesystem from the disk, a failed load must not
+		//leave maps behind or the next mount would skip loading and checkpoint over it
+		if ((writtenMap == NULL) && (loadFilesystem() != 0)){
+			fs3_close_cache();
+			fs3_sched_close();
+			dropDriverState();
+			abandonMount();
+			return (-1);
+		}
+		//Other clients sharing the disk may have written anywhere since the last mount
+		if (fs3_lease_enabled == true){
+			forgetSums();
+		}
+		mounted = 1;
+		return (0);
 	}
 	return (-1);
 }
@@ -243,12 +3375,30 @@ int32_t fs3_mount_disk(void) {
 int32_t fs3_unmount_disk(void) {
 	//unmount disk
 	if (mounted == 1){
-		FS3CmdBlk cmdBlock = construct_fs3_cmdblock(FS3_OP_UMOUNT, 0, 0, 0);
+		//Files left open give back their reserved runs
+		for (int i=0; i<filesLen; i++){
+			if (files[i].fileHandle != 0){
+				releaseWindow(i);
+			}
+		}
+		FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver: %lu track seeks, %lu sector reads, %lu sector writes, %lu checksums checked",
+			(unsigned long)seekCount, (unsigned long)readCount, (unsigned long)writeCount, (unsigned long)sumChecks);
+		if (fs3ColumnTracks > 0){
+			FS3_LOG_INFO(FS3DriverLLevel, "FS3 driver: rebalancer moved %lu files (%lu sectors)",
+				(unsigned long)rebalanceFiles, (unsigned long)rebalanceSectors);
+		}
+		//The file table and free space bitmap are written out so the files are still there at the next mount
+		if (checkpoint(true) != 0){
+			return (-1);
+		}
+		FS3CmdBlk cmdBlock = fs3_cmd_encode(FS3_OP_UMOUNT, 0, 0, 0);
 		FS3CmdBlk *rtnBlock = &cmdBlock;
 		network_fs3_syscall(cmdBlock, rtnBlock, NULL);
+		fs3_trace_close();
+		fs3_span_close();
 
 		//value returned here will be the ret value that fs3_syscall gave back
-		int32_t retValue = deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_UMOUNT, 0, 0, 0);
+		int32_t retValue = fs3_cmd_ret(*rtnBlock);
 		if (retValue == 0){
 			mounted = 0;
 		}
@@ -266,29 +3416,48 @@ int32_t fs3_unmount_disk(void) {
 // Outputs      : file handle if successful, -1 if failure
 
 int16_t fs3_open(char *path) {
+	FS3_SPAN("driver", "fs3_open");
 	//Checking if disk is mounted
 	if (mounted == 0){
 		return (-1);
 	}
+	//The metadata stream and journal cannot hold a longer name, a file with one could never be mounted again
+	if (strlen(path) > FS3_MAX_PATH_LENGTH){
+		FS3_LOG_ERROR("FS3 driver: file name longer than %d characters.", FS3_MAX_PATH_LENGTH);
+		return (-1);
+	}
 
-	//Find file to see if it is already open, then handle accordingly
-	int fileHandleRtn = findFile(0, path);
-	if (fileHandleRtn != -1){
-		return (fileHandleRtn);
+	//Find file to see if it already exists, then handle accordingly
+	int idx = findFile(path);
+	if (idx != -1){
+		//The file might already be open, in that case it keeps its handle
+		if (files[idx].fileHandle == 0){
+			if (allocateHandle(idx) == -1){
+				return (-1);
+			}
+		}
+		files[idx].filePos = 0;
+		return (files[idx].fileHandle);
 	}
 	else{
-		//File is not open yet, so we need to open one and create its' data
-		files[nextHandle].fileName = path;
-		files[nextHandle].fileHandle = nextHandle;
-		files[nextHandle].fileOpen = true;
-		files[nextHandle].filePos = 0;
-		files[nextHandle].fileLen = 0;
-		files[nextHandle].fileStorage[nextTrkAvailable][nextSecAvailable] = 1;
-		files[nextHandle].secNums++;
-		updateSpace();
-		fileHandleRtn = nextHandle;
-		nextHandle++;
-		return (fileHandleRtn);
+		//File does not exist yet, so we need to create its' data. Its first sector is given to it by its
+		//  first write so empty files take up no space on the disk
+		idx = createFile(path);
+		if (idx == -1){
+			return (-1);
+		}
+		//Nothing on the disk will ever know of a file without its record, so it is taken back out of the table
+		if (fs3_journal_append(FS3_JREC_CREATE, path, NULL, 0) != 0){
+			deleteFile(idx);
+			return (-1);
+		}
+		//The record stays pending in the journal if the group commit fails, and goes to the disk with the next
+		//  commit, so the file is kept and the open still succeeds
+		metaChanges++;
+		if ((metaChanges >= FS3_JOURNAL_GROUP) && (commitMetadata() != 0)){
+			FS3_LOG_ERROR("FS3 driver failed to commit metadata, it is tried again at the next commit.");
+		}
+		return (allocateHandle(idx));
 	}
 	return (-1);
 }
@@ -302,31 +3471,94 @@ int16_t fs3_open(char *path) {
 // Outputs      : 0 if successful, -1 if failure
 
 int16_t fs3_close(int16_t fd) {
+	FS3_SPAN("driver", "fs3_close");
 	//Checking if disk is mounted
 	if (mounted ==0){
 		return (-1);
 	}
 	//Checking if fd is valid
-	if (fd > filesLen){
+	int idx = fileIndex(fd);
+	if (idx == -1){
 		return (-1);
 	}
-	if (fd < 10){
+	//The file is done being written for now, so its last collected sector is written, the rest of its
+	//  reserved run goes back to the disk and its changes are committed
+	if ((flushWriteBuffer(idx) != 0) || (releaseWindow(idx) != 0) || (commitMetadata() != 0)){
 		return (-1);
 	}
-	//Closing the file that is opened (if it is open)
-	if (files[fd].fileHandle == fd){
-		if (files[fd].fileOpen == true){
-			files[fd].fileOpen = false;
-			return (0);
-		}
+	free(files[idx].wcBuf);
+	files[idx].wcBuf = NULL;
+	//Closing the file and putting its handle back to be reused
+	files[idx].fileHandle = 0;
+	handleTable[fd] = -1;
+	freeHandles[freeHandlesLen] = fd;
+	freeHandlesLen++;
+	//Files left on the wrong column by a change to the placement ring are moved a few at a time
+	if ((rebalancePending == true) && (rebalance(FS3_REBALANCE_BUDGET) < 0)){
+		return (-1);
 	}
-	return (-1);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_delete
+// Description  : This function deletes a file, giving all of its sectors back
+//                to the disk. An open file is closed first
+//
+// Inputs       : path - filename of the file to delete
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t fs3_delete(char *path) {
+	//Checking if disk is mounted
+	if (mounted == 0){
+		return (-1);
+	}
+	int idx = findFile(path);
+	if (idx == -1){
+		return (-1);
+	}
+	if ((files[idx].fileHandle != 0) && (fs3_close(files[idx].fileHandle) != 0)){
+		return (-1);
+	}
+	//Committed straight away, the freed sectors must not be reused while the journal still gives them to the file
+	if ((fs3_journal_append(FS3_JREC_DELETE, path, NULL, 0) != 0) || (deleteFile(idx) != 0)){
+		return (-1);
+	}
+	return (commitMetadata());
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_truncate
+// Description  : This function shortens a file to len bytes, giving the sectors
+//                past the new end back to the disk. Files can only be shortened
+//
+// Inputs       : fd - the file descriptor
+//                len - new length of the file
+// Outputs      : 0 if successful, -1 if failure
+
+int32_t fs3_truncate(int16_t fd, uint32_t len) {
+	//Checking if disk is mounted
+	if (mounted == 0){
+		return (-1);
+	}
+	int idx = fileIndex(fd);
+	if ((idx == -1) || (len > files[idx].fileLen)){
+		return (-1);
+	}
+	//Committed straight away like a delete, after anything the file gained before it
+	if ((flushWriteBuffer(idx) != 0) || (flushDirty() != 0) || (fs3_journal_append(FS3_JREC_TRUNCATE, files[idx].fileName, &len, sizeof(uint32_t)) != 0) ||
+			(truncateFile(idx, len) != 0)){
+		return (-1);
+	}
+	return (commitMetadata());
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_read
-// Description  : Reads "count" bytes from the file handle "fh" into the 
+// Description  : Reads "count" bytes from the file handle "fh" into the
 //                buffer "buf"
 //
 // Inputs       : fd - filename of the file to read from
@@ -335,185 +3567,93 @@ int16_t fs3_close(int16_t fd) {
 // Outputs      : bytes read if successful, -1 if failure
 
 int32_t fs3_read(int16_t fd, void *buf, int32_t count) {
+	FS3_SPAN("driver", "fs3_read");
 	//Checking if disk is mounted
 	if (mounted ==0){
 		return (-1);
 	}
 	//Checking if the count that is inputted is good
-	if (count <= 0){
-		if (recursion == 1){
-			recursion = 0;
-			return totalBytes;
-		}
+	if ((count <= 0) || (buf == NULL)){
 		return (-1);
 	}
 	//Check if the fileHandle is good
-	if (fd > filesLen){
-		return (-1);
-	}
-	if (fd < 10){
-		recursion = 0;
+	int idx = fileIndex(fd);
+	if (idx == -1){
 		return (-1);
 	}
-	if (fd == files[fd].fileHandle){
-		//Check if file is open
-		if (files[fd].fileOpen == true){
-			//Need to find where the file is located
-			if (recursion == 0){
-				sec = 0;
-				trk = 0;
-				fileLocation(files[fd].fileHandle, sec, trk);
-			}
-			//Count might be too large from our current position
-			if ((files[fd].filePos + count) > files[fd].fileLen){
-				count = files[fd].fileLen - files[fd].filePos;
-			}
+	struct fileData *file = &files[idx];
 
-			int numSec;
-			//The current file takes up more than one sector so we need to know where we currently are
-			if (files[fd].fileLen >= FS3_SECTOR_SIZE){
-				//numSec will give us a way of determining which sector we are in according to the file's data (filePos)
-				numSec = (files[fd].filePos / FS3_SECTOR_SIZE);
-				//tempPos will tell us where in that file we are currently
-				tempPos = (files[fd].filePos - (FS3_SECTOR_SIZE * (numSec)));
-			}
-			else{
-				tempPos = files[fd].filePos;
-			}
-			//If the pos that were are starting from is in a different sector than the first one so we need to know 
-			//what pos that would be in relation to the sector size      ie pos=1025 means we are at pos 1 in next sector
-			if ((tempPos < FS3_SECTOR_SIZE) && (tempPos != files[fd].filePos)){
-				sec = 0;
-				trk = 0;
-				int i;
-				for(i = 0; i <= numSec; i++){
-					if ((sec + 1) > FS3_TRACK_SIZE -1){
-						sec = 0;
-						trk++;
-					}
-					else if ((sec == 0) && (i != 0)){
-						sec++;
-					}
-					else if (sec != 0){
-						sec++;
-					}
-					if (fileLocation(files[fd].fileHandle, sec, trk) == -1){
-						i = numSec+1;
-					}
-				}
+	//Count might be too large from our current position
+	if ((file->filePos + count) > file->fileLen){
+		count = file->fileLen - file->filePos;
+	}
 
-			}
-			char fixedBuf[FS3_SECTOR_SIZE];
-			//The position we are currently in might not be in the same sector as the end of the file 
-			//so if read is called for more bytes than what are left in the sector then we need to do 2 read syscalls
-			if (((tempPos + count) > FS3_SECTOR_SIZE) && (FS3_SECTOR_SIZE < files[fd].fileLen)){
-				int spaceAvailable = FS3_SECTOR_SIZE - tempPos;
-				
-				//Before we make a syscall we need to check if the line is in the cache
-				void *tempBuf = fs3_get_cache(trk, sec);
-				if (tempBuf != NULL){
-					memcpy(fixedBuf, tempBuf, FS3_SECTOR_SIZE);
-				}
-				FS3CmdBlk cmdBlock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trk, 0);
-				FS3CmdBlk *rtnBlock = &cmdBlock;
-				network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-				if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_TSEEK, 0, trk, 0) != 0){
-					return (-1);
-				}
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_RDSECT, sec, 0, 0);
-				network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-				if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_RDSECT, sec, 0 ,0) != 0){
-					return (-1);
-				}
-				if (recursion == 1){
-					memcpy(buf+totalBytes, &fixedBuf[tempPos], spaceAvailable);
-					files[fd].filePos += spaceAvailable;
-					totalBytes += spaceAvailable;
-				}
-				else{
-					memcpy(buf, &fixedBuf[tempPos], spaceAvailable);
-					files[fd].filePos += spaceAvailable;
-					totalBytes = spaceAvailable;
-				}
-				//We still have more bytes we need to read so we need to call read again and continue on
-				spaceAvailable = count - spaceAvailable;
-				recursion = 1;
-				if (tempBuf == NULL){
-					fs3_put_cache(trk, sec, fixedBuf);
-				}
-				return (fs3_read(files[fd].fileHandle, buf, spaceAvailable));
-			}
-			
-			//File is read for count bytes
-			else{
-				if (recursion == 1){
-					
-					//Before we make a syscall we need to check if the buffer is in the cache
-					void *tempBuf = fs3_get_cache(trk, sec);
-					if (tempBuf != NULL){
-						memcpy(fixedBuf, tempBuf, FS3_SECTOR_SIZE);
-					}
-					FS3CmdBlk cmdBlock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trk, 0);
-					FS3CmdBlk *rtnBlock = &cmdBlock;
-					network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-					if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_TSEEK, 0, trk, 0) != 0){
-						return (-1);
-					}
-					cmdBlock = construct_fs3_cmdblock(FS3_OP_RDSECT, sec, 0, 0);
-					network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-					if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_RDSECT, sec, 0, 0) != 0){
-						return (-1);
-					}
-					memcpy(buf+totalBytes, fixedBuf+tempPos, count);
-					files[fd].filePos += count;
-					totalBytes += count;
-					recursion = 0;
-					if (tempBuf == NULL){
-						fs3_put_cache(trk, sec, fixedBuf);
-					}
-					return totalBytes;
-				}
+	//On a striped volume a read covering several sectors fetches them all at once, each controller
+	//  reading its share in parallel
+	char *stripeBuf = NULL;
+	int stripeFirst = SECTOR_INDEX_NUMBER(file->filePos);
+	int stripeLen = 0;
+	if ((fs3Controllers > 1) && (count > 0)){
+		stripeLen = SECTOR_INDEX_NUMBER(file->filePos + count - 1) - stripeFirst + 1;
+		if (stripeFirst + stripeLen > file->secNums){
+			stripeLen = file->secNums - stripeFirst;
+		}
+	}
+	if (stripeLen > 1){
+		stripeBuf = malloc((size_t)stripeLen * FS3_SECTOR_SIZE);
+		if ((stripeBuf == NULL) || (getSectors(&file->fileSectors[stripeFirst], stripeBuf, stripeLen) != 0)){
+			free(stripeBuf);
+			return (-1);
+		}
+	}
 
-				//Before we make a syscall we need to check if the buffer is in the cache
-				void *tempBuf = fs3_get_cache(trk, sec);
-				if (tempBuf != NULL){
-					memcpy(fixedBuf, tempBuf, FS3_SECTOR_SIZE);
-				}
-				FS3CmdBlk cmdBlock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trk, 0);
-				FS3CmdBlk *rtnBlock = &cmdBlock;
-				network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-				if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_TSEEK, 0, trk, 0) != 0){
-					return (-1);
-				}
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_RDSECT, sec, 0, 0);
-				network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-				if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_RDSECT, sec, 0, 0) != 0){
-					return (-1);
-				}
-				memcpy(buf, &fixedBuf[tempPos], count);
-				files[fd].filePos += count;
-				if (recursion == 1){
-					totalBytes += count;
-					recursion = 0;
-					if (tempBuf == NULL){
-						fs3_put_cache(trk, sec, fixedBuf);
-					}
-					return totalBytes;
-				}
-				if (tempBuf == NULL){
-					fs3_put_cache(trk, sec, fixedBuf);
-				}
-				return(count);
-			}
+	//Walk the sectors the read covers, copying out the part of each one that was asked for. Whatever is
+	//  past the last sector comes from the inline bytes without going to the disk
+	char fixedBuf[FS3_SECTOR_SIZE];
+	int32_t bytesRead = 0;
+	while (bytesRead < count){
+		int secIndex = SECTOR_INDEX_NUMBER(file->filePos);
+		int tempPos = file->filePos % FS3_SECTOR_SIZE;
+		int spaceAvailable = FS3_SECTOR_SIZE - tempPos;
+		if (spaceAvailable > (count - bytesRead)){
+			spaceAvailable = count - bytesRead;
+		}
+		if (secIndex >= file->secNums){
+			memcpy((char *)buf + bytesRead, &file->inlineData[tempPos], spaceAvailable);
+			file->filePos += spaceAvailable;
+			bytesRead += spaceAvailable;
+			continue;
+		}
+		//The sector being collected for a write is newer than the disk
+		if ((file->wcDirty == true) && (file->wcSec == secIndex)){
+			memcpy((char *)buf + bytesRead, &file->wcBuf[tempPos], spaceAvailable);
+			file->filePos += spaceAvailable;
+			bytesRead += spaceAvailable;
+			continue;
+		}
+		if (stripeBuf != NULL){
+			memcpy((char *)buf + bytesRead, &stripeBuf[((size_t)(secIndex - stripeFirst) * FS3_SECTOR_SIZE) + tempPos],
+				spaceAvailable);
+			file->filePos += spaceAvailable;
+			bytesRead += spaceAvailable;
+			continue;
+		}
+		FS3SectorAddress *addr = &file->fileSectors[secIndex];
+		if (getSector(addr->trk, addr->sec, fixedBuf) != 0){
+			return (-1);
 		}
+		memcpy((char *)buf + bytesRead, &fixedBuf[tempPos], spaceAvailable);
+		file->filePos += spaceAvailable;
+		bytesRead += spaceAvailable;
 	}
-	return (-1);
+	free(stripeBuf);
+	return (bytesRead);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : fs3_write
-// Description  : Writes "count" bytes to the file handle "fh" from the 
+// Description  : Writes "count" bytes to the file handle "fh" from the
 //                buffer  "buf"
 //
 // Inputs       : fd - filename of the file to write to
@@ -522,241 +3662,119 @@ int32_t fs3_read(int16_t fd, void *buf, int32_t count) {
 // Outputs      : bytes written if successful, -1 if failure
 
 int32_t fs3_write(int16_t fd, void *buf, int32_t count) {
+	FS3_SPAN("driver", "fs3_write");
 	//Checking if disk is mounted
 	if (mounted == 0){
 		return (-1);
 	}
-	//Checking if the buffer contains data
-	if (buf == NULL){
-		if (recursion == 1){
-			recursion = 0;
-			return totalBytes;
-		}
-		return (-1);
-	}
-	//Validating count number
-	if (count <= 0){
-		if (recursion == 1){
-			recursion = 0;
-			return totalBytes;
-		}
+	//Checking if the buffer contains data and the count is good
+	if ((buf == NULL) || (count <= 0)){
 		return (-1);
 	}
 	//Validating fileHandle
-	if (fd > filesLen){
-		return (-1);
-	}
-	if (fd < 10){
+	int idx = fileIndex(fd);
+	if (idx == -1){
 		return (-1);
 	}
-	//Validating file contents
-	if (fd == files[fd].fileHandle){
-		if (files[fd].fileOpen == true){
-			//Need to find where the file is located
-			if (recursion == 0){
-				sec = 0;
-				trk = 0;
-				fileLocation(files[fd].fileHandle, sec, trk);
-			}
+	struct fileData *file = &files[idx];
 
-			char fixedBuf[FS3_SECTOR_SIZE];
-			FS3CmdBlk cmdBlock;
+	//A write that leaves no more than FS3_INLINE_MAX bytes past the last full sector goes into the inline
+	//  bytes, small files and short tails then live in the metadata and take no sector of their own
+	int base = file->secNums * FS3_SECTOR_SIZE;
+	int newLen = ((file->filePos + count) > file->fileLen) ? (file->filePos + count) : file->fileLen;
+	if (((file->fileLen - base) == file->inlineLen) && (file->filePos >= base) && ((newLen - base) <= FS3_INLINE_MAX)){
+		if (file->inlineData == NULL){
+			file->inlineData = malloc(FS3_INLINE_MAX);
+			if (file->inlineData == NULL){
+				return (-1);
+			}
+		}
+		memcpy(&file->inlineData[file->filePos - base], buf, count);
+		file->filePos += count;
+		file->fileLen = newLen;
+		file->inlineLen = newLen - base;
+		file->inlineDirty = true;
+		metaChanges++;
+		if ((markDirty(idx) != 0) || ((metaChanges >= FS3_JOURNAL_GROUP) && (commitMetadata() != 0))){
+			return (-1);
+		}
+		return (count);
+	}
 
-			//Can't read the file if there is nothing in it yet
-			if ((files[fd].fileLen == 0) && (files[fd].filePos == 0)){
-				memcpy(fixedBuf, buf, count);
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trk, 0);
-				FS3CmdBlk *rtnBlock = &cmdBlock;
-				network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-				if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_TSEEK, 0, trk, 0) != 0){
+	//Walk the sectors the write covers, writing past the last sector the file owns gives it a new one.
+	//  Partial sector writes are collected in the file's write-combining buffer, so a run of small
+	//  writes to the same sector reaches the disk as one write when the file moves on to another sector
+	char fixedBuf[FS3_SECTOR_SIZE];
+	int32_t bytesWritten = 0;
+	while (bytesWritten < count){
+		int secIndex = SECTOR_INDEX_NUMBER(file->filePos);
+		int tempPos = file->filePos % FS3_SECTOR_SIZE;
+		int spaceAvailable = FS3_SECTOR_SIZE - tempPos;
+		if (spaceAvailable > (count - bytesWritten)){
+			spaceAvailable = count - bytesWritten;
+		}
+		if ((file->wcDirty == true) && (file->wcSec == secIndex)){
+			memcpy(&file->wcBuf[tempPos], (char *)buf + bytesWritten, spaceAvailable);
+		}
+		else{
+			if (flushWriteBuffer(idx) != 0){
+				return (-1);
+			}
+			if (secIndex >= file->secNums){
+				//A new sector starts out holding the inline bytes, which no longer fit inline
+				if (addFileSector(idx) != 0){
 					return (-1);
 				}
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_WRSECT, sec , 0, 0);
-				network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-				
-				//Checking if syscall was successful
-				if ((deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_WRSECT, sec, 0, 0)) == 0){
-					files[fd].fileLen += count;
-					files[fd].filePos = files[fd].fileLen;
-					recursion = 0;
-					fs3_put_cache(trk, sec, fixedBuf);
-					return (count);
-				}
-				else{
-					recursion = 0;
-					return (-1);
+				memset(fixedBuf, 0, FS3_SECTOR_SIZE);
+				if (file->inlineLen > 0){
+					memcpy(fixedBuf, file->inlineData, file->inlineLen);
+					file->inlineLen = 0;
+					file->inlineDirty = true;
 				}
 			}
-
-			
-			//If the write bytes is going to fill up current sector and go beyond then need to handle accordingly
-
-			int numSec;
-			//The current file takes up more than one sector so we need to know where we currently are
-			if (files[fd].fileLen >= FS3_SECTOR_SIZE){
-				//numSec will give us a way of determining which sector we are in according to the file's data (filePos)
-				numSec = (files[fd].filePos / FS3_SECTOR_SIZE);
-
-				//tempPos will tell us where in that file we are currently
-				tempPos = (files[fd].filePos - (FS3_SECTOR_SIZE * (numSec)));
-			}else{
-				//File is only on one sector currently so we can handle as though it is a normal write call
-				tempPos = files[fd].filePos;
-			}
-			//If the pos that were are starting from is in a different sector than the first one so we need to know 
-			//what pos that would be in relation to the sector size      ie pos=1025 means we are at pos 1 in next sector
-			if ((tempPos < FS3_SECTOR_SIZE) && (tempPos != files[fd].filePos)){
-				//Need to loop through until we find the next sector that we can write to
-				sec = 0;
-				trk = 0;
-				int i;
-				for(i = 0; i <= numSec; i++){
-					if ((sec + 1) > FS3_TRACK_SIZE -1){
-						sec = 0;
-						trk++;
-					}
-					else if ((sec == 0) && (i != 0)){
-						sec++;
-					}
-					else if (sec != 0){
-						sec++;
-					}
-					if (fileLocation(files[fd].fileHandle, sec, trk) == -1){
-						//If we reach this point then the file is not on any other sector so we need to add a new one to its list and read/write there
-						files[fd].fileStorage[nextTrkAvailable][nextSecAvailable] = 1;
-						files[fd].secNums++;
-						sec = nextSecAvailable;
-						trk = nextTrkAvailable;
-						updateSpace();
-						i = numSec + 1;
-					}
+			//Only a partial write to a sector the file already had needs its old contents
+			else if (spaceAvailable < FS3_SECTOR_SIZE){
+				if (getSector(file->fileSectors[secIndex].trk, file->fileSectors[secIndex].sec, fixedBuf) != 0){
+					return (-1);
 				}
-
 			}
-			//If this block gets avtivated then that means we are going to need to perform more than one write call to write all the count bytes
-			if ((tempPos + count) > FS3_SECTOR_SIZE){
-				int spaceAvailable = FS3_SECTOR_SIZE - tempPos;
-
-				//We need to write for spaceAvailable number of bytes and then call write again to finish the last of the bytes
+			memcpy(&fixedBuf[tempPos], (char *)buf + bytesWritten, spaceAvailable);
 
-				//Before we call syscall we need to check if the trk/sec is already in the cache
-				void *tempBuf = NULL; //fs3_get_cache(trk, sec);
-				if (tempBuf != NULL){
-					memcpy(fixedBuf, tempBuf, FS3_SECTOR_SIZE);
-				}
-				//Syscall read into fixedBuf since cache does not have the trk/sec
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trk, 0);
-				FS3CmdBlk *rtnBlock = &cmdBlock;
-				network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-				if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_TSEEK, 0, trk, 0) != 0){
-					return (-1);
-				}
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_RDSECT, sec, 0, 0);
-				network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-				if ((deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_RDSECT, sec, 0, 0) != 0)){
+			//A whole sector goes straight to the scheduler, anything less waits in the buffer for more writes
+			if (spaceAvailable == FS3_SECTOR_SIZE){
+				FS3SectorAddress *addr = &file->fileSectors[secIndex];
+				if (queueSector(addr->trk, addr->sec, fixedBuf) != 0){
 					return (-1);
 				}
-				// Either syscall was successful or trk/sec was in cache so now we need to write in spaceAvailable number of bytes
-				memcpy(&fixedBuf[tempPos], buf, spaceAvailable);
-				
-				cmdBlock = construct_fs3_cmdblock(FS3_OP_WRSECT, sec, 0, 0);
-				rtnBlock = &cmdBlock;
-				network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-				if ((deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_WRSECT, sec, 0, 0) == 0)){
-					//Syscall successfully wrote spaceAvailable number of bytes so now we need to update filePos and fileLen
-					if (files[fd].filePos == files[fd].fileLen){
-						files[fd].fileLen += spaceAvailable;
-						files[fd].filePos = files[fd].fileLen;
-					}
-					else{
-						files[fd].filePos += spaceAvailable;
-						if (files[fd].filePos > files[fd].fileLen){
-							files[fd].fileLen = files[fd].filePos;
-						}
-					}
-
-					//We still have bytes left to write so now we need to call write again with the count number updated
-					totalBytes = spaceAvailable;
-					spaceAvailable = count - spaceAvailable;
-					recursion = 1;
-					//Creating a var to get the contents that are in buf
-					char *tempBuf = (char *)buf;
-					//Now we need to move the contents of buf that we still need to a newBuf that we can then pass into write again
-					char newBuf[spaceAvailable];
-					for (int i=0; i<=spaceAvailable; i++){
-						newBuf[i] = tempBuf[i+totalBytes];
-					}
-					fs3_put_cache(trk, sec, fixedBuf);
-					return (fs3_write(files[fd].fileHandle, newBuf, spaceAvailable));
-				}
-			}
-
-			//Before we call syscall we need to check if the trk/sec is already in the cache
-			void *tempBuf = fs3_get_cache(trk, sec);
-			if (tempBuf != NULL){
-				memcpy(fixedBuf, tempBuf, FS3_SECTOR_SIZE);
-			}
-			//Sycall read into fixedBuf
-			cmdBlock = construct_fs3_cmdblock(FS3_OP_TSEEK, 0, trk, 0);
-			FS3CmdBlk *rtnBlock = &cmdBlock;
-			network_fs3_syscall(cmdBlock, rtnBlock, NULL);
-			if (deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_TSEEK, 0, trk, 0) != 0){
-				return (-1);
 			}
-			cmdBlock = construct_fs3_cmdblock(FS3_OP_RDSECT, sec, 0, 0);
-			network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-			if ((deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_RDSECT, sec, 0, 0) != 0)){
-				return (-1);
-			}
-			//Syscall was successful so now need to memcpy what the controller gave back into the buf that controller initially passed
-			memcpy(&fixedBuf[tempPos], buf, count);
-			cmdBlock = construct_fs3_cmdblock(FS3_OP_WRSECT, sec, 0, 0);
-			rtnBlock = &cmdBlock;
-			network_fs3_syscall(cmdBlock, rtnBlock, fixedBuf);
-			if ((deconstruct_fs3_cmdblock(rtnBlock, FS3_OP_WRSECT, sec, 0, 0) == 0)){
-				//Syscall successfully wrote to sector, now need to update internal metadata
-
-				//First block is checking if the written data was appended onto the end of the file
-				if (files[fd].filePos == files[fd].fileLen){
-					files[fd].fileLen += count;
-					files[fd].filePos = files[fd].fileLen;
-					if (recursion == 1){
-						totalBytes += count;
-						recursion = 0;
-						fs3_put_cache(trk, sec, fixedBuf);
-						return totalBytes;
-					}
-					fs3_put_cache(trk, sec, fixedBuf);
-					return (count);
-				}
-
-				//Second block is checking if the file's new position is passed the end of the fileLen or not (if it is then updating that data as well)
-				else{
-					files[fd].filePos += count;
-					if (files[fd].filePos > files[fd].fileLen){
-						files[fd].fileLen = files[fd].filePos;
-						if (recursion == 1){
-							totalBytes += count;
-							recursion = 0;
-							fs3_put_cache(trk, sec, fixedBuf);
-							return (totalBytes);
-						}
-						fs3_put_cache(trk, sec, fixedBuf);
-						return (count);
-					}
-					if (recursion == 1){
-						totalBytes += count;
-						recursion = 0;
-						fs3_put_cache(trk, sec, fixedBuf);
-						return (totalBytes);
+			else{
+				if (file->wcBuf == NULL){
+					file->wcBuf = malloc(FS3_SECTOR_SIZE);
+					if (file->wcBuf == NULL){
+						return (-1);
 					}
-					fs3_put_cache(trk, sec, fixedBuf);
-					return (count);
 				}
+				memcpy(file->wcBuf, fixedBuf, FS3_SECTOR_SIZE);
+				file->wcSec = secIndex;
+				file->wcDirty = true;
 			}
 		}
+
+		//Sector successfully written, now need to update internal metadata
+		file->filePos += spaceAvailable;
+		if (file->filePos > file->fileLen){
+			file->fileLen = file->filePos;
+		}
+		bytesWritten += spaceAvailable;
 	}
-	return (-1);
+	//The new sectors, inline bytes and length are journalled with the next group commit
+	if (((file->fileLen != file->jLen) || (file->secNums != file->jSecs) || (file->inlineDirty == true)) && (markDirty(idx) != 0)){
+		return (-1);
+	}
+	if ((metaChanges >= FS3_JOURNAL_GROUP) && (commitMetadata() != 0)){
+		return (-1);
+	}
+	return (bytesWritten);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -769,28 +3787,20 @@ int32_t fs3_write(int16_t fd, void *buf, int32_t count) {
 // Outputs      : 0 if successful, -1 if failure
 
 int32_t fs3_seek(int16_t fd, uint32_t loc) {
+	FS3_SPAN("driver", "fs3_seek");
 	//Checking if disk is mounted
 	if (mounted == 0){
 		return (-1);
 	}
-	//Validating loc
-	if (loc < 0){
-		return (-1);
-	}
 	//Validating fileHandle
-	if (fd > filesLen){
-		return (-1);
-	}
-	if (fd < 10){
+	int idx = fileIndex(fd);
+	if (idx == -1){
 		return (-1);
 	}
 	//Setting current file's pointer to location inputted
-	if (fd == files[fd].fileHandle){
-		if (loc > files[fd].fileLen){
-			return (-1);
-		}
-		files[fd].filePos = loc;
-		return (0);
+	if (loc > files[idx].fileLen){
+		return (-1);
 	}
-	return (-1);
+	files[idx].filePos = loc;
+	return (0);
 }
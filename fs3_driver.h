@@ -13,10 +13,66 @@
 
 // Include files
 #include <stdint.h>
+#include <stdbool.h>
 
 // Defines
 #define FS3_MAX_TOTAL_FILES 1024 // Maximum number of files ever
 #define FS3_MAX_PATH_LENGTH 128 // Maximum length of filename length
+#define FS3_META_MAGIC "FS3META1" // Identifies a superblock written by this driver
+#define FS3_META_VERSION 8 // Version of the on-disk metadata layout
+#define FS3_META_MAX_EXTENTS 78 // Runs of the metadata stream listed in the superblock itself
+#define FS3_META_LIST_EXTENTS 84 // Runs listed in each extent list sector chained from the superblock
+#define FS3_INLINE_MAX 512 // Largest tail of a file kept in its metadata rather than in a sector
+
+// Type definitions
+typedef struct {
+	uint32_t trk; // Track the sector is on
+	uint16_t sec; // Sector within the track
+} FS3SectorAddress;
+
+typedef struct {
+	int ctrl;     // Controller the sector is on
+	uint32_t trk; // Track on that controller
+	uint16_t sec; // Sector on that controller
+	char *buf;    // FS3_SECTOR_SIZE bytes to send or receive
+} FS3Shard;
+
+typedef struct {
+	uint32_t trk; // Track the run is on
+	uint32_t sec; // First sector of the run
+	uint32_t len; // Number of sectors in the run
+} FS3MetaExtent;
+
+typedef struct {
+	uint32_t nextTrk; // Next sector of the chain, when there are runs left to list after this one
+	uint32_t nextSec;
+	uint32_t count; // Number of runs listed in this sector
+	FS3MetaExtent extents[FS3_META_LIST_EXTENTS]; // The runs, following on from the ones before them
+} FS3MetaExtentList; // Runs of the metadata stream past the first FS3_META_MAX_EXTENTS, a sector each
+
+typedef struct {
+	char magic[8]; // FS3_META_MAGIC, anything else means the disk is unformatted
+	uint32_t version; // FS3_META_VERSION
+	uint32_t tracks; // Geometry of the disk the metadata was written for
+	uint32_t trackSize;
+	uint32_t fileCount; // Number of inodes in the metadata stream
+	uint64_t streamBytes; // Length of the metadata stream
+	uint32_t extentCount; // Number of runs holding the metadata stream
+	uint32_t listTrk; // First extent list sector, when there are more than FS3_META_MAX_EXTENTS runs
+	uint32_t listSec;
+	uint32_t journalStart; // First sector of the journal on track 0
+	uint32_t journalLen; // Number of sectors in the journal
+	uint32_t controllers; // Number of controllers the disk is striped over (data shards when erasure coded)
+	uint32_t parity; // Parity shards in each stripe, 0 when the disk is not erasure coded
+	uint16_t columnTracks; // Tracks on each controller when files are placed rather than striped, 0 if striped
+	uint16_t retired; // Bit set for each controller taken off the placement ring
+	uint64_t checkpointSeq; // Last journal record the metadata stream includes
+	uint32_t sumCount; // Sector checksums saved after the metadata stream, 0 unless the disk was unmounted cleanly
+	FS3MetaExtent extents[FS3_META_MAX_EXTENTS]; // Where the metadata stream is, in order
+} FS3Superblock; // Kept in sector 0 of track 0
+
+// Global data
+extern bool fs3_sector_sums; // Check every sector read from the controller against its checksum (on by default)
 
 //
 // Interface functions
@@ -41,17 +97,254 @@ int32_t fs3_write(int16_t fd, void *buf, int32_t count);
 
 int32_t fs3_seek(int16_t fd, uint32_t loc);
 	// Seek to specific point in the file
+
+int32_t fs3_delete(char *path);
+	// Delete a file, releasing its space on the disk
+
+int32_t fs3_truncate(int16_t fd, uint32_t len);
+	// Shorten a file to "len" bytes, releasing the space past the new end
 	
-int findFile(int fd, char *fileName);
+int findFile(char *fileName);
 	//Function used to find a file based on its fileName
 
-int updateSpace();
-	//Function used to update the global variables for disk space available
+uint32_t hashFileName(const char *fileName);
+	//Function used to hash a fileName for the filename table
+
+int insertFile(int idx);
+	//Function used to add a file to the filename table
+
+int removeFile(int idx);
+	//Function used to take a file out of the filename table
+
+int createFile(char *fileName);
+	//Function used to add a new empty file to the file table
+
+int allocateHandle(int idx);
+	//Function used to give an open file a file handle
+
+int fileIndex(int16_t fd);
+	//Function used to find the file a file handle refers to
+
+uint32_t findFreeRun(uint32_t localTrk, uint32_t from, uint32_t want, uint32_t need, uint32_t *start);
+	//Function used to find a run of free sectors on a track
+
+int fileHome(int idx);
+	//Function used to find the column the placement ring gives a file
+
+bool trackOnRing(uint32_t localTrk);
+	//Function used to check whether a track belongs to a column on the placement ring
+
+int reserveWindow(int idx);
+	//Function used to reserve the next run of sectors for a file that is being written
+
+int releaseWindow(int idx);
+	//Function used to give the unused part of a file's reserved run back to the disk
+
+int markRunAllocated(uint32_t localTrk, uint32_t start, uint32_t len);
+	//Function used to mark a run of sectors on a track as allocated
+
+int freeSector(FS3SectorAddress *addr);
+	//Function used to give a sector back to the free space bitmap
+
+int diskSpace(uint64_t *totalSectors, uint64_t *freeSectors);
+	//Function used to count the total and free sectors on the disk
+
+int addFileSector(int idx);
+	//Function used to give a file another sector on the disk
+
+int releaseFileSectors(int idx, int keep);
+	//Function used to give the sectors at the end of a file back to the disk
+
+int flushWriteBuffer(int idx);
+	//Function used to write out the sector collected in a file's write-combining buffer
+
+int flushWriteBuffers(void);
+	//Function used to write out the write-combining buffers of every open file
+
+int setInline(int idx, const char *data, uint16_t len);
+	//Function used to replace the contents of a file's inline tail
+
+bool sectorIsWritten(uint_fast32_t localTrk, uint16_t localSec);
+	//Function used to check whether a sector has ever been written
+
+int markSectorWritten(uint_fast32_t localTrk, uint16_t localSec);
+	//Function used to record that a sector has been written
+
+int recordSectorSum(uint_fast32_t localTrk, uint16_t localSec, const char *sectorBuf);
+	//Function used to keep the checksum of what was written to a sector
+
+int dropSectorSum(uint_fast32_t localTrk, uint16_t localSec);
+	//Function used to forget the checksum of a sector whose contents are no longer known
+
+int forgetTrackSums(uint_fast32_t localTrk);
+	//Function used to forget the checksums of a track another client may write to
+
+int forgetSums(void);
+	//Function used to forget the checksum of every sector
+
+int checkSectorSum(uint_fast32_t localTrk, uint16_t localSec, const char *sectorBuf);
+	//Function used to check a sector read from the controller against its checksum
+
+int resetHeads(void);
+	//Function used to forget where the controllers' heads are
+
+int seekTrack(int ctrl, uint_fast32_t localTrk);
+	//Function used to move a controller's disk head to a track, skipped if the head is already there
+
+uint64_t trackSeeks(void);
+	//Function used to get the number of TSEEK commands sent to the controller
+
+uint64_t diskReads(void);
+	//Function used to get the number of RDSECT commands sent to the controller
+
+uint64_t diskWrites(void);
+	//Function used to get the number of WRSECT commands sent to the controller
+
+uint64_t sectorSumChecks(void);
+	//Function used to get the number of sectors read from the controller that were checked against a checksum
+
+uint64_t sectorSumFailures(void);
+	//Function used to get the number of sectors read from the controller that did not match their checksum
+
+FS3Shard mapSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf);
+	//Function used to find the controller, track and sector a sector of the disk is on
+
+int readSectorFromDisk(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf);
+	//Function used to read a sector from the controller whether or not it has been written
+
+int readSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf);
+	//Function used to read a sector, never written sectors are zero filled without going to the disk
+
+int writeSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf);
+	//Function used to write a sector and mark it as written
+
+int sendShards(uint8_t op, FS3Shard *shards, int n);
+	//Function used to read or write a batch of sectors given by the controller they are on
+
+int ecRead(FS3SectorAddress *addrs, char **bufs, int n);
+	//Function used to read a batch of sectors of an erasure coded disk, rebuilding those on failed controllers
+
+int ecWrite(FS3SectorAddress *addrs, char **bufs, int n);
+	//Function used to write a batch of sectors of an erasure coded disk along with the parity of their stripes
+
+int ecTransfer(uint8_t op, FS3SectorAddress *addrs, char **bufs, int n);
+	//Function used to read or write a batch of sectors of an erasure coded disk, carrying on as controllers fail
+
+int transferSectors(uint8_t op, FS3SectorAddress *addrs, char **bufs, int n);
+	//Function used to read or write a batch of sectors with the controllers working in parallel
+
+int queueSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf);
+	//Function used to hand a data sector write to the scheduler, or write it straight through when leases are held
+
+int getSector(uint_fast32_t localTrk, uint16_t localSec, char *sectorBuf);
+	//Function used to get a sector from the cache, or from the disk if it is not cached
+
+int getSectors(FS3SectorAddress *addrs, char *sectorBufs, int n);
+	//Function used to get a run of sectors, reading the ones that are not cached as one batch
+
+int probeController(void);
+	//Function used to choose the controller the geometry is negotiated with
+
+bool probeTrack(uint_fast32_t localTrk);
+	//Function used to check whether the controller has a track
+
+bool probeSector(uint32_t localSec);
+	//Function used to check whether the controller has a sector on the current track
+
+int negotiateGeometry(void);
+	//Function used to find the number of tracks and sectors per track of the disk
+
+int setupSectorMaps(void);
+	//Function used to allocate the per track sector maps once the geometry is known
+
+int growTracks(uint32_t tracks);
+	//Function used to extend the sector maps for controllers added to a placed disk
+
+int setupRing(void);
+	//Function used to put the columns of a placed disk on the placement ring
+
+uint32_t journalSectors(void);
+	//Function used to get the number of sectors the journal takes up on track 0
+
+int formatDisk(void);
+	//Function used to start an empty filesystem, reserving the superblock sector
+
+int countExtents(int idx);
+	//Function used to count the runs of contiguous sectors in a file
+
+int freeExtents(FS3MetaExtent *extents, uint32_t count);
+	//Function used to give every sector in a list of runs back to the disk
+
+int addMetaExtent(FS3MetaExtent **extents, uint32_t *len, uint32_t *cap, uint32_t localTrk, uint32_t start, uint32_t runLen);
+	//Function used to allocate a run of sectors for the metadata and add it to a list of runs
+
+int streamSectorFree(char *stream, uint32_t localTrk, uint32_t localSec);
+	//Function used to mark a sector free in the bitmap of a metadata stream being put together
+
+int saveMetadata(bool sums);
+	//Function used to write the inode table, free space bitmap and (when unmounting) sector checksums to the disk
+
+int loadExtents(FS3Superblock *super, FS3MetaExtent **extents, uint32_t *len);
+	//Function used to read the runs of the metadata stream from the superblock and its extent list
+
+int loadMetadata(FS3Superblock *super);
+	//Function used to read the inode table and free space bitmap back from the disk
+
+int loadSums(char *pos, uint32_t count);
+	//Function used to take the sector checksums saved after the metadata stream
+
+int loadFilesystem(void);
+	//Function used to load the filesystem from the superblock and journal, or format an empty disk
+
+int markDirty(int idx);
+	//Function used to note that a file's sectors or length have changed since the journal last saw it
+
+int flushDirty(void);
+	//Function used to add entries for the changes to every dirty file to the journal
+
+int commitMetadata(void);
+	//Function used to write the journal entries waiting as one record, checkpointing when it fills
+
+int checkpoint(bool clean);
+	//Function used to write the full metadata to the disk and start the journal over
+
+int deleteFile(int idx);
+	//Function used to free a file's sectors and take it out of the file table
+
+int truncateFile(int idx, uint32_t len);
+	//Function used to shorten a file, freeing the sectors past its new end
+
+int misplacedSectors(int idx, int home);
+	//Function used to count the sectors of a file that are not on a column
+
+int migrateFile(int idx, int home);
+	//Function used to move a closed file's sectors to its home column
+
+int rebalance(uint32_t budget);
+	//Function used to move files left on the wrong column by a change to the placement ring
+
+int setControllerMember(int ctrl, bool member);
+	//Function used to put a column on the placement ring or take it off
+
+int columnUsage(uint64_t *sectors);
+	//Function used to count the allocated sectors on each column of a placed disk
+
+int applyJournalRecord(uint8_t type, char *name, char *payload, uint16_t payloadLen);
+	//Function used to redo one journal entry during replay
+
+int injectCrash(int64_t writes);
+	//Function used to make the driver stop reaching the disk after "writes" more sector writes
+
+int remountAfterCrash(void);
+	//Function used to throw away everything in memory and recover the filesystem from the disk
+
+int dropDriverState(void);
+	//Function used to free all of the driver's in-memory metadata
 
-int fileLocation(int fd, uint16_t localSec, uint_fast32_t localTrk);
-	//Function used to find which trk/sec a file is stored on
+int claimSector(uint64_t *bitmap, uint32_t localTrk, uint32_t localSec);
+	//Function used to set a sector's bit in a whole disk bitmap, reporting if it was already set
 
-int fileLocationRead(int fd, uint16_t localSec, uint_fast32_t localTrk);
-	//Function sued during read calls to find where the file currently is held on the disk
+int checkAllocation(void);
+	//Function used to count sectors the free space bitmap disagrees with the metadata about
 
 #endif
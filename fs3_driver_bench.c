@@ -0,0 +1,542 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_driver_bench.c
+//  Description    : This is the set of benchmarks of the FS3 driver itself, its
+//                   open path, allocator, journal and small file layout.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_common.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_CRASH_MAX_FILE (256 * 1024) // Largest file the crash benchmark grows
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_open
+// Description  : Create nfiles files, then open every one of them again by
+//                a name held in a different buffer, timing both passes. Files
+//                are closed after each open so handles are recycled
+//
+// Inputs       : nfiles - the number of files to create
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_open(int nfiles) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH];
+	BenchSpan create, reopen;
+	int16_t fh;
+	int i;
+
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+
+	// Create all of the files
+	bench_start(&create);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "bench-file-%d.txt", i);
+		if ( ((fh = fs3_open(fname)) == -1) || (fs3_close(fh) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark create of [%s] failed (%d files).", fname, i );
+			fs3_unmount_disk();
+			return( -1 );
+		}
+	}
+	bench_stop(&create);
+
+	// Now open them again, the names are rebuilt so lookups must match on content
+	bench_start(&reopen);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "bench-file-%d.txt", i);
+		if ( ((fh = fs3_open(fname)) == -1) || (fs3_close(fh) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark re-open of [%s] failed.", fname );
+			fs3_unmount_disk();
+			return( -1 );
+		}
+	}
+	bench_stop(&reopen);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 open benchmark, %d files", nfiles );
+	logMessage( LOG_OUTPUT_LEVEL, " create  = [ %10.1f ns/open]", (create.elapsed * 1e9) / nfiles );
+	logMessage( LOG_OUTPUT_LEVEL, " re-open = [ %10.1f ns/open]", (reopen.elapsed * 1e9) / nfiles );
+
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_churn
+// Description  : Keep up to nfiles files alive, repeatedly picking one at
+//                random: an empty slot gets a new file of 1 to 64 sectors, a
+//                live file is read back, checked and then either truncated or
+//                deleted. Runs until the driver has handed out wraps times the
+//                number of sectors on the disk, then deletes everything and
+//                checks no sector outside the metadata is still allocated
+//
+// Inputs       : nfiles - the maximum number of live files
+//                wraps - how many times over the disk is allocated
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_churn(int nfiles, int wraps) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], *buf, *rbuf;
+	uint64_t totalSectors, freeSectors, allocated = 0, bytes = 0;
+	uint32_t *sizes;
+	uint8_t *fills;
+	BenchSpan span;
+	int16_t fh;
+	int i, ops = 0, leaked;
+
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	diskSpace(&totalSectors, &freeSectors);
+	buf = malloc(64 * FS3_SECTOR_SIZE);
+	rbuf = malloc(64 * FS3_SECTOR_SIZE);
+	sizes = calloc(nfiles, sizeof(uint32_t));
+	fills = calloc(nfiles, sizeof(uint8_t));
+	srand(311);
+
+	bench_start(&span);
+	while (allocated < (totalSectors * wraps)) {
+		i = rand() % nfiles;
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "churn-file-%d.txt", i);
+		if ( (fh = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+
+		if (sizes[i] == 0) {
+			// Create the file, the contents depend on the file and the pass so stale data shows up
+			sizes[i] = ((rand() % 64) + 1) * FS3_SECTOR_SIZE - (rand() % FS3_SECTOR_SIZE);
+			fills[i] = (i + ops) & 0xff;
+			memset(buf, fills[i], sizes[i]);
+			if ( fs3_write(fh, buf, sizes[i]) != sizes[i] ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark write of [%s] failed.", fname );
+				return( -1 );
+			}
+			allocated += (sizes[i] + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE;
+			bytes += sizes[i];
+			fs3_close(fh);
+		} else {
+			// Check the file still holds what was written, then drop some or all of it
+			if ( fs3_read(fh, rbuf, sizes[i]) != sizes[i] ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed.", fname );
+				return( -1 );
+			}
+			for (uint32_t b=0; b<sizes[i]; b++) {
+				if ( (uint8_t)rbuf[b] != fills[i] ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark [%s] corrupt at byte %u.", fname, b );
+					return( -1 );
+				}
+			}
+			bytes += sizes[i];
+			if ( (rand() % 4 == 0) && (sizes[i] > FS3_SECTOR_SIZE) ) {
+				sizes[i] /= 2;
+				if ( (fs3_truncate(fh, sizes[i]) == -1) || (fs3_close(fh) == -1) ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark truncate of [%s] failed.", fname );
+					return( -1 );
+				}
+			} else {
+				if ( fs3_delete(fname) == -1 ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark delete of [%s] failed.", fname );
+					return( -1 );
+				}
+				sizes[i] = 0;
+			}
+		}
+		ops++;
+	}
+	bench_stop(&span);
+
+	// Everything that is left goes, after which the disk should be empty
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "churn-file-%d.txt", i);
+		if ( (sizes[i] != 0) && (fs3_delete(fname) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark delete of [%s] failed.", fname );
+			return( -1 );
+		}
+	}
+	if ( (leaked = checkAllocation()) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark leaked %d sectors.", leaked );
+		return( -1 );
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 churn benchmark, %d files, disk allocated %d times over", nfiles, wraps );
+	logMessage( LOG_OUTPUT_LEVEL, " operations = [ %10d ]", ops );
+	logMessage( LOG_OUTPUT_LEVEL, " sectors    = [ %10lu allocated ]", (unsigned long)allocated );
+	logMessage( LOG_OUTPUT_LEVEL, " throughput = [ %10.2f MB/s ]", (bytes / span.elapsed) / (1024.0 * 1024.0) );
+
+	free(buf);
+	free(rbuf);
+	free(sizes);
+	free(fills);
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_interleave
+// Description  : Write nfiles files together, one sector to each file in turn,
+//                so their allocations arrive interleaved. Then close them and
+//                read each file back from start to end, counting the track
+//                seeks per MB read. The files are sized to fill half the disk
+//                and are at most 256 sectors each
+//
+// Inputs       : nfiles - the number of files to write
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_interleave(int nfiles) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], buf[FS3_SECTOR_SIZE];
+	uint64_t totalSectors, freeSectors;
+	int16_t *fhs;
+	uint32_t sectors, s;
+	BenchSpan span;
+	double mb;
+	int i;
+
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	diskSpace(&totalSectors, &freeSectors);
+	sectors = totalSectors / (2 * (uint64_t)nfiles);
+	sectors = (sectors > 256) ? 256 : sectors;
+	if ( sectors == 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark has too many files for the disk." );
+		return( -1 );
+	}
+
+	// Write the files a sector at a time, going round all of them
+	fhs = malloc(sizeof(int16_t) * nfiles);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "interleave-file-%d.txt", i);
+		if ( (fhs[i] = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+	}
+	for (s=0; s<sectors; s++) {
+		for (i=0; i<nfiles; i++) {
+			memset(buf, (i + s) & 0xff, FS3_SECTOR_SIZE);
+			if ( fs3_write(fhs[i], buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark write to file %d failed.", i );
+				return( -1 );
+			}
+		}
+	}
+	for (i=0; i<nfiles; i++) {
+		fs3_close(fhs[i]);
+	}
+
+	// Read every file back on its own, start to end
+	bench_start(&span);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "interleave-file-%d.txt", i);
+		if ( (fhs[i] = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (s=0; s<sectors; s++) {
+			if ( (fs3_read(fhs[i], buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE) || ((uint8_t)buf[0] != ((i + s) & 0xff)) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed at sector %u.", fname, s );
+				return( -1 );
+			}
+		}
+		fs3_close(fhs[i]);
+	}
+	bench_stop(&span);
+	mb = ((double)nfiles * sectors * FS3_SECTOR_SIZE) / (1024.0 * 1024.0);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 interleave benchmark, %d files of %u sectors", nfiles, sectors );
+	logMessage( LOG_OUTPUT_LEVEL, " seeks      = [ %10lu ]", (unsigned long)span.seeks );
+	logMessage( LOG_OUTPUT_LEVEL, " seeks/MB   = [ %10.2f ]", span.seeks / mb );
+	logMessage( LOG_OUTPUT_LEVEL, " throughput = [ %10.2f MB/s ]", mb / span.elapsed );
+
+	free(fhs);
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_crash
+// Description  : Crash injection harness for the metadata journal. Random
+//                appends, closes, truncates and deletes run on nfiles files
+//                until an injected crash stops the driver reaching the disk
+//                at a random sector write. The driver then recovers from the
+//                disk and every file is checked: it must hold a prefix of
+//                what was written to it, at least as much as was made durable
+//                by a close, truncate or delete that returned, and a deleted
+//                file must not come back. The free space bitmap is checked
+//                against the recovered files too
+//
+// Inputs       : nfiles - the number of files
+//                trials - the number of crashes
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_crash(int nfiles, int trials) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], *buf;
+	int *gen, *lastGen, *durGen, *live;
+	uint32_t *len, *maxLen, *durLen, chunk, off, got;
+	int16_t *fds, fh;
+	double start, recoverTime = 0;
+	int t, i, r, ops = 0, deleted;
+
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	buf = malloc(FS3_CRASH_MAX_FILE + FS3_SECTOR_SIZE);
+	gen = calloc(nfiles, sizeof(int));
+	lastGen = calloc(nfiles, sizeof(int));
+	durGen = calloc(nfiles, sizeof(int));
+	live = calloc(nfiles, sizeof(int));
+	len = calloc(nfiles, sizeof(uint32_t));
+	maxLen = calloc(nfiles, sizeof(uint32_t));
+	durLen = calloc(nfiles, sizeof(uint32_t));
+	fds = malloc(nfiles * sizeof(int16_t));
+	for (i=0; i<nfiles; i++) {
+		fds[i] = -1;
+	}
+	srand(311);
+
+	for (t=0; t<trials; t++) {
+
+		// Run operations until the crash, the durable state is what must survive it
+		injectCrash(1 + (rand() % 3000));
+		for (;;) {
+			i = rand() % nfiles;
+			r = rand() % 10;
+			snprintf(fname, FS3_MAX_PATH_LENGTH, "crash-file-%d.txt", i);
+			ops++;
+			if ( live[i] == 0 ) {
+				lastGen[i]++;
+				gen[i] = lastGen[i];
+				len[i] = maxLen[i] = 0;
+				live[i] = 1;
+				if ( (fds[i] = fs3_open(fname)) == -1 ) {
+					break;
+				}
+			} else if ( r == 0 ) {
+				// A delete that fails may or may not have happened
+				durLen[i] = 0;
+				if ( fs3_delete(fname) == -1 ) {
+					break;
+				}
+				live[i] = 0;
+				fds[i] = -1;
+				durGen[i] = -gen[i];
+			} else if ( (r <= 2) && (fds[i] != -1) ) {
+				if ( fs3_close(fds[i]) == -1 ) {
+					break;
+				}
+				fds[i] = -1;
+				durGen[i] = gen[i];
+				durLen[i] = len[i];
+			} else if ( (r == 3) || (len[i] + 4096 > FS3_CRASH_MAX_FILE) ) {
+				if ( (fds[i] == -1) && ((fds[i] = fs3_open(fname)) == -1) ) {
+					break;
+				}
+				len[i] /= 2;
+				if ( durLen[i] > len[i] ) {
+					durLen[i] = len[i];
+				}
+				if ( (fs3_truncate(fds[i], len[i]) == -1) || (fs3_seek(fds[i], len[i]) == -1) ) {
+					break;
+				}
+				durGen[i] = gen[i];
+				durLen[i] = len[i];
+			} else {
+				if ( (fds[i] == -1) && (((fds[i] = fs3_open(fname)) == -1) || (fs3_seek(fds[i], len[i]) == -1)) ) {
+					break;
+				}
+				chunk = 1 + (rand() % 4096);
+				for (off=0; off<chunk; off++) {
+					buf[off] = bench_pattern(i, gen[i], len[i] + off);
+				}
+				if ( fs3_write(fds[i], buf, chunk) != chunk ) {
+					break;
+				}
+				len[i] += chunk;
+				if ( len[i] > maxLen[i] ) {
+					maxLen[i] = len[i];
+				}
+			}
+		}
+
+		// Recover and check every file against what was made durable
+		start = bench_now();
+		if ( remountAfterCrash() != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark recovery failed on trial %d.", t );
+			return( -1 );
+		}
+		recoverTime += bench_now() - start;
+		if ( checkAllocation() != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark free space bitmap wrong after trial %d.", t );
+			return( -1 );
+		}
+		for (i=0; i<nfiles; i++) {
+			if ( lastGen[i] == 0 ) {
+				continue;
+			}
+			snprintf(fname, FS3_MAX_PATH_LENGTH, "crash-file-%d.txt", i);
+			if ( (fh = fs3_open(fname)) == -1 ) {
+				return( -1 );
+			}
+			got = 0;
+			while ( (r = fs3_read(fh, buf + got, FS3_SECTOR_SIZE)) > 0 ) {
+				got += r;
+				if ( got > FS3_CRASH_MAX_FILE ) {
+					break;
+				}
+			}
+			deleted = (durGen[i] < 0);
+			if ( got == 0 ) {
+				// Empty is fine unless a non-empty file was made durable
+				if ( (deleted == 0) && (durGen[i] != 0) && (durLen[i] > 0) ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark lost [%s] on trial %d.", fname, t );
+					return( -1 );
+				}
+				lastGen[i]++;
+				gen[i] = lastGen[i];
+			} else {
+				// The contents say which generation came back, it must be the durable one or the one after it
+				int g = ((deleted == 0) && (bench_pattern(i, durGen[i], 0) == (uint8_t)buf[0])) ? durGen[i] : gen[i];
+				if ( (deleted == 1) && (g == -durGen[i]) ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark deleted [%s] came back on trial %d.", fname, t );
+					return( -1 );
+				}
+				for (off=0; off<got; off++) {
+					if ( (uint8_t)buf[off] != bench_pattern(i, g, off) ) {
+						logMessage( LOG_ERROR_LEVEL, "FS3 benchmark [%s] corrupt at byte %u on trial %d.", fname, off, t );
+						return( -1 );
+					}
+				}
+				if ( ((g == gen[i]) && (got > maxLen[i])) || ((g == durGen[i]) && (got < durLen[i])) ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark [%s] has length %u on trial %d.", fname, got, t );
+					return( -1 );
+				}
+				gen[i] = g;
+			}
+			if ( fs3_close(fh) == -1 ) {
+				return( -1 );
+			}
+			// What came back is the new starting point
+			live[i] = 1;
+			fds[i] = -1;
+			len[i] = maxLen[i] = durLen[i] = got;
+			durGen[i] = gen[i];
+		}
+		logMessage( FS3DriverLLevel, "FS3 crash benchmark trial %d recovered.", t );
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 crash benchmark, %d files", nfiles );
+	logMessage( LOG_OUTPUT_LEVEL, " crashes    = [ %10d recovered ]", trials );
+	logMessage( LOG_OUTPUT_LEVEL, " operations = [ %10d ]", ops );
+	logMessage( LOG_OUTPUT_LEVEL, " recovery   = [ %10.2f ms average ]", (recoverTime * 1e3) / trials );
+
+	free(buf);
+	free(gen);
+	free(lastGen);
+	free(durGen);
+	free(live);
+	free(len);
+	free(maxLen);
+	free(durLen);
+	free(fds);
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_small
+// Description  : Write nfiles small files, three in four of 1 to 400 bytes and
+//                the rest of 1 to 8192 bytes, each in one write. Reports how
+//                much of the space the files (and the metadata describing
+//                them) take up is their data, then re-opens and reads every
+//                file, reporting the sectors read from the controller per open
+//
+// Inputs       : nfiles - the number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_small(int nfiles) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], buf[8192];
+	uint64_t totalSectors, freeBefore, freeAfter, dataBytes = 0;
+	uint32_t *sizes, off;
+	int16_t fh;
+	BenchSpan span;
+	int i;
+
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	// The metadata is checkpointed before and after so both counts include a complete metadata stream
+	checkpoint(false);
+	diskSpace(&totalSectors, &freeBefore);
+
+	srand(33);
+	sizes = malloc(sizeof(uint32_t) * nfiles);
+	for (i=0; i<nfiles; i++) {
+		sizes[i] = ((rand() % 4) != 0) ? 1 + (rand() % 400) : 1 + (rand() % 8192);
+		for (off=0; off<sizes[i]; off++) {
+			buf[off] = bench_pattern(i, 0, off);
+		}
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "small-file-%d.txt", i);
+		if ( ((fh = fs3_open(fname)) == -1) || (fs3_write(fh, buf, sizes[i]) != sizes[i]) || (fs3_close(fh) == -1) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark write of [%s] failed.", fname );
+			return( -1 );
+		}
+		dataBytes += sizes[i];
+	}
+	checkpoint(false);
+	diskSpace(&totalSectors, &freeAfter);
+
+	// Read every file back in full
+	bench_start(&span);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "small-file-%d.txt", i);
+		if ( ((fh = fs3_open(fname)) == -1) || (fs3_read(fh, buf, sizeof(buf)) != sizes[i]) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (off=0; off<sizes[i]; off++) {
+			if ( (uint8_t)buf[off] != bench_pattern(i, 0, off) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark [%s] is wrong at byte %u.", fname, off );
+				return( -1 );
+			}
+		}
+		fs3_close(fh);
+	}
+	bench_stop(&span);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 small file benchmark, %d files, %lu bytes", nfiles, (unsigned long)dataBytes );
+	logMessage( LOG_OUTPUT_LEVEL, " sectors used     = [ %10lu ]", (unsigned long)(freeBefore - freeAfter) );
+	logMessage( LOG_OUTPUT_LEVEL, " space efficiency = [ %10.1f %% ]",
+		(100.0 * dataBytes) / ((double)(freeBefore - freeAfter) * FS3_SECTOR_SIZE) );
+	logMessage( LOG_OUTPUT_LEVEL, " sectors/open     = [ %10.2f ]", (double)span.reads / nfiles );
+	logMessage( LOG_OUTPUT_LEVEL, " read latency     = [ %10.1f us/file ]", (span.elapsed * 1e6) / nfiles );
+
+	free(sizes);
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
@@ -0,0 +1,417 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_erasure.c
+//  Description    : This is the implementation of the Reed-Solomon erasure code
+//                   for the FS3 filesystem. A stripe of k data shards gets m
+//                   parity shards, each a combination of the data shards over
+//                   GF(2^8) with coefficients from a Cauchy matrix, so any k of
+//                   the k + m shards are enough to rebuild the rest. All of
+//                   the work is multiplying a shard by a constant and adding
+//                   it to another, which is done 16 or 32 bytes at a time with
+//                   the nibble table trick (the product of c and x is the
+//                   product of c and the low nibble of x added to the product
+//                   of c and the high nibble, each looked up with a byte
+//                   shuffle) when the CPU can, and one byte at a time when it
+//                   cannot
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <stdbool.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FS3_EC_X86
+#endif
+
+// Project Includes
+#include <fs3_erasure.h>
+
+//
+// Support Macros/Data
+
+#define GF_POLYNOMIAL 0x11d // x^8 + x^4 + x^3 + x^2 + 1
+
+typedef void (*FS3MulAdd)(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len);
+
+int fs3_erasure_data = 0;
+int fs3_erasure_parity = 0;
+
+//Log and antilog tables for GF(2^8), the antilog table is doubled so a sum of two logs needs no reduction
+uint8_t gfExp[510];
+uint8_t gfLog[256];
+bool gfReady = false;
+
+//Parity row j, data column i of the code, 1 / ((k + j) + i) in GF(2^8)
+uint8_t ecMatrix[FS3_EC_MAX_PARITY][FS3_EC_MAX_DATA];
+int ecK = 0;
+int ecM = 0;
+FS3ErasureKernel ecKernel = FS3_EC_SCALAR;
+FS3MulAdd ecMulAdd = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gfMul
+// Description  : Multiplies two elements of GF(2^8)
+//
+// Inputs       : a, b - the elements
+// Outputs      : the product
+
+uint8_t gfMul(uint8_t a, uint8_t b) {
+	if ((a == 0) || (b == 0)) {
+		return (0);
+	}
+	return (gfExp[gfLog[a] + gfLog[b]]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : gfInv
+// Description  : Gets the multiplicative inverse of a non-zero element of
+//                GF(2^8)
+//
+// Inputs       : a - the element
+// Outputs      : the inverse
+
+uint8_t gfInv(uint8_t a) {
+	return (gfExp[255 - gfLog[a]]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mulAddScalar
+// Description  : Adds c times src to dst, one byte at a time through a table
+//                of the products of c
+//
+// Inputs       : dst - shard to add to
+//                src - shard to multiply
+//                c - the constant
+//                len - bytes in each shard
+// Outputs      : none
+
+void mulAddScalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+	uint8_t product[256];
+	for (int x=0; x<256; x++) {
+		product[x] = gfMul(c, x);
+	}
+	for (size_t i=0; i<len; i++) {
+		dst[i] ^= product[src[i]];
+	}
+}
+
+#ifdef FS3_EC_X86
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mulAddSsse3
+// Description  : Adds c times src to dst 16 bytes at a time, each byte's
+//                product is looked up by its two nibbles with PSHUFB
+//
+// Inputs       : dst - shard to add to
+//                src - shard to multiply
+//                c - the constant
+//                len - bytes in each shard
+// Outputs      : none
+
+__attribute__((target("ssse3")))
+void mulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+	uint8_t lo[16], hi[16];
+	for (int x=0; x<16; x++) {
+		lo[x] = gfMul(c, x);
+		hi[x] = gfMul(c, x << 4);
+	}
+	__m128i tableLo = _mm_loadu_si128((const __m128i *)lo);
+	__m128i tableHi = _mm_loadu_si128((const __m128i *)hi);
+	__m128i mask = _mm_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i+16<=len; i+=16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i product = _mm_xor_si128(_mm_shuffle_epi8(tableLo, _mm_and_si128(x, mask)),
+			_mm_shuffle_epi8(tableHi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(dst + i)), product));
+	}
+	for (; i<len; i++) {
+		dst[i] ^= gfMul(c, src[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mulAddAvx2
+// Description  : Adds c times src to dst 32 bytes at a time, the same as
+//                mulAddSsse3 with the nibble tables in both 128 bit lanes
+//
+// Inputs       : dst - shard to add to
+//                src - shard to multiply
+//                c - the constant
+//                len - bytes in each shard
+// Outputs      : none
+
+__attribute__((target("avx2")))
+void mulAddAvx2(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+	uint8_t lo[16], hi[16];
+	for (int x=0; x<16; x++) {
+		lo[x] = gfMul(c, x);
+		hi[x] = gfMul(c, x << 4);
+	}
+	__m256i tableLo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)lo));
+	__m256i tableHi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hi));
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for (; i+32<=len; i+=32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(tableLo, _mm256_and_si256(x, mask)),
+			_mm256_shuffle_epi8(tableHi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(dst + i)), product));
+	}
+	for (; i<len; i++) {
+		dst[i] ^= gfMul(c, src[i]);
+	}
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mulAdd
+// Description  : Adds c times src to dst with the chosen kernel, multiplying
+//                by 0 or 1 needs no tables
+//
+// Inputs       : dst - shard to add to
+//                src - shard to multiply
+//                c - the constant
+//                len - bytes in each shard
+// Outputs      : none
+
+void mulAdd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len) {
+	if (c == 0) {
+		return;
+	}
+	if (c == 1) {
+		for (size_t i=0; i<len; i++) {
+			dst[i] ^= src[i];
+		}
+		return;
+	}
+	ecMulAdd(dst, src, c, len);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_init
+// Description  : Sets up the code for stripes of data data shards and parity
+//                parity shards, picking the fastest kernel the CPU has
+//
+// Inputs       : data - data shards in each stripe
+//                parity - parity shards in each stripe
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_erasure_init(int data, int parity) {
+	if ((data < 1) || (data > FS3_EC_MAX_DATA) || (parity < 1) || (parity > FS3_EC_MAX_PARITY)) {
+		return (-1);
+	}
+	if (gfReady == false) {
+		int x = 1;
+		for (int i=0; i<255; i++) {
+			gfExp[i] = x;
+			gfExp[i + 255] = x;
+			gfLog[x] = i;
+			x <<= 1;
+			if (x & 0x100) {
+				x ^= GF_POLYNOMIAL;
+			}
+		}
+		gfReady = true;
+	}
+	for (int j=0; j<parity; j++) {
+		for (int i=0; i<data; i++) {
+			ecMatrix[j][i] = gfInv((uint8_t)((data + j) ^ i));
+		}
+	}
+	ecK = data;
+	ecM = parity;
+	return (fs3_erasure_kernel(fs3_erasure_best_kernel()));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_kernel
+// Description  : Chooses the kernel used to multiply shards, so the kernels
+//                can be compared
+//
+// Inputs       : kernel - the kernel
+// Outputs      : 0 if successful, -1 if the CPU does not support it
+
+int fs3_erasure_kernel(FS3ErasureKernel kernel) {
+	switch (kernel) {
+	case FS3_EC_SCALAR:
+		ecMulAdd = mulAddScalar;
+		break;
+#ifdef FS3_EC_X86
+	case FS3_EC_SSSE3:
+		if (!__builtin_cpu_supports("ssse3")) {
+			return (-1);
+		}
+		ecMulAdd = mulAddSsse3;
+		break;
+	case FS3_EC_AVX2:
+		if (!__builtin_cpu_supports("avx2")) {
+			return (-1);
+		}
+		ecMulAdd = mulAddAvx2;
+		break;
+#endif
+	default:
+		return (-1);
+	}
+	ecKernel = kernel;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_best_kernel
+// Description  : Gets the fastest kernel the CPU supports
+//
+// Inputs       : none
+// Outputs      : the kernel
+
+FS3ErasureKernel fs3_erasure_best_kernel(void) {
+#ifdef FS3_EC_X86
+	if (__builtin_cpu_supports("avx2")) {
+		return (FS3_EC_AVX2);
+	}
+	if (__builtin_cpu_supports("ssse3")) {
+		return (FS3_EC_SSSE3);
+	}
+#endif
+	return (FS3_EC_SCALAR);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_kernel_name
+// Description  : Gets the name of a kernel
+//
+// Inputs       : kernel - the kernel
+// Outputs      : the name
+
+const char *fs3_erasure_kernel_name(FS3ErasureKernel kernel) {
+	switch (kernel) {
+	case FS3_EC_SSSE3:
+		return ("ssse3");
+	case FS3_EC_AVX2:
+		return ("avx2");
+	default:
+		return ("scalar");
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_encode
+// Description  : Computes the parity shards of a stripe
+//
+// Inputs       : data - the k data shards
+//                parity - the m parity shards to fill in
+//                len - bytes in each shard
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_erasure_encode(uint8_t **data, uint8_t **parity, size_t len) {
+	if (ecK == 0) {
+		return (-1);
+	}
+	for (int j=0; j<ecM; j++) {
+		memset(parity[j], 0, len);
+		for (int i=0; i<ecK; i++) {
+			mulAdd(parity[j], data[i], ecMatrix[j][i], len);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_erasure_decode
+// Description  : Rebuilds one shard of a stripe from k others. The rows of the
+//                code for the shards that are there are inverted to get the
+//                data shards as combinations of those shards, and the wanted
+//                shard's row turns that into its own combination
+//
+// Inputs       : present - shard numbers (data 0 to k-1, then parity) of the
+//                          k shards given
+//                shards - the k shards given
+//                want - shard number to rebuild
+//                out - buffer for the rebuilt shard
+//                len - bytes in each shard
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_erasure_decode(const int *present, uint8_t **shards, int want, uint8_t *out, size_t len) {
+	uint8_t rows[FS3_EC_MAX_DATA][FS3_EC_MAX_DATA], inverse[FS3_EC_MAX_DATA][FS3_EC_MAX_DATA];
+	uint8_t coef[FS3_EC_MAX_DATA];
+	int k = ecK;
+	if ((k == 0) || (want < 0) || (want >= k + ecM)) {
+		return (-1);
+	}
+	for (int t=0; t<k; t++) {
+		if (present[t] == want) {
+			memcpy(out, shards[t], len);
+			return (0);
+		}
+		for (int i=0; i<k; i++) {
+			rows[t][i] = (present[t] < k) ? (present[t] == i) : ecMatrix[present[t] - k][i];
+			inverse[t][i] = (t == i);
+		}
+	}
+
+	//Gauss-Jordan elimination, any k rows of the code are independent unless a shard was given twice
+	for (int col=0; col<k; col++) {
+		int pivot = col;
+		while ((pivot < k) && (rows[pivot][col] == 0)) {
+			pivot++;
+		}
+		if (pivot == k) {
+			return (-1);
+		}
+		for (int i=0; i<k; i++) {
+			uint8_t tmp = rows[col][i];
+			rows[col][i] = rows[pivot][i];
+			rows[pivot][i] = tmp;
+			tmp = inverse[col][i];
+			inverse[col][i] = inverse[pivot][i];
+			inverse[pivot][i] = tmp;
+		}
+		uint8_t scale = gfInv(rows[col][col]);
+		for (int i=0; i<k; i++) {
+			rows[col][i] = gfMul(rows[col][i], scale);
+			inverse[col][i] = gfMul(inverse[col][i], scale);
+		}
+		for (int r=0; r<k; r++) {
+			uint8_t factor = rows[r][col];
+			if ((r == col) || (factor == 0)) {
+				continue;
+			}
+			for (int i=0; i<k; i++) {
+				rows[r][i] ^= gfMul(factor, rows[col][i]);
+				inverse[r][i] ^= gfMul(factor, inverse[col][i]);
+			}
+		}
+	}
+
+	for (int t=0; t<k; t++) {
+		if (want < k) {
+			coef[t] = inverse[want][t];
+		}
+		else {
+			coef[t] = 0;
+			for (int i=0; i<k; i++) {
+				coef[t] ^= gfMul(ecMatrix[want - k][i], inverse[i][t]);
+			}
+		}
+	}
+	memset(out, 0, len);
+	for (int t=0; t<k; t++) {
+		mulAdd(out, shards[t], coef[t], len);
+	}
+	return (0);
+}
@@ -0,0 +1,55 @@
+#ifndef FS3_ERASURE_INCLUDED
+#define FS3_ERASURE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_erasure.h
+//  Description    : This is the interface for the Reed-Solomon erasure code
+//                   used to spread stripes over controllers in the FS3
+//                   filesystem.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <stddef.h>
+
+// Defines
+#define FS3_EC_MAX_DATA 8   // Most data shards in a stripe
+#define FS3_EC_MAX_PARITY 4 // Most parity shards in a stripe
+
+// Type definitions
+typedef enum {
+	FS3_EC_SCALAR = 0, // One byte at a time through a 256 entry product table
+	FS3_EC_SSSE3 = 1,  // 16 bytes at a time with PSHUFB nibble tables
+	FS3_EC_AVX2 = 2,   // 32 bytes at a time with VPSHUFB nibble tables
+} FS3ErasureKernel;
+
+// Global data
+extern int fs3_erasure_data;   // Data shards in each stripe
+extern int fs3_erasure_parity; // Parity shards in each stripe, 0 when the volume is not erasure coded
+
+//
+// Erasure Code Functions
+
+int fs3_erasure_init(int data, int parity);
+	// Set up the code for stripes of "data" data shards and "parity" parity shards
+
+int fs3_erasure_kernel(FS3ErasureKernel kernel);
+	// Choose the kernel used to multiply over GF(2^8), -1 if the CPU does not support it
+
+FS3ErasureKernel fs3_erasure_best_kernel(void);
+	// The fastest kernel the CPU supports
+
+const char *fs3_erasure_kernel_name(FS3ErasureKernel kernel);
+	// Name of a kernel, for logging
+
+int fs3_erasure_encode(uint8_t **data, uint8_t **parity, size_t len);
+	// Compute the parity shards of a stripe from its data shards
+
+int fs3_erasure_decode(const int *present, uint8_t **shards, int want, uint8_t *out, size_t len);
+	// Rebuild one shard of a stripe from any "data" of its other shards
+
+#endif
@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_erasure_bench.c
+//  Description    : This is the benchmark of the FS3 erasure code, the speed of
+//                   its kernels and the read latency of a degraded disk.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_network.h>
+#include <fs3_erasure.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_ERASURE_STRIPES 1024 // Stripes the erasure benchmark encodes at a time
+#define FS3_ERASURE_ITERATIONS 16 // Times the erasure benchmark encodes and decodes them
+#define FS3_ERASURE_READS 512 // Single sector reads in each pass of the erasure benchmark
+#define FS3_ERASURE_CHUNKS 4 // Most chunks in each file of the erasure benchmark
+
+//
+// Functional Prototypes
+
+int bench_erasure_pass(BenchFiles *files, const char *label); // One pass of reads of the erasure benchmark
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_erasure_pass
+// Description  : Read back the files of the erasure benchmark, first a
+//                sector at a time at random places and then a chunk at a
+//                time, checking everything read
+//
+// Inputs       : files - the files of the benchmark
+//                label - name of the pass in the report
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_erasure_pass(BenchFiles *files, const char *label) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], *expect;
+	uint32_t c, off, j;
+	BenchSpan sectors, chunks;
+	int16_t fh;
+	int i, r;
+
+	expect = malloc(FS3_BENCH_CHUNK);
+	srand(311);
+
+	bench_start(&sectors);
+	for (r=0; r<FS3_ERASURE_READS; r++) {
+		i = rand() % files->nfiles;
+		off = (rand() % (files->chunks * (FS3_BENCH_CHUNK / FS3_SECTOR_SIZE))) * FS3_SECTOR_SIZE;
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "%s-file-%d.txt", files->name, i);
+		if ( ((fh = fs3_open(fname)) == -1) || (fs3_seek(fh, off) != 0) ||
+				(fs3_read(fh, files->buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (j=0; j<FS3_SECTOR_SIZE; j++) {
+			if ( (uint8_t)files->buf[j] != bench_pattern(i, 0, off + j) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] is wrong at %u.", fname, off + j );
+				return( -1 );
+			}
+		}
+		fs3_close(fh);
+	}
+	bench_stop(&sectors);
+
+	// Every byte of the chunks is checked here, a rebuilt chunk can be wrong anywhere in it
+	bench_start(&chunks);
+	for (i=0; i<files->nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "%s-file-%d.txt", files->name, i);
+		if ( (fh = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (c=0; c<files->chunks; c++) {
+			for (j=0; j<FS3_BENCH_CHUNK; j++) {
+				expect[j] = bench_pattern(i, 0, (c * FS3_BENCH_CHUNK) + j);
+			}
+			if ( (fs3_read(fh, files->buf, FS3_BENCH_CHUNK) != FS3_BENCH_CHUNK) || (memcmp(files->buf, expect, FS3_BENCH_CHUNK) != 0) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed at chunk %u.", fname, c );
+				return( -1 );
+			}
+		}
+		fs3_close(fh);
+	}
+	bench_stop(&chunks);
+
+	logMessage( LOG_OUTPUT_LEVEL, " %-11s = [ %8.1f us per sector, %8.1f us per %d KB chunk ]", label,
+		(sectors.elapsed * 1e6) / FS3_ERASURE_READS, (chunks.elapsed * 1e6) / ((double)files->nfiles * files->chunks),
+		FS3_BENCH_CHUNK / 1024 );
+	free(expect);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_erasure
+// Description  : Measure the erasure code, first the encode and decode
+//                throughput of every kernel the CPU has on sector sized
+//                shards, then (with -e) the read latency of nfiles files
+//                with every controller up and again with the last one down
+//
+// Inputs       : nfiles - number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_erasure(int nfiles) {
+
+	// Local variables
+	uint8_t *shards, *data[FS3_EC_MAX_DATA], *parity[FS3_EC_MAX_PARITY], *have[FS3_EC_MAX_DATA], *out;
+	double start, encodeTime, decodeTime, gb;
+	int present[FS3_EC_MAX_DATA];
+	int k, m, kernel, s, t, iter;
+	BenchFiles files;
+	uint32_t j;
+
+	k = (fs3_erasure_parity > 0) ? fs3_erasure_data : 4;
+	m = (fs3_erasure_parity > 0) ? fs3_erasure_parity : 2;
+	if ( fs3_erasure_init(k, m) != 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark cannot erasure code %d data and %d parity shards.", k, m );
+		return( -1 );
+	}
+	shards = malloc((size_t)FS3_ERASURE_STRIPES * (k + m) * FS3_SECTOR_SIZE);
+	out = malloc(FS3_SECTOR_SIZE);
+	for (j=0; j<(uint32_t)FS3_ERASURE_STRIPES * k * FS3_SECTOR_SIZE; j++) {
+		shards[j] = rand();
+	}
+
+	// Each stripe's data shards come first in the buffer, then all of the parity. The decode rebuilds data
+	//  shard 0 from the shards left after the first m are lost, the most work a rebuild can take
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 erasure benchmark, %d data and %d parity shards of %d bytes", k, m, FS3_SECTOR_SIZE );
+	gb = ((double)FS3_ERASURE_STRIPES * FS3_ERASURE_ITERATIONS * k * FS3_SECTOR_SIZE) / 1e9;
+	for (kernel=FS3_EC_SCALAR; kernel<=FS3_EC_AVX2; kernel++) {
+		if ( fs3_erasure_kernel(kernel) != 0 ) {
+			continue;
+		}
+		start = bench_now();
+		for (iter=0; iter<FS3_ERASURE_ITERATIONS; iter++) {
+			for (s=0; s<FS3_ERASURE_STRIPES; s++) {
+				for (t=0; t<k; t++) {
+					data[t] = shards + ((((size_t)s * (k + m)) + t) * FS3_SECTOR_SIZE);
+				}
+				for (t=0; t<m; t++) {
+					parity[t] = shards + ((((size_t)s * (k + m)) + k + t) * FS3_SECTOR_SIZE);
+				}
+				fs3_erasure_encode(data, parity, FS3_SECTOR_SIZE);
+			}
+		}
+		encodeTime = bench_now() - start;
+
+		start = bench_now();
+		for (iter=0; iter<FS3_ERASURE_ITERATIONS; iter++) {
+			for (s=0; s<FS3_ERASURE_STRIPES; s++) {
+				for (t=0; t<k; t++) {
+					present[t] = m + t;
+					have[t] = shards + ((((size_t)s * (k + m)) + m + t) * FS3_SECTOR_SIZE);
+				}
+				if ( (fs3_erasure_decode(present, have, 0, out, FS3_SECTOR_SIZE) != 0) ||
+						(memcmp(out, shards + ((size_t)s * (k + m) * FS3_SECTOR_SIZE), FS3_SECTOR_SIZE) != 0) ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark %s decode is wrong.", fs3_erasure_kernel_name(kernel) );
+					return( -1 );
+				}
+			}
+		}
+		decodeTime = bench_now() - start;
+		logMessage( LOG_OUTPUT_LEVEL, " %-11s = [ encode %6.2f GB/s, decode %6.2f GB/s ]", fs3_erasure_kernel_name(kernel),
+			gb / encodeTime, gb / decodeTime );
+	}
+	free(shards);
+	free(out);
+	fs3_erasure_kernel(fs3_erasure_best_kernel());
+	if ( fs3_erasure_parity == 0 ) {
+		return( 0 );
+	}
+
+	// Then the disk itself, the files are written with every controller up
+	if ( bench_setup(&files, "erasure", nfiles, FS3_ERASURE_CHUNKS) != 0 ) {
+		return( -1 );
+	}
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 erasure benchmark, %d files of %u KB over %d controllers", nfiles,
+		files.chunks * (FS3_BENCH_CHUNK / 1024), fs3_network_controllers );
+	if ( bench_erasure_pass(&files, "healthy") != 0 ) {
+		return( -1 );
+	}
+	dropReplica(fs3_network_controllers - 1, "taken down by the benchmark");
+	if ( bench_erasure_pass(&files, "degraded") != 0 ) {
+		return( -1 );
+	}
+	return( bench_teardown(&files) );
+}
@@ -0,0 +1,334 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_journal.c
+//  Description    : This is the implementation of the metadata write-ahead
+//                   journal for the FS3 filesystem. Metadata changes are added
+//                   as entries to a group in memory and the whole group is
+//                   written as one record by a commit. Records go one after
+//                   another through a run of sectors on track 0 until the
+//                   driver checkpoints, which starts the run over.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_journal.h>
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_common.h>
+
+//
+// Support Macros/Data
+
+#define RECORD_SECTORS(x) (((x) + sizeof(FS3JournalHeader) + FS3_SECTOR_SIZE - 1) / FS3_SECTOR_SIZE)
+
+//Where the journal is on the disk and the next sector a record will be written to
+uint32_t journalTrk = 0;
+uint32_t journalStart = 0;
+uint32_t journalLen = 0;
+uint32_t journalHead = 0;
+
+//Sequence number of the last record written (or of the last record the checkpoint includes)
+uint64_t journalSeq = 0;
+
+//Entries waiting for the next commit, each is the type, name length, payload length, name and payload
+char *pendingBuf = NULL;
+uint32_t pendingLen = 0;
+uint32_t pendingCap = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : journalChecksum
+// Description  : FNV-1a over the sequence number, length and entries of a
+//                record
+//
+// Inputs       : seq - sequence number of the record
+//                entries - the entries of the record
+//                length - number of bytes of entries
+// Outputs      : the checksum
+
+uint64_t journalChecksum(uint64_t seq, const char *entries, uint32_t length) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (int i=0; i<8; i++) {
+		hash = (hash ^ ((seq >> (i * 8)) & 0xff)) * 1099511628211ULL;
+	}
+	for (int i=0; i<4; i++) {
+		hash = (hash ^ ((length >> (i * 8)) & 0xff)) * 1099511628211ULL;
+	}
+	for (uint32_t i=0; i<length; i++) {
+		hash = (hash ^ (uint8_t)entries[i]) * 1099511628211ULL;
+	}
+	return (hash);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_init
+// Description  : Sets where the journal is on the disk, new records start at
+//                the beginning of the run
+//
+// Inputs       : trk - track the journal is on
+//                start - first sector of the journal
+//                len - number of sectors in the journal
+//                seq - sequence number of the last record the checkpoint includes
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_init(uint32_t trk, uint32_t start, uint32_t len, uint64_t seq) {
+	journalTrk = trk;
+	journalStart = start;
+	journalLen = len;
+	journalHead = 0;
+	journalSeq = seq;
+	pendingLen = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_append
+// Description  : Adds an entry to the group waiting for the next commit
+//
+// Inputs       : type - what kind of change the entry records
+//                name - name of the file that changed
+//                payload - the details of the change
+//                payloadLen - number of bytes in the payload
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_append(uint8_t type, const char *name, const void *payload, uint16_t payloadLen) {
+	uint16_t nameLen = strlen(name);
+	uint32_t entryLen = sizeof(uint8_t) + (2 * sizeof(uint16_t)) + nameLen + payloadLen;
+	if (pendingLen + entryLen > pendingCap) {
+		uint32_t newCap = (pendingCap == 0) ? FS3_SECTOR_SIZE : pendingCap * 2;
+		while (newCap < pendingLen + entryLen) {
+			newCap *= 2;
+		}
+		char *newBuf = realloc(pendingBuf, newCap);
+		if (newBuf == NULL) {
+			return (-1);
+		}
+		pendingBuf = newBuf;
+		pendingCap = newCap;
+	}
+	char *pos = pendingBuf + pendingLen;
+	*pos = type;
+	pos += sizeof(uint8_t);
+	memcpy(pos, &nameLen, sizeof(uint16_t));
+	pos += sizeof(uint16_t);
+	memcpy(pos, &payloadLen, sizeof(uint16_t));
+	pos += sizeof(uint16_t);
+	memcpy(pos, name, nameLen);
+	pos += nameLen;
+	if (payloadLen > 0) {
+		memcpy(pos, payload, payloadLen);
+	}
+	pendingLen += entryLen;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_pending
+// Description  : Gets the number of bytes of entries waiting to be committed
+//
+// Inputs       : none
+// Outputs      : the number of bytes
+
+uint32_t fs3_journal_pending(void) {
+	return (pendingLen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_fits
+// Description  : Checks whether the waiting entries fit in the rest of the
+//                journal as one record
+//
+// Inputs       : none
+// Outputs      : 1 if they fit, 0 if not
+
+int fs3_journal_fits(void) {
+	return ((journalHead + RECORD_SECTORS(pendingLen)) <= journalLen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_commit
+// Description  : Writes the waiting entries to the journal as a single record,
+//                the caller checks they fit first
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_commit(void) {
+	if (pendingLen == 0) {
+		return (0);
+	}
+	if (fs3_journal_fits() == 0) {
+		return (-1);
+	}
+
+	//Lay the header and the entries out over whole sectors
+	uint32_t sectors = RECORD_SECTORS(pendingLen);
+	char *record = calloc(sectors, FS3_SECTOR_SIZE);
+	if (record == NULL) {
+		return (-1);
+	}
+	FS3JournalHeader header;
+	header.magic = FS3_JOURNAL_MAGIC;
+	header.length = pendingLen;
+	header.seq = journalSeq + 1;
+	header.checksum = journalChecksum(header.seq, pendingBuf, pendingLen);
+	memcpy(record, &header, sizeof(FS3JournalHeader));
+	memcpy(record + sizeof(FS3JournalHeader), pendingBuf, pendingLen);
+
+	for (uint32_t i=0; i<sectors; i++) {
+		if (writeSector(journalTrk, journalStart + journalHead + i, record + (i * FS3_SECTOR_SIZE)) != 0) {
+			free(record);
+			return (-1);
+		}
+	}
+	free(record);
+	journalHead += sectors;
+	journalSeq = header.seq;
+	pendingLen = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_used
+// Description  : Gets how much of the journal holds records since the last
+//                checkpoint
+//
+// Inputs       : none
+// Outputs      : the number of sectors
+
+uint32_t fs3_journal_used(void) {
+	return (journalHead);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_seq
+// Description  : Gets the sequence number of the last record committed
+//
+// Inputs       : none
+// Outputs      : the sequence number
+
+uint64_t fs3_journal_seq(void) {
+	return (journalSeq);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_reset
+// Description  : Starts the journal over once a checkpoint has written out
+//                everything its records describe. The sequence number carries
+//                on so old records left in the run are never taken as new ones
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_reset(void) {
+	journalHead = 0;
+	pendingLen = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_replay
+// Description  : Reads the records written since the last checkpoint, passing
+//                each entry to apply. Replay stops at the first record that is
+//                not the next in sequence or does not match its checksum, which
+//                is where the client stopped writing. New records are written
+//                from there on
+//
+// Inputs       : apply - called for each entry
+// Outputs      : number of records replayed if successful, -1 if failure
+
+int fs3_journal_replay(FS3JournalApply apply) {
+	char sectorBuf[FS3_SECTOR_SIZE];
+	FS3JournalHeader header;
+	int records = 0;
+
+	while (journalHead < journalLen) {
+		if (readSectorFromDisk(journalTrk, journalStart + journalHead, sectorBuf) != 0) {
+			return (-1);
+		}
+		memcpy(&header, sectorBuf, sizeof(FS3JournalHeader));
+		if ((header.magic != FS3_JOURNAL_MAGIC) || (header.seq != journalSeq + 1) ||
+				((journalHead + RECORD_SECTORS(header.length)) > journalLen)) {
+			break;
+		}
+
+		//Read the rest of the record and check it was written completely
+		uint32_t sectors = RECORD_SECTORS(header.length);
+		char *record = malloc(sectors * FS3_SECTOR_SIZE);
+		if (record == NULL) {
+			return (-1);
+		}
+		memcpy(record, sectorBuf, FS3_SECTOR_SIZE);
+		for (uint32_t i=1; i<sectors; i++) {
+			if (readSectorFromDisk(journalTrk, journalStart + journalHead + i, record + (i * FS3_SECTOR_SIZE)) != 0) {
+				free(record);
+				return (-1);
+			}
+		}
+		char *entries = record + sizeof(FS3JournalHeader);
+		if (journalChecksum(header.seq, entries, header.length) != header.checksum) {
+			free(record);
+			break;
+		}
+
+		//Hand each entry over, the name is copied out so it can be terminated
+		char name[FS3_MAX_PATH_LENGTH + 1];
+		uint32_t pos = 0;
+		while (pos < header.length) {
+			uint8_t type = entries[pos];
+			uint16_t nameLen, payloadLen;
+			memcpy(&nameLen, entries + pos + sizeof(uint8_t), sizeof(uint16_t));
+			memcpy(&payloadLen, entries + pos + sizeof(uint8_t) + sizeof(uint16_t), sizeof(uint16_t));
+			pos += sizeof(uint8_t) + (2 * sizeof(uint16_t));
+			if ((nameLen > FS3_MAX_PATH_LENGTH) || ((pos + nameLen + payloadLen) > header.length)) {
+				free(record);
+				return (-1);
+			}
+			memcpy(name, entries + pos, nameLen);
+			name[nameLen] = '\0';
+			pos += nameLen;
+			if (apply(type, name, entries + pos, payloadLen) != 0) {
+				free(record);
+				return (-1);
+			}
+			pos += payloadLen;
+		}
+		free(record);
+		journalHead += sectors;
+		journalSeq = header.seq;
+		records++;
+	}
+	return (records);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_journal_close
+// Description  : Frees the buffer of waiting entries
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_journal_close(void) {
+	free(pendingBuf);
+	pendingBuf = NULL;
+	pendingLen = 0;
+	pendingCap = 0;
+	return (0);
+}
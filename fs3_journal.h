@@ -0,0 +1,74 @@
+#ifndef FS3_JOURNAL_INCLUDED
+#define FS3_JOURNAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_journal.h
+//  Description    : This is the interface for the metadata write-ahead journal
+//                   in the FS3 filesystem.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+
+// Defines
+#define FS3_JOURNAL_MAGIC 0x4c4e524a // Marks the start of a journal record ("JRNL")
+#define FS3_JOURNAL_SECTORS 128 // Sectors kept for the journal on track 0, after the superblock
+
+// Type definitions
+typedef enum {
+	FS3_JREC_CREATE = 1,   // A new, empty file
+	FS3_JREC_EXTEND = 2,   // A run of sectors appended to a file
+	FS3_JREC_SETLEN = 3,   // New length of a file
+	FS3_JREC_TRUNCATE = 4, // A file shortened, giving back the sectors past the new end
+	FS3_JREC_DELETE = 5,   // A file removed
+	FS3_JREC_INLINE = 6,   // New contents of a file's inline tail
+} FS3JournalRecordType;
+
+typedef struct {
+	uint32_t magic; // FS3_JOURNAL_MAGIC
+	uint32_t length; // Bytes of entries following the header
+	uint64_t seq; // Sequence number, one more than the record before it
+	uint64_t checksum; // FNV-1a over the sequence number, length and entries
+} FS3JournalHeader; // Each commit writes one header followed by its entries
+
+typedef int (*FS3JournalApply)(uint8_t type, char *name, char *payload, uint16_t payloadLen);
+	// Called once for each entry found by replay
+
+//
+// Journal Functions
+
+int fs3_journal_init(uint32_t trk, uint32_t start, uint32_t len, uint64_t seq);
+	// Set where the journal is and the sequence number of the last record the checkpoint includes
+
+int fs3_journal_append(uint8_t type, const char *name, const void *payload, uint16_t payloadLen);
+	// Add an entry to the group of entries waiting to be committed
+
+uint32_t fs3_journal_pending(void);
+	// Number of bytes of entries waiting to be committed
+
+int fs3_journal_fits(void);
+	// Check whether the waiting entries fit in what is left of the journal (1 if so, 0 if not)
+
+int fs3_journal_commit(void);
+	// Write all of the waiting entries to the journal as one record
+
+uint32_t fs3_journal_used(void);
+	// Number of journal sectors holding records since the last checkpoint
+
+uint64_t fs3_journal_seq(void);
+	// Sequence number of the last record committed
+
+int fs3_journal_reset(void);
+	// Start the journal again after a checkpoint, dropping any waiting entries
+
+int fs3_journal_replay(FS3JournalApply apply);
+	// Read back the records written since the checkpoint, passing each entry to "apply"
+
+int fs3_journal_close(void);
+	// Free the buffers held by the journal
+
+#endif
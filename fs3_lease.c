@@ -0,0 +1,200 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_lease.c
+//  Description    : This is the implementation of the track leases for the
+//                   FS3 filesystem. When several clients share a controller
+//                   through a lease broker, a client may only cache a track's
+//                   sectors while it holds a lease on the track. Read leases
+//                   are shared and a write lease is held by one client only,
+//                   so before a track is written every other client has given
+//                   its lease back (dropping the track from its cache) or let
+//                   it lapse. The broker asks for leases back by setting the
+//                   recall bit in its replies, the client then sends a lease
+//                   request and the reply lists the tracks to give up
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <string.h>
+#include <arpa/inet.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_lease.h>
+#include <fs3_driver.h>
+#include <fs3_cache.h>
+#include <fs3_network.h>
+#include <fs3_common.h>
+#include <fs3_log.h>
+#include <fs3_cmdblock.h>
+
+//
+// Support Macros/Data
+
+bool fs3_lease_enabled = false;
+
+//Lease held on each track and when it has to be given up, in networkNow() seconds
+uint8_t leaseMode[FS3_LEASE_MAX_TRACKS];
+double leaseExpires[FS3_LEASE_MAX_TRACKS];
+
+//Metrics
+uint64_t leaseRequests = 0;
+uint64_t leaseRecalls = 0;
+uint64_t leaseLapses = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropLease
+// Description  : Gives up the lease on a track, what was cached of the track
+//                and the checksums of its sectors may be out of date from now
+//                on so they are dropped
+//
+// Inputs       : trk - the track
+// Outputs      : 0 if successful, -1 if failure
+
+int dropLease(uint32_t trk) {
+	leaseMode[trk] = FS3_LEASE_NONE;
+	fs3_invalidate_cache_track(trk);
+	forgetTrackSums(trk);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : requestLease
+// Description  : Sends a lease request to the broker and gives up the leases
+//                its reply lists as recalled. A request for FS3_LEASE_NONE
+//                only collects the recalled leases
+//
+// Inputs       : trk - the track
+//                mode - lease wanted
+// Outputs      : 0 if successful, -1 if failure
+
+int requestLease(uint32_t trk, FS3LeaseMode mode) {
+	char buf[FS3_SECTOR_SIZE];
+	FS3CmdBlk cmd = fs3_cmd_encode(FS3_OP_LEASE, mode, trk, 0), ret;
+	double sent = networkNow();
+
+	leaseRequests++;
+	fs3_network_recalled = false;
+	if ((network_fs3_syscall_on(0, cmd, &ret, buf) != 0) || (fs3_cmd_ret(ret) != 0)) {
+		FS3_LOG_ERROR("FS3 lease request for track %u failed.", trk);
+		return (-1);
+	}
+
+	//The recalled tracks go before the new lease is taken, the broker may list a track it is granting again
+	uint16_t count, recalled;
+	memcpy(&count, buf, sizeof(count));
+	count = ntohs(count);
+	for (int i=0; (i<count) && (i<(FS3_SECTOR_SIZE / 2) - 1); i++) {
+		memcpy(&recalled, buf + ((i + 1) * sizeof(recalled)), sizeof(recalled));
+		recalled = ntohs(recalled);
+		if (leaseMode[recalled] != FS3_LEASE_NONE) {
+			dropLease(recalled);
+			leaseRecalls++;
+		}
+	}
+	if (mode == FS3_LEASE_NONE) {
+		return (0);
+	}
+
+	//The broker counts the term from when it grants the lease, which is after it was sent
+	uint16_t term = fs3_cmd_sec(ret);
+	leaseMode[trk] = mode;
+	leaseExpires[trk] = sent + ((term > FS3_LEASE_MARGIN_MS) ? (term - FS3_LEASE_MARGIN_MS) / 1000.0 : 0);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lease_reset
+// Description  : Forgets every lease, the broker drops a client's leases when
+//                it unmounts
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_lease_reset(void) {
+	memset(leaseMode, 0, sizeof(leaseMode));
+	fs3_network_recalled = false;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lease_acquire
+// Description  : Makes sure a lease of at least the mode asked for is held on
+//                a track before it is read through the cache or written.
+//                Leases the broker has recalled are given back first, and a
+//                lease that has lapsed is dropped along with the track's
+//                cached sectors
+//
+// Inputs       : trk - the track
+//                mode - lease needed
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_lease_acquire(uint32_t trk, FS3LeaseMode mode) {
+	if (fs3_lease_enabled == false) {
+		return (0);
+	}
+	if (trk >= FS3_LEASE_MAX_TRACKS) {
+		return (-1);
+	}
+	if ((fs3_network_recalled == true) && (requestLease(0, FS3_LEASE_NONE) != 0)) {
+		return (-1);
+	}
+	if ((leaseMode[trk] != FS3_LEASE_NONE) && (leaseExpires[trk] <= networkNow())) {
+		dropLease(trk);
+		leaseLapses++;
+	}
+	if (leaseMode[trk] >= mode) {
+		return (0);
+	}
+	return (requestLease(trk, mode));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lease_requests
+// Description  : Gets the number of lease requests sent to the broker
+//
+// Inputs       : none
+// Outputs      : the number of requests
+
+uint64_t fs3_lease_requests(void) {
+	return (leaseRequests);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_lease_recalls
+// Description  : Gets the number of leases given back because the broker
+//                recalled them, leases that lapsed are not counted
+//
+// Inputs       : none
+// Outputs      : the number of recalls
+
+uint64_t fs3_lease_recalls(void) {
+	return (leaseRecalls);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_lease_metrics
+// Description  : Log the metrics for the leases, if they are being used
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_lease_metrics(void) {
+	if (fs3_lease_enabled == false) {
+		return (0);
+	}
+	FS3_LOG_INFO(FS3SimulatorLLevel, "** FS3 Lease Metrics **");
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Requests =       [     %lu]", (unsigned long)leaseRequests);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Recalled =       [     %lu]", (unsigned long)leaseRecalls);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Lapsed =         [     %lu]", (unsigned long)leaseLapses);
+	return (0);
+}
@@ -0,0 +1,51 @@
+#ifndef FS3_LEASE_INCLUDED
+#define FS3_LEASE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_lease.h
+//  Description    : This is the interface for the track leases that keep the
+//                   caches of several FS3 clients sharing a controller
+//                   coherent.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <stdbool.h>
+
+// Defines
+#define FS3_LEASE_MAX_TRACKS 65536 // Most tracks leases can be held on
+#define FS3_LEASE_MARGIN_MS 10 // A lease is given up this long before the broker would let it lapse
+
+// Type definitions
+typedef enum {
+	FS3_LEASE_NONE = 0,  // No lease, the track cannot be cached
+	FS3_LEASE_READ = 1,  // The track can be read and cached, shared with other readers
+	FS3_LEASE_WRITE = 2, // The track can also be written, held by one client only
+} FS3LeaseMode;
+
+// Global data
+extern bool fs3_lease_enabled; // Whether the controller is a lease broker shared with other clients
+
+//
+// Lease Functions
+
+int fs3_lease_reset(void);
+	// Forget every lease held, done when the disk is mounted
+
+int fs3_lease_acquire(uint32_t trk, FS3LeaseMode mode);
+	// Make sure a lease of at least "mode" is held on a track, asking the broker for one if not
+
+uint64_t fs3_lease_requests(void);
+	// Number of lease requests sent to the broker
+
+uint64_t fs3_lease_recalls(void);
+	// Number of leases the broker has recalled
+
+int fs3_log_lease_metrics(void);
+	// Log the metrics for the leases
+
+#endif
@@ -0,0 +1,231 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_lease_bench.c
+//  Description    : This is the benchmark of the FS3 track leases, two clients
+//                   sharing a server's sectors through the broker.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_controller.h>
+#include <fs3_cache.h>
+#include <fs3_lease.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_LEASE_CLIENTS 2 // Clients the lease benchmark runs at once
+#define FS3_LEASE_TRACKS 4 // Tracks, at the end of the disk, the lease benchmark clients share
+#define FS3_LEASE_TRACK_SECTORS 16 // Sectors of each shared track the lease benchmark uses
+#define FS3_LEASE_SECTORS (FS3_LEASE_TRACKS * FS3_LEASE_TRACK_SECTORS)
+#define FS3_LEASE_WRITE_ONE_IN 10 // One in this many lease benchmark operations is a write
+#define FS3_LEASE_CACHE 256 // Cache lines of each lease benchmark client
+
+// Type definitions
+typedef struct {
+	uint64_t ops, reads, diskReads, requests, recalls, stale;
+	double elapsed;
+	int failed;
+} BenchLeaseResult;
+
+typedef struct {
+	uint64_t published[FS3_LEASE_SECTORS]; // Newest write of each sector its writer has finished
+	BenchLeaseResult results[FS3_LEASE_CLIENTS];
+} BenchLeaseShared;
+
+//
+// Global Data
+BenchLeaseShared *leaseShared = NULL; // Shared by the lease benchmark clients
+
+//
+// Functional Prototypes
+
+int bench_lease_client(int client, int ops, int ready, int go); // One client of the lease benchmark
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_lease
+// Description  : Format the disk, then fork two clients that mount it through
+//                the broker and run random operations on the same sectors of
+//                the last tracks, each sector written by one client and read
+//                by both. Every write stamps the sector with a sequence number
+//                the writer publishes once the write has returned, so a read
+//                that returns an older number than was published before it
+//                started has seen stale data. Reports the throughput and hit
+//                ratio of each client and the stale reads, which leases
+//                should keep at zero
+//
+// Inputs       : nfiles - sets the operations, 16 per file for each client
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_lease(int nfiles) {
+
+	// Local variables
+	pid_t pids[FS3_LEASE_CLIENTS];
+	int ready[2], go[FS3_LEASE_CLIENTS][2], c, barrier, status, failed = 0;
+	uint64_t ops = 0, stale = 0;
+	double slowest = 0;
+	char byte = 0;
+	BenchLeaseResult *r;
+
+	// Without leases the clients write over each other's sectors, which the sector checksums would fail
+	//  rather than count as stale reads
+	fs3_sector_sums = fs3_lease_enabled;
+
+	// The clients start from a disk that is already formatted so they do not both format it
+	if ( (fs3_init_cache(FS3_LEASE_CACHE) != 0) || (fs3_mount_disk() == -1) || (fs3_unmount_disk() == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark could not format the disk." );
+		return( -1 );
+	}
+	leaseShared = mmap(NULL, sizeof(BenchLeaseShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if ( (leaseShared == MAP_FAILED) || (pipe(ready) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark could not set up the clients." );
+		return( -1 );
+	}
+	memset(leaseShared, 0, sizeof(BenchLeaseShared));
+	for (c=0; c<FS3_LEASE_CLIENTS; c++) {
+		if ( pipe(go[c]) != 0 ) {
+			return( -1 );
+		}
+		if ( (pids[c] = fork()) == 0 ) {
+			exit( (bench_lease_client(c, 16 * nfiles, ready[1], go[c][0]) == 0) ? 0 : 1 );
+		}
+	}
+
+	// The clients wait for each other once they have mounted and again before the final check, each is let
+	//  go on its own pipe so a fast one cannot take the other's turn
+	for (barrier=0; barrier<2; barrier++) {
+		for (c=0; c<FS3_LEASE_CLIENTS; c++) {
+			if ( read(ready[0], &byte, 1) != 1 ) {
+				return( -1 );
+			}
+		}
+		for (c=0; c<FS3_LEASE_CLIENTS; c++) {
+			if ( write(go[c][1], &byte, 1) != 1 ) {
+				return( -1 );
+			}
+		}
+	}
+	for (c=0; c<FS3_LEASE_CLIENTS; c++) {
+		waitpid(pids[c], &status, 0);
+		failed |= (!WIFEXITED(status) || (WEXITSTATUS(status) != 0));
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 lease benchmark, %d clients, %d operations each over %d sectors, leases %s",
+		FS3_LEASE_CLIENTS, 16 * nfiles, FS3_LEASE_SECTORS, fs3_lease_enabled ? "on" : "off" );
+	for (c=0; c<FS3_LEASE_CLIENTS; c++) {
+		r = &leaseShared->results[c];
+		logMessage( LOG_OUTPUT_LEVEL, " client %d    = [ %10.0f ops/s, hit ratio %5.1f%%, %lu lease requests, %lu recalled, %lu stale reads ]",
+			c, (r->elapsed > 0) ? r->ops / r->elapsed : 0.0, (r->reads == 0) ? 0.0 : 100.0 * (1.0 - (double)r->diskReads / r->reads),
+			(unsigned long)r->requests, (unsigned long)r->recalls, (unsigned long)r->stale );
+		ops += r->ops;
+		stale += r->stale;
+		slowest = (r->elapsed > slowest) ? r->elapsed : slowest;
+	}
+	logMessage( LOG_OUTPUT_LEVEL, " throughput  = [ %10.0f ops/s ]", (slowest > 0) ? ops / slowest : 0.0 );
+	logMessage( LOG_OUTPUT_LEVEL, " stale reads = [ %10lu ]%s", (unsigned long)stale,
+		((stale > 0) && !fs3_lease_enabled) ? " (expected without leases)" : "" );
+	munmap(leaseShared, sizeof(BenchLeaseShared));
+	if ( failed || (fs3_lease_enabled && (stale > 0)) ) {
+		return( -1 );
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_lease_client
+// Description  : One client of the lease benchmark, it mounts, runs its
+//                random operations, then reads every shared sector once the
+//                other client has finished writing and checks it holds the
+//                newest write. Its results go in the shared region
+//
+// Inputs       : client - which client this is, it writes the sectors with
+//                         this index modulo the number of clients
+//                ops - random operations to run
+//                ready - pipe to tell the benchmark it reached a barrier
+//                go - pipe the benchmark lets the clients past barriers on
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_lease_client(int client, int ops, int ready, int go) {
+
+	// Local variables
+	BenchLeaseResult *r = &leaseShared->results[client];
+	char buf[FS3_SECTOR_SIZE], byte = 0;
+	uint64_t seq, before, requests, recalls;
+	int mounted, ok, n, s;
+	BenchSpan span;
+
+	srand(311 + client);
+	mounted = ok = (fs3_mount_disk() == 0);
+	if ( (write(ready, &byte, 1) != 1) || (read(go, &byte, 1) != 1) ) {
+		ok = 0;
+	}
+
+	// Random reads of any shared sector and writes of the client's own
+	requests = fs3_lease_requests();
+	recalls = fs3_lease_recalls();
+	bench_start(&span);
+	for (n=0; ok && (n<ops); n++) {
+		if ( (rand() % FS3_LEASE_WRITE_ONE_IN) == 0 ) {
+			s = (FS3_LEASE_CLIENTS * (rand() % (FS3_LEASE_SECTORS / FS3_LEASE_CLIENTS))) + client;
+			seq = leaseShared->published[s] + 1;
+			memset(buf, (uint8_t)(s + seq), FS3_SECTOR_SIZE);
+			memcpy(buf, &seq, sizeof(seq));
+			if ( queueSector(FS3_MAX_TRACKS - FS3_LEASE_TRACKS + (s / FS3_LEASE_TRACK_SECTORS), s % FS3_LEASE_TRACK_SECTORS, buf) != 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark client %d write of sector %d failed.", client, s );
+				ok = 0;
+			} else {
+				__atomic_store_n(&leaseShared->published[s], seq, __ATOMIC_SEQ_CST);
+			}
+		} else {
+			s = rand() % FS3_LEASE_SECTORS;
+			before = __atomic_load_n(&leaseShared->published[s], __ATOMIC_SEQ_CST);
+			if ( getSector(FS3_MAX_TRACKS - FS3_LEASE_TRACKS + (s / FS3_LEASE_TRACK_SECTORS), s % FS3_LEASE_TRACK_SECTORS, buf) != 0 ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark client %d read of sector %d failed.", client, s );
+				ok = 0;
+			}
+			memcpy(&seq, buf, sizeof(seq));
+			r->stale += (seq < before);
+			r->reads++;
+		}
+		r->ops++;
+	}
+	bench_stop(&span);
+	r->elapsed = span.elapsed;
+	r->diskReads = span.reads;
+	r->requests = fs3_lease_requests() - requests;
+	r->recalls = fs3_lease_recalls() - recalls;
+
+	// Nothing is written any more, so every sector has to hold its newest write
+	if ( (write(ready, &byte, 1) != 1) || (read(go, &byte, 1) != 1) ) {
+		ok = 0;
+	}
+	for (s=0; ok && (s<FS3_LEASE_SECTORS); s++) {
+		if ( getSector(FS3_MAX_TRACKS - FS3_LEASE_TRACKS + (s / FS3_LEASE_TRACK_SECTORS), s % FS3_LEASE_TRACK_SECTORS, buf) != 0 ) {
+			ok = 0;
+		}
+		memcpy(&seq, buf, sizeof(seq));
+		r->stale += (seq != leaseShared->published[s]);
+	}
+	if ( mounted && (fs3_unmount_disk() == -1) ) {
+		ok = 0;
+	}
+	r->failed = !ok;
+	return( ok ? 0 : -1 );
+}
@@ -0,0 +1,324 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_log.c
+//  Description    : This is the implementation of logging for the FS3
+//                   filesystem. Messages go straight to the log unless the
+//                   log is asynchronous, then each thread formats its
+//                   messages into a ring only it adds to and a log thread
+//                   takes them out, oldest first, and writes them to the log,
+//                   so a thread never waits on the log file to log.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+// Project Includes
+#include <fs3_log.h>
+
+//
+// Support Macros/Data
+
+unsigned long fs3LogMask = ~0UL;
+
+//A message waiting to be written
+typedef struct {
+	uint64_t seq;      // Order it was logged in
+	unsigned long lvl; // Level it was logged at
+	char text[MAX_LOG_MESSAGE_SIZE];
+} FS3LogEntry;
+
+//A thread's messages, the thread adds at head and the log thread takes from tail
+typedef struct FS3LogRing {
+	FS3LogEntry entries[FS3_LOG_RING_ENTRIES];
+	uint32_t head;
+	uint32_t tail;
+	bool owned;               // A thread is logging to it, else it is kept for the next thread
+	struct FS3LogRing *next;  // Next of every ring made
+} FS3LogRing;
+
+bool logAsync = false;
+bool logStopping = false;
+uint64_t logSeq = 0;            // Sequence number of the next message, taken with an atomic add
+FS3LogRing *logRings = NULL;
+__thread FS3LogRing *logRing = NULL;
+pthread_t logThread;
+pthread_key_t logKey;
+pthread_once_t logOnce = PTHREAD_ONCE_INIT;
+pthread_mutex_t logRingsLock = PTHREAD_MUTEX_INITIALIZER; // Held to add or hand out a ring
+pthread_mutex_t logDrainLock = PTHREAD_MUTEX_INITIALIZER; // Held while the rings are emptied
+pthread_cond_t logWake = PTHREAD_COND_INITIALIZER;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logDrain
+// Description  : Writes out every message waiting, taking the oldest of the
+//                rings each time so the log keeps the order they were logged
+//                in. Called with logDrainLock held
+//
+// Inputs       : none
+// Outputs      : number of messages written
+
+int logDrain(void) {
+	int written = 0;
+	while (true) {
+		FS3LogRing *oldest = NULL;
+		pthread_mutex_lock(&logRingsLock);
+		for (FS3LogRing *ring=logRings; ring!=NULL; ring=ring->next) {
+			if ((__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) && ((oldest == NULL) ||
+					(ring->entries[ring->tail % FS3_LOG_RING_ENTRIES].seq < oldest->entries[oldest->tail % FS3_LOG_RING_ENTRIES].seq))) {
+				oldest = ring;
+			}
+		}
+		pthread_mutex_unlock(&logRingsLock);
+		if (oldest == NULL) {
+			return (written);
+		}
+		FS3LogEntry *entry = &oldest->entries[oldest->tail % FS3_LOG_RING_ENTRIES];
+		logMessage(entry->lvl, "%s", entry->text);
+		__atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+		written++;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logWorker
+// Description  : The log thread, it writes out the messages waiting whenever
+//                a ring fills up and every few milliseconds otherwise
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *logWorker(void *arg) {
+	pthread_mutex_lock(&logDrainLock);
+	while (!logStopping) {
+		struct timespec until;
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_nsec += 10000000;
+		if (until.tv_nsec >= 1000000000) {
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&logWake, &logDrainLock, &until);
+		logDrain();
+	}
+	logDrain();
+	pthread_mutex_unlock(&logDrainLock);
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logRingExit
+// Description  : Keeps the ring of a thread that is exiting for another
+//                thread, the log thread still writes out what it holds
+//
+// Inputs       : arg - the ring
+// Outputs      : none
+
+void logRingExit(void *arg) {
+	FS3LogRing *ring = arg;
+	pthread_mutex_lock(&logRingsLock);
+	ring->owned = false;
+	pthread_mutex_unlock(&logRingsLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logThreadRing
+// Description  : Gets the calling thread's ring, giving it one the first
+//                time it logs
+//
+// Inputs       : none
+// Outputs      : the ring, NULL if failure
+
+FS3LogRing *logThreadRing(void) {
+	if (logRing != NULL) {
+		return (logRing);
+	}
+	pthread_mutex_lock(&logRingsLock);
+	FS3LogRing *ring = logRings;
+	while ((ring != NULL) && ring->owned) {
+		ring = ring->next;
+	}
+	if ((ring == NULL) && ((ring = calloc(1, sizeof(FS3LogRing))) != NULL)) {
+		ring->next = logRings;
+		logRings = ring;
+	}
+	if (ring != NULL) {
+		ring->owned = true;
+	}
+	pthread_mutex_unlock(&logRingsLock);
+	if (ring != NULL) {
+		logRing = ring;
+		pthread_setspecific(logKey, ring);
+	}
+	return (ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logForkPrepare, logForkParent, logForkChild
+// Description  : Write out every message waiting before a fork, so the child
+//                does not write them again, and give the child a log thread
+//                of its own, as only the thread that forked is copied
+//
+// Inputs       : none
+// Outputs      : none
+
+void logForkPrepare(void) {
+	if (logAsync) {
+		pthread_mutex_lock(&logDrainLock);
+		logDrain();
+		pthread_mutex_lock(&logRingsLock);
+	}
+}
+
+void logForkParent(void) {
+	if (logAsync) {
+		pthread_mutex_unlock(&logRingsLock);
+		pthread_mutex_unlock(&logDrainLock);
+	}
+}
+
+void logForkChild(void) {
+	if (logAsync) {
+		for (FS3LogRing *ring=logRings; ring!=NULL; ring=ring->next) {
+			ring->owned = (ring == logRing);
+		}
+		pthread_mutex_unlock(&logRingsLock);
+		pthread_mutex_unlock(&logDrainLock);
+		pthread_cond_init(&logWake, NULL);  // The log thread may have been waiting on it, which the copy remembers
+		if (pthread_create(&logThread, NULL, logWorker, NULL) != 0) {
+			logAsync = false;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logExit
+// Description  : Writes out every message waiting when the program exits
+//
+// Inputs       : none
+// Outputs      : none
+
+void logExit(void) {
+	fs3_log_close();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logSetup
+// Description  : Creates the key that gives back each thread's ring and
+//                the fork handlers, once
+//
+// Inputs       : none
+// Outputs      : none
+
+void logSetup(void) {
+	pthread_key_create(&logKey, logRingExit);
+	pthread_atfork(logForkPrepare, logForkParent, logForkChild);
+	atexit(logExit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_init
+// Description  : Takes the levels that are on, call it once they are set,
+//                and starts the log thread if the log is asynchronous
+//
+// Inputs       : async - write messages from a thread of their own
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_init(bool async) {
+	unsigned long mask = 0;
+	for (int bit=0; bit<(int)(sizeof(mask) * 8); bit++) {
+		if (levelEnabled(1UL << bit)) {
+			mask |= 1UL << bit;
+		}
+	}
+	fs3LogMask = mask;
+	if (!async || logAsync) {
+		return (0);
+	}
+	pthread_once(&logOnce, logSetup);
+	logStopping = false;
+	if (pthread_create(&logThread, NULL, logWorker, NULL) != 0) {
+		logMessage(LOG_ERROR_LEVEL, "FS3 log: failed starting the log thread, logging synchronously.");
+		return (-1);
+	}
+	logAsync = true;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_close
+// Description  : Writes out every message waiting and stops the log thread,
+//                called at exit when the log is asynchronous
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_close(void) {
+	if (!logAsync) {
+		return (0);
+	}
+	pthread_mutex_lock(&logDrainLock);
+	logStopping = true;
+	pthread_cond_signal(&logWake);
+	pthread_mutex_unlock(&logDrainLock);
+	if (pthread_join(logThread, NULL) != 0) {
+		return (-1);
+	}
+	logAsync = false;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_message
+// Description  : Logs a message, straight to the log or into the calling
+//                thread's ring, waiting for the log thread if the ring is
+//                full
+//
+// Inputs       : lvl - level of the message
+//                fmt - "printf"-style format
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_message(unsigned long lvl, const char *fmt, ...) {
+	va_list args;
+	int result = 0;
+	FS3LogRing *ring;
+
+	va_start(args, fmt);
+	if (!logAsync || ((ring = logThreadRing()) == NULL)) {
+		result = vlogMessage(lvl, fmt, args);
+		va_end(args);
+		return (result);
+	}
+	while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == FS3_LOG_RING_ENTRIES) {
+		pthread_cond_signal(&logWake);
+		sched_yield();
+	}
+	FS3LogEntry *entry = &ring->entries[ring->head % FS3_LOG_RING_ENTRIES];
+	entry->seq = __atomic_fetch_add(&logSeq, 1, __ATOMIC_RELAXED);
+	entry->lvl = lvl;
+	vsnprintf(entry->text, sizeof(entry->text), fmt, args);
+	va_end(args);
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+	if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) == FS3_LOG_RING_ENTRIES / 2) {
+		pthread_cond_signal(&logWake);
+	}
+	return (result);
+}
@@ -0,0 +1,57 @@
+#ifndef FS3_LOG_INCLUDED
+#define FS3_LOG_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_log.h
+//  Description    : This is the interface for logging in the FS3 filesystem.
+//                   The macros check the level before the arguments are
+//                   evaluated, and a message below the tier the program was
+//                   built with (FS3_LOG_BUILD_TIER) is compiled out.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdbool.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_LOG_TIER_ERROR 0 // Errors, warnings and output, always built in
+#define FS3_LOG_TIER_INFO 1 // The simulator, driver, cache and controller levels
+#define FS3_LOG_TIER_DEBUG 2 // Extended debugging
+#ifndef FS3_LOG_BUILD_TIER
+#define FS3_LOG_BUILD_TIER FS3_LOG_TIER_DEBUG // Highest tier built in, set with -DFS3_LOG_BUILD_TIER
+#endif
+#define FS3_LOG_RING_ENTRIES 256 // Messages a thread can have waiting to be written when logging asynchronously
+
+// Log a message of a level, if the tier is built in and the level is on
+#define FS3_LOG(tier, lvl, ...) \
+	do { \
+		if (((tier) <= FS3_LOG_BUILD_TIER) && ((fs3LogMask & (lvl)) != 0)) { \
+			fs3_log_message((lvl), __VA_ARGS__); \
+		} \
+	} while (0)
+#define FS3_LOG_ERROR(...) FS3_LOG(FS3_LOG_TIER_ERROR, LOG_ERROR_LEVEL, __VA_ARGS__)
+#define FS3_LOG_WARNING(...) FS3_LOG(FS3_LOG_TIER_ERROR, LOG_WARNING_LEVEL, __VA_ARGS__)
+#define FS3_LOG_OUTPUT(...) FS3_LOG(FS3_LOG_TIER_ERROR, LOG_OUTPUT_LEVEL, __VA_ARGS__)
+#define FS3_LOG_INFO(lvl, ...) FS3_LOG(FS3_LOG_TIER_INFO, (lvl), __VA_ARGS__)
+#define FS3_LOG_DEBUG(lvl, ...) FS3_LOG(FS3_LOG_TIER_DEBUG, (lvl), __VA_ARGS__)
+
+// Global data
+extern unsigned long fs3LogMask; // Levels that are on, every level until fs3_log_init is called
+
+//
+// Log Functions
+
+int fs3_log_init(bool async);
+	// Take the levels that are on, and start writing messages from a thread of their own if async
+
+int fs3_log_close(void);
+	// Write out every message waiting and stop the log thread
+
+int fs3_log_message(unsigned long lvl, const char *fmt, ...);
+	// Log a "printf"-style message, use the FS3_LOG macros rather than this
+
+#endif
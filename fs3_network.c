@@ -14,12 +14,21 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <cmpsc311_log.h>
 
 // Project Includes
 #include <fs3_network.h>
-#include <math.h>
 #include <fs3_controller.h>
+#include <fs3_common.h>
+#include <fs3_log.h>
+#include <fs3_cmdblock.h>
+#include <fs3_span.h>
+#include <fs3_trace.h>
 #include <cmpsc311_util.h>
 #include <string.h>
 
@@ -28,10 +37,54 @@
 unsigned char     *fs3_network_address = NULL; // Address of FS3 server
 unsigned short     fs3_network_port = 0;       // Port of FS3 server
 
-int unusedbits = 0;
-int socketfd;
-struct sockaddr_in cadder;
-int connected = -1;
+
+//Controllers the volume is striped over, controller 0 is the one given by fs3_network_address and
+//  fs3_network_port. Each has its own connection, connected is 0 while it is up and -2 once it has been
+//  dropped, a dropped controller has missed writes so it is not connected to again by a later mount
+int fs3_network_controllers = 1;
+unsigned char *controllerAddress[FS3_MAX_CONTROLLERS];
+unsigned short controllerPort[FS3_MAX_CONTROLLERS];
+int socketfd[FS3_MAX_CONTROLLERS];
+int connected[FS3_MAX_CONTROLLERS] = { [0 ... FS3_MAX_CONTROLLERS - 1] = -1 };
+
+//Mirroring, each of the fs3_network_controllers / fs3_network_replicas columns the volume is striped over is
+//  kept on fs3_network_replicas controllers, column c being controllers c, c + columns, c + 2 * columns and
+//  so on. Writes and seeks go to every replica and are acknowledged once fs3_network_quorum of them (all of
+//  them when 0) have replied, the replies of the others are collected later. Reads go to a single replica
+int fs3_network_replicas = 1;
+int fs3_network_quorum = 0;
+//Erasure coded volumes have no mirrors, instead up to fs3_network_spares controllers may fail (at mount or
+//  after) and the driver rebuilds what they held from the others
+int fs3_network_spares = 0;
+int replicaPending[FS3_MAX_CONTROLLERS];   // Replies sent by the controller that have not been read yet
+double replicaSentAt[FS3_MAX_CONTROLLERS]; // When the last command went to the controller
+double replicaLatency[FS3_MAX_CONTROLLERS]; // Moving average of the controller's reply time in seconds
+uint64_t replicaReads[FS3_MAX_CONTROLLERS]; // Reads the controller has served
+uint64_t replicaLastRead[FS3_MAX_CONTROLLERS]; // Read number of its column the controller last served
+uint64_t columnReads[FS3_MAX_CONTROLLERS]; // Reads made on each column
+
+//Commands sent to each controller, each is a round trip on its connection. Kept per controller so the threads
+//  running a batch each count their own
+uint64_t controllerCommands[FS3_MAX_CONTROLLERS];
+
+//Name of the span of a command to a controller, by opcode
+const char *controllerSpans[16] = {
+	"controller mount", "controller tseek", "controller rdsect", "controller wrsect", "controller umount",
+	"controller", "controller", "controller", "controller lease", "controller", "controller", "controller",
+	"controller", "controller", "controller", "controller"
+};
+
+//A lease broker sets the recall bit in any reply to a client it wants leases back from, the client sends a
+//  lease request to find out which
+bool fs3_network_recalled = false;
+
+//Work handed to the thread running one controller's part of a batch
+typedef struct {
+	FS3NetRequest *reqs;
+	int n;
+	int ctrl;
+	int result;
+} FS3NetWorker;
 
 
 //
@@ -39,136 +92,652 @@ int connected = -1;
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : construct_fs3_cmdblock
-// Description  : constructs the command block that will be used
+// Function     : fs3_network_add_controller
+// Description  : Adds another controller to stripe the volume over, it is
+//                connected to when the disk is mounted
 //
-// Inputs       : op - operator code
-//				  sec - sector number
-//				  trk - track number
-//				  ret - return value (typically zero)
-// Outputs      : the constructed command block
-
-FS3CmdBlk construct_network_fs3_cmdblock(uint8_t op, uint16_t sec, uint_fast32_t trk, uint8_t ret){
-	//create variables for command blocks that will be used
-	uint64_t cmdBlock = 0;
-	uint64_t temp = 0;
+// Inputs       : address - IP address of the controller
+//                port - port number of the controller
+// Outputs      : index of the controller if successful, -1 if failure
 
-	//repeated process -> make temp have the different components in the correct spot and or "|" it with cmdBlock
-	//  each part will be surrounded by 0's which when or'd with cmdBlock will give the correct cmdBlock back
-	cmdBlock = op;
-	cmdBlock = cmdBlock << 60;
-	temp = sec;
-	temp = temp << 44;
-	cmdBlock = cmdBlock | temp;
-	temp = trk;
-	temp = temp << 12;
-	cmdBlock = cmdBlock | temp;
-	temp = ret;
-	temp = temp << 11;
-	cmdBlock = cmdBlock | temp;
-	cmdBlock = cmdBlock | unusedbits;
-	return cmdBlock;
+int fs3_network_add_controller(const char *address, unsigned short port)
+{
+	if (fs3_network_controllers == FS3_MAX_CONTROLLERS){
+		return (-1);
+	}
+	controllerAddress[fs3_network_controllers] = (unsigned char *)strdup(address);
+	controllerPort[fs3_network_controllers] = port;
+	fs3_network_controllers++;
+	return (fs3_network_controllers - 1);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : deconstruct_fs3_cmdblock
-// Description  : deconstructs command block that was passed
+// Function     : network_fs3_syscall
+// Description  : Perform a system call over the network, a mount or unmount
+//                goes to every controller and anything else to controller 0
 //
-// Inputs       : same parameters as construction function
+// Inputs       : cmd - the command block to send
+//                ret - the returned command block
+//                buf - the buffer to place received data in
 // Outputs      : 0 if successful, -1 if failure
 
-int deconstruct_network_fs3_cmdblock(FS3CmdBlk cmdBlock, uint8_t op, uint16_t sec, uint32_t trk, uint8_t ret){
-	//Generate a destroyBlock that contains 0's in every place that we don't want the value of
-	// then shift to get proper value
-	//Getting ret value
-	FS3CmdBlk destroyBlock = construct_network_fs3_cmdblock(0, 0, 0, 1);
-	ret = (cmdBlock & destroyBlock) >> 11;
+int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+{
+	FS3_SPAN("network", "network_fs3_syscall");
+	uint8_t op = fs3_cmd_op(cmd);
+	if ((op != FS3_OP_MOUNT) && (op != FS3_OP_UMOUNT)){
+		return (network_fs3_syscall_on(0, cmd, ret, buf));
+	}
 
-	//Getting trk value
-	destroyBlock = construct_network_fs3_cmdblock(0, 0, pow(2.0, 32.0), 0);
-	trk = (cmdBlock & destroyBlock) >> 12;
+	//Setting up address and port data, controller 0 is the one set on the command line
+	if (fs3_network_address == NULL){
+		fs3_network_address = (unsigned char *)FS3_DEFAULT_IP;
+	}
+	if (fs3_network_port == 0){
+		fs3_network_port = FS3_DEFAULT_PORT;
+	}
+	controllerAddress[0] = fs3_network_address;
+	controllerPort[0] = fs3_network_port;
+
+	if ((fs3_network_replicas < 1) || ((fs3_network_controllers % fs3_network_replicas) != 0) ||
+			(fs3_network_quorum > fs3_network_replicas)){
+		FS3_LOG_ERROR("FS3 network: %d controllers cannot hold %d replicas with a quorum of %d.",
+			fs3_network_controllers, fs3_network_replicas, fs3_network_quorum);
+		*ret = fs3_cmd_encode(op, 0, 0, 1);
+		return (-1);
+	}
 
-	//Getting sec value
-	destroyBlock = construct_network_fs3_cmdblock(0, (uint16_t)pow(2.0,16.0), 0, 0);
-	sec = (cmdBlock & destroyBlock) >> 44;
+	//Controller 0 goes last so its reply is the one handed back. A mirrored controller that fails is left out
+	//  as long as every column still has a replica, and so are up to fs3_network_spares others. Anything
+	//  else failing fails the whole call
+	FS3CmdBlk ctrlRet;
+	int lost = 0;
+	for (int ctrl=fs3_network_controllers-1; ctrl>=0; ctrl--){
+		if ((op == FS3_OP_UMOUNT) && ((fs3_network_replicas > 1) || (fs3_network_spares > 0))){
+			if ((connected[ctrl] != 0) || (drainReplica(ctrl) != 0)){
+				continue;
+			}
+		}
+		if ((op == FS3_OP_MOUNT) && (connected[ctrl] == -2)){
+			if ((fs3_network_replicas == 1) && (++lost > fs3_network_spares)){
+				*ret = fs3_cmd_encode(op, 0, 0, 1);
+				return (-1);
+			}
+			continue;
+		}
+		uint64_t start = fs3_trace_begin();
+		ctrlRet = 0;
+		int result = controllerSyscall(ctrl, cmd, &ctrlRet, buf);
+		fs3_trace_command(ctrl, cmd, ctrlRet, buf, result, start);
+		if ((result != 0) || (fs3_cmd_ret(ctrlRet) != 0)){
+			if ((fs3_network_replicas == 1) && (++lost > fs3_network_spares)){
+				*ret = fs3_cmd_encode(op, 0, 0, 1);
+				return (-1);
+			}
+			dropReplica(ctrl, (op == FS3_OP_MOUNT) ? "mount failed" : "unmount failed");
+			continue;
+		}
+		*ret = ctrlRet;
+	}
+	if ((op == FS3_OP_MOUNT) && (fs3_network_replicas > 1)){
+		for (int col=0; col<fs3_network_columns(); col++){
+			if (pickReplica(col, false) == -1){
+				*ret = fs3_cmd_encode(op, 0, 0, 1);
+				return (-1);
+			}
+		}
+	}
+	return (0);
+}
 
-	//Getting op value
-	op = cmdBlock >> 60;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_network_columns
+// Description  : Gets the number of columns the volume is striped over, each
+//                held by fs3_network_replicas controllers
+//
+// Inputs       : none
+// Outputs      : the number of columns
 
-	return op;
+int fs3_network_columns(void)
+{
+	return (fs3_network_controllers / fs3_network_replicas);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : network_fs3_syscall
-// Description  : Perform a system call over the network
+// Function     : network_fs3_syscall_on
+// Description  : Perform a system call on one of the columns the volume is
+//                striped over, tracing it when a trace is being taken
 //
-// Inputs       : cmd - the command block to send
+// Inputs       : ctrl - the column to send it to
+//                cmd - the command block to send
 //                ret - the returned command block
 //                buf - the buffer to place received data in
 // Outputs      : 0 if successful, -1 if failure
 
-int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+int network_fs3_syscall_on(int ctrl, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
 {
+	FS3_SPAN("network", "network_fs3_syscall_on");
+	uint64_t start = fs3_trace_begin();
+	int result = columnSyscall(ctrl, cmd, ret, buf);
+	//A failed call may not have set the reply, the trace records 0 for it instead
+	fs3_trace_command(ctrl, cmd, (result == 0) ? *ret : 0, buf, result, start);
+	return (result);
+}
 
-	//MOUNT function called, so initializing network connection
-	if (deconstruct_network_fs3_cmdblock(cmd, FS3_OP_MOUNT, 0, 0, 0) == 0){
-		//Setting up address and port data
-		if (fs3_network_address == NULL){
-			fs3_network_address = (unsigned char *)FS3_DEFAULT_IP;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : columnSyscall
+// Description  : Perform a system call on one of the columns the volume is
+//                striped over, going to its mirrors when it has them
+//
+// Inputs       : ctrl - the column to send it to
+//                cmd - the command block to send
+//                ret - the returned command block
+//                buf - the buffer to place received data in
+// Outputs      : 0 if successful, -1 if failure
+
+int columnSyscall(int ctrl, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+{
+	if (fs3_network_replicas == 1){
+		int result = controllerSyscall(ctrl, cmd, ret, buf);
+		if ((result == 0) && (((*ret >> FS3_LEASE_RECALL_BIT) & 1) != 0)){
+			fs3_network_recalled = true;
+		}
+		return (result);
+	}
+	uint8_t op = fs3_cmd_op(cmd);
+	if (op == FS3_OP_RDSECT){
+		return (mirrorRead(ctrl, cmd, ret, buf));
+	}
+	return (mirrorUpdate(ctrl, cmd, ret, buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : networkNow
+// Description  : Gets the current monotonic time
+//
+// Inputs       : none
+// Outputs      : the time in seconds
+
+double networkNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((double)ts.tv_sec + ((double)ts.tv_nsec / 1e9));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropReplica
+// Description  : Stops using a controller that has failed or fallen out of
+//                step with the others, a mirrored column carries on with the
+//                rest of its replicas
+//
+// Inputs       : ctrl - the controller
+//                why - reason logged
+// Outputs      : 0 if successful, -1 if failure
+
+int dropReplica(int ctrl, const char *why)
+{
+	if (connected[ctrl] == 0){
+		close(socketfd[ctrl]);
+	}
+	socketfd[ctrl] = -1;
+	connected[ctrl] = -2;
+	replicaPending[ctrl] = 0;
+	FS3_LOG_WARNING("FS3 network: dropping controller %s:%u (%s).",
+		(controllerAddress[ctrl] != NULL) ? (char *)controllerAddress[ctrl] : FS3_DEFAULT_IP, controllerPort[ctrl], why);
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_network_up
+// Description  : Checks whether a controller is connected and has not been
+//                dropped
+//
+// Inputs       : ctrl - the controller
+// Outputs      : true if the controller is up, false if not
+
+bool fs3_network_up(int ctrl)
+{
+	return ((ctrl >= 0) && (ctrl < fs3_network_controllers) && (connected[ctrl] == 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replicaRead
+// Description  : Reads from a mirrored controller, giving up if it does not
+//                answer within FS3_MIRROR_TIMEOUT_MS
+//
+// Inputs       : ctrl - the controller
+//                buf - buffer to read into
+//                len - number of bytes to read
+// Outputs      : 0 if successful, -1 if failure
+
+int replicaRead(int ctrl, void *buf, size_t len)
+{
+	struct pollfd pfd = { .fd = socketfd[ctrl], .events = POLLIN };
+	size_t done = 0;
+	while (done < len){
+		if (poll(&pfd, 1, FS3_MIRROR_TIMEOUT_MS) <= 0){
+			return (-1);
+		}
+		ssize_t got = read(socketfd[ctrl], (char *)buf + done, len - done);
+		if (got <= 0){
+			return (-1);
+		}
+		done += got;
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readReply
+// Description  : Reads the oldest reply a mirrored controller owes, updating
+//                its reply time once it has caught up
+//
+// Inputs       : ctrl - the controller
+//                reply - where to put the reply
+// Outputs      : 0 if successful, -1 if failure (the replica is dropped)
+
+int readReply(int ctrl, FS3CmdBlk *reply)
+{
+	if (replicaRead(ctrl, reply, sizeof(FS3CmdBlk)) != 0){
+		dropReplica(ctrl, "no reply");
+		return (-1);
+	}
+	*reply = ntohll64(*reply);
+	replicaPending[ctrl]--;
+	if (replicaPending[ctrl] == 0){
+		double sample = networkNow() - replicaSentAt[ctrl];
+		replicaLatency[ctrl] = (replicaLatency[ctrl] == 0) ? sample : ((0.875 * replicaLatency[ctrl]) + (0.125 * sample));
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drainReplica
+// Description  : Collects every reply a mirrored controller still owes, they
+//                are all for writes and seeks its column already acknowledged
+//                so any of them failing means the replica is out of step
+//
+// Inputs       : ctrl - the controller
+// Outputs      : 0 if successful, -1 if the replica was dropped
+
+int drainReplica(int ctrl)
+{
+	FS3CmdBlk reply;
+	while (replicaPending[ctrl] > 0){
+		if (readReply(ctrl, &reply) != 0){
+			return (-1);
+		}
+		if (fs3_cmd_ret(reply) != 0){
+			dropReplica(ctrl, "missed a write");
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pickReplica
+// Description  : Chooses the replica of a column to read from, the one whose
+//                replies are expected soonest given its reply time and the
+//                replies it still owes. Every FS3_MIRROR_PROBE_INTERVAL reads
+//                the replica that has gone longest without a read is used
+//                instead so its reply time stays current
+//
+// Inputs       : col - the column
+//                count - whether this is a read to be counted
+// Outputs      : the controller, -1 if the column has no replica left
+
+int pickReplica(int col, bool count)
+{
+	int cols = fs3_network_columns();
+	int best = -1;
+	double bestWait = 0;
+	bool probe = false;
+	if (count == true){
+		columnReads[col]++;
+		probe = ((columnReads[col] % FS3_MIRROR_PROBE_INTERVAL) == 0);
+	}
+	for (int ctrl=col; ctrl<fs3_network_controllers; ctrl+=cols){
+		if (connected[ctrl] != 0){
+			continue;
+		}
+		double wait = probe ? (double)replicaLastRead[ctrl] : (replicaLatency[ctrl] * (1 + replicaPending[ctrl]));
+		if ((best == -1) || (wait < bestWait)){
+			best = ctrl;
+			bestWait = wait;
+		}
+	}
+	if ((best != -1) && (count == true)){
+		replicaLastRead[best] = columnReads[col];
+	}
+	return (best);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirrorRead
+// Description  : Reads a sector from one replica of a column, moving on to
+//                another replica if the one chosen fails
+//
+// Inputs       : col - the column
+//                cmd - the RDSECT command block
+//                ret - the returned command block
+//                buf - the buffer to place the sector in
+// Outputs      : 0 if successful, -1 if failure
+
+int mirrorRead(int col, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+{
+	int ctrl;
+	while ((ctrl = pickReplica(col, true)) != -1){
+		//Replies owed for earlier writes come first on the connection
+		if (drainReplica(ctrl) != 0){
+			continue;
+		}
+		uint64_t cmdConvert = htonll64(cmd);
+		replicaSentAt[ctrl] = networkNow();
+		replicaPending[ctrl]++;
+		controllerCommands[ctrl]++;
+		if (write(socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
+			dropReplica(ctrl, "read failed");
+			continue;
+		}
+		if (readReply(ctrl, ret) != 0){
+			continue;
+		}
+		//The controller does not send the sector back when the read failed (e.g. a bad sector number)
+		if (fs3_cmd_ret(*ret) != 0){
+			return (0);
+		}
+		if (replicaRead(ctrl, buf, FS3_SECTOR_SIZE) != 0){
+			dropReplica(ctrl, "read failed");
+			continue;
+		}
+		replicaReads[ctrl]++;
+		return (0);
+	}
+	*ret = fs3_cmd_encode(0, 0, 0, 1);
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirrorQuorum
+// Description  : Gets the number of replicas that have to acknowledge a write
+//                or seek, fs3_network_quorum if it is set and otherwise every
+//                replica it went to that is still up and has not failed it
+//
+// Inputs       : sent - the replicas the command went to
+//                sentLen - number of replicas it went to
+//                failed - number of them that failed it
+// Outputs      : the number of acknowledgements needed
+
+int mirrorQuorum(int *sent, int sentLen, int failed)
+{
+	if (fs3_network_quorum != 0){
+		return (fs3_network_quorum);
+	}
+	int live = 0;
+	for (int i=0; i<sentLen; i++){
+		live += (connected[sent[i]] == 0) ? 1 : 0;
+	}
+	return (live - failed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mirrorUpdate
+// Description  : Sends a write or seek to every replica of a column and waits
+//                for the quorum to reply. A replica that fails the command
+//                while others carry it out is out of step and dropped, if they
+//                all fail it (a seek past the last track) the failure is the
+//                reply
+//
+// Inputs       : col - the column
+//                cmd - the TSEEK or WRSECT command block
+//                ret - the returned command block
+//                buf - the sector to write, NULL for a seek
+// Outputs      : 0 if successful, -1 if failure
+
+int mirrorUpdate(int col, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+{
+	int cols = fs3_network_columns();
+	int sent[FS3_MAX_CONTROLLERS], sentLen = 0;
+	uint64_t cmdConvert = htonll64(cmd);
+	for (int ctrl=col; ctrl<fs3_network_controllers; ctrl+=cols){
+		if ((connected[ctrl] != 0) || ((replicaPending[ctrl] >= FS3_MIRROR_MAX_PENDING) && (drainReplica(ctrl) != 0))){
+			continue;
 		}
-		if (fs3_network_port == 0){
-			fs3_network_port = FS3_DEFAULT_PORT;
+		if ((write(socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)) ||
+				((buf != NULL) && (write(socketfd[ctrl], buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE))){
+			dropReplica(ctrl, "write failed");
+			continue;
 		}
+		replicaSentAt[ctrl] = networkNow();
+		replicaPending[ctrl]++;
+		controllerCommands[ctrl]++;
+		sent[sentLen++] = ctrl;
+	}
+	if ((sentLen == 0) || (sentLen < fs3_network_quorum)){
+		*ret = fs3_cmd_encode(0, 0, 0, 1);
+		return (-1);
+	}
 
+	//Replies are taken from whichever replicas answer first, each replica's reply to this command is the
+	//  last one it owes. Without a quorum every replica still up has to answer
+	int acked = 0, failed = 0, waiting = sentLen, need = 0;
+	int failedCtrl[FS3_MAX_CONTROLLERS];
+	FS3CmdBlk reply, failReply = 0;
+	struct pollfd pfds[FS3_MAX_CONTROLLERS];
+	while (true){
+		need = mirrorQuorum(sent, sentLen, failed);
+		if ((acked >= need) || (waiting == 0)){
+			break;
+		}
+		int nfds = 0;
+		for (int i=0; i<sentLen; i++){
+			if ((connected[sent[i]] == 0) && (replicaPending[sent[i]] > 0)){
+				pfds[nfds].fd = socketfd[sent[i]];
+				pfds[nfds].events = POLLIN;
+				pfds[nfds].revents = 0;
+				nfds++;
+			}
+		}
+		if (poll(pfds, nfds, FS3_MIRROR_TIMEOUT_MS) <= 0){
+			break;
+		}
+		for (int i=0; i<sentLen; i++){
+			int ctrl = sent[i];
+			bool ready = false;
+			for (int j=0; j<nfds; j++){
+				if ((pfds[j].fd == socketfd[ctrl]) && (pfds[j].revents != 0)){
+					ready = true;
+				}
+			}
+			if ((ready == false) || (connected[ctrl] != 0) || (replicaPending[ctrl] == 0)){
+				continue;
+			}
+			if (readReply(ctrl, &reply) != 0){
+				waiting--;
+				continue;
+			}
+			bool failedCmd = (fs3_cmd_ret(reply) != 0);
+			if (replicaPending[ctrl] > 0){
+				if (failedCmd){
+					dropReplica(ctrl, "missed a write");
+					waiting--;
+				}
+				continue;
+			}
+			waiting--;
+			if (failedCmd){
+				failReply = reply;
+				failedCtrl[failed++] = ctrl;
+			}
+			else{
+				if (acked == 0){
+					*ret = reply;
+				}
+				acked++;
+			}
+		}
+	}
+
+	//Whatever is still owed is collected later, unless the replica has stopped answering altogether
+	if ((acked < need) && (failed == 0)){
+		for (int i=0; i<sentLen; i++){
+			if ((connected[sent[i]] == 0) && (replicaPending[sent[i]] > 0)){
+				dropReplica(sent[i], "timed out");
+			}
+		}
+		need = mirrorQuorum(sent, sentLen, failed);
+	}
+	if ((acked > 0) && (acked >= need)){
+		for (int i=0; i<failed; i++){
+			dropReplica(failedCtrl[i], "missed a write");
+		}
+		return (0);
+	}
+	if ((acked == 0) && (failed > 0)){
+		*ret = failReply;
+		return (0);
+	}
+	*ret = fs3_cmd_encode(0, 0, 0, 1);
+	return (-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_network_reads
+// Description  : Gets the number of reads a mirrored controller has served
+//
+// Inputs       : ctrl - the controller
+// Outputs      : the number of reads
+
+uint64_t fs3_network_reads(int ctrl)
+{
+	return (replicaReads[ctrl]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_network_round_trips
+// Description  : Gets the number of commands sent to the controllers, a write
+//                to several mirrors counts once for each
+//
+// Inputs       : none
+// Outputs      : the number of round trips
+
+uint64_t fs3_network_round_trips(void)
+{
+	uint64_t total = 0;
+	for (int ctrl=0; ctrl<FS3_MAX_CONTROLLERS; ctrl++){
+		total += controllerCommands[ctrl];
+	}
+	return (total);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_network_metrics
+// Description  : Log the metrics for the mirrored controllers
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_network_metrics(void)
+{
+	if (fs3_network_replicas == 1){
+		return (0);
+	}
+	FS3_LOG_INFO(FS3SimulatorLLevel, "** FS3 Mirror Metrics **");
+	for (int ctrl=0; ctrl<fs3_network_controllers; ctrl++){
+		FS3_LOG_INFO(FS3SimulatorLLevel, " Controller %d (column %d) = [ %s, %lu reads, %.3f ms ]", ctrl,
+			ctrl % fs3_network_columns(), (connected[ctrl] == 0) ? "up" : "down",
+			(unsigned long)replicaReads[ctrl], replicaLatency[ctrl] * 1000);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : controllerSyscall
+// Description  : Perform a system call over the network on one controller
+//
+// Inputs       : ctrl - the controller to send it to
+//                cmd - the command block to send
+//                ret - the returned command block
+//                buf - the buffer to place received data in
+// Outputs      : 0 if successful, -1 if failure
+
+int controllerSyscall(int ctrl, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
+{
+	uint8_t op = fs3_cmd_op(cmd);
+	FS3_SPAN("network", controllerSpans[op]);
+	struct sockaddr_in cadder;
+
+	controllerCommands[ctrl]++;
+
+	//MOUNT function called, so initializing network connection
+	if (op == FS3_OP_MOUNT){
 		//Creating the socket that will be used
-		socketfd = socket(PF_INET, SOCK_STREAM, 0);
-		if (socketfd == -1){
+		socketfd[ctrl] = socket(PF_INET, SOCK_STREAM, 0);
+		if (socketfd[ctrl] == -1){
 			//Socket creation was unsuccessful
 			return (-1);
 		}
 
 		//Creating netowrk address data
 		cadder.sin_family = AF_INET;
-		cadder.sin_port = htons(fs3_network_port);
-		if (inet_aton((const char *)fs3_network_address, &cadder.sin_addr) == 0){
+		cadder.sin_port = htons(controllerPort[ctrl]);
+		if (inet_aton((const char *)controllerAddress[ctrl], &cadder.sin_addr) == 0){
 			return (-1);
 		}
 
 		//Making connection to socket
-		if (connect(socketfd, (const struct sockaddr*)&cadder, sizeof(cadder)) == -1){
+		if (connect(socketfd[ctrl], (const struct sockaddr*)&cadder, sizeof(cadder)) == -1){
 			return (-1);
 		}
 
 		uint64_t cmdConvert = htonll64(cmd);
-		if (write (socketfd, &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (write (socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
-		if (read(socketfd, ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (read(socketfd[ctrl], ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
 		*ret = ntohll64(*ret);
 
-		connected = 0;
+		connected[ctrl] = 0;
 
 		return (0);
 	}
 
 	//TSEEK function called, so need to send track information to the server
-	if (deconstruct_network_fs3_cmdblock(cmd, FS3_OP_TSEEK, 0, 0, 0) == 1){
-		if (connected != 0){
+	if (op == FS3_OP_TSEEK){
+		if (connected[ctrl] != 0){
 			return (-1);
 		}
 		uint64_t cmdConvert = htonll64(cmd);
-		if (write(socketfd, &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (write(socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
-		if (read(socketfd, ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (read(socketfd[ctrl], ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
 		*ret = ntohll64(*ret);
@@ -176,49 +745,54 @@ int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
 		return (0);
 	}
 
-	//RDSECT function called, so need to read the data in the sector and return it to the driver
-	if (deconstruct_network_fs3_cmdblock(cmd, FS3_OP_RDSECT, 0, 0, 0) == 2){
-		if (connected != 0){
+	//RDSECT function called, so need to read the data in the sector and return it to the driver. A lease
+	//  request to a broker is answered the same way, the sector holding the tracks it recalled
+	if ((op == FS3_OP_RDSECT) || (op == FS3_OP_LEASE)){
+		if (connected[ctrl] != 0){
 			return (-1);
 		}
 		//Need to call read and fill in the buf with the data
 		uint64_t cmdConvert = htonll64(cmd);
-		if (write(socketfd, &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (write(socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
-		if (read(socketfd, ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (read(socketfd[ctrl], ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
+		*ret = ntohll64(*ret);
 
-		if (read(socketfd, buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		//The controller does not send the sector back when the read failed (e.g. a bad sector number)
+		if (fs3_cmd_ret(*ret) != 0){
+			return (0);
+		}
+		if (read(socketfd[ctrl], buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
-		*ret = ntohll64(*ret);
 
 		return (0);
 	}
 
 	//WRSECT function called, so need to write the data into the sector
-	if (deconstruct_network_fs3_cmdblock(cmd, FS3_OP_WRSECT, 0, 0, 0) == 3){
-		if (connected != 0){
+	if (op == FS3_OP_WRSECT){
+		if (connected[ctrl] != 0){
 			return (-1);
 		}
 		//Need to call write and fill in the new data
 		uint64_t cmdConvert = htonll64(cmd);
-		if (write(socketfd, &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (write(socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
 
-		if (write(socketfd, buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (write(socketfd[ctrl], buf, FS3_SECTOR_SIZE) != FS3_SECTOR_SIZE){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
-		if (read(socketfd, ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
-			*ret = construct_network_fs3_cmdblock(0, 0, 0, 1);
+		if (read(socketfd[ctrl], ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
 		*ret = ntohll64(*ret);
@@ -227,15 +801,27 @@ int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
 	}
 
 	//UMOUNT function called, so need to close the socket
-	if (deconstruct_network_fs3_cmdblock(cmd, FS3_OP_UMOUNT, 0, 0, 0) == 4){
-		if (connected != 0){
+	if (op == FS3_OP_UMOUNT){
+		if (connected[ctrl] != 0){
+			return (-1);
+		}
+		//The controller only stores the disk to its backing file when it is told to unmount, so the
+		//  command goes over before the socket is closed
+		uint64_t cmdConvert = htonll64(cmd);
+		if (write(socketfd[ctrl], &cmdConvert, sizeof(cmdConvert)) != sizeof(cmdConvert)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
 			return (-1);
 		}
+		if (read(socketfd[ctrl], ret, sizeof(FS3CmdBlk)) != sizeof(FS3CmdBlk)){
+			*ret = fs3_cmd_encode(0, 0, 0, 1);
+			return (-1);
+		}
+		*ret = ntohll64(*ret);
+
 		//Need to close the socket
-		close(socketfd);
-    	socketfd = -1;
-		
-		*ret = construct_network_fs3_cmdblock(0, 0, 0, 0);
+		close(socketfd[ctrl]);
+    	socketfd[ctrl] = -1;
+		connected[ctrl] = -1;
 
 		return (0);
 	}
@@ -243,3 +829,84 @@ int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf)
     return (0);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : networkWorker
+// Description  : Thread body running one controller's part of a batch, in
+//                the order the batch gives
+//
+// Inputs       : arg - the FS3NetWorker describing the work
+// Outputs      : NULL
+
+void *networkWorker(void *arg)
+{
+	FS3NetWorker *worker = arg;
+	worker->result = 0;
+	for (int i=0; i<worker->n; i++){
+		FS3NetRequest *req = &worker->reqs[i];
+		if (req->ctrl != worker->ctrl){
+			continue;
+		}
+		req->result = network_fs3_syscall_on(req->ctrl, req->cmd, &req->ret, req->buf);
+		if (req->result != 0){
+			worker->result = -1;
+			break;
+		}
+	}
+	return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : network_fs3_syscall_batch
+// Description  : Perform a batch of system calls, each controller's calls go
+//                in the order they are in the batch while the controllers all
+//                work at the same time, one thread each (a batch for a single
+//                controller runs on the calling thread). The reply of each call
+//                and whether it was made is left in its request
+//
+// Inputs       : reqs - the calls to make
+//                n - number of calls in the batch
+// Outputs      : 0 if successful, -1 if any call failed
+
+int network_fs3_syscall_batch(FS3NetRequest *reqs, int n)
+{
+	FS3_SPAN("network", "network_fs3_syscall_batch");
+	FS3NetWorker workers[FS3_MAX_CONTROLLERS];
+	pthread_t threads[FS3_MAX_CONTROLLERS];
+	bool used[FS3_MAX_CONTROLLERS] = { false };
+	int result = 0, usedLen = 0;
+
+	for (int i=0; i<n; i++){
+		if ((reqs[i].ctrl < 0) || (reqs[i].ctrl >= fs3_network_columns())){
+			return (-1);
+		}
+		reqs[i].result = 1;
+		usedLen += (used[reqs[i].ctrl] == false) ? 1 : 0;
+		used[reqs[i].ctrl] = true;
+	}
+	for (int ctrl=0; ctrl<fs3_network_columns(); ctrl++){
+		workers[ctrl].reqs = reqs;
+		workers[ctrl].n = n;
+		workers[ctrl].ctrl = ctrl;
+		workers[ctrl].result = 0;
+		if ((used[ctrl] == true) && (usedLen == 1)){
+			used[ctrl] = false;
+			networkWorker(&workers[ctrl]);
+		}
+		else if ((used[ctrl] == true) && (pthread_create(&threads[ctrl], NULL, networkWorker, &workers[ctrl]) != 0)){
+			//The controller's part is run here instead
+			used[ctrl] = false;
+			networkWorker(&workers[ctrl]);
+		}
+	}
+	for (int ctrl=0; ctrl<fs3_network_columns(); ctrl++){
+		if (used[ctrl] == true){
+			pthread_join(threads[ctrl], NULL);
+		}
+		if (workers[ctrl].result != 0){
+			result = -1;
+		}
+	}
+	return (result);
+}
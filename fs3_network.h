@@ -11,6 +11,8 @@
 //
 
 // Include Files
+#include <stddef.h>
+#include <stdbool.h>
 
 // Project Include Files
 #include <fs3_controller.h>
@@ -20,11 +22,31 @@
 #define FS3_NET_HEADER_SIZE sizeof(FS3CmdBlk)
 #define FS3_DEFAULT_IP "127.0.0.1"
 #define FS3_DEFAULT_PORT 22887
+#define FS3_MAX_CONTROLLERS 8 // Controllers a volume can be striped over
+#define FS3_MIRROR_TIMEOUT_MS 2000 // How long a mirrored controller has to reply before it is dropped
+#define FS3_MIRROR_MAX_PENDING 256 // Replies a mirrored controller can owe before it is waited for
+#define FS3_MIRROR_PROBE_INTERVAL 64 // Reads of a column between reads of its least recently read replica
+#define FS3_OP_LEASE 8 // Ask a lease broker for a lease on a track, sec is the FS3LeaseMode and trk the track
+#define FS3_LEASE_RECALL_BIT 10 // Set in a broker's reply when the client has leases it is asked to give back
+
+// Type definitions
+typedef struct {
+	int ctrl;      // Controller the call goes to
+	FS3CmdBlk cmd; // Command block to send
+	FS3CmdBlk ret; // Command block the controller returned
+	void *buf;     // Sector to send or receive, NULL for commands without one
+	int result;    // 0 once the call is made, -1 if it failed, 1 if it was never sent
+} FS3NetRequest;
 
 
 // Global data
 extern unsigned char *fs3_network_address;     // Address of FS3 server
 extern unsigned short fs3_network_port;        // Port of FS3 server
+extern int fs3_network_controllers;            // Number of controllers the volume is striped over
+extern int fs3_network_replicas;               // Number of controllers holding each column
+extern int fs3_network_quorum;                 // Replicas that must acknowledge a write, 0 for all
+extern int fs3_network_spares;                 // Unmirrored controllers that may be down at mount, for erasure coding
+extern bool fs3_network_recalled;              // A lease broker has asked for leases back since the last lease request
 
 //
 // Functional Prototypes
@@ -32,10 +54,61 @@ extern unsigned short fs3_network_port;        // Port of FS3 server
 int network_fs3_syscall(FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
 	// This is the client/network system call for communicating with controller
 
+int network_fs3_syscall_on(int ctrl, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
+	// The system call made on one of the columns the volume is striped over
+
+int columnSyscall(int ctrl, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
+	// The system call made on a column, untraced
+
+int controllerSyscall(int ctrl, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
+	// The system call made on a single controller
+
+int fs3_network_columns(void);
+	// Number of columns the volume is striped over, each held by fs3_network_replicas controllers
+
+double networkNow(void);
+	// Get the current monotonic time in seconds
+
+int dropReplica(int ctrl, const char *why);
+	// Stop using a controller that has failed
+
+bool fs3_network_up(int ctrl);
+	// Whether a controller is connected and has not been dropped
+
+int replicaRead(int ctrl, void *buf, size_t len);
+	// Read from a mirrored controller, giving up after FS3_MIRROR_TIMEOUT_MS
+
+int readReply(int ctrl, FS3CmdBlk *reply);
+	// Read the oldest reply a mirrored controller owes
+
+int drainReplica(int ctrl);
+	// Collect every reply a mirrored controller still owes
+
+int pickReplica(int col, bool count);
+	// Choose the replica of a column to read from
+
+int mirrorRead(int col, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
+	// Read a sector from one replica of a column
+
+int mirrorQuorum(int *sent, int sentLen, int failed);
+	// Number of replicas that have to acknowledge a write or seek
+
+int mirrorUpdate(int col, FS3CmdBlk cmd, FS3CmdBlk *ret, void *buf);
+	// Send a write or seek to every replica of a column and wait for the quorum
+
+uint64_t fs3_network_reads(int ctrl);
+	// Number of reads a mirrored controller has served
+
+uint64_t fs3_network_round_trips(void);
+	// Number of commands sent to the controllers
+
+int fs3_log_network_metrics(void);
+	// Log the metrics for the mirrored controllers
+
+int network_fs3_syscall_batch(FS3NetRequest *reqs, int n);
+	// Make a batch of system calls, running the controllers in parallel
 
-FS3CmdBlk construct_network_fs3_cmdblock(uint8_t op, uint16_t sec, uint_fast32_t trk, uint8_t ret);
-	// Constructs the correct command block to be sent back to the driver
+int fs3_network_add_controller(const char *address, unsigned short port);
+	// Add a controller to stripe the volume over
 
-int deconstruct_network_fs3_cmdblock(FS3CmdBlk cmdBlock, uint8_t op, uint16_t sec, uint32_t trk, uint8_t ret);
-	// Deconstructs the command block that was sent by the driver
 #endif
@@ -0,0 +1,110 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_network_bench.c
+//  Description    : This is the set of benchmarks of the FS3 network layer, the
+//                   throughput of striping and the reads mirroring spreads.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_network.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_STRIPE_CHUNKS 16 // Most chunks in each file of the stripe benchmark
+#define FS3_MIRROR_CHUNKS 4 // Most chunks in each file of the mirror benchmark
+#define FS3_MIRROR_PASSES 8 // Times the mirror benchmark reads its files back
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_stripe
+// Description  : Write nfiles files start to end in 64KB chunks, then read
+//                each back the same way, reporting the throughput of both
+//                passes. Run with more servers given by -s to see how the
+//                throughput scales with the controllers the disk is striped
+//                over
+//
+// Inputs       : nfiles - number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_stripe(int nfiles) {
+
+	// Local variables
+	BenchFiles files;
+	BenchSpan readBack;
+
+	if ( bench_setup(&files, "stripe", nfiles, FS3_STRIPE_CHUNKS) != 0 ) {
+		return( -1 );
+	}
+	bench_start(&readBack);
+	if ( bench_read_files(&files) != 0 ) {
+		return( -1 );
+	}
+	bench_stop(&readBack);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 stripe benchmark, %d files of %u KB over %d controllers",
+		nfiles, files.chunks * (FS3_BENCH_CHUNK / 1024), fs3_network_controllers );
+	logMessage( LOG_OUTPUT_LEVEL, " write      = [ %10.2f MB/s ]", files.mb / files.written.elapsed );
+	logMessage( LOG_OUTPUT_LEVEL, " read       = [ %10.2f MB/s ]", files.mb / readBack.elapsed );
+	logMessage( LOG_OUTPUT_LEVEL, " seeks      = [ %10lu ]", (unsigned long)(files.written.seeks + readBack.seeks) );
+
+	return( bench_teardown(&files) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_mirror
+// Description  : Write nfiles files, then read them all back
+//                FS3_MIRROR_PASSES times, reporting the throughput of each
+//                pass and how many of its reads each controller served. Run
+//                with -r and a slowed or failing controller (see fs3_proxy)
+//                to see the reads move away from it
+//
+// Inputs       : nfiles - number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_mirror(int nfiles) {
+
+	// Local variables
+	uint64_t before[FS3_MAX_CONTROLLERS];
+	BenchFiles files;
+	BenchSpan span;
+	char line[256];
+	int pass, ctrl, len;
+
+	if ( bench_setup(&files, "mirror", nfiles, FS3_MIRROR_CHUNKS) != 0 ) {
+		return( -1 );
+	}
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 mirror benchmark, %d files of %u KB over %d controllers, %d replicas",
+		nfiles, files.chunks * (FS3_BENCH_CHUNK / 1024), fs3_network_controllers, fs3_network_replicas );
+	for (pass=0; pass<FS3_MIRROR_PASSES; pass++) {
+		for (ctrl=0; ctrl<fs3_network_controllers; ctrl++) {
+			before[ctrl] = fs3_network_reads(ctrl);
+		}
+		bench_start(&span);
+		if ( bench_read_files(&files) != 0 ) {
+			return( -1 );
+		}
+		bench_stop(&span);
+		len = 0;
+		for (ctrl=0; ctrl<fs3_network_controllers; ctrl++) {
+			len += snprintf(&line[len], sizeof(line) - len, " %6lu", (unsigned long)(fs3_network_reads(ctrl) - before[ctrl]));
+		}
+		logMessage( LOG_OUTPUT_LEVEL, " pass %d      = [ %8.2f MB/s ] reads per controller [%s ]", pass + 1,
+			files.mb / span.elapsed, line );
+	}
+
+	return( bench_teardown(&files) );
+}
@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_proxy.c
+//  Description    : This is a proxy that sits between the FS3 driver and a
+//                   controller, adding latency to everything the driver sends
+//                   and optionally dropping the connection after a number of
+//                   messages. Used to check that mirrored reads move away from
+//                   a slow controller and that a failed one is bypassed.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Defines
+#define FS3_PROXY_ARGUMENTS "hd:f:"
+#define FS3_PROXY_BUFFER 65536
+#define USAGE \
+	"USAGE: fs3_proxy [-h] [-d <delay>] [-f <messages>] <listen port> <server ip:port>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -d - microseconds to hold each message from the driver (default 0)\n" \
+	"    -f - drop the connection and exit after this many messages from the\n" \
+	"         driver, as if the controller had died (default never)\n" \
+	"\n" \
+	"    <listen port> - port the driver connects to\n" \
+	"    <server ip:port> - controller the proxy forwards to\n" \
+	"\n" \
+
+//
+// Functional Prototypes
+
+int proxy_connect(const char *address, unsigned short port); // Connect to the controller
+int proxy_relay(int client, int server, long delay, long fail); // Forward one driver connection
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 proxy, it accepts one driver
+//                connection at a time and relays it to the controller
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	struct sockaddr_in addr;
+	char address[64];
+	unsigned short listenPort, serverPort;
+	long delay = 0, fail = -1;
+	int ch, lfd, client, server, one = 1;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_PROXY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'd': // Set the delay
+			if ( (sscanf(optarg, "%ld", &delay) != 1) || (delay < 0) ) {
+				fprintf( stderr, "Bad delay [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'f': // Set when the connection fails
+			if ( (sscanf(optarg, "%ld", &fail) != 1) || (fail < 0) ) {
+				fprintf( stderr, "Bad message count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+	if ( (optind + 2 != argc) || (sscanf(argv[optind], "%hu", &listenPort) != 1) ||
+			(sscanf(argv[optind + 1], "%63[^:]:%hu", address, &serverPort) != 2) ) {
+		fprintf( stderr, "Missing or bad command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+
+	// Listen for the driver
+	lfd = socket(PF_INET, SOCK_STREAM, 0);
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(listenPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ( (lfd == -1) || (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) || (listen(lfd, 1) == -1) ) {
+		fprintf( stderr, "Cannot listen on port %u\n", listenPort );
+		return( -1 );
+	}
+
+	// Each driver connection gets its own connection to the controller
+	while ( (client = accept(lfd, NULL, NULL)) != -1 ) {
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if ( (server = proxy_connect(address, serverPort)) == -1 ) {
+			fprintf( stderr, "Cannot connect to %s:%u\n", address, serverPort );
+			close(client);
+			continue;
+		}
+		int failed = proxy_relay(client, server, delay, fail);
+		close(client);
+		close(server);
+		if ( failed ) {
+			break;
+		}
+	}
+	close(lfd);
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_connect
+// Description  : Connect to the controller
+//
+// Inputs       : address - IP address of the controller
+//                port - port of the controller
+// Outputs      : the socket if successful, -1 if failure
+
+int proxy_connect(const char *address, unsigned short port) {
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if ( (inet_aton(address, &addr.sin_addr) == 0) || ((fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) ) {
+		return( -1 );
+	}
+	if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+		close(fd);
+		return( -1 );
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return( fd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : proxy_relay
+// Description  : Forward a driver connection until either side closes it,
+//                holding each message from the driver for the delay first
+//
+// Inputs       : client - socket of the driver
+//                server - socket of the controller
+//                delay - microseconds to hold each message from the driver
+//                fail - messages to forward before failing, -1 for never
+// Outputs      : 1 if the connection was failed on purpose, 0 if not
+
+int proxy_relay(int client, int server, long delay, long fail) {
+	struct pollfd pfds[2] = { { .fd = client, .events = POLLIN }, { .fd = server, .events = POLLIN } };
+	char buf[FS3_PROXY_BUFFER];
+	long messages = 0;
+	ssize_t len;
+
+	while ( poll(pfds, 2, -1) > 0 ) {
+		if ( pfds[0].revents != 0 ) {
+			if ( (len = read(client, buf, sizeof(buf))) <= 0 ) {
+				return( 0 );
+			}
+			if ( (fail != -1) && (messages++ >= fail) ) {
+				return( 1 );
+			}
+			if ( delay > 0 ) {
+				usleep(delay);
+			}
+			if ( write(server, buf, len) != len ) {
+				return( 0 );
+			}
+		}
+		if ( pfds[1].revents != 0 ) {
+			if ( (len = read(server, buf, sizeof(buf))) <= 0 ) {
+				return( 0 );
+			}
+			if ( write(client, buf, len) != len ) {
+				return( 0 );
+			}
+		}
+	}
+	return( 0 );
+}
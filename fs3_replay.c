@@ -0,0 +1,422 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_replay.c
+//  Description    : This is the trace replayer for the FS3 filesystem. It
+//                   reads a trace written by a driver mounted with tracing on
+//                   and sends the same commands to the controllers, either
+//                   at the times they were first sent or as fast as the
+//                   controllers answer, so a controller can be measured
+//                   without the driver or the workload that made the trace.
+//                   Commands are sent one at a time in the order they were
+//                   first sent. Only a hash of each sector is traced, so the
+//                   sectors written are made up from it.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <fs3_controller.h>
+#include <fs3_network.h>
+#include <fs3_trace.h>
+#include <fs3_cmdblock.h>
+
+// Defines
+#define FS3_REPLAY_ARGUMENTS "hm"
+#define FS3_REPLAY_MAX_SERVERS 64 // Controllers a trace can be replayed to
+#define FS3_REPLAY_OPS 9 // Operator codes counted, up to FS3_OP_LEASE
+#define USAGE \
+	"USAGE: fs3_replay [-h] [-m] <trace file> <server ip:port> [<server ip:port> ...]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -m - send each command as soon as the last is answered, instead of\n" \
+	"         at the time it was first sent\n" \
+	"\n" \
+	"    <trace file> - trace written by the driver (fs3_sim -T)\n" \
+	"    <server ip:port> - controller the trace's controller (or column) 0\n" \
+	"         commands go to, then 1 and so on\n" \
+	"\n" \
+
+// Type definitions
+typedef struct {
+	const char *name; // Name of the operator in the report
+	uint64_t count;   // Commands replayed
+	double total;     // Seconds they took to answer, replayed and traced
+	double max;
+	double traceTotal;
+	double traceMax;
+} ReplayOp;
+
+//
+// Global Data
+
+int servers[FS3_REPLAY_MAX_SERVERS];
+char *serverNames[FS3_REPLAY_MAX_SERVERS];
+int nservers = 0;
+ReplayOp replayOps[FS3_REPLAY_OPS] = {
+	[FS3_OP_MOUNT] = { .name = "mount" },
+	[FS3_OP_TSEEK] = { .name = "tseek" },
+	[FS3_OP_RDSECT] = { .name = "rdsect" },
+	[FS3_OP_WRSECT] = { .name = "wrsect" },
+	[FS3_OP_UMOUNT] = { .name = "umount" },
+	[FS3_OP_LEASE] = { .name = "lease" },
+};
+
+//
+// Functional Prototypes
+
+int replay_connect(const char *name); // Connect to a controller
+double replay_now(void); // Monotonic time in seconds
+int replay_read(int fd, void *buf, size_t len); // Read all of a message
+int replay_write(int fd, const void *buf, size_t len); // Write all of a message
+int replay_compare(const void *a, const void *b); // Order records by when they were sent
+void replay_sector(uint32_t hash, char *buf); // Make up a sector to write
+int replay_command(const FS3TraceRecord *rec, FS3CmdBlk *ret); // Send one command
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the FS3 trace replayer, it reads the
+//                trace, sends its commands to the controllers and reports
+//                how long they took against how long they took when traced
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main(int argc, char *argv[]) {
+
+	// Local variables
+	const FS3TraceHeader *header;
+	FS3TraceRecord *records;
+	struct timespec when;
+	struct stat st;
+	double begin, first, elapsed, took;
+	uint64_t nrecords, i, replayed = 0, skipped = 0, failed = 0, differ = 0;
+	FS3CmdBlk ret;
+	char *map;
+	int ch, fd, maxSpeed = 0;
+	uint8_t op;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_REPLAY_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'm': // Replay as fast as the controllers answer
+			maxSpeed = 1;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+	if ( (optind + 2 > argc) || (argc - optind - 1 > FS3_REPLAY_MAX_SERVERS) ) {
+		fprintf( stderr, "Missing or bad command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+	for (i=optind+1; i<(uint64_t)argc; i++) {
+		servers[nservers] = -1;
+		serverNames[nservers++] = argv[i];
+	}
+
+	// Map the trace and check it was written by this version of the tracer
+	if ( ((fd = open(argv[optind], O_RDONLY)) == -1) || (fstat(fd, &st) == -1) ||
+			((size_t)st.st_size < sizeof(FS3TraceHeader)) ) {
+		fprintf( stderr, "Cannot read trace [%s]\n", argv[optind] );
+		return( -1 );
+	}
+	if ( (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+		fprintf( stderr, "Cannot map trace [%s]\n", argv[optind] );
+		return( -1 );
+	}
+	close(fd);
+	header = (const FS3TraceHeader *)map;
+	if ( (memcmp(header->magic, FS3_TRACE_MAGIC, sizeof(header->magic)) != 0) ||
+			(header->version != FS3_TRACE_VERSION) || (header->recordSize != sizeof(FS3TraceRecord)) ) {
+		fprintf( stderr, "[%s] is not a version %d FS3 trace\n", argv[optind], FS3_TRACE_VERSION );
+		return( -1 );
+	}
+
+	// Each thread wrote its records in runs, put them back in the order they were sent
+	nrecords = (st.st_size - sizeof(FS3TraceHeader)) / sizeof(FS3TraceRecord);
+	if ( (records = malloc((nrecords ? nrecords : 1) * sizeof(FS3TraceRecord))) == NULL ) {
+		fprintf( stderr, "Cannot allocate %lu trace records\n", (unsigned long)nrecords );
+		return( -1 );
+	}
+	memcpy(records, map + sizeof(FS3TraceHeader), nrecords * sizeof(FS3TraceRecord));
+	munmap(map, st.st_size);
+	qsort(records, nrecords, sizeof(FS3TraceRecord), replay_compare);
+
+	// Replay the commands, waiting for the time each was sent unless at full speed
+	begin = replay_now();
+	first = (nrecords > 0) ? (double)records[0].start / 1e9 : 0.0;
+	for (i=0; i<nrecords; i++) {
+		op = fs3_cmd_op(records[i].cmd);
+		if ( (records[i].result != 0) || (records[i].ctrl < 0) || (records[i].ctrl >= nservers) ||
+				(op >= FS3_REPLAY_OPS) || (replayOps[op].name == NULL) ) {
+			skipped++;
+			continue;
+		}
+		if ( ! maxSpeed ) {
+			elapsed = begin + ((double)records[i].start / 1e9) - first;
+			when.tv_sec = (time_t)elapsed;
+			when.tv_nsec = (long)((elapsed - (double)when.tv_sec) * 1e9);
+			while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &when, NULL) == EINTR );
+		}
+
+		took = replay_now();
+		if ( replay_command(&records[i], &ret) != 0 ) {
+			failed++;
+			continue;
+		}
+		took = replay_now() - took;
+
+		// Count the time it took and whether it worked as it did when traced
+		replayed++;
+		replayOps[op].count++;
+		replayOps[op].total += took;
+		replayOps[op].max = (took > replayOps[op].max) ? took : replayOps[op].max;
+		replayOps[op].traceTotal += (double)records[i].elapsed / 1e9;
+		if ( (double)records[i].elapsed / 1e9 > replayOps[op].traceMax ) {
+			replayOps[op].traceMax = (double)records[i].elapsed / 1e9;
+		}
+		if ( fs3_cmd_ret(ret) != fs3_cmd_ret(records[i].ret) ) {
+			differ++;
+		}
+	}
+	elapsed = replay_now() - begin;
+	for (i=0; i<(uint64_t)nservers; i++) {
+		if ( servers[i] != -1 ) {
+			close(servers[i]);
+		}
+	}
+
+	// Report how the replay went
+	printf( "FS3 replay of [%s]: %lu commands in %.3f s (%.0f commands/s), %lu skipped, %lu failed, %lu answered differently\n",
+		argv[optind], (unsigned long)replayed, elapsed, (elapsed > 0) ? (double)replayed / elapsed : 0.0,
+		(unsigned long)skipped, (unsigned long)failed, (unsigned long)differ );
+	printf( "%-8s %10s %14s %14s %14s %14s\n", "op", "count", "mean us", "max us", "traced mean", "traced max" );
+	for (op=0; op<FS3_REPLAY_OPS; op++) {
+		if ( replayOps[op].count == 0 ) {
+			continue;
+		}
+		printf( "%-8s %10lu %14.1f %14.1f %14.1f %14.1f\n", replayOps[op].name, (unsigned long)replayOps[op].count,
+			replayOps[op].total / replayOps[op].count * 1e6, replayOps[op].max * 1e6,
+			replayOps[op].traceTotal / replayOps[op].count * 1e6, replayOps[op].traceMax * 1e6 );
+	}
+	free(records);
+	return( ((failed == 0) && (differ == 0)) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_connect
+// Description  : Connect to a controller
+//
+// Inputs       : name - the controller as ip:port
+// Outputs      : the socket if successful, -1 if failure
+
+int replay_connect(const char *name) {
+	struct sockaddr_in addr;
+	char address[64];
+	unsigned short port;
+	int fd, one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	if ( (sscanf(name, "%63[^:]:%hu", address, &port) != 2) || (inet_aton(address, &addr.sin_addr) == 0) ||
+			((fd = socket(PF_INET, SOCK_STREAM, 0)) == -1) ) {
+		return( -1 );
+	}
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ) {
+		close(fd);
+		return( -1 );
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return( fd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_now
+// Description  : Get the current monotonic time
+//
+// Inputs       : none
+// Outputs      : the time in seconds
+
+double replay_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return( (double)ts.tv_sec + ((double)ts.tv_nsec / 1e9) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_read
+// Description  : Read a whole message from a socket, however it is split
+//
+// Inputs       : fd - the socket
+//                buf - where to put the message
+//                len - length of the message
+// Outputs      : 0 if successful, -1 if failure (or the socket closed)
+
+int replay_read(int fd, void *buf, size_t len) {
+	size_t got = 0;
+	ssize_t n;
+
+	while ( got < len ) {
+		if ( (n = read(fd, (char *)buf + got, len - got)) <= 0 ) {
+			if ( (n == -1) && (errno == EINTR) ) {
+				continue;
+			}
+			return( -1 );
+		}
+		got += n;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_write
+// Description  : Write a whole message to a socket
+//
+// Inputs       : fd - the socket
+//                buf - the message
+//                len - length of the message
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_write(int fd, const void *buf, size_t len) {
+	size_t sent = 0;
+	ssize_t n;
+
+	while ( sent < len ) {
+		if ( (n = write(fd, (const char *)buf + sent, len - sent)) <= 0 ) {
+			if ( (n == -1) && (errno == EINTR) ) {
+				continue;
+			}
+			return( -1 );
+		}
+		sent += n;
+	}
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_compare
+// Description  : Order trace records by when they were sent, then by the
+//                order they were made in
+//
+// Inputs       : a, b - the records
+// Outputs      : <0, 0 or >0 as a goes before, with or after b
+
+int replay_compare(const void *a, const void *b) {
+	const FS3TraceRecord *ra = a, *rb = b;
+
+	if ( ra->start != rb->start ) {
+		return( (ra->start < rb->start) ? -1 : 1 );
+	}
+	return( (ra->seq < rb->seq) ? -1 : (ra->seq > rb->seq) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_sector
+// Description  : Make up the sector a traced write sent, seeded from its hash
+//                so the same write always sends the same bytes
+//
+// Inputs       : hash - hash of the sector traced
+//                buf - where to put the sector
+// Outputs      : none
+
+void replay_sector(uint32_t hash, char *buf) {
+	uint64_t x = ((uint64_t)hash << 32) | 0x9e3779b9, word;
+	int i;
+
+	for (i=0; i<FS3_SECTOR_SIZE; i+=sizeof(word)) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		word = x * 2685821657736338717ULL;
+		memcpy(buf + i, &word, sizeof(word));
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_command
+// Description  : Send one traced command to its controller and read the
+//                reply, connecting to the controller when it is mounted and
+//                disconnecting when it is unmounted
+//
+// Inputs       : rec - the traced command
+//                ret - the command block the controller returned
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_command(const FS3TraceRecord *rec, FS3CmdBlk *ret) {
+	char msg[sizeof(FS3CmdBlk) + FS3_SECTOR_SIZE];
+	uint8_t op = fs3_cmd_op(rec->cmd);
+	uint64_t wire = htobe64(rec->cmd);
+	size_t len = sizeof(wire) + ((op == FS3_OP_WRSECT) ? FS3_SECTOR_SIZE : 0);
+	int *fd = &servers[(int)rec->ctrl];
+
+	if ( (op == FS3_OP_MOUNT) && (*fd == -1) && ((*fd = replay_connect(serverNames[(int)rec->ctrl])) == -1) ) {
+		fprintf( stderr, "Cannot connect to %s\n", serverNames[(int)rec->ctrl] );
+		return( -1 );
+	}
+	if ( *fd == -1 ) {
+		return( -1 );
+	}
+
+	// A write goes with its sector in one message
+	memcpy(msg, &wire, sizeof(wire));
+	if ( op == FS3_OP_WRSECT ) {
+		replay_sector(rec->hash, msg + sizeof(wire));
+	}
+	if ( (replay_write(*fd, msg, len) != 0) || (replay_read(*fd, &wire, sizeof(wire)) != 0) ) {
+		close(*fd);
+		*fd = -1;
+		return( -1 );
+	}
+	*ret = be64toh(wire);
+	if ( ((op == FS3_OP_RDSECT) || (op == FS3_OP_LEASE)) && (fs3_cmd_ret(*ret) == 0) &&
+			(replay_read(*fd, msg, FS3_SECTOR_SIZE) != 0) ) {
+		close(*fd);
+		*fd = -1;
+		return( -1 );
+	}
+	if ( op == FS3_OP_UMOUNT ) {
+		close(*fd);
+		*fd = -1;
+	}
+	return( 0 );
+}
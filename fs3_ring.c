@@ -0,0 +1,204 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_ring.c
+//  Description    : This is the implementation of the consistent hashing ring
+//                   for the FS3 filesystem. Every node (a controller) is hashed
+//                   to a number of points on a 32 bit ring and a key belongs to
+//                   the node with the first point at or after the key's hash.
+//                   Adding a node only takes keys from the points just before
+//                   its own and removing one only gives its keys to the points
+//                   after them, so a membership change moves about 1 / nodes of
+//                   the keys, and the many points per node even out the share
+//                   each node gets
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+
+// Project Includes
+#include <fs3_ring.h>
+
+//
+// Support Macros/Data
+
+typedef struct {
+	uint32_t hash; // Where the point is on the ring
+	uint16_t node; // Node the point belongs to
+} FS3RingPoint;
+
+int fs3_ring_vnodes = 0;
+
+//Points of every node on the ring, sorted by hash
+FS3RingPoint *ringPoints = NULL;
+int ringLen = 0;
+int ringVnodes = FS3_RING_DEFAULT_VNODES;
+bool ringMember[FS3_RING_MAX_NODES];
+int ringNodes = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ringMix
+// Description  : Scrambles a 64 bit value so nearby values land far apart on
+//                the ring (the MurmurHash3 finalizer)
+//
+// Inputs       : x - the value
+// Outputs      : the scrambled value
+
+uint32_t ringMix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return ((uint32_t)x);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : comparePoints
+// Description  : qsort comparison putting points in ring order
+//
+// Inputs       : a, b - the points to compare
+// Outputs      : less than, equal to or greater than 0 as a sorts before, with
+//                or after b
+
+int comparePoints(const void *a, const void *b) {
+	const FS3RingPoint *pa = a, *pb = b;
+	if (pa->hash != pb->hash) {
+		return ((pa->hash < pb->hash) ? -1 : 1);
+	}
+	return ((int)pa->node - (int)pb->node);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ring_init
+// Description  : Empties the ring and sets how many points the nodes added
+//                from now on get
+//
+// Inputs       : vnodes - points per node
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_ring_init(int vnodes) {
+	if ((vnodes < 1) || (vnodes > FS3_RING_MAX_VNODES)) {
+		return (-1);
+	}
+	free(ringPoints);
+	ringPoints = NULL;
+	ringLen = 0;
+	ringVnodes = vnodes;
+	ringNodes = 0;
+	for (int node=0; node<FS3_RING_MAX_NODES; node++) {
+		ringMember[node] = false;
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ring_add
+// Description  : Puts a node on the ring, point v of node n is at the hash of
+//                (n, v) so a node always lands in the same places
+//
+// Inputs       : node - the node
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_ring_add(int node) {
+	if ((node < 0) || (node >= FS3_RING_MAX_NODES) || (ringMember[node] == true)) {
+		return (-1);
+	}
+	FS3RingPoint *points = realloc(ringPoints, sizeof(FS3RingPoint) * (ringLen + ringVnodes));
+	if (points == NULL) {
+		return (-1);
+	}
+	ringPoints = points;
+	for (int v=0; v<ringVnodes; v++) {
+		ringPoints[ringLen].hash = ringMix(((uint64_t)node << 32) | (uint32_t)v);
+		ringPoints[ringLen].node = node;
+		ringLen++;
+	}
+	qsort(ringPoints, ringLen, sizeof(FS3RingPoint), comparePoints);
+	ringMember[node] = true;
+	ringNodes++;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ring_remove
+// Description  : Takes a node's points off the ring, the points left stay in
+//                order
+//
+// Inputs       : node - the node
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_ring_remove(int node) {
+	if ((node < 0) || (node >= FS3_RING_MAX_NODES) || (ringMember[node] == false)) {
+		return (-1);
+	}
+	int kept = 0;
+	for (int i=0; i<ringLen; i++) {
+		if (ringPoints[i].node != node) {
+			ringPoints[kept++] = ringPoints[i];
+		}
+	}
+	ringLen = kept;
+	ringMember[node] = false;
+	ringNodes--;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ring_member
+// Description  : Checks whether a node is on the ring
+//
+// Inputs       : node - the node
+// Outputs      : true if it is, false if not
+
+bool fs3_ring_member(int node) {
+	return ((node >= 0) && (node < FS3_RING_MAX_NODES) && (ringMember[node] == true));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ring_nodes
+// Description  : Gets the number of nodes on the ring
+//
+// Inputs       : none
+// Outputs      : the number of nodes
+
+int fs3_ring_nodes(void) {
+	return (ringNodes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_ring_lookup
+// Description  : Finds the node owning a key with a binary search for the first
+//                point at or after the key's hash, wrapping around to the
+//                first point past the end of the ring
+//
+// Inputs       : key - the key (e.g. the hash of a filename)
+// Outputs      : the node, -1 if the ring is empty
+
+int fs3_ring_lookup(uint32_t key) {
+	if (ringLen == 0) {
+		return (-1);
+	}
+	uint32_t hash = ringMix(key);
+	int lo = 0, hi = ringLen;
+	while (lo < hi) {
+		int mid = lo + ((hi - lo) / 2);
+		if (ringPoints[mid].hash < hash) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return (ringPoints[(lo == ringLen) ? 0 : lo].node);
+}
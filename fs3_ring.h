@@ -0,0 +1,47 @@
+#ifndef FS3_RING_INCLUDED
+#define FS3_RING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_ring.h
+//  Description    : This is the interface for the consistent hashing ring
+//                   used to place files on controllers in the FS3 filesystem.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <stdbool.h>
+
+// Defines
+#define FS3_RING_MAX_NODES 256 // Most nodes the ring can hold
+#define FS3_RING_MAX_VNODES 1024 // Most points each node can have on the ring
+#define FS3_RING_DEFAULT_VNODES 64 // Points each node gets unless told otherwise
+
+// Global data
+extern int fs3_ring_vnodes; // Points each controller gets on the ring, 0 when files are striped instead of placed
+
+//
+// Ring Functions
+
+int fs3_ring_init(int vnodes);
+	// Empty the ring, each node added afterwards gets "vnodes" points on it
+
+int fs3_ring_add(int node);
+	// Put a node on the ring
+
+int fs3_ring_remove(int node);
+	// Take a node off the ring, its keys go to the nodes after its points
+
+bool fs3_ring_member(int node);
+	// Whether a node is on the ring
+
+int fs3_ring_nodes(void);
+	// Number of nodes on the ring
+
+int fs3_ring_lookup(uint32_t key);
+	// Node owning a key, the first point at or after the key's hash (-1 if the ring is empty)
+
+#endif
@@ -0,0 +1,232 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_ring_bench.c
+//  Description    : This is the benchmark of the FS3 placement ring, the balance
+//                   and data moved as controllers join and leave it.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_network.h>
+#include <fs3_ring.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define FS3_RING_MAX_FILE 16 // Most sectors in a file of the ring benchmark
+#define FS3_RING_STEPS 5 // Memberships the ring benchmark places its files over
+
+//
+// Functional Prototypes
+
+int bench_ring_check(int nfiles, uint32_t *sizes, const char *label); // Check the ring benchmark files and report their placement
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_ring_check
+// Description  : Read back every file of the ring benchmark, then report how
+//                many sectors are on each controller and how many the
+//                rebalancer has moved
+//
+// Inputs       : nfiles - number of files
+//                sizes - sectors in each file
+//                label - name of the step in the report
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_ring_check(int nfiles, uint32_t *sizes, const char *label) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], *buf, line[256];
+	uint64_t used[FS3_MAX_CONTROLLERS];
+	uint32_t j;
+	int16_t fh;
+	int i, ctrl, cols, len;
+
+	buf = malloc(FS3_RING_MAX_FILE * FS3_SECTOR_SIZE);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "ring-file-%d.txt", i);
+		if ( ((fh = fs3_open(fname)) == -1) ||
+				(fs3_read(fh, buf, sizes[i] * FS3_SECTOR_SIZE) != (int32_t)(sizes[i] * FS3_SECTOR_SIZE)) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of [%s] failed.", fname );
+			return( -1 );
+		}
+		for (j=0; j<sizes[i] * FS3_SECTOR_SIZE; j++) {
+			if ( (uint8_t)buf[j] != bench_pattern(i, 0, j) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark [%s] is wrong at byte %u.", fname, j );
+				return( -1 );
+			}
+		}
+		fs3_close(fh);
+	}
+	free(buf);
+
+	cols = columnUsage(used);
+	len = 0;
+	for (ctrl=0; ctrl<cols; ctrl++) {
+		len += snprintf(&line[len], sizeof(line) - len, " %6lu", (unsigned long)used[ctrl]);
+	}
+	logMessage( LOG_OUTPUT_LEVEL, " %-12s = sectors per controller [%s ]", label, line );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_ring
+// Description  : Simulate placing nfiles files of random sizes over a cluster
+//                that grows from 4 controllers to 5, 6 and 8 and then loses
+//                one, with a ring of 1, 16, 64 and 256 points per controller
+//                and with the name's hash modulo the number of controllers.
+//                Each membership reports the largest controller's share of
+//                the bytes against an even share, and the bytes the change to
+//                it moved. Then (with -H) the files are written to the disk,
+//                the last controller is taken off the ring and put back, and
+//                the rebalancer's moves are timed and checked
+//
+// Inputs       : nfiles - number of files
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_ring(int nfiles) {
+
+	// Local variables
+	static const uint32_t members[FS3_RING_STEPS] = { 0x0f, 0x1f, 0x3f, 0xff, 0xfb };
+	static const int schemes[] = { 0, 1, 16, 64, 256 };
+	char fname[FS3_MAX_PATH_LENGTH], *buf, imbalance[128], shifted[128], label[32];
+	uint64_t load[FS3_MAX_CONTROLLERS], total, moved, most;
+	uint32_t *keys, *sizes, j;
+	int *owner, nodes[FS3_MAX_CONTROLLERS];
+	int scheme, step, count, node, i, ilen, slen, last, sectors;
+	BenchSpan span;
+	int16_t fh;
+
+	keys = malloc(sizeof(uint32_t) * nfiles);
+	sizes = malloc(sizeof(uint32_t) * nfiles);
+	owner = malloc(sizeof(int) * nfiles);
+	srand(311);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "ring-file-%d.txt", i);
+		keys[i] = hashFileName(fname);
+		sizes[i] = 1 + (rand() % FS3_RING_MAX_FILE);
+	}
+
+	// An ideal change only moves the share of the bytes the new controllers should hold (or the old one held)
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 ring benchmark, %d files over 4, 5, 6 and 8 controllers, then 7", nfiles );
+	logMessage( LOG_OUTPUT_LEVEL, " %-12s = imbalance [  1.00  1.00  1.00  1.00  1.00 ] moved [  20.0%%  16.7%%  25.0%%  12.5%% ]", "ideal" );
+	for (scheme=0; scheme<(int)(sizeof(schemes) / sizeof(schemes[0])); scheme++) {
+		ilen = slen = 0;
+		for (step=0; step<FS3_RING_STEPS; step++) {
+			count = 0;
+			for (node=0; node<FS3_MAX_CONTROLLERS; node++) {
+				if ( (members[step] >> node) & 1 ) {
+					nodes[count++] = node;
+				}
+			}
+			if ( schemes[scheme] > 0 ) {
+				fs3_ring_init(schemes[scheme]);
+				for (node=0; node<count; node++) {
+					fs3_ring_add(nodes[node]);
+				}
+			}
+			memset(load, 0, sizeof(load));
+			total = moved = most = 0;
+			for (i=0; i<nfiles; i++) {
+				node = (schemes[scheme] > 0) ? fs3_ring_lookup(keys[i]) : nodes[keys[i] % count];
+				if ( (step > 0) && (node != owner[i]) ) {
+					moved += sizes[i];
+				}
+				owner[i] = node;
+				load[node] += sizes[i];
+				total += sizes[i];
+			}
+			for (node=0; node<FS3_MAX_CONTROLLERS; node++) {
+				most = (load[node] > most) ? load[node] : most;
+			}
+			ilen += snprintf(&imbalance[ilen], sizeof(imbalance) - ilen, " %5.2f", ((double)most * count) / total);
+			if ( step > 0 ) {
+				slen += snprintf(&shifted[slen], sizeof(shifted) - slen, " %5.1f%%", (100.0 * moved) / total);
+			}
+		}
+		if ( schemes[scheme] == 0 ) {
+			snprintf(label, sizeof(label), "modulo");
+		} else {
+			snprintf(label, sizeof(label), "%d points", schemes[scheme]);
+		}
+		logMessage( LOG_OUTPUT_LEVEL, " %-12s = imbalance [%s ] moved [%s ]", label, imbalance, shifted );
+	}
+	free(keys);
+	free(owner);
+	if ( fs3_ring_vnodes == 0 ) {
+		free(sizes);
+		return( 0 );
+	}
+
+	// Then the disk itself, the files are written with every controller on the ring
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	last = fs3_network_columns() - 1;
+	if ( last == 0 ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark needs more than one controller to place files over." );
+		return( -1 );
+	}
+	buf = malloc(FS3_RING_MAX_FILE * FS3_SECTOR_SIZE);
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "ring-file-%d.txt", i);
+		for (j=0; j<sizes[i] * FS3_SECTOR_SIZE; j++) {
+			buf[j] = bench_pattern(i, 0, j);
+		}
+		if ( ((fh = fs3_open(fname)) == -1) || (fs3_truncate(fh, 0) != 0) ||
+				(fs3_write(fh, buf, sizes[i] * FS3_SECTOR_SIZE) != (int32_t)(sizes[i] * FS3_SECTOR_SIZE)) ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark write to [%s] failed.", fname );
+			return( -1 );
+		}
+		fs3_close(fh);
+	}
+	free(buf);
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 ring benchmark, %d files over %d controllers with %d points each", nfiles,
+		last + 1, fs3_ring_vnodes );
+	if ( bench_ring_check(nfiles, sizes, "written") != 0 ) {
+		return( -1 );
+	}
+
+	// The rebalancer is run to the end here rather than a little at each close
+	total = 0;
+	for (i=0; i<nfiles; i++) {
+		total += sizes[i];
+	}
+	for (step=0; step<2; step++) {
+		if ( setControllerMember(last, step == 1) != 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark could not change the ring." );
+			return( -1 );
+		}
+		moved = 0;
+		bench_start(&span);
+		while ( (sectors = rebalance(UINT32_MAX)) > 0 ) {
+			moved += sectors;
+		}
+		bench_stop(&span);
+		if ( sectors < 0 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark rebalance failed." );
+			return( -1 );
+		}
+		logMessage( LOG_OUTPUT_LEVEL, " %-12s = [ moved %lu sectors (%.1f%%) in %.3f s ]", (step == 1) ? "rejoined" : "left",
+			(unsigned long)moved, (100.0 * moved) / total, span.elapsed );
+		if ( bench_ring_check(nfiles, sizes, (step == 1) ? "rejoined" : "left") != 0 ) {
+			return( -1 );
+		}
+	}
+	free(sizes);
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
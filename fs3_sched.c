@@ -0,0 +1,314 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_sched.c
+//  Description    : This is the implementation of the sector write scheduler
+//                   for the FS3 filesystem. Data sector writes are queued
+//                   instead of going to the controller one at a time, and the
+//                   queue is sent as a batch once it fills or the driver needs
+//                   everything on the disk (before metadata is committed). A
+//                   batch is sent in C-LOOK order so the head sweeps across
+//                   the tracks once instead of bouncing between files. Only the
+//                   last write of each sector is kept, so the order of writes
+//                   to any one sector is never changed
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_sched.h>
+#include <fs3_driver.h>
+#include <fs3_common.h>
+#include <fs3_log.h>
+
+//
+// Support Macros/Data
+
+typedef struct {
+	FS3TrackIndex trk;
+	FS3SectorIndex sct;
+	char *data; // One of the FS3_SECTOR_SIZE slots in schedData
+} FS3SchedRequest;
+
+//Queued writes, the first schedLen requests are in use. Every request owns a data slot and requests are only
+//  ever swapped around, so the requests past schedLen always own the free slots. The queue and its slots are
+//  allocated the first time a write is queued
+FS3SchedRequest *schedQueue = NULL;
+char *schedData = NULL;
+uint16_t schedLen = 0;
+uint16_t schedDepth = FS3_SCHED_DEFAULT_DEPTH;
+FS3SchedPolicy schedPolicy = FS3_SCHED_CLOOK;
+
+//Metrics
+uint64_t schedQueued = 0;
+uint64_t schedReplaced = 0;
+uint64_t schedDispatched = 0;
+uint64_t schedBatches = 0;
+uint16_t schedMaxDepth = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareRequests
+// Description  : qsort comparison putting requests in (track, sector) order
+//
+// Inputs       : a, b - the requests to compare
+// Outputs      : less than, equal to or greater than 0 as a sorts before, with
+//                or after b
+
+int compareRequests(const void *a, const void *b) {
+	const FS3SchedRequest *ra = a, *rb = b;
+	if (ra->trk != rb->trk) {
+		return ((ra->trk < rb->trk) ? -1 : 1);
+	}
+	return ((int)ra->sct - (int)rb->sct);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_init
+// Description  : Sets how many writes are queued before a batch is sent and
+//                the order batches are sent in. Only allowed while nothing is
+//                queued
+//
+// Inputs       : depth - writes queued before they are dispatched, 0 sends
+//                        each write as soon as it is queued
+//                policy - order to dispatch in
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_sched_init(uint16_t depth, FS3SchedPolicy policy) {
+	if (schedLen != 0) {
+		return (-1);
+	}
+	free(schedQueue);
+	free(schedData);
+	schedQueue = NULL;
+	schedData = NULL;
+	schedDepth = depth;
+	schedPolicy = policy;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_write
+// Description  : Queues a write of a sector. A sector that is already queued
+//                has its data replaced, only the newest contents need to reach
+//                the disk
+//
+// Inputs       : trk - track of the sector
+//                sct - the sector
+//                buf - FS3_SECTOR_SIZE bytes to write
+// Outputs      : 1 if the queue is now full and should be dispatched, 0 if
+//                not, -1 if failure
+
+int fs3_sched_write(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+	uint16_t slots = (schedDepth == 0) ? 1 : schedDepth;
+	if (schedQueue == NULL) {
+		schedQueue = malloc(sizeof(FS3SchedRequest) * slots);
+		schedData = malloc((size_t)slots * FS3_SECTOR_SIZE);
+		if ((schedQueue == NULL) || (schedData == NULL)) {
+			return (-1);
+		}
+		for (uint16_t i=0; i<slots; i++) {
+			schedQueue[i].data = schedData + ((size_t)i * FS3_SECTOR_SIZE);
+		}
+	}
+	schedQueued++;
+	for (uint16_t i=0; i<schedLen; i++) {
+		if ((schedQueue[i].trk == trk) && (schedQueue[i].sct == sct)) {
+			memcpy(schedQueue[i].data, buf, FS3_SECTOR_SIZE);
+			schedReplaced++;
+			return (0);
+		}
+	}
+	if (schedLen == slots) {
+		return (-1);
+	}
+
+	schedQueue[schedLen].trk = trk;
+	schedQueue[schedLen].sct = sct;
+	memcpy(schedQueue[schedLen].data, buf, FS3_SECTOR_SIZE);
+	schedLen++;
+	if (schedLen > schedMaxDepth) {
+		schedMaxDepth = schedLen;
+	}
+	return ((schedLen >= schedDepth) ? 1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_lookup
+// Description  : Finds a queued write of a sector, which is newer than what
+//                the disk holds
+//
+// Inputs       : trk - track of the sector
+//                sct - the sector
+//                buf - buffer of FS3_SECTOR_SIZE bytes to copy the data into
+// Outputs      : 1 if the sector was queued, 0 if not
+
+int fs3_sched_lookup(FS3TrackIndex trk, FS3SectorIndex sct, void *buf) {
+	for (uint16_t i=0; i<schedLen; i++) {
+		if ((schedQueue[i].trk == trk) && (schedQueue[i].sct == sct)) {
+			memcpy(buf, schedQueue[i].data, FS3_SECTOR_SIZE);
+			return (1);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_cancel
+// Description  : Drops a queued write of a sector that has been freed, so it
+//                cannot land on the sector after it is given to something else
+//
+// Inputs       : trk - track of the sector
+//                sct - the sector
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_sched_cancel(FS3TrackIndex trk, FS3SectorIndex sct) {
+	for (uint16_t i=0; i<schedLen; i++) {
+		if ((schedQueue[i].trk == trk) && (schedQueue[i].sct == sct)) {
+			//The last request is swapped into the dropped one's place, which leaves the dropped slot free
+			schedLen--;
+			FS3SchedRequest dropped = schedQueue[i];
+			schedQueue[i] = schedQueue[schedLen];
+			schedQueue[schedLen] = dropped;
+			return (0);
+		}
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_dispatch
+// Description  : Sends every queued write to the disk. With C-LOOK the writes
+//                are sorted by track and sector and sent from the first one
+//                at or past the head's track to the end, then from the lowest
+//                track up to where the sweep started
+//
+// Inputs       : head - virtual track the head is on (FS3_SCHED_NO_HEAD
+//                       sweeps from the lowest track)
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_sched_dispatch(uint32_t head) {
+	if (schedLen == 0) {
+		return (0);
+	}
+	uint16_t start = 0;
+	if (schedPolicy == FS3_SCHED_CLOOK) {
+		qsort(schedQueue, schedLen, sizeof(FS3SchedRequest), compareRequests);
+		while ((head != FS3_SCHED_NO_HEAD) && (start < schedLen) && (schedQueue[start].trk < head)) {
+			start++;
+		}
+		if (start == schedLen) {
+			start = 0;
+		}
+	}
+	//The batch goes out as one, so a volume striped over several controllers writes to all of them at once
+	FS3SectorAddress *addrs = malloc(sizeof(FS3SectorAddress) * schedLen);
+	char **bufs = malloc(sizeof(char *) * schedLen);
+	if ((addrs == NULL) || (bufs == NULL)) {
+		free(addrs);
+		free(bufs);
+		return (-1);
+	}
+	for (uint16_t n=0; n<schedLen; n++) {
+		FS3SchedRequest *req = &schedQueue[(start + n) % schedLen];
+		addrs[n].trk = req->trk;
+		addrs[n].sec = req->sct;
+		bufs[n] = req->data;
+	}
+	int result = transferSectors(FS3_OP_WRSECT, addrs, bufs, schedLen);
+	free(addrs);
+	free(bufs);
+	if (result != 0) {
+		return (-1);
+	}
+	schedDispatched += schedLen;
+	schedBatches++;
+	schedLen = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_depth
+// Description  : Gets the number of writes waiting in the queue
+//
+// Inputs       : none
+// Outputs      : the number of writes
+
+uint16_t fs3_sched_depth(void) {
+	return (schedLen);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_batches
+// Description  : Gets the number of batches that have been dispatched
+//
+// Inputs       : none
+// Outputs      : the number of batches
+
+uint64_t fs3_sched_batches(void) {
+	return (schedBatches);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_dispatched
+// Description  : Gets the number of writes that have been dispatched, writes
+//                replaced while they were queued are not counted
+//
+// Inputs       : none
+// Outputs      : the number of writes
+
+uint64_t fs3_sched_dispatched(void) {
+	return (schedDispatched);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_sched_close
+// Description  : Frees the queue, anything still in it is dropped
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_sched_close(void) {
+	free(schedQueue);
+	free(schedData);
+	schedQueue = NULL;
+	schedData = NULL;
+	schedLen = 0;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_log_sched_metrics
+// Description  : Log the metrics for the scheduler
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_log_sched_metrics(void) {
+	FS3_LOG_INFO(FS3SimulatorLLevel, "** FS3 Scheduler Metrics **");
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Policy =         [  %s]", (schedPolicy == FS3_SCHED_CLOOK) ? "C-LOOK" : "FIFO");
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Writes Queued =  [     %lu]", (unsigned long)schedQueued);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Replaced =       [     %lu]", (unsigned long)schedReplaced);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Dispatched =     [     %lu]", (unsigned long)schedDispatched);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Batches =        [     %lu]", (unsigned long)schedBatches);
+	float avgDepth = (schedBatches == 0) ? 0 : ((float)schedDispatched / (float)schedBatches);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Average Depth =  [   %.2f]", avgDepth);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Max Depth =      [     %u]", schedMaxDepth);
+	FS3_LOG_INFO(FS3SimulatorLLevel, " Track Seeks =    [     %lu]", (unsigned long)trackSeeks());
+	return (0);
+}
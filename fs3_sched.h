@@ -0,0 +1,61 @@
+#ifndef FS3_SCHED_INCLUDED
+#define FS3_SCHED_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_sched.h
+//  Description    : This is the interface for the sector write scheduler in
+//                   the FS3 filesystem.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_SCHED_DEFAULT_DEPTH 64 // Sector writes queued before they are dispatched as a batch
+#define FS3_SCHED_NO_HEAD UINT32_MAX // The head's track is not known, the sweep starts from the lowest track
+
+// Type definitions
+typedef enum {
+	FS3_SCHED_FIFO = 0,  // Dispatch in the order the writes were queued
+	FS3_SCHED_CLOOK = 1, // Sweep up through the tracks from the head, then start again from the lowest
+} FS3SchedPolicy;
+
+//
+// Scheduler Functions
+
+int fs3_sched_init(uint16_t depth, FS3SchedPolicy policy);
+	// Set the queue depth (0 writes straight through) and dispatch order, the queue must be empty
+
+int fs3_sched_write(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+	// Queue a sector write, a write to a sector already queued replaces it (1 if the queue is full, 0 if not, -1 if failure)
+
+int fs3_sched_lookup(FS3TrackIndex trk, FS3SectorIndex sct, void *buf);
+	// Copy out a queued write of the sector (1 if it was queued, 0 if not)
+
+int fs3_sched_cancel(FS3TrackIndex trk, FS3SectorIndex sct);
+	// Drop a queued write of a sector that is no longer in use
+
+int fs3_sched_dispatch(uint32_t head);
+	// Send every queued write to the disk in the order of the policy, starting from the head's (virtual) track
+
+uint16_t fs3_sched_depth(void);
+	// Number of writes waiting in the queue
+
+uint64_t fs3_sched_batches(void);
+	// Number of batches dispatched
+
+uint64_t fs3_sched_dispatched(void);
+	// Number of writes dispatched, over all batches
+
+int fs3_sched_close(void);
+	// Free the queue, dropping anything still in it
+
+int fs3_log_sched_metrics(void);
+	// Log the metrics for the scheduler
+
+#endif
@@ -0,0 +1,139 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_sched_bench.c
+//  Description    : This is the benchmark of the FS3 write scheduler, it runs
+//                   the same random appends and reads once per dispatch order.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Project Includes
+#include <fs3_driver.h>
+#include <fs3_sched.h>
+#include <fs3_bench.h>
+#include <cmpsc311_log.h>
+
+//
+// Functional Prototypes
+
+int bench_sched_pass(int nfiles, FS3SchedPolicy policy); // One pass of the scheduling benchmark
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_sched
+// Description  : Run the scheduling benchmark with FIFO dispatch and then with
+//                C-LOOK, each pass on its own set of files
+//
+// Inputs       : nfiles - the number of files in each pass
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_sched(int nfiles) {
+	if ( bench_mount() != 0 ) {
+		return( -1 );
+	}
+	if ( (bench_sched_pass(nfiles, FS3_SCHED_FIFO) != 0) || (bench_sched_pass(nfiles, FS3_SCHED_CLOOK) != 0) ) {
+		return( -1 );
+	}
+	return( fs3_unmount_disk() == -1 ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_sched_pass
+// Description  : Open nfiles files and run 32 operations per file on them,
+//                each on a random file: four in five append 1 to 4096 bytes
+//                and the rest read back up to 4096 bytes from a random offset
+//                and check them. Reports the seeks and the average depth of
+//                the batches the scheduler dispatched
+//
+// Inputs       : nfiles - the number of files
+//                policy - order the scheduler dispatches writes in
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_sched_pass(int nfiles, FS3SchedPolicy policy) {
+
+	// Local variables
+	char fname[FS3_MAX_PATH_LENGTH], buf[4096];
+	uint64_t batches, dispatched, bytes = 0;
+	uint32_t *len, chunk, off, pos;
+	int16_t *fhs;
+	BenchSpan span;
+	int i, n, f;
+
+	// Start from an empty queue so the pass only sees its own writes
+	if ( (checkpoint(false) != 0) || (fs3_sched_init(FS3_SCHED_DEFAULT_DEPTH, policy) != 0) ) {
+		logMessage( LOG_ERROR_LEVEL, "FS3 benchmark could not set the scheduling policy." );
+		return( -1 );
+	}
+	fhs = malloc(sizeof(int16_t) * nfiles);
+	len = calloc(nfiles, sizeof(uint32_t));
+	for (i=0; i<nfiles; i++) {
+		snprintf(fname, FS3_MAX_PATH_LENGTH, "sched-%d-file-%d.txt", policy, i);
+		if ( (fhs[i] = fs3_open(fname)) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "FS3 benchmark open of [%s] failed.", fname );
+			return( -1 );
+		}
+	}
+
+	srand(35);
+	batches = fs3_sched_batches();
+	dispatched = fs3_sched_dispatched();
+	bench_start(&span);
+	for (n=0; n<32*nfiles; n++) {
+		f = rand() % nfiles;
+		if ( ((rand() % 5) != 0) || (len[f] == 0) ) {
+			chunk = 1 + (rand() % 4096);
+			for (off=0; off<chunk; off++) {
+				buf[off] = bench_pattern(f, policy, len[f] + off);
+			}
+			if ( fs3_write(fhs[f], buf, chunk) != chunk ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark write to file %d failed.", f );
+				return( -1 );
+			}
+			len[f] += chunk;
+			bytes += chunk;
+		} else {
+			pos = rand() % len[f];
+			chunk = 1 + (rand() % 4096);
+			chunk = (chunk > len[f] - pos) ? len[f] - pos : chunk;
+			if ( (fs3_seek(fhs[f], pos) != 0) || (fs3_read(fhs[f], buf, chunk) != chunk) ) {
+				logMessage( LOG_ERROR_LEVEL, "FS3 benchmark read of file %d failed.", f );
+				return( -1 );
+			}
+			for (off=0; off<chunk; off++) {
+				if ( (uint8_t)buf[off] != bench_pattern(f, policy, pos + off) ) {
+					logMessage( LOG_ERROR_LEVEL, "FS3 benchmark file %d is wrong at byte %u.", f, pos + off );
+					return( -1 );
+				}
+			}
+			fs3_seek(fhs[f], len[f]);
+			bytes += chunk;
+		}
+	}
+	for (i=0; i<nfiles; i++) {
+		fs3_close(fhs[i]);
+	}
+	bench_stop(&span);
+	batches = fs3_sched_batches() - batches;
+	dispatched = fs3_sched_dispatched() - dispatched;
+
+	logMessage( LOG_OUTPUT_LEVEL, "FS3 scheduling benchmark, %s, %d files, %d operations",
+		(policy == FS3_SCHED_CLOOK) ? "C-LOOK" : "FIFO", nfiles, 32 * nfiles );
+	logMessage( LOG_OUTPUT_LEVEL, " seeks       = [ %10lu ]", (unsigned long)span.seeks );
+	logMessage( LOG_OUTPUT_LEVEL, " writes      = [ %10lu ]", (unsigned long)span.writes );
+	logMessage( LOG_OUTPUT_LEVEL, " queue depth = [ %10.2f average per batch ]", (batches == 0) ? 0.0 : (double)dispatched / batches );
+	logMessage( LOG_OUTPUT_LEVEL, " throughput  = [ %10.2f MB/s ]", (bytes / (1024.0 * 1024.0)) / span.elapsed );
+
+	free(fhs);
+	free(len);
+	return( 0 );
+}
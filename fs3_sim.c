@@ -10,13 +10,17 @@
 
 // Include Files
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -24,17 +28,31 @@
 #include <fs3_driver.h>
 #include <fs3_controller.h>
 #include <fs3_common.h>
+#include <fs3_log.h>
 #include <fs3_cache.h>
+#include <fs3_sched.h>
 #include <fs3_network.h>
+#include <fs3_erasure.h>
+#include <fs3_ring.h>
+#include <fs3_lease.h>
+#include <fs3_trace.h>
+#include <fs3_span.h>
 #include <cmpsc311_log.h>
 #include <cmpsc311_util.h>
 
 // Defines
 #define FS3_WORKLOAD_DIR "workload"
 #define FS3_SIM_MAX_OPEN_FILES 256
-#define FS3_ARGUMENTS "hvc:l:i:p:"
+#define FS3_SIM_FILE_SLOTS 512 // Slots of the file table's hash, a power of two above the most files
+#define FS3_SIM_MAX_WORKERS 16 // Most workers a workload can be replayed by in parallel
+#define FS3_SIM_VALIDATE_CHUNK (64 * FS3_SECTOR_SIZE) // Bytes of a file read back from the disk at a time to validate
+#define FS3_SIM_LATENCY_SAMPLES 4096
+#define FS3_ARGUMENTS "hvc:l:i:p:s:r:q:e:H:Lb:t:Pj:kT:aS:C"
 #define USAGE \
-	"USAGE: fs3_sim [-h] [-v] [-c <cache size>] [-l <logfile>] <workload-file>\n" \
+	"USAGE: fs3_sim [-h] [-v] [-c <cache size>] [-l <logfile>] [-i <address>] [-p <port>] [-s <ip:port>]...\n" \
+	"               [-r <copies>] [-q <acks>] [-e <data:parity>] [-H <points>] [-L]\n" \
+	"               [-b <results file> [-t <tag>]] [-P] [-j <workers>] [-k] [-T <trace file>] [-a] [-S <span file>]\n" \
+	"               [-C] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
@@ -43,6 +61,23 @@
 	"    -l - write log messages to the filename <logfile>\n" \
     "    -i - IP address of server to connect to.\n" \
     "    -p - port number of server to connect to.\n" \
+    "    -s - <ip:port> of another server to stripe the disk over, up to 7 times.\n" \
+    "    -r - number of servers holding a copy of each stripe.\n" \
+    "    -q - copies that must acknowledge a write (default all of them).\n" \
+    "    -e - <data:parity> erasure code each stripe over data + parity servers.\n" \
+    "    -H - <points> place whole files on servers by consistent hashing, with this many points per server.\n" \
+    "    -L - the server is a lease broker shared with other clients, cache only under its leases.\n" \
+    "    -b - benchmark the workload, appending the results to <results file> (CSV if it ends in .csv, else JSON).\n" \
+    "    -t - tag the benchmark results with <tag>, e.g. the commit being measured.\n" \
+    "    -P - only parse the workload, reporting how fast it was parsed.\n" \
+    "    -j - replay the workload with this many workers (up to 16), the files split between\n" \
+    "         them by name. Worker n uses the server at port + n, which holds only its files.\n" \
+    "    -k - keep a .cmm copy of every file validated, not just of those that fail.\n" \
+    "    -T - trace the commands sent to the servers to <trace file> (one per worker with -j), for fs3_replay.\n" \
+    "    -S - write the time spent in driver, cache and network operations to <span file> as Chrome trace\n" \
+    "         events, to view in Perfetto (one per worker with -j).\n" \
+    "    -a - write log messages from a thread of their own, so logging does not wait on the log file.\n" \
+    "    -C - do not check sectors read from the server against their CRC32C checksums.\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -53,16 +88,82 @@ typedef struct {
 	int16_t   fhandle;   // This is a file handle for the opened file
 } FS3SimulationTable;
 
+// The commands of the workload, and the operations timed when benchmarking
+typedef enum {
+	FS3_SIM_OPEN    = 0, // First use of a file opens it
+	FS3_SIM_READ    = 1,
+	FS3_SIM_WRITE   = 2,
+	FS3_SIM_WRITEAT = 3, // The seek and the write together
+	FS3_SIM_SEEK    = 4,
+	FS3_SIM_OPS     = 5,
+} FS3SimOperation;
+
+// The latencies of one kind of operation
+typedef struct {
+	const char *name;    // This is the name of the operation
+	double     *samples; // The latency of each operation, in seconds
+	uint64_t    count;   // Number of operations timed
+	uint64_t    size;    // Number of samples there is room for
+	double      total;   // Sum of the latencies
+} FS3SimLatency;
+
+// The workload file, mapped into memory
+typedef struct {
+	const char *data;  // This is the start of the workload
+	const char *next;  // Start of the next line to parse
+	const char *end;   // End of the workload
+	size_t      size;  // Size of the workload
+	int         line;  // Number of the last line parsed
+} FS3SimWorkload;
+
+// A line of the workload, the file name and data point into the workload
+typedef struct {
+	const char      *fname;    // This is the name of the file
+	int              fnameLen; // Length of the name
+	FS3SimOperation  op;       // The command
+	int32_t          len;      // Length of the read or write
+	int32_t          off;      // Offset of the seek or write
+	const char      *data;     // Text to write, up to the end of the line
+	int              dataLen;  // Length of the text on the line
+} FS3SimCommand;
+
+// The files of the workload, found by the hash of their names
+typedef struct {
+	FS3SimulationTable ftable[FS3_SIM_MAX_OPEN_FILES]; // This is the file table
+	int16_t            slots[FS3_SIM_FILE_SLOTS];      // Index in the table of the file hashed to each slot, -1 if none
+	int                nfiles;                         // Number of files in the table
+} FS3SimFiles;
+
 //
 // Global Data
 int verbose;
 uint16_t fs3CacheSize = FS3_DEFAULT_CACHE_SIZE; 
+char *benchResults = NULL; // File the benchmark results go to, NULL when not benchmarking
+char *benchTag = "";       // Tag recorded with the results
+int simWorkers = 1;        // Number of workers replaying the workload
+int keepBackups = 0;       // Whether a .cmm copy of every file validated is kept
+FS3SimLatency benchLatency[FS3_SIM_OPS] = {
+	{ "OPEN" }, { "READ" }, { "WRITE" }, { "WRITEAT" }, { "SEEK" }
+};
 
 //
 // Functional Prototypes
 
 int simulate_FS3( char *wload );              // control loop of the FS3 simulation
+int replay_FS3( char *wload, int worker );    // Replay a worker's share of the workload
+int parse_FS3( char *wload );                 // Parse the workload without running it
+int open_workload( char *wload, FS3SimWorkload *work ); // Map the workload file
+int close_workload( FS3SimWorkload *work );   // Unmap the workload file
+int abort_replay( FS3SimWorkload *work, FS3SimFiles *sim, char *rbuf ); // Clean up a replay that failed
+int next_command( FS3SimWorkload *work, FS3SimCommand *cmd ); // Parse the next line of the workload
+uint32_t hash_name( const char *name, int len ); // Hash a file name
+int lookup_file( FS3SimFiles *sim, FS3SimCommand *cmd, int *added ); // Find or add the file of a command
+int command_text( FS3SimCommand *cmd, char *text ); // Get the text a write writes
 int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesystem
+int backup_file(char *fname, int16_t mfh, char *bkfile); // Copy a file on the disk to a .cmm file
+int record_latency( FS3SimOperation op, double start ); // Time a benchmarked operation
+double latency_percentile( FS3SimLatency *lat, double pct ); // Get a latency percentile
+int write_results( char *wload, double wall, double replay, uint64_t bytes ); // Save the benchmark results
 
 //
 // Functions
@@ -79,7 +180,9 @@ int validate_file(char *fname, int16_t mfh);  // Validate a file in the filesyst
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0;
+	int ch, verbose = 0, log_initialized = 0, parseOnly = 0, asyncLog = 0;
+	char address[64];
+	unsigned short port;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, FS3_ARGUMENTS)) != -1) {
@@ -100,14 +203,14 @@ int main( int argc, char *argv[] ) {
 
 		case 'c': // Set the cache size
 			if ( sscanf(optarg, "%hu", &fs3CacheSize) != 1) {
-				logMessage(LOG_ERROR_LEVEL, "Failed parsing cache size [%s]", optarg);
+				FS3_LOG_ERROR("Failed parsing cache size [%s]", optarg);
 				return(-1);
 			}
 			break;
 
 		case 'i': // Get the IP address
 			if (inet_addr(optarg) == INADDR_NONE) {
-				logMessage( LOG_ERROR_LEVEL, "Bad IP address [%s]", argv[optind] );
+				FS3_LOG_ERROR( "Bad IP address [%s]", argv[optind] );
 				return(-1);
 			}
 			fs3_network_address = (unsigned char *)strdup(optarg);
@@ -115,7 +218,89 @@ int main( int argc, char *argv[] ) {
 
 		case 'p': // Set the network port number
 			if ( sscanf(optarg, "%hu", &fs3_network_port) != 1 ) {
-				logMessage( LOG_ERROR_LEVEL, "Bad  port number [%s]", argv[optind] );
+				FS3_LOG_ERROR( "Bad  port number [%s]", argv[optind] );
+				return(-1);
+			}
+			break;
+
+		case 's': // Add a server to stripe over
+			if ( (sscanf(optarg, "%63[^:]:%hu", address, &port) != 2) || (inet_addr(address) == INADDR_NONE) ||
+					(fs3_network_add_controller(address, port) == -1) ) {
+				FS3_LOG_ERROR( "Bad stripe server [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'r': // Set the number of replicas
+			if ( (sscanf(optarg, "%d", &fs3_network_replicas) != 1) || (fs3_network_replicas <= 0) ) {
+				FS3_LOG_ERROR( "Bad replica count [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'q': // Set the write quorum
+			if ( (sscanf(optarg, "%d", &fs3_network_quorum) != 1) || (fs3_network_quorum < 0) ) {
+				FS3_LOG_ERROR( "Bad quorum [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'e': // Erasure code the disk
+			if ( (sscanf(optarg, "%d:%d", &fs3_erasure_data, &fs3_erasure_parity) != 2) ||
+					(fs3_erasure_data <= 0) || (fs3_erasure_parity <= 0) ) {
+				FS3_LOG_ERROR( "Bad erasure code [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'H': // Place files on the servers by consistent hashing
+			if ( (sscanf(optarg, "%d", &fs3_ring_vnodes) != 1) || (fs3_ring_vnodes <= 0) ||
+					(fs3_ring_vnodes > FS3_RING_MAX_VNODES) ) {
+				FS3_LOG_ERROR( "Bad placement ring [%s]", optarg );
+				return(-1);
+			}
+			break;
+
+		case 'L': // Share the server with other clients under leases
+			fs3_lease_enabled = true;
+			break;
+
+		case 'b': // Benchmark the workload
+			benchResults = optarg;
+			break;
+
+		case 't': // Tag the benchmark results
+			benchTag = optarg;
+			break;
+
+		case 'P': // Only parse the workload
+			parseOnly = 1;
+			break;
+
+		case 'T': // Trace the commands sent to the servers
+			fs3_trace_file = optarg;
+			break;
+
+		case 'S': // Write spans of the operations
+			fs3_span_file = optarg;
+			break;
+
+		case 'a': // Log asynchronously
+			asyncLog = 1;
+			break;
+
+		case 'C': // Turn off the sector checksums
+			fs3_sector_sums = false;
+			break;
+
+		case 'k': // Keep copies of the files validated
+			keepBackups = 1;
+			break;
+
+		case 'j': // Replay the workload in parallel
+			if ( (sscanf(optarg, "%d", &simWorkers) != 1) || (simWorkers <= 0) ||
+					(simWorkers > FS3_SIM_MAX_WORKERS) ) {
+				FS3_LOG_ERROR( "Bad worker count [%s]", optarg );
 				return(-1);
 			}
 			break;
@@ -136,6 +321,7 @@ int main( int argc, char *argv[] ) {
 	if ( verbose ) {
 		enableLogLevels(FS3ControllerLLevel | FS3DriverLLevel | FS3SimulatorLLevel);
 	}
+	fs3_log_init( asyncLog );
 
 	// The filename should be the next option
 	if ( optind >= argc ) {
@@ -143,22 +329,297 @@ int main( int argc, char *argv[] ) {
 		return( -1 );
 	}
 
+	// Each worker has a controller of its own
+	if ( (simWorkers > 1) && ((fs3_network_controllers > 1) || fs3_lease_enabled || (benchResults != NULL)) ) {
+		FS3_LOG_ERROR( "Parallel replay gives each worker one server, it cannot be used with -s, -L or -b" );
+		return( -1 );
+	}
+
+	// Only parse the workload if asked to
+	if ( parseOnly ) {
+		return( (parse_FS3(argv[optind]) == 0) ? 0 : -1 );
+	}
+
 	// Run the simulation
-	if ( simulate_FS3(argv[optind]) == 0 ) {
-		logMessage( LOG_INFO_LEVEL, "FS3 simulation completed successfully.\n\n" );
-	} else {
-		logMessage( LOG_INFO_LEVEL, "FS3 simulation failed.\n\n" );
+	if ( simulate_FS3(argv[optind]) != 0 ) {
+		FS3_LOG_INFO( LOG_INFO_LEVEL, "FS3 simulation failed.\n\n" );
+		return( -1 );
 	}
+	FS3_LOG_INFO( LOG_INFO_LEVEL, "FS3 simulation completed successfully.\n\n" );
 
 	// Return successfully
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : open_workload
+// Description  : Map the workload file into memory, it is parsed in place
+//
+// Inputs       : wload - the name of the workload file
+//                work - the workload to set up
+// Outputs      : 0 if successful, -1 if failure
+
+int open_workload( char *wload, FS3SimWorkload *work ) {
+
+	// Local variables
+	struct stat stats;
+	void *data = NULL;
+	int fd;
+
+	// Open the workload file, map all of it
+	memset( work, 0x0, sizeof(FS3SimWorkload) );
+	if ( ((fd=open(wload, O_RDONLY)) == -1) || (fstat(fd, &stats) == -1) ||
+			((stats.st_size > 0) && ((data=mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) ) {
+		FS3_LOG_ERROR( "Failure opening the workload file [%s], error: %s.\n",
+			wload, strerror(errno) );
+		if ( fd != -1 ) {
+			close( fd );
+		}
+		return( -1 );
+	}
+	close( fd );
+
+	// The workload is read front to back, once
+	work->size = stats.st_size;
+	if ( work->size > 0 ) {
+		madvise( data, work->size, MADV_SEQUENTIAL );
+	}
+	work->next = work->data = data;
+	work->end = work->data + work->size;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_workload
+// Description  : Unmap the workload file
+//
+// Inputs       : work - the workload
+// Outputs      : 0 if successful, -1 if failure
+
+int close_workload( FS3SimWorkload *work ) {
+	if ( (work->size > 0) && (munmap((void *)work->data, work->size) == -1) ) {
+		return( -1 );
+	}
+	memset( work, 0x0, sizeof(FS3SimWorkload) );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : scan_word
+// Description  : Scan the next blank separated word of a line
+//
+// Inputs       : p - where to scan from, moved past the word
+//                end - the end of the line
+//                word - set to the start of the word
+//                len - set to the length of the word
+// Outputs      : 0 if successful, -1 if there is no word
+
+static int scan_word( const char **p, const char *end, const char **word, int *len ) {
+
+	// Local variables
+	const char *s = *p;
+
+	while ( (s < end) && ((*s == ' ') || (*s == '\t')) ) {
+		s++;
+	}
+	*word = s;
+	while ( (s < end) && (*s != ' ') && (*s != '\t') ) {
+		s++;
+	}
+	*len = s - *word;
+	*p = s;
+	return( (*len > 0) ? 0 : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : scan_number
+// Description  : Scan the next blank separated decimal number of a line
+//
+// Inputs       : p - where to scan from, moved past the number
+//                end - the end of the line
+//                val - set to the number
+// Outputs      : 0 if successful, -1 if there is no number
+
+static int scan_number( const char **p, const char *end, int32_t *val ) {
+
+	// Local variables
+	const char *s = *p;
+	int64_t v = 0;
+	int neg = 0;
+
+	while ( (s < end) && ((*s == ' ') || (*s == '\t')) ) {
+		s++;
+	}
+	if ( (s < end) && (*s == '-') ) {
+		neg = 1;
+		s++;
+	}
+	if ( (s == end) || (*s < '0') || (*s > '9') ) {
+		return( -1 );
+	}
+	while ( (s < end) && (*s >= '0') && (*s <= '9') ) {
+		v = (v * 10) + (*s - '0');
+		if ( v > INT32_MAX ) {
+			return( -1 );
+		}
+		s++;
+	}
+	*val = (int32_t)(neg ? -v : v);
+	*p = s;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : next_command
+// Description  : Parse the next line of the workload, the file name and data
+//                of the command are left pointing into the workload
+//
+// Inputs       : work - the workload
+//                cmd - the command to fill in
+// Outputs      : 1 if a command was parsed, 0 at the end of the workload, -1
+//                if the line could not be parsed
+
+int next_command( FS3SimWorkload *work, FS3SimCommand *cmd ) {
+
+	// Local variables
+	const char *line, *eol, *p, *sep, *word;
+	int wlen;
+
+	// Find the end of the line, the last one may not have a newline
+	if ( work->next >= work->end ) {
+		return( 0 );
+	}
+	line = p = work->next;
+	if ( (eol = memchr(line, '\n', work->end - line)) == NULL ) {
+		eol = work->end;
+	}
+	work->next = (eol < work->end) ? eol + 1 : eol;
+	work->line ++;
+
+	// "fname COMMAND len off:data"
+	if ( (scan_word(&p, eol, &cmd->fname, &cmd->fnameLen) == -1) || (scan_word(&p, eol, &word, &wlen) == -1) ||
+			(scan_number(&p, eol, &cmd->len) == -1) || (scan_number(&p, eol, &cmd->off) == -1) ||
+			((sep = memchr(p, ':', eol - p)) == NULL) ) {
+		FS3_LOG_ERROR( "FS3 un-parsable workload string, aborting [%.*s], line %d",
+				(int)(eol - line), line, work->line );
+		return( -1 );
+	}
+	cmd->data = sep + 1;
+	cmd->dataLen = eol - cmd->data;
+
+	// Work out the command
+	if ( (wlen == 7) && (memcmp(word, "WRITEAT", 7) == 0) ) {
+		cmd->op = FS3_SIM_WRITEAT;
+	} else if ( (wlen == 5) && (memcmp(word, "WRITE", 5) == 0) ) {
+		cmd->op = FS3_SIM_WRITE;
+	} else if ( (wlen == 4) && (memcmp(word, "SEEK", 4) == 0) ) {
+		cmd->op = FS3_SIM_SEEK;
+	} else if ( (wlen == 4) && (memcmp(word, "READ", 4) == 0) ) {
+		cmd->op = FS3_SIM_READ;
+	} else {
+		FS3_LOG_ERROR( "FS3_SIM : Failed, unknown command [%.*s], line %d", wlen, word, work->line );
+		return( -1 );
+	}
+	return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hash_name
+// Description  : Hash a file name (FNV-1a), for the file table and to split
+//                the files between the workers
+//
+// Inputs       : name - the file name
+//                len - the length of the name
+// Outputs      : the hash
+
+uint32_t hash_name( const char *name, int len ) {
+
+	// Local variables
+	uint32_t hash = 2166136261u;
+	int i;
+
+	for ( i=0; i<len; i++ ) {
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return( hash );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookup_file
+// Description  : Find the file of a command in the file table, adding it the
+//                first time the file is used. The table is indexed by a hash
+//                of the file names (linear probing)
+//
+// Inputs       : sim - the file table
+//                cmd - the command
+//                added - set to 1 if the file was added, 0 if not
+// Outputs      : the index of the file in the table
+
+int lookup_file( FS3SimFiles *sim, FS3SimCommand *cmd, int *added ) {
+
+	// Local variables
+	int slot, idx;
+
+	// Find the file's slot, or the empty one it goes in
+	slot = hash_name(cmd->fname, cmd->fnameLen) & (FS3_SIM_FILE_SLOTS - 1);
+	while ( (idx = sim->slots[slot]) != -1 ) {
+		if ( (strncmp(sim->ftable[idx].filename, cmd->fname, cmd->fnameLen) == 0) &&
+				(sim->ftable[idx].filename[cmd->fnameLen] == 0x0) ) {
+			*added = 0;
+			return( idx );
+		}
+		slot = (slot + 1) & (FS3_SIM_FILE_SLOTS - 1);
+	}
+
+	// Not found, add the file
+	CMPSC311_ASSERT1(sim->nfiles<FS3_SIM_MAX_OPEN_FILES, "Too many open files on FS3 sim [%d]", sim->nfiles);
+	idx = sim->nfiles ++;
+	sim->ftable[idx].filename = strndup(cmd->fname, cmd->fnameLen);
+	sim->ftable[idx].fhandle = -1;
+	sim->slots[slot] = idx;
+	*added = 1;
+	return( idx );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : command_text
+// Description  : Get the text a write command writes, "^" in the workload
+//                is a newline
+//
+// Inputs       : cmd - the command
+//                text - the buffer to place the text in
+// Outputs      : 0 if successful, -1 if failure
+
+int command_text( FS3SimCommand *cmd, char *text ) {
+
+	// Local variables
+	int i;
+
+	CMPSC311_ASSERT1(cmd->len<1024, "Simulated workload command text too large [%d]", cmd->len);
+	CMPSC311_ASSERT2((cmd->dataLen>=cmd->len), "Workload str [%d<%d]", cmd->dataLen, cmd->len);
+	for (i=0; i<cmd->len; i++) {
+		text[i] = (cmd->data[i] == '^') ? '\n' : cmd->data[i];
+	}
+	text[cmd->len] = 0x0;
+	return( 0 );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : simulate_FS3
 // Description  : The main control loop for the processing of the FS3
-//                simulation.
+//                simulation. With several workers each replays its share of
+//                the files in a process of its own, as the driver keeps one
+//                disk's state, on a server of its own. The lines of a file all
+//                go to one worker, in order
 //
 // Inputs       : wload - the name of the workload file
 // Outputs      : 0 if successful test, -1 if failure
@@ -166,230 +627,362 @@ int main( int argc, char *argv[] ) {
 int simulate_FS3( char *wload ) {
 
 	// Local variables
-	char line[1024], fname[128], command[128], text[1025], *sep, *rbuf;
-	FILE *fhandle = NULL;
-	int32_t err=0, len, off, fields, linecount;
-	FS3SimulationTable ftable[FS3_SIM_MAX_OPEN_FILES];
-	int idx, i, millions;
+	pid_t pids[FS3_SIM_MAX_WORKERS];
+	int w, i, status, failed = 0;
+	double start = networkNow();
+
+	// A single worker replays the workload here
+	if ( simWorkers == 1 ) {
+		failed = replay_FS3(wload, 0);
+		FS3_LOG_OUTPUT( "FS3 replay: 1 worker, %.3f s.", networkNow() - start );
+		return( failed );
+	}
+
+	// Start the workers, the log is flushed so they do not write out what is buffered again
+	fflush( NULL );
+	for ( w=0; w<simWorkers; w++ ) {
+		if ( (pids[w] = fork()) == -1 ) {
+			FS3_LOG_ERROR( "FS3 simulator failed starting worker %d.", w );
+			failed = 1;
+			break;
+		}
+		if ( pids[w] == 0 ) {
+			exit( (replay_FS3(wload, w) == 0) ? 0 : 1 );
+		}
+	}
+
+	// Wait for every worker that was started
+	for ( i=0; i<w; i++ ) {
+		if ( (waitpid(pids[i], &status, 0) == -1) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) {
+			FS3_LOG_ERROR( "FS3 simulation worker %d failed.", i );
+			failed = 1;
+		}
+	}
+	if ( failed ) {
+		return( -1 );
+	}
+	FS3_LOG_OUTPUT( "FS3 replay: %d workers, %.3f s.", simWorkers, networkNow() - start );
+	FS3_LOG_OUTPUT( "FS3 simulation: all tests successful!!!." );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_FS3
+// Description  : Replay a worker's share of the workload and validate its
+//                files, all of the workload when there is one worker
+//
+// Inputs       : wload - the name of the workload file
+//                worker - the worker, from 0
+// Outputs      : 0 if successful test, -1 if failure
+
+int replay_FS3( char *wload, int worker ) {
+
+	// Local variables
+	char text[1025], *rbuf = NULL;
+	FS3SimWorkload work;
+	FS3SimCommand cmd;
+	FS3SimFiles sim;
+	int idx, i, millions, added, parsed;
+	int32_t rbufSize = 0;
+	char traceName[256], spanName[256];
+	double started, replayed, start;
+	uint64_t bytes = 0;
 
 	// Setup the file table
-	memset(ftable, 0x0, sizeof(FS3SimulationTable)*FS3_SIM_MAX_OPEN_FILES);
+	memset(&sim, 0x0, sizeof(FS3SimFiles));
+	memset(sim.slots, 0xff, sizeof(sim.slots));
 
 	// Open the workload file
-	millions = linecount = 0;
-	if ( (fhandle=fopen(wload, "r")) == NULL ) {
-		logMessage( LOG_ERROR_LEVEL, "Failure opening the workload file [%s], error: %s.\n",
-			wload, strerror(errno) );
+	millions = 0;
+	if ( open_workload(wload, &work) == -1 ) {
 		return( -1 );
 	}
 
+	// Each worker has its own server, trace and spans
+	if ( simWorkers > 1 ) {
+		fs3_network_port = ((fs3_network_port == 0) ? FS3_DEFAULT_PORT : fs3_network_port) + worker;
+		if ( fs3_trace_file != NULL ) {
+			snprintf( traceName, sizeof(traceName), "%s.%d", fs3_trace_file, worker );
+			fs3_trace_file = traceName;
+		}
+		if ( fs3_span_file != NULL ) {
+			snprintf( spanName, sizeof(spanName), "%s.%d", fs3_span_file, worker );
+			fs3_span_file = spanName;
+		}
+	}
+
 	// Startup the interface
+	started = networkNow();
 	if ( (fs3_mount_disk() == -1) || (fs3_init_cache(fs3CacheSize) == -1) ){
-		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed initialization.");
-		fclose( fhandle );
-		return( -1 );
+		FS3_LOG_ERROR( "FS3 simulator failed initialization.");
+		return( abort_replay(&work, &sim, rbuf) );
 	}
-	logMessage(FS3SimulatorLLevel, "FS3 simulator initialization complete.");
+	FS3_LOG_INFO(FS3SimulatorLLevel, "FS3 simulator initialization complete.");
 
-	// While file not done
-	while (!feof(fhandle)) {
+	// While workload not done
+	while ( (parsed = next_command(&work, &cmd)) == 1 ) {
+
+		// Give some output when doing long worklaods, the first worker speaks for them all
+		if ( (worker == 0) && (work.line > 1) && (work.line-1)%1000000 == 0 ) {
+			millions ++;
+			fprintf( stderr, ". %d million operations.\n", millions );
+		} else if ( (worker == 0) && (work.line > 1) && (work.line-1)%100000 == 0 ) {
+			fprintf( stderr, ". " );
+		}
 
-		// Get the line and bail out on fail
-		if (fgets(line, 1024, fhandle) != NULL) {
+		// Skip the other workers' files
+		if ( (simWorkers > 1) && ((hash_name(cmd.fname, cmd.fnameLen) % simWorkers) != worker) ) {
+			continue;
+		}
 
-			// Give some output when doing long worklaods
-			if ( (linecount > 0) && (linecount)%1000000 == 0 ) {
-				millions ++;
-				fprintf( stderr, ". %d million operations.\n", millions );
-			} else if ( (linecount > 0) && (linecount)%100000 == 0 ) {
-				fprintf( stderr, ". " );
+		// Just log the contents
+		FS3_LOG_INFO(FS3SimulatorLLevel, "File [%.*s], command [%s], len=%d, offset=%d",
+				cmd.fnameLen, cmd.fname, benchLatency[cmd.op].name, cmd.len, cmd.off);
+
+		// Find the file, open it the first time it is used
+		idx = lookup_file(&sim, &cmd, &added);
+		if ( added ) {
+
+			// Log message, now perform the open
+			FS3_LOG_INFO(FS3SimulatorLLevel, "FS3_SIM : Opening file [%s]", sim.ftable[idx].filename);
+			start = networkNow();
+			sim.ftable[idx].fhandle = fs3_open(sim.ftable[idx].filename);
+			if (sim.ftable[idx].fhandle == -1) {
+				// Failed, error out
+				FS3_LOG_ERROR("Open of new file [%s] failed, aborting simulation.", sim.ftable[idx].filename);
+				return( abort_replay(&work, &sim, rbuf) );
 			}
+			record_latency( FS3_SIM_OPEN, start );
+
+		}
 
-			// Parse out the string
-			linecount ++;
-			fields = sscanf(line, "%s %s %d %d", fname, command, &len, &off);
-			sep = strchr(line, ':');
-			if ( (fields != 4) || (sep == NULL) ) {
-				logMessage( LOG_ERROR_LEVEL, "FS3 un-parsable workload string, aborting [%s], line %d",
-						line, linecount );
-				fclose( fhandle );
-				return( -1 );
+		// Now execute the specific command
+		if (cmd.op == FS3_SIM_WRITEAT) {
+
+			// Log the command executed
+			FS3_LOG_INFO(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes at position %d from file [%s]", cmd.len, cmd.off,
+				sim.ftable[idx].filename);
+
+			// First perform the seek
+			start = networkNow();
+			if (fs3_seek(sim.ftable[idx].fhandle, cmd.off)) {
+				// Failed, error out
+				FS3_LOG_ERROR("Seek/WriteAt file [%s] to position %d failed, aborting simulation.",
+					sim.ftable[idx].filename, cmd.off);
+				return( abort_replay(&work, &sim, rbuf) );
 			}
 
-			// Just log the contents
-			logMessage(FS3SimulatorLLevel, "File [%s], command [%s], len=%d, offset=%d",
-					fname, command, len, off);
-
-			// Now walk the the table looking for the file
-			idx = -1;
-			i = 0;
-			while ( (i < FS3_SIM_MAX_OPEN_FILES) && (idx == -1) ) {
-				if ( (ftable[i].filename != NULL) && (strcmp(ftable[i].filename,fname) == 0) ) {
-					idx = i;
-				}
-				i++;
+			// Now perform the write
+			command_text(&cmd, text);
+			if (fs3_write(sim.ftable[idx].fhandle, text, cmd.len) != cmd.len) {
+				// Failed, error out
+				FS3_LOG_ERROR("WriteAt of file [%s], length %d failed, aborting simulation.",
+					sim.ftable[idx].filename, cmd.len);
+				return( abort_replay(&work, &sim, rbuf) );
+			}
+			record_latency( FS3_SIM_WRITEAT, start );
+			bytes += cmd.len;
+
+		} else if (cmd.op == FS3_SIM_WRITE) {
+
+			// Log the command executed
+			FS3_LOG_INFO(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes to file [%s]", cmd.len, sim.ftable[idx].filename);
+
+			// Now perform the write
+			command_text(&cmd, text);
+			start = networkNow();
+			if (fs3_write(sim.ftable[idx].fhandle, text, cmd.len) != cmd.len) {
+				// Failed, error out
+				FS3_LOG_ERROR("Write of file [%s], length %d failed, aborting simulation.",
+					sim.ftable[idx].filename, cmd.len);
+				return( abort_replay(&work, &sim, rbuf) );
 			}
+			record_latency( FS3_SIM_WRITE, start );
+			bytes += cmd.len;
 
-			// File is not found, open the file
-			if (idx == -1) {
-
-				// Log message, find unused index and save filename for later use
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Opening file [%s]", fname);
-				idx = 0;
-				while ((ftable[idx].filename != NULL) && (idx < FS3_SIM_MAX_OPEN_FILES)) {
-					idx++;
-				}
-				CMPSC311_ASSERT1(idx<FS3_SIM_MAX_OPEN_FILES, "Too many open files on FS3 sim [%d]", idx);
-				ftable[idx].filename = strdup(fname);
-
-				// Now perform the open
-				ftable[idx].fhandle = fs3_open(ftable[idx].filename);
-				if (ftable[idx].fhandle == -1) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Open of new file [%s] failed, aborting simulation.", fname);
-					return(-1);
-				}
+		} else if (cmd.op == FS3_SIM_SEEK) {
 
+			// Log the command executed
+			FS3_LOG_INFO(FS3SimulatorLLevel, "FS3_SIM : Seeking to position %d in file [%s]", cmd.off, sim.ftable[idx].filename);
+
+			// Now perform the seek
+			start = networkNow();
+			if (fs3_seek(sim.ftable[idx].fhandle, cmd.off) != cmd.len) {
+				// Failed, error out
+				FS3_LOG_ERROR("Seek in file [%s] to position %d failed, aborting simulation.",
+					sim.ftable[idx].filename, cmd.off);
+				return( abort_replay(&work, &sim, rbuf) );
 			}
+			record_latency( FS3_SIM_SEEK, start );
+
+		} else {
 
-			// Now execute the specific command
-			if (strncmp(command, "WRITEAT", 7) == 0) {
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes at position %d from file [%s]", len, off, fname);
-
-				// First perform the seek
-				if (fs3_seek(ftable[idx].fhandle, off)) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Seek/WriteAt file [%s] to position %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-
-				// Now see if we need more data to fill, terminate the lines
-				CMPSC311_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-				CMPSC311_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-				strncpy(text, sep+1, len);
-				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
-					if (text[i] == '^') {
-						text[i] = '\n';
-					}
-				}
-
-				// Now perform the write
-				if (fs3_write(ftable[idx].fhandle, text, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "WriteAt of file [%s], length %d failed, aborting simulation.", fname, len);
-					return(-1);
-				}
-
-
-			} else if (strncmp(command, "WRITE", 5) == 0) {
-
-				// Now see if we need more data to fill, terminate the lines
-				CMPSC311_ASSERT1(len<1024, "Simulated workload command text too large [%d]", len);
-				CMPSC311_ASSERT2((strlen(sep+1)>=len), "Workload str [%d<%d]", strlen(sep+1), len);
-				strncpy(text, sep+1, len);
-				text[len] = 0x0;
-				for (i=0; i<strlen(text); i++) {
-					if (text[i] == '^') {
-						text[i] = '\n';
-					}
-				}
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Writing %d bytes to file [%s]", len, fname);
-
-				// Now perform the write
-				if (fs3_write(ftable[idx].fhandle, text, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Write of file [%s], length %d failed, aborting simulation.", fname, len);
-					return(-1);
-				}
-
-
-			} else if (strncmp(command, "SEEK", 4) == 0) {
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Seeking to position %d in file [%s]", off, fname);
-
-				// Now perform the seek
-				if (fs3_seek(ftable[idx].fhandle, off) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Seek in file [%s] to position %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-
-			} else if (strncmp(command, "READ", 4) == 0) {
-
-				// Log the command executed
-				logMessage(FS3SimulatorLLevel, "FS3_SIM : Reading %d bytes from file [%s]", len, fname);
-
-				// Now perform the read
-				rbuf = malloc(len);
-				if (fs3_read(ftable[idx].fhandle, rbuf, len) != len) {
-					// Failed, error out
-					logMessage(LOG_ERROR_LEVEL, "Read file [%s] of length %d failed, aborting simulation.", fname, off);
-					return(-1);
-				}
-				free(rbuf);
-				rbuf = NULL;
-
-			} else {
-
-				// Bomb out, don't understand the command
-				CMPSC311_ASSERT1(0, "FS3_SIM : Failed, unknown command [%s]", command);
+			// Log the command executed
+			FS3_LOG_INFO(FS3SimulatorLLevel, "FS3_SIM : Reading %d bytes from file [%s]", cmd.len, sim.ftable[idx].filename);
 
+			// The read buffer is kept from one read to the next, growing as needed
+			if ( cmd.len > rbufSize ) {
+				rbufSize = cmd.len;
+				rbuf = realloc(rbuf, rbufSize);
+				CMPSC311_ASSERT1(rbuf != NULL, "Out of memory for a %d byte read", rbufSize);
 			}
-		}
 
-		// Check for the virtual level failing
-		if ( err ) {
-			logMessage( LOG_ERROR_LEVEL, "CRUS system failed, aborting [%d]", err );
-			fclose( fhandle );
-			return( -1 );
+			// Now perform the read
+			start = networkNow();
+			if (fs3_read(sim.ftable[idx].fhandle, rbuf, cmd.len) != cmd.len) {
+				// Failed, error out
+				FS3_LOG_ERROR("Read file [%s] of length %d failed, aborting simulation.",
+					sim.ftable[idx].filename, cmd.len);
+				return( abort_replay(&work, &sim, rbuf) );
+			}
+			record_latency( FS3_SIM_READ, start );
+			bytes += cmd.len;
+
 		}
 	}
+	free(rbuf);
+	rbuf = NULL;
 
-	// Now walk the the table looking for the file
-	for (i=0; i<FS3_SIM_MAX_OPEN_FILES; i++) {
-		if (ftable[i].filename != NULL) {
-			if (validate_file(ftable[i].filename, ftable[i].fhandle) != 0) {
-				logMessage(LOG_ERROR_LEVEL, "FS3 Validation failed on file [%s].", ftable[i].filename,fname);
-				fclose( fhandle );
-				return(-1);
-			}
+	// Check for the workload failing to parse
+	if ( parsed == -1 ) {
+		return( abort_replay(&work, &sim, rbuf) );
+	}
 
-			// Clean up the file
-			logMessage(FS3SimulatorLLevel, "Contents of file [%s] validated.", ftable[i].filename);
-			fs3_close(ftable[i].fhandle);
-			free(ftable[i].filename);
-			ftable[i].filename = NULL;
+	// Now walk the the table validating the files
+	replayed = networkNow();
+	for (i=0; i<sim.nfiles; i++) {
+		if (validate_file(sim.ftable[i].filename, sim.ftable[i].fhandle) != 0) {
+			FS3_LOG_ERROR("FS3 Validation failed on file [%s].", sim.ftable[i].filename);
+			return( abort_replay(&work, &sim, rbuf) );
 		}
+
+		// Clean up the file
+		FS3_LOG_INFO(FS3SimulatorLLevel, "Contents of file [%s] validated.", sim.ftable[i].filename);
+		fs3_close(sim.ftable[i].fhandle);
+		free(sim.ftable[i].filename);
+		sim.ftable[i].filename = NULL;
 	}
 
-	// Log cache metrics, shut down the interface
-	if ( fs3_log_cache_metrics() == -1 ) {
-		logMessage(LOG_ERROR_LEVEL, "FS3 simulation failed, controller metrics failed");
-		return(-1);
+	// Log cache, scheduler, mirror and lease metrics, shut down the interface
+	if ( (fs3_log_cache_metrics() == -1) || (fs3_log_sched_metrics() == -1) || (fs3_log_network_metrics() == -1) ||
+			(fs3_log_lease_metrics() == -1) ) {
+		FS3_LOG_ERROR("FS3 simulation failed, controller metrics failed");
+		return( abort_replay(&work, &sim, rbuf) );
 	}
 	if ((fs3_unmount_disk() == -1) || (fs3_close_cache() == -1)) {
-		logMessage( LOG_ERROR_LEVEL, "FS3 simulator failed shutdown.");
-		fclose( fhandle );
+		FS3_LOG_ERROR( "FS3 simulator failed shutdown.");
+		close_workload( &work );
+		return( -1 );
+	}
+	FS3_LOG_INFO(FS3SimulatorLLevel, "FS3 simulator shutdown complete.");
+	if ( simWorkers == 1 ) {
+		FS3_LOG_OUTPUT("FS3 simulation: all tests successful!!!.");
+	} else {
+		FS3_LOG_INFO(FS3SimulatorLLevel, "FS3 simulation worker %d: %d files validated.", worker, sim.nfiles);
+	}
+
+	// Save the benchmark results, if benchmarking
+	if ( write_results(wload, networkNow() - started, replayed - started, bytes) == -1 ) {
+		close_workload( &work );
 		return( -1 );
 	}
-	logMessage(FS3SimulatorLLevel, "FS3 simulator shutdown complete.");
-	logMessage(LOG_OUTPUT_LEVEL, "FS3 simulation: all tests successful!!!.");
 
 	// Close the workload file, successfully
-	fclose( fhandle );
+	close_workload( &work );
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : abort_replay
+// Description  : Clean up a replay that failed part way, unmapping the
+//                workload, freeing the read buffer and file names and
+//                unmounting the disk
+//
+// Inputs       : work - the workload
+//                sim - the file table
+//                rbuf - the read buffer, NULL if none
+// Outputs      : -1, the failure replay_FS3 returns
+
+int abort_replay( FS3SimWorkload *work, FS3SimFiles *sim, char *rbuf ) {
+
+	// Local variables
+	int i;
+
+	// Release everything the replay holds, the unmount closes its open files
+	close_workload( work );
+	free( rbuf );
+	for (i=0; i<sim->nfiles; i++) {
+		free( sim->ftable[i].filename );
+		sim->ftable[i].filename = NULL;
+	}
+	fs3_unmount_disk();
+	fs3_close_cache();
+	return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parse_FS3
+// Description  : Parse the workload without running it, to measure how fast
+//                the simulator gets through a workload apart from the driver.
+//                The file table and the text of the writes are set up as
+//                they are when simulating
+//
+// Inputs       : wload - the name of the workload file
+// Outputs      : 0 if successful, -1 if failure
+
+int parse_FS3( char *wload ) {
+
+	// Local variables
+	char text[1025];
+	FS3SimWorkload work;
+	FS3SimCommand cmd;
+	FS3SimFiles sim;
+	int i, added, parsed;
+	uint64_t bytes = 0;
+	double start, elapsed;
+
+	// Setup the file table, open the workload file
+	memset(&sim, 0x0, sizeof(FS3SimFiles));
+	memset(sim.slots, 0xff, sizeof(sim.slots));
+	if ( open_workload(wload, &work) == -1 ) {
+		return( -1 );
+	}
+
+	// Parse every line
+	start = networkNow();
+	while ( (parsed = next_command(&work, &cmd)) == 1 ) {
+		lookup_file(&sim, &cmd, &added);
+		if ( (cmd.op == FS3_SIM_WRITE) || (cmd.op == FS3_SIM_WRITEAT) ) {
+			command_text(&cmd, text);
+		}
+		bytes += ((cmd.op != FS3_SIM_SEEK) ? cmd.len : 0);
+	}
+	elapsed = networkNow() - start;
+
+	// Log the throughput, clean up
+	if ( parsed == 0 ) {
+		FS3_LOG_OUTPUT( "FS3 parser: %d lines (%lu bytes of workload, %lu read or written, %d files) "
+			"in %.3f s, %.0f lines/s, %.1f MB/s.", work.line, (unsigned long)work.size, (unsigned long)bytes,
+			sim.nfiles, elapsed, work.line / elapsed, (work.size / elapsed) / 1e6 );
+	}
+	for (i=0; i<sim.nfiles; i++) {
+		free(sim.ftable[i].filename);
+	}
+	close_workload( &work );
+	return( (parsed == 0) ? 0 : -1 );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : validate_file
-// Description  : Vadliate a file in the filesystem
+// Description  : Vadliate a file in the filesystem. The reference file is
+//                mapped and the file is read back from the disk a chunk of
+//                sectors at a time, each chunk compared with memcmp. A .cmm
+//                copy of what the disk holds is kept for debugging when the
+//                file fails, or for every file with -k
 //
 // Inputs       : fname - the name of the file to validate
 //                mfh - the disk file handle
@@ -398,71 +991,291 @@ int simulate_FS3( char *wload ) {
 int validate_file(char *fname, int16_t mfh) {
 
 	// Local variables
-	char filename[256], bkfile[256], *filbuf, *membuf;
+	char filename[256], bkfile[256], membuf[FS3_SIM_VALIDATE_CHUNK], *filbuf;
 	struct stat stats;
-	int idx, fh;
+	int fh, bk = -1, result = -1;
+	off_t off, idx;
+	int32_t len;
 
-	// First figure out how big the file is, setup buffer
+	// First figure out how big the file is, map it
 	snprintf(filename, 256, "%s/%s", FS3_WORKLOAD_DIR, fname);
-	if ((stat(filename, &stats) != 0) || (stats.st_size == 0)) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], missing or "
+	if (((fh=open(filename, O_RDONLY)) == -1) || (fstat(fh, &stats) != 0) || (stats.st_size == 0)) {
+		FS3_LOG_ERROR("Failure validating file [%s], missing or "
 			"unknown source.", filename);
+		if (fh != -1) {
+			close(fh);
+		}
 		return(-1);		
 	}
-	if ( ((filbuf = malloc(stats.st_size)) == NULL) || ((membuf = malloc(stats.st_size)) == NULL) ) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], failed "
-			"buffer allocation.", filename);
+	filbuf = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fh, 0);
+	close(fh);
+	if (filbuf == MAP_FAILED) {
+		FS3_LOG_ERROR("Failure validating file [%s], map failed ", filename);
 		return(-1);		
 	}
 
-	// Now open the file and read the contents
-	if ((fh=open(filename, O_RDONLY)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], open failed ", filename);
-		return(-1);		
-	}
-	if ((read(fh, filbuf, stats.st_size)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure validating file [%s], read failed ", filename);
-		return(-1);
-	}
-	close(fh);
+	// The kernel reads the reference file in while the disk is read
+	madvise(filbuf, stats.st_size, MADV_SEQUENTIAL);
+	madvise(filbuf, stats.st_size, MADV_WILLNEED);
 
-	// Seek to the beginning of the disk file, read the contents
+	// Seek to the beginning of the disk file, create the backup if keeping them
+	snprintf(bkfile, 256, "%s/%s.cmm", FS3_WORKLOAD_DIR, fname);
 	if (fs3_seek(mfh, 0) == -1) {
 		// Failed, error out
-		logMessage(LOG_ERROR_LEVEL, "Read fs3 file [%s] see to zero failed.", fname);
+		FS3_LOG_ERROR("Read fs3 file [%s] see to zero failed.", fname);
+		munmap(filbuf, stats.st_size);
 		return(-1);
 	}
-	if (fs3_read(mfh, membuf, stats.st_size) != stats.st_size) {
-		// Failed, error out
-		logMessage(LOG_ERROR_LEVEL, "Read fs3 file [%s] of length %d failed.", fname, stats.st_size);
+	if (keepBackups && ((bk=open(bkfile, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU)) == -1)) {
+		FS3_LOG_ERROR("Failure creating backup file [%s], open failed (%s) ", 
+			bkfile, strerror(errno));
+		munmap(filbuf, stats.st_size);
+		return(-1);		
+	}
+
+	// Now read the disk file a chunk at a time, comparing each with the reference
+	for (off=0; off<stats.st_size; off+=len) {
+		len = ((stats.st_size - off) < FS3_SIM_VALIDATE_CHUNK) ? (int32_t)(stats.st_size - off) : FS3_SIM_VALIDATE_CHUNK;
+		if (fs3_read(mfh, membuf, len) != len) {
+			// Failed, error out
+			FS3_LOG_ERROR("Read fs3 file [%s] of length %d failed.", fname, stats.st_size);
+			break;
+		}
+		if ((bk != -1) && (write(bk, membuf, len) != len)) {
+			FS3_LOG_ERROR("Failure writing backup file [%s].", bkfile);
+			break;
+		}
+		if (memcmp(membuf, &filbuf[off], len) != 0) {
+			for (idx=0; membuf[idx] == filbuf[off+idx]; idx++);
+			FS3_LOG_ERROR("Validation of [%s] failed at offset %d (mem %x/'%c' "
+				"!= fil %x/'%c')", fname, (int)(off+idx), membuf[idx], membuf[idx], filbuf[off+idx], filbuf[off+idx]);
+			break;
+		}
+	}
+
+	// The disk file must end where the reference does
+	if ((off >= stats.st_size) && (fs3_read(mfh, membuf, 1) != 0)) {
+		FS3_LOG_ERROR("Validation of [%s] failed, fs3 file is longer than %d bytes.",
+			fname, stats.st_size);
+	} else if (off >= stats.st_size) {
+		result = 0;
+	}
+
+	// Clean up, keep what the disk holds if the file failed
+	munmap(filbuf, stats.st_size);
+	if (bk != -1) {
+		close(bk);
+	} else if (result != 0) {
+		backup_file(fname, mfh, bkfile);
+	}
+	if (result != 0) {
 		return(-1);
 	}
+	FS3_LOG_OUTPUT("Validation of [%s], length %d sucessful.", fname, stats.st_size);
+	return( 0 );
+}
 
-	// Now create a backup of the disk file so people can debug
-	snprintf(bkfile, 256, "%s/%s.cmm", FS3_WORKLOAD_DIR, fname);
-	if ((fh=open(bkfile, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure creating backup file [%s], open failed (%s) ", 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : backup_file
+// Description  : Copy what the disk holds for a file into a .cmm file, so
+//                people can debug a file that failed validation
+//
+// Inputs       : fname - the name of the file
+//                mfh - the disk file handle
+//                bkfile - the name of the backup file
+// Outputs      : 0 if successful, -1 if failure
+
+int backup_file(char *fname, int16_t mfh, char *bkfile) {
+
+	// Local variables
+	char membuf[FS3_SIM_VALIDATE_CHUNK];
+	int fh;
+	int32_t len;
+
+	if ((fs3_seek(mfh, 0) == -1) || ((fh=open(bkfile, O_RDWR|O_CREAT|O_TRUNC, S_IRWXU)) == -1)) {
+		FS3_LOG_ERROR("Failure creating backup file [%s], open failed (%s) ", 
 			bkfile, strerror(errno));
-		return(-1);		
-	}
-	if ((write(fh, membuf, stats.st_size)) == -1) {
-		logMessage(LOG_ERROR_LEVEL, "Failure writing backup file [%s].", bkfile);
 		return(-1);
 	}
+	while ((len = fs3_read(mfh, membuf, FS3_SIM_VALIDATE_CHUNK)) > 0) {
+		if (write(fh, membuf, len) != len) {
+			FS3_LOG_ERROR("Failure writing backup file [%s].", bkfile);
+			close(fh);
+			return(-1);
+		}
+	}
 	close(fh);
+	return(0);
+}
 
-	// Now walk the buffers and compare byte for byte
-	for (idx=0; idx<stats.st_size; idx++) {
-		if (membuf[idx] != filbuf[idx]) {
-			logMessage(LOG_ERROR_LEVEL, "Validation of [%s] failed at offset %d (mem %x/'%c' "
-				"!= fil %x/'%c')", fname, idx, membuf[idx], membuf[idx], filbuf[idx], filbuf[idx]);
-			return(-1);
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : record_latency
+// Description  : Record how long a workload operation took, when benchmarking
+//
+// Inputs       : op - the operation
+//                start - when the operation started (networkNow())
+// Outputs      : 0 if successful, -1 if failure
+
+int record_latency( FS3SimOperation op, double start ) {
+
+	// Local variables
+	FS3SimLatency *lat = &benchLatency[op];
+	double *samples;
+
+	// Only kept when benchmarking
+	if ( benchResults == NULL ) {
+		return( 0 );
+	}
+
+	// Grow the samples as needed, save the sample
+	if ( lat->count == lat->size ) {
+		lat->size = (lat->size == 0) ? FS3_SIM_LATENCY_SAMPLES : lat->size * 2;
+		samples = realloc( lat->samples, lat->size * sizeof(double) );
+		CMPSC311_ASSERT1( samples != NULL, "Out of memory for %lu latency samples", (unsigned long)lat->size );
+		lat->samples = samples;
+	}
+	lat->samples[lat->count] = networkNow() - start;
+	lat->total += lat->samples[lat->count];
+	lat->count ++;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compare_latency
+// Description  : Order two latency samples, for qsort
+//
+// Inputs       : a, b - the samples
+// Outputs      : <0, 0 or >0 as a is shorter, the same or longer than b
+
+static int compare_latency( const void *a, const void *b ) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return( (x > y) - (x < y) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : latency_percentile
+// Description  : Get a percentile of the latencies of an operation, the
+//                samples must have been sorted (nearest rank)
+//
+// Inputs       : lat - the operation's latencies
+//                pct - the percentile (0 to 100)
+// Outputs      : the latency in microseconds, 0 if there are no samples
+
+double latency_percentile( FS3SimLatency *lat, double pct ) {
+
+	// Local variables
+	uint64_t rank;
+
+	if ( lat->count == 0 ) {
+		return( 0 );
+	}
+	rank = (uint64_t)((pct / 100.0) * lat->count + 0.999999);
+	rank = (rank == 0) ? 1 : ((rank > lat->count) ? lat->count : rank);
+	return( lat->samples[rank-1] * 1e6 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_results
+// Description  : Append the benchmark results of the workload to the results
+//                file, one line of JSON per run or one row of CSV (with a
+//                header when the file is new) if it ends in ".csv". The round
+//                trips and seeks are those of the whole run, the validation
+//                and unmount included
+//
+// Inputs       : wload - the name of the workload file
+//                wall - seconds from mounting to unmounting the disk
+//                replay - seconds spent replaying the workload
+//                bytes - bytes the workload read and wrote
+// Outputs      : 0 if successful, -1 if failure
+
+int write_results( char *wload, double wall, double replay, uint64_t bytes ) {
+
+	// Local variables
+	FILE *fh;
+	FS3SimLatency *lat;
+	uint64_t ops = 0;
+	int csv, i;
+	size_t nlen;
+
+	// Only when benchmarking
+	if ( benchResults == NULL ) {
+		return( 0 );
+	}
+
+	// Sort the samples so the percentiles can be read off
+	for ( i=0; i<FS3_SIM_OPS; i++ ) {
+		lat = &benchLatency[i];
+		if ( lat->count > 0 ) {
+			qsort( lat->samples, lat->count, sizeof(double), compare_latency );
+		}
+		ops += lat->count;
+	}
+
+	// Open the results file for appending
+	nlen = strlen( benchResults );
+	csv = (nlen >= 4) && (strcmp(&benchResults[nlen-4], ".csv") == 0);
+	if ( (fh=fopen(benchResults, "a")) == NULL ) {
+		FS3_LOG_ERROR( "Failure opening the results file [%s], error: %s.",
+			benchResults, strerror(errno) );
+		return( -1 );
+	}
+
+	if ( csv ) {
+
+		// New files get the header first
+		if ( ftell(fh) == 0 ) {
+			fprintf( fh, "workload,tag,time,cache_sectors,wall_s,replay_s,ops,ops_per_s,bytes,bytes_per_s,"
+				"round_trips,seeks" );
+			for ( i=0; i<FS3_SIM_OPS; i++ ) {
+				fprintf( fh, ",%s_count,%s_mean_us,%s_p50_us,%s_p90_us,%s_p99_us,%s_p999_us,%s_max_us",
+					benchLatency[i].name, benchLatency[i].name, benchLatency[i].name, benchLatency[i].name,
+					benchLatency[i].name, benchLatency[i].name, benchLatency[i].name );
+			}
+			fprintf( fh, "\n" );
+		}
+		fprintf( fh, "%s,%s,%ld,%u,%.6f,%.6f,%lu,%.1f,%lu,%.1f,%lu,%lu", wload, benchTag, (long)time(NULL),
+			fs3CacheSize, wall, replay, (unsigned long)ops, ops / replay, (unsigned long)bytes, bytes / replay,
+			(unsigned long)fs3_network_round_trips(), (unsigned long)trackSeeks() );
+		for ( i=0; i<FS3_SIM_OPS; i++ ) {
+			lat = &benchLatency[i];
+			fprintf( fh, ",%lu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f", (unsigned long)lat->count,
+				(lat->count > 0) ? (lat->total / lat->count) * 1e6 : 0, latency_percentile(lat, 50),
+				latency_percentile(lat, 90), latency_percentile(lat, 99), latency_percentile(lat, 99.9),
+				latency_percentile(lat, 100) );
+		}
+		fprintf( fh, "\n" );
+
+	} else {
+
+		fprintf( fh, "{\"workload\": \"%s\", \"tag\": \"%s\", \"time\": %ld, \"cache_sectors\": %u, "
+			"\"wall_s\": %.6f, \"replay_s\": %.6f, \"ops\": %lu, \"ops_per_s\": %.1f, \"bytes\": %lu, "
+			"\"bytes_per_s\": %.1f, \"round_trips\": %lu, \"seeks\": %lu, \"latency_us\": {", wload, benchTag,
+			(long)time(NULL), fs3CacheSize, wall, replay, (unsigned long)ops, ops / replay, (unsigned long)bytes,
+			bytes / replay, (unsigned long)fs3_network_round_trips(), (unsigned long)trackSeeks() );
+		for ( i=0; i<FS3_SIM_OPS; i++ ) {
+			lat = &benchLatency[i];
+			fprintf( fh, "%s\"%s\": {\"count\": %lu, \"mean\": %.2f, \"p50\": %.2f, \"p90\": %.2f, "
+				"\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}", (i > 0) ? ", " : "", lat->name,
+				(unsigned long)lat->count, (lat->count > 0) ? (lat->total / lat->count) * 1e6 : 0,
+				latency_percentile(lat, 50), latency_percentile(lat, 90), latency_percentile(lat, 99),
+				latency_percentile(lat, 99.9), latency_percentile(lat, 100) );
 		}
+		fprintf( fh, "}}\n" );
+
 	}
 
-	// Free the buffers, log success, and return successfully
-	free(filbuf);
-	free(membuf);
-	logMessage(LOG_OUTPUT_LEVEL, "Validation of [%s], length %d sucessful.", fname, stats.st_size);
+	// Close the file, log the headline numbers
+	if ( fclose(fh) != 0 ) {
+		FS3_LOG_ERROR( "Failure writing the results file [%s].", benchResults );
+		return( -1 );
+	}
+	FS3_LOG_OUTPUT( "FS3 benchmark: %lu ops in %.3f s (%.1f ops/s, %.1f bytes/s), %lu round trips, "
+		"%lu seeks.", (unsigned long)ops, replay, ops / replay, bytes / replay,
+		(unsigned long)fs3_network_round_trips(), (unsigned long)trackSeeks() );
 	return( 0 );
 }
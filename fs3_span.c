@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_span.c
+//  Description    : This is the implementation of the operation spans of the
+//                   FS3 filesystem. Each thread buffers the spans it ends and
+//                   writes them out as Chrome trace events (the JSON array
+//                   format) when its buffer fills, when it exits and when the
+//                   spans are closed. The file is started at the first mount
+//                   of the process and a later mount adds to it.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_span.h>
+#include <fs3_common.h>
+#include <fs3_log.h>
+
+//
+// Support Macros/Data
+
+char *fs3_span_file = NULL;
+bool fs3SpansOn = false;
+
+//A span that has ended, times are monotonic nanoseconds
+typedef struct {
+	const char *cat;
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+} FS3SpanEvent;
+
+//A thread's buffered spans, buffers of threads that have exited are kept for the next threads
+typedef struct FS3SpanRing {
+	FS3SpanEvent events[FS3_SPAN_RING_EVENTS];
+	int count;
+	pid_t tid;
+	struct FS3SpanRing *next;
+} FS3SpanRing;
+
+FILE *spanFile = NULL;
+long spanEnd = -1;          // Where the closing bracket was written, -1 before the file is started
+uint64_t spanEpoch = 0;     // Monotonic time the file's timestamps count from
+uint64_t spanCount = 0;     // Spans written
+__thread FS3SpanRing *spanRing = NULL;
+pthread_key_t spanKey;
+pthread_once_t spanKeyOnce = PTHREAD_ONCE_INIT;
+pthread_mutex_t spanLock = PTHREAD_MUTEX_INITIALIZER; // Held to write to the file or take a buffer from the pool
+FS3SpanRing *spanPool = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushSpans
+// Description  : Writes out the spans a thread has buffered
+//
+// Inputs       : ring - the thread's buffer
+// Outputs      : 0 if successful, -1 if failure
+
+int flushSpans(FS3SpanRing *ring) {
+	int result = 0;
+	pthread_mutex_lock(&spanLock);
+	for (int i=0; (spanFile != NULL) && (i<ring->count); i++) {
+		FS3SpanEvent *ev = &ring->events[i];
+		if (fprintf(spanFile, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+				ev->name, ev->cat, (double)(ev->start - spanEpoch) / 1000.0, (double)(ev->end - ev->start) / 1000.0,
+				(int)getpid(), (int)ring->tid) < 0) {
+			result = -1;
+		}
+	}
+	spanCount += ring->count;
+	pthread_mutex_unlock(&spanLock);
+	ring->count = 0;
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : spanExit
+// Description  : Writes out the spans of a thread that is exiting and keeps
+//                its buffer for another thread
+//
+// Inputs       : arg - the buffer
+// Outputs      : none
+
+void spanExit(void *arg) {
+	FS3SpanRing *ring = arg;
+	flushSpans(ring);
+	pthread_mutex_lock(&spanLock);
+	ring->next = spanPool;
+	spanPool = ring;
+	pthread_mutex_unlock(&spanLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : spanKeySetup
+// Description  : Creates the key that gives back each thread's buffer when
+//                the thread exits
+//
+// Inputs       : none
+// Outputs      : none
+
+void spanKeySetup(void) {
+	pthread_key_create(&spanKey, spanExit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : threadSpans
+// Description  : Gets the calling thread's buffer, giving it one the first
+//                time it ends a span
+//
+// Inputs       : none
+// Outputs      : the buffer, NULL if failure
+
+FS3SpanRing *threadSpans(void) {
+	if (spanRing != NULL) {
+		return (spanRing);
+	}
+	pthread_mutex_lock(&spanLock);
+	FS3SpanRing *ring = spanPool;
+	if (ring != NULL) {
+		spanPool = ring->next;
+	}
+	pthread_mutex_unlock(&spanLock);
+	if ((ring == NULL) && ((ring = malloc(sizeof(FS3SpanRing))) == NULL)) {
+		return (NULL);
+	}
+	ring->count = 0;
+	ring->tid = (pid_t)syscall(SYS_gettid);
+	spanRing = ring;
+	pthread_setspecific(spanKey, ring);
+	return (ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_span_open
+// Description  : Starts writing spans to fs3_span_file, if it is set. The
+//                first mount of the process starts the file, naming the
+//                process, a later one writes over its closing bracket
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_span_open(void) {
+	if ((fs3_span_file == NULL) || (spanFile != NULL)) {
+		return (0);
+	}
+	pthread_once(&spanKeyOnce, spanKeySetup);
+	if ((spanFile = fopen(fs3_span_file, (spanEnd == -1) ? "w" : "r+")) == NULL) {
+		FS3_LOG_ERROR("FS3 spans: cannot open [%s].", fs3_span_file);
+		return (-1);
+	}
+	if (spanEnd == -1) {
+		spanEpoch = fs3_span_now();
+		fprintf(spanFile, "[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"fs3 driver %d\"}}",
+			(int)getpid(), (int)getpid(), (int)getpid());
+	} else {
+		fseek(spanFile, spanEnd, SEEK_SET);
+	}
+	fs3SpansOn = true;
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_span_close
+// Description  : Writes out the calling thread's spans and closes the file,
+//                the threads running batches have written theirs out as they
+//                exited
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_span_close(void) {
+	if (spanFile == NULL) {
+		return (0);
+	}
+	fs3SpansOn = false;
+	int result = (spanRing != NULL) ? flushSpans(spanRing) : 0;
+	spanEnd = ftell(spanFile);
+	fprintf(spanFile, "\n]\n");
+	if (fclose(spanFile) != 0) {
+		result = -1;
+	}
+	spanFile = NULL;
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 spans: %lu spans written to [%s].", (unsigned long)spanCount, fs3_span_file);
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_span_now
+// Description  : Gets the current monotonic time
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+uint64_t fs3_span_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_span_record
+// Description  : Buffers a span that has ended, writing the buffer out when
+//                it is full. A span that ends after the spans are closed is
+//                dropped
+//
+// Inputs       : span - the span
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_span_record(FS3Span *span) {
+	if (!fs3SpansOn) {
+		return (0);
+	}
+	FS3SpanRing *ring = threadSpans();
+	if (ring == NULL) {
+		return (-1);
+	}
+	FS3SpanEvent *ev = &ring->events[ring->count++];
+	ev->cat = span->cat;
+	ev->name = span->name;
+	ev->start = span->start;
+	ev->end = fs3_span_now();
+	if (ring->count == FS3_SPAN_RING_EVENTS) {
+		return (flushSpans(ring));
+	}
+	return (0);
+}
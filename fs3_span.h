@@ -0,0 +1,76 @@
+#ifndef FS3_SPAN_INCLUDED
+#define FS3_SPAN_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_span.h
+//  Description    : This is the interface for timing the driver, cache and
+//                   network operations of the FS3 filesystem. A span covers
+//                   the rest of the block it is declared in, and the spans are
+//                   written as Chrome trace events that Perfetto can show.
+//                   Built with -DFS3_SPAN_USDT each span also fires USDT
+//                   probes (fs3:span__begin and fs3:span__end) for perf and
+//                   bpftrace, whether or not a span file is being written.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef FS3_SPAN_USDT
+#include <sys/sdt.h>
+#define FS3_SPAN_PROBE(event, cat, name) DTRACE_PROBE2(fs3, event, cat, name)
+#else
+#define FS3_SPAN_PROBE(event, cat, name)
+#endif
+
+// Defines
+#define FS3_SPAN_RING_EVENTS 4096 // Spans a thread buffers before writing them out
+
+// Time the rest of the block as an operation called name, of the category cat (string constants)
+#define FS3_SPAN(cat, name) \
+	FS3Span spanScope __attribute__((cleanup(fs3_span_end))) = { (cat), (name), fs3_span_begin((cat), (name)) }
+
+// Type definitions
+typedef struct {
+	const char *cat;  // Category, driver, cache or network
+	const char *name; // Operation
+	uint64_t start;   // Monotonic nanoseconds it started at, 0 when spans are not being written
+} FS3Span;
+
+// Global data
+extern char *fs3_span_file; // File the spans are written to, NULL when not writing them
+extern bool fs3SpansOn;     // Whether spans are being written
+
+//
+// Span Functions
+
+int fs3_span_open(void);
+	// Start writing spans to fs3_span_file, if it is set
+
+int fs3_span_close(void);
+	// Write out every span buffered and stop writing them
+
+uint64_t fs3_span_now(void);
+	// Get the monotonic time in nanoseconds
+
+int fs3_span_record(FS3Span *span);
+	// Buffer a span that has ended, use FS3_SPAN rather than this
+
+static inline uint64_t fs3_span_begin(const char *cat, const char *name) {
+	FS3_SPAN_PROBE(span__begin, cat, name);
+	return (fs3SpansOn ? fs3_span_now() : 0);
+}
+	// Start a span, all it costs when spans are off is a test of fs3SpansOn
+
+static inline void fs3_span_end(FS3Span *span) {
+	FS3_SPAN_PROBE(span__end, span->cat, span->name);
+	if (span->start != 0) {
+		fs3_span_record(span);
+	}
+}
+	// End a span as its block is left
+
+#endif
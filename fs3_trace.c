@@ -0,0 +1,289 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_trace.c
+//  Description    : This is the implementation of the command tracer for the
+//                   FS3 filesystem. Every command the driver sends to a
+//                   controller is recorded with when it was sent, how long
+//                   the reply took, a hash of the sector that went with it
+//                   and the reply, so fs3_replay can send the same commands
+//                   to a controller without the driver. Each thread buffers
+//                   its own records in a ring only it touches and writes a
+//                   full ring to the trace file at a spot it reserves with an
+//                   atomic add, so threads never wait on each other to trace
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <fs3_trace.h>
+#include <fs3_network.h>
+#include <fs3_common.h>
+#include <fs3_cmdblock.h>
+#include <fs3_log.h>
+
+//
+// Support Macros/Data
+
+char *fs3_trace_file = NULL;
+
+//A thread's buffered records, rings of threads that have exited are kept for the next threads
+typedef struct FS3TraceRing {
+	FS3TraceRecord records[FS3_TRACE_RING_RECORDS];
+	int count;
+	struct FS3TraceRing *next;
+} FS3TraceRing;
+
+int traceFd = -1;
+uint64_t traceEpoch = 0;   // Monotonic time in nanoseconds the first trace of the process started at
+uint64_t traceSeq = 0;     // Sequence number of the next record, taken with an atomic add
+uint64_t traceOffset = 0;  // Where the next run of records goes in the file, reserved with an atomic add
+__thread FS3TraceRing *traceRing = NULL;
+pthread_key_t traceKey;
+pthread_once_t traceKeyOnce = PTHREAD_ONCE_INIT;
+pthread_mutex_t tracePoolLock = PTHREAD_MUTEX_INITIALIZER;
+FS3TraceRing *tracePool = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : traceNow
+// Description  : Gets the current monotonic time
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+uint64_t traceNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushRing
+// Description  : Writes out the records a ring holds, at a spot in the file
+//                no other thread will write to
+//
+// Inputs       : ring - the ring
+// Outputs      : 0 if successful, -1 if failure
+
+int flushRing(FS3TraceRing *ring) {
+	size_t len = ring->count * sizeof(FS3TraceRecord);
+	if ((ring->count == 0) || (traceFd == -1)) {
+		ring->count = 0;
+		return (0);
+	}
+	uint64_t off = __atomic_fetch_add(&traceOffset, len, __ATOMIC_RELAXED);
+	ring->count = 0;
+	if (pwrite(traceFd, ring->records, len, off) != (ssize_t)len) {
+		FS3_LOG_ERROR("FS3 trace: failed writing %lu bytes to [%s].", (unsigned long)len, fs3_trace_file);
+		return (-1);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ringExit
+// Description  : Writes out the ring of a thread that is exiting and keeps it
+//                for another thread
+//
+// Inputs       : arg - the ring
+// Outputs      : none
+
+void ringExit(void *arg) {
+	FS3TraceRing *ring = arg;
+	flushRing(ring);
+	pthread_mutex_lock(&tracePoolLock);
+	ring->next = tracePool;
+	tracePool = ring;
+	pthread_mutex_unlock(&tracePoolLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ringKey
+// Description  : Creates the key that gives each thread's ring back when the
+//                thread exits
+//
+// Inputs       : none
+// Outputs      : none
+
+void ringKey(void) {
+	pthread_key_create(&traceKey, ringExit);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : threadRing
+// Description  : Gets the calling thread's ring, giving it one the first
+//                time it traces
+//
+// Inputs       : none
+// Outputs      : the ring, NULL if failure
+
+FS3TraceRing *threadRing(void) {
+	if (traceRing != NULL) {
+		return (traceRing);
+	}
+	pthread_mutex_lock(&tracePoolLock);
+	FS3TraceRing *ring = tracePool;
+	if (ring != NULL) {
+		tracePool = ring->next;
+	}
+	pthread_mutex_unlock(&tracePoolLock);
+	if ((ring == NULL) && ((ring = malloc(sizeof(FS3TraceRing))) == NULL)) {
+		return (NULL);
+	}
+	ring->count = 0;
+	traceRing = ring;
+	pthread_setspecific(traceKey, ring);
+	return (ring);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_open
+// Description  : Starts tracing to fs3_trace_file, if it is set. The first
+//                trace of the process starts the file afresh, a later mount
+//                adds to it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_trace_open(void) {
+	if ((fs3_trace_file == NULL) || (traceFd != -1)) {
+		return (0);
+	}
+	pthread_once(&traceKeyOnce, ringKey);
+	bool first = (traceEpoch == 0);
+	if ((traceFd = open(fs3_trace_file, O_WRONLY | O_CREAT | (first ? O_TRUNC : 0), 0644)) == -1) {
+		FS3_LOG_ERROR("FS3 trace: cannot open [%s].", fs3_trace_file);
+		return (-1);
+	}
+	if (first) {
+		FS3TraceHeader header = { .version = FS3_TRACE_VERSION, .recordSize = sizeof(FS3TraceRecord) };
+		memcpy(header.magic, FS3_TRACE_MAGIC, sizeof(header.magic));
+		if (pwrite(traceFd, &header, sizeof(header), 0) != sizeof(header)) {
+			close(traceFd);
+			traceFd = -1;
+			return (-1);
+		}
+		traceEpoch = traceNow();
+		traceOffset = sizeof(header);
+	} else {
+		traceOffset = lseek(traceFd, 0, SEEK_END);
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_close
+// Description  : Writes out the calling thread's records and stops tracing,
+//                the threads running batches have written theirs out as they
+//                exited
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_trace_close(void) {
+	if (traceFd == -1) {
+		return (0);
+	}
+	int result = (traceRing != NULL) ? flushRing(traceRing) : 0;
+	if (close(traceFd) != 0) {
+		result = -1;
+	}
+	traceFd = -1;
+	FS3_LOG_INFO(FS3DriverLLevel, "FS3 trace: %lu commands traced to [%s].", (unsigned long)traceSeq, fs3_trace_file);
+	return (result);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_begin
+// Description  : Gets the time a command is being sent at, for its record
+//
+// Inputs       : none
+// Outputs      : nanoseconds since the trace started, 0 when not tracing
+
+uint64_t fs3_trace_begin(void) {
+	if (traceFd == -1) {
+		return (0);
+	}
+	return (traceNow() - traceEpoch);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_command
+// Description  : Records a command and its reply in the calling thread's
+//                ring, writing the ring out when it is full
+//
+// Inputs       : ctrl - controller (or column) the command went to
+//                cmd - the command block sent
+//                ret - the command block returned
+//                buf - the sector written or read, NULL if none
+//                result - what the system call returned
+//                start - fs3_trace_begin() when the command was sent
+// Outputs      : 0 if successful, -1 if failure
+
+int fs3_trace_command(int ctrl, FS3CmdBlk cmd, FS3CmdBlk ret, void *buf, int result, uint64_t start) {
+	if (traceFd == -1) {
+		return (0);
+	}
+	FS3TraceRing *ring = threadRing();
+	if (ring == NULL) {
+		return (-1);
+	}
+	FS3TraceRecord *rec = &ring->records[ring->count++];
+	uint64_t elapsed = traceNow() - traceEpoch - start;
+	uint8_t op = fs3_cmd_op(cmd);
+
+	//Only a sector that was sent, or came back, is hashed
+	rec->seq = __atomic_fetch_add(&traceSeq, 1, __ATOMIC_RELAXED);
+	rec->start = start;
+	rec->cmd = cmd;
+	rec->ret = ret;
+	rec->elapsed = (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t)elapsed;
+	rec->hash = 0;
+	if ((buf != NULL) && ((op == FS3_OP_WRSECT) ||
+			(((op == FS3_OP_RDSECT) || (op == FS3_OP_LEASE)) && (result == 0) && (fs3_cmd_ret(ret) == 0)))) {
+		rec->hash = fs3_trace_hash(buf);
+	}
+	rec->ctrl = (int8_t)ctrl;
+	rec->result = (int8_t)result;
+	memset(rec->pad, 0, sizeof(rec->pad));
+	if (ring->count == FS3_TRACE_RING_RECORDS) {
+		return (flushRing(ring));
+	}
+	return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fs3_trace_hash
+// Description  : Hashes a sector for the trace (FNV-1a over 64 bit words,
+//                folded to 32 bits)
+//
+// Inputs       : buf - the sector
+// Outputs      : the hash
+
+uint32_t fs3_trace_hash(const void *buf) {
+	uint64_t hash = 14695981039346656037ULL, word;
+	for (int i=0; i<FS3_SECTOR_SIZE; i+=sizeof(word)) {
+		memcpy(&word, (const char *)buf + i, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	return ((uint32_t)(hash ^ (hash >> 32)));
+}
@@ -0,0 +1,65 @@
+#ifndef FS3_TRACE_INCLUDED
+#define FS3_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_trace.h
+//  Description    : This is the interface for tracing the commands the FS3
+//                   driver sends to its controllers, and the layout of the
+//                   trace file fs3_replay reads back.
+//
+//  Author         : Kyle George
+//  Last Modified  :
+//
+
+// Include
+#include <stdint.h>
+#include <stdbool.h>
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_TRACE_MAGIC "FS3TRACE" // Starts a trace file
+#define FS3_TRACE_VERSION 1 // Version of the trace file layout
+#define FS3_TRACE_RING_RECORDS 4096 // Records a thread buffers before writing them out
+
+// Type definitions
+typedef struct {
+	char     magic[8];   // FS3_TRACE_MAGIC
+	uint32_t version;    // FS3_TRACE_VERSION
+	uint32_t recordSize; // sizeof(FS3TraceRecord)
+} FS3TraceHeader;
+
+typedef struct {
+	uint64_t  seq;     // Order the commands were made in, the file holds each thread's records in runs
+	uint64_t  start;   // Nanoseconds from the start of the trace the command was sent at
+	FS3CmdBlk cmd;     // Command block sent
+	FS3CmdBlk ret;     // Command block returned
+	uint32_t  elapsed; // Nanoseconds until the reply, at most UINT32_MAX
+	uint32_t  hash;    // Hash of the sector written or read, 0 if there was none
+	int8_t    ctrl;    // Controller (column when mirrored) it was sent to
+	int8_t    result;  // What the system call returned
+	uint8_t   pad[6];
+} FS3TraceRecord;
+
+// Global data
+extern char *fs3_trace_file; // File the commands are traced to, NULL when not tracing
+
+//
+// Trace Functions
+
+int fs3_trace_open(void);
+	// Start tracing to fs3_trace_file, if it is set
+
+int fs3_trace_close(void);
+	// Write out every record buffered and stop tracing
+
+uint64_t fs3_trace_begin(void);
+	// Get the time a command is being sent at, 0 when not tracing
+
+int fs3_trace_command(int ctrl, FS3CmdBlk cmd, FS3CmdBlk ret, void *buf, int result, uint64_t start);
+	// Record a command and its reply
+
+uint32_t fs3_trace_hash(const void *buf);
+	// Hash a sector for the trace
+
+#endif
@@ -0,0 +1,479 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : fs3_wlgen.c
+//  Description    : This is a generator of synthetic workloads for the FS3
+//                   simulator. It writes a workload file of
+//                   "fname COMMAND len off:data" lines along with the file
+//                   each workload file should end up as in the workload
+//                   directory, for the simulator to validate against. The
+//                   number of files, the distribution of their sizes, which
+//                   files are used most, the read/write mix and how many
+//                   operations go to random rather than sequential offsets
+//                   are all tunable. Lines are streamed out as they are made
+//                   and only the files' contents are kept, so workloads of
+//                   hundreds of millions of lines can be made.
+//
+//   Author        : Kyle George
+//   Last Modified :
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <fs3_controller.h>
+
+// Defines
+#define FS3_WLGEN_ARGUMENTS "hf:n:s:d:a:r:R:m:S:w:"
+#define FS3_WLGEN_MAX_FILES 256 // Files fs3_sim can have open at once
+#define FS3_WLGEN_MAX_WRITE 1023 // Longest write the simulator takes
+#define FS3_WLGEN_DEFAULT_OP 960 // Default largest operation, its lines fit the simulator's old 1024 byte line buffer
+#define FS3_WLGEN_POOL (1 << 20) // Random text the data of each write is taken from
+#define FS3_WLGEN_MAX_CLASSES (1 << 20) // Most file sizes a Zipfian size distribution picks between
+#define FS3_WLGEN_OUTPUT_BUFFER (4 << 20)
+#define FS3_WLGEN_DISK_BYTES ((uint64_t)FS3_MAX_TRACKS * FS3_TRACK_SIZE * FS3_SECTOR_SIZE)
+#define USAGE \
+	"USAGE: fs3_wlgen [-h] [-f <files>] [-n <lines>] [-s <min:max>] [-d <distribution>] [-a <skew>]\n" \
+	"                 [-r <read pct>] [-R <random pct>] [-m <op bytes>] [-S <seed>] [-w <dir>] <workload-file>\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -f - number of files (default 100, at most 256)\n" \
+	"    -n - number of workload lines (default 100000)\n" \
+	"    -s - smallest and largest file size in bytes (default 1024:65536)\n" \
+	"    -d - file size distribution, \"uniform\", \"fixed\" (every file the largest size)\n" \
+	"         or \"zipf:<exponent>\" (sizes in multiples of the smallest, small ones\n" \
+	"         most likely, default uniform)\n" \
+	"    -a - Zipf exponent of how often each file is used, 0 uses them evenly (default 0)\n" \
+	"    -r - percentage of operations that read (default 30)\n" \
+	"    -R - percentage of operations at a random offset rather than where\n" \
+	"         the last one on the file left off (default 20)\n" \
+	"    -m - largest read or write in bytes (default 960, writes at most 1023). Larger writes make\n" \
+	"         lines longer than 1024 bytes, which only a simulator parsing the workload in place takes\n" \
+	"    -S - seed for the random numbers (default 1)\n" \
+	"    -w - directory the final contents of the files go to (default workload)\n" \
+	"\n" \
+	"    <workload-file> - file the workload is written to\n" \
+	"\n" \
+
+// A file of the workload
+typedef struct {
+	char      name[32];  // This is the name of the file
+	uint32_t  target;    // Size the file grows to
+	uint32_t  size;      // Size the file is so far
+	uint32_t  pos;       // Position the next sequential operation starts at
+	char     *contents;  // What the file holds so far, as written in the workload
+} FS3WorkloadFile;
+
+//
+// Global Data
+uint64_t rngState = 1;
+
+//
+// Functional Prototypes
+
+uint64_t wlgen_random( void );                                   // Get a random number
+double wlgen_uniform( void );                                    // Get a random number in [0, 1)
+double *wlgen_zipf( uint32_t n, double s );                      // Make the CDF of a Zipf distribution
+uint32_t wlgen_pick( double *cdf, uint32_t n );                  // Draw from a distribution
+int wlgen_operation( FILE *out, FS3WorkloadFile *f, int read, int random, uint32_t maxOp, const char *pool,
+	uint64_t left, uint64_t *lines );                            // Write the lines of one operation
+int wlgen_save( FS3WorkloadFile *files, int nfiles, const char *dir ); // Write the final file contents
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the workload generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+
+	// Local variables
+	FS3WorkloadFile *files;
+	FILE *out;
+	char dist[64] = "uniform", *pool, *dir = "workload";
+	double zipfSize = 0, skew = 0, *sizeCdf = NULL, *fileCdf = NULL;
+	uint32_t minSize = 1024, maxSize = 65536, maxOp = FS3_WLGEN_DEFAULT_OP, classes = 1, i;
+	uint64_t nlines = 100000, lines = 0, total = 0, seed = 1, millions = 0;
+	int ch, nfiles = 100, readPct = 30, randomPct = 20, idx;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, FS3_WLGEN_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'f': // Set the number of files
+			if ( (sscanf(optarg, "%d", &nfiles) != 1) || (nfiles <= 0) || (nfiles > FS3_WLGEN_MAX_FILES) ) {
+				fprintf( stderr, "Bad file count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'n': // Set the number of lines
+			if ( sscanf(optarg, "%lu", (unsigned long *)&nlines) != 1 ) {
+				fprintf( stderr, "Bad line count [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 's': // Set the range of file sizes
+			if ( (sscanf(optarg, "%u:%u", &minSize, &maxSize) != 2) || (minSize == 0) || (minSize > maxSize) ) {
+				fprintf( stderr, "Bad file sizes [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'd': // Set the size distribution
+			if ( (sscanf(optarg, "%63s", dist) != 1) || ((strcmp(dist, "uniform") != 0) &&
+					(strcmp(dist, "fixed") != 0) && ((sscanf(dist, "zipf:%lf", &zipfSize) != 1) ||
+					(zipfSize <= 0))) ) {
+				fprintf( stderr, "Bad size distribution [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'a': // Set how unevenly the files are used
+			if ( (sscanf(optarg, "%lf", &skew) != 1) || (skew < 0) ) {
+				fprintf( stderr, "Bad file skew [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'r': // Set the read mix
+			if ( (sscanf(optarg, "%d", &readPct) != 1) || (readPct < 0) || (readPct > 100) ) {
+				fprintf( stderr, "Bad read percentage [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'R': // Set the random mix
+			if ( (sscanf(optarg, "%d", &randomPct) != 1) || (randomPct < 0) || (randomPct > 100) ) {
+				fprintf( stderr, "Bad random percentage [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'm': // Set the largest operation
+			if ( (sscanf(optarg, "%u", &maxOp) != 1) || (maxOp == 0) ) {
+				fprintf( stderr, "Bad operation size [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'S': // Set the seed
+			if ( sscanf(optarg, "%lu", (unsigned long *)&seed) != 1 ) {
+				fprintf( stderr, "Bad seed [%s]\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'w': // Set the reference directory
+			dir = optarg;
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+	if ( optind + 1 != argc ) {
+		fprintf( stderr, "Missing command line parameters, use -h to see usage, aborting.\n" );
+		return( -1 );
+	}
+	rngState = (seed == 0) ? 1 : seed;
+
+	// Zipfian sizes are multiples of the smallest size, the first most likely
+	if ( zipfSize > 0 ) {
+		classes = maxSize / minSize;
+		classes = (classes > FS3_WLGEN_MAX_CLASSES) ? FS3_WLGEN_MAX_CLASSES : classes;
+		sizeCdf = wlgen_zipf( classes, zipfSize );
+	}
+	if ( skew > 0 ) {
+		fileCdf = wlgen_zipf( nfiles, skew );
+	}
+
+	// Make the files and the text the writes are taken from, "^" is a newline in the workload
+	files = calloc( nfiles, sizeof(FS3WorkloadFile) );
+	pool = malloc( FS3_WLGEN_POOL );
+	if ( (files == NULL) || (pool == NULL) || ((zipfSize > 0) && (sizeCdf == NULL)) ||
+			((skew > 0) && (fileCdf == NULL)) ) {
+		fprintf( stderr, "Out of memory\n" );
+		return( -1 );
+	}
+	for ( i=0; i<FS3_WLGEN_POOL; i++ ) {
+		pool[i] = ((wlgen_random() % 64) == 0) ? '^' : "0123456789abcdefghijklmnopqrstuvwxyz"[wlgen_random() % 36];
+	}
+	for ( idx=0; idx<nfiles; idx++ ) {
+		snprintf( files[idx].name, sizeof(files[idx].name), "file%d.txt", idx );
+		if ( strcmp(dist, "fixed") == 0 ) {
+			files[idx].target = maxSize;
+		} else if ( zipfSize > 0 ) {
+			files[idx].target = minSize * (wlgen_pick(sizeCdf, classes) + 1);
+		} else {
+			files[idx].target = minSize + (uint32_t)(wlgen_random() % ((uint64_t)maxSize - minSize + 1));
+		}
+		if ( (files[idx].contents = malloc(files[idx].target)) == NULL ) {
+			fprintf( stderr, "Out of memory for file contents\n" );
+			return( -1 );
+		}
+		total += files[idx].target;
+	}
+	if ( total > FS3_WLGEN_DISK_BYTES ) {
+		fprintf( stderr, "Warning: the files may grow to %lu bytes, more than one controller holds (%lu)\n",
+			(unsigned long)total, (unsigned long)FS3_WLGEN_DISK_BYTES );
+	}
+
+	// Open the workload file
+	if ( (out=fopen(argv[optind], "w")) == NULL ) {
+		fprintf( stderr, "Failure opening the workload file [%s], error: %s.\n", argv[optind], strerror(errno) );
+		return( -1 );
+	}
+	setvbuf( out, NULL, _IOFBF, FS3_WLGEN_OUTPUT_BUFFER );
+
+	// Write operations until there are enough lines, a file is always written before it can be read
+	while ( lines < nlines ) {
+		idx = (skew > 0) ? wlgen_pick(fileCdf, nfiles) : (int)(wlgen_random() % nfiles);
+		if ( wlgen_operation(out, &files[idx], (files[idx].size > 0) && ((wlgen_random() % 100) < readPct),
+				(wlgen_random() % 100) < randomPct, maxOp, pool, nlines - lines, &lines) == -1 ) {
+			fclose( out );
+			return( -1 );
+		}
+		if ( lines / 1000000 > millions ) {
+			millions = lines / 1000000;
+			fprintf( stderr, ". %lu million lines.\n", (unsigned long)millions );
+		}
+	}
+	if ( fclose(out) != 0 ) {
+		fprintf( stderr, "Failure writing the workload file [%s].\n", argv[optind] );
+		return( -1 );
+	}
+
+	// Write what each file should hold at the end
+	if ( wlgen_save(files, nfiles, dir) == -1 ) {
+		return( -1 );
+	}
+	fprintf( stderr, "Wrote %lu lines to [%s], reference files in [%s].\n", (unsigned long)lines, argv[optind], dir );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wlgen_random
+// Description  : Get a random number (xorshift64*), the workload depends only
+//                on the seed and the options
+//
+// Inputs       : none
+// Outputs      : the random number
+
+uint64_t wlgen_random( void ) {
+	rngState ^= rngState >> 12;
+	rngState ^= rngState << 25;
+	rngState ^= rngState >> 27;
+	return( rngState * 0x2545F4914F6CDD1DULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wlgen_uniform
+// Description  : Get a random number between 0 and 1
+//
+// Inputs       : none
+// Outputs      : the random number, in [0, 1)
+
+double wlgen_uniform( void ) {
+	return( (wlgen_random() >> 11) * (1.0 / 9007199254740992.0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wlgen_zipf
+// Description  : Make the cumulative distribution of a Zipf distribution over
+//                n items, item k (from 0) having weight 1 / (k + 1)^s
+//
+// Inputs       : n - the number of items
+//                s - the exponent
+// Outputs      : the distribution (freed by the caller), NULL if failure
+
+double *wlgen_zipf( uint32_t n, double s ) {
+
+	// Local variables
+	double *cdf = malloc( n * sizeof(double) ), sum = 0;
+	uint32_t k;
+
+	if ( cdf == NULL ) {
+		return( NULL );
+	}
+	for ( k=0; k<n; k++ ) {
+		sum += 1.0 / pow( k + 1, s );
+		cdf[k] = sum;
+	}
+	for ( k=0; k<n; k++ ) {
+		cdf[k] /= sum;
+	}
+	return( cdf );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wlgen_pick
+// Description  : Draw an item from a distribution
+//
+// Inputs       : cdf - the cumulative distribution
+//                n - the number of items
+// Outputs      : the item
+
+uint32_t wlgen_pick( double *cdf, uint32_t n ) {
+
+	// Local variables
+	double u = wlgen_uniform();
+	uint32_t lo = 0, hi = n - 1, mid;
+
+	// Find the first item the distribution reaches u at
+	while ( lo < hi ) {
+		mid = lo + (hi - lo) / 2;
+		if ( cdf[mid] > u ) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return( lo );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wlgen_operation
+// Description  : Write the lines of one read or write on a file and apply it
+//                to the file's contents. Sequential operations carry on from
+//                where the last one on the file left off, going back to the
+//                start once a read reaches the end or a write would take the
+//                file past its size. A file that has not grown to its size
+//                yet is appended to by sequential writes
+//
+// Inputs       : out - the workload file
+//                f - the file
+//                read - 1 to read, 0 to write
+//                random - 1 to go to a random offset first
+//                maxOp - largest read or write
+//                pool - text to take the data written from
+//                left - lines the workload still has room for, a read that
+//                       needs a seek first becomes a write when it is 1
+//                lines - the count of lines written, updated
+// Outputs      : 0 if successful, -1 if failure
+
+int wlgen_operation( FILE *out, FS3WorkloadFile *f, int read, int random, uint32_t maxOp, const char *pool,
+		uint64_t left, uint64_t *lines ) {
+
+	// Local variables
+	uint32_t len, off, limit;
+	const char *data;
+
+	if ( read && (left < 2) && (random || (f->pos >= f->size)) ) {
+		read = 0;
+	}
+	if ( read ) {
+
+		// Seek somewhere in the file first, or back to the start if at its end
+		len = 1 + (uint32_t)(wlgen_random() % maxOp);
+		if ( random || (f->pos >= f->size) ) {
+			f->pos = random ? (uint32_t)(wlgen_random() % f->size) : 0;
+			fprintf( out, "%s SEEK 0 %u :\n", f->name, f->pos );
+			(*lines) ++;
+		}
+		len = (len > f->size - f->pos) ? f->size - f->pos : len;
+		fprintf( out, "%s READ %u 0 :\n", f->name, len );
+		f->pos += len;
+		(*lines) ++;
+		return( 0 );
+	}
+
+	// Work out where the write goes, it never takes the file past its size
+	limit = (maxOp > FS3_WLGEN_MAX_WRITE) ? FS3_WLGEN_MAX_WRITE : maxOp;
+	len = 1 + (uint32_t)(wlgen_random() % limit);
+	if ( random ) {
+		off = (uint32_t)(wlgen_random() % ((f->size < f->target) ? f->size + 1 : f->size));
+	} else if ( f->size < f->target ) {
+		off = f->size;
+	} else {
+		off = ((f->pos + len > f->target) || (f->pos >= f->target)) ? 0 : f->pos;
+	}
+	len = (len > f->target - off) ? f->target - off : len;
+
+	// A write where the file is already positioned needs no seek
+	data = &pool[wlgen_random() % (FS3_WLGEN_POOL - len)];
+	if ( off == f->pos ) {
+		fprintf( out, "%s WRITE %u 0 :", f->name, len );
+	} else {
+		fprintf( out, "%s WRITEAT %u %u :", f->name, len, off );
+	}
+	fwrite( data, 1, len, out );
+	fputc( '\n', out );
+	(*lines) ++;
+
+	// Apply the write to the file
+	memcpy( &f->contents[off], data, len );
+	f->pos = off + len;
+	f->size = (f->pos > f->size) ? f->pos : f->size;
+	return( ferror(out) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : wlgen_save
+// Description  : Write what each file used by the workload should hold at the
+//                end into the reference directory, "^" becoming a newline as
+//                the simulator writes it
+//
+// Inputs       : files - the files
+//                nfiles - the number of files
+//                dir - the reference directory
+// Outputs      : 0 if successful, -1 if failure
+
+int wlgen_save( FS3WorkloadFile *files, int nfiles, const char *dir ) {
+
+	// Local variables
+	char path[256];
+	FILE *fh;
+	uint32_t i;
+	int idx;
+
+	if ( (mkdir(dir, 0755) == -1) && (errno != EEXIST) ) {
+		fprintf( stderr, "Failure creating the reference directory [%s], error: %s.\n", dir, strerror(errno) );
+		return( -1 );
+	}
+	for ( idx=0; idx<nfiles; idx++ ) {
+
+		// Files never written are never opened by the simulator, so are not checked
+		if ( files[idx].size == 0 ) {
+			continue;
+		}
+		for ( i=0; i<files[idx].size; i++ ) {
+			if ( files[idx].contents[i] == '^' ) {
+				files[idx].contents[i] = '\n';
+			}
+		}
+		snprintf( path, sizeof(path), "%s/%s", dir, files[idx].name );
+		if ( ((fh=fopen(path, "w")) == NULL) ||
+				(fwrite(files[idx].contents, 1, files[idx].size, fh) != files[idx].size) || (fclose(fh) != 0) ) {
+			fprintf( stderr, "Failure writing the reference file [%s].\n", path );
+			return( -1 );
+		}
+	}
+	return( 0 );
+}